@@ -69,7 +69,9 @@ enum ActiveObjectCommand {
 	AO_CMD_OBSOLETE1,
 	// ^ UPDATE_NAMETAG_ATTRIBUTES deprecated since 0.4.14, removed in 5.3.0
 	AO_CMD_SPAWN_INFANT,
-	AO_CMD_SET_ANIMATION_SPEED
+	AO_CMD_SET_ANIMATION_SPEED,
+	// Position update relative to a keyframe, see ObjectPositionEncoder
+	AO_CMD_UPDATE_POSITION_DELTA
 };
 
 /*
@@ -0,0 +1,100 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "constants.h"
+#include "server/activeobjectmgr.h"
+#include "unittest/mock_serveractiveobject.h"
+#include "noise.h"
+#include <queue>
+
+// Scatters `count` objects over a cube of `extent` nodes around the origin
+static void fillManager(server::ActiveObjectMgr &mgr, u32 count, s32 extent)
+{
+	PcgRandom pr(count);
+	for (u32 i = 0; i < count; i++) {
+		v3f pos(pr.range(-extent, extent), pr.range(-extent, extent),
+				pr.range(-extent, extent));
+		mgr.registerObject(new MockServerActiveObject(nullptr, pos * BS));
+	}
+}
+
+static void clearManager(server::ActiveObjectMgr &mgr)
+{
+	mgr.clear([] (ServerActiveObject *obj, u16) {
+		delete obj;
+		return true;
+	});
+}
+
+#define BENCH_INSIDE_RADIUS(_count) \
+	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		fillManager(mgr, _count, 1000); \
+		std::vector<ServerActiveObject *> result; \
+		meter.measure([&] { \
+			result.clear(); \
+			mgr.getObjectsInsideRadius(v3f(), 30 * BS, result, nullptr); \
+			return result.size(); \
+		}); \
+		clearManager(mgr); \
+	};
+
+#define BENCH_IN_AREA(_count) \
+	BENCHMARK_ADVANCED("in_area_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		fillManager(mgr, _count, 1000); \
+		aabb3f box(v3f(-30 * BS), v3f(30 * BS)); \
+		std::vector<ServerActiveObject *> result; \
+		meter.measure([&] { \
+			result.clear(); \
+			mgr.getObjectsInArea(box, result, nullptr); \
+			return result.size(); \
+		}); \
+		clearManager(mgr); \
+	};
+
+#define BENCH_ADDED_AROUND_POS(_count) \
+	BENCHMARK_ADVANCED("added_around_pos_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		server::ActiveObjectMgr mgr; \
+		fillManager(mgr, _count, 1000); \
+		std::set<u16> current_objects; \
+		meter.measure([&] { \
+			std::queue<u16> added_objects; \
+			mgr.getAddedActiveObjectsAroundPos(v3f(), 64 * BS, 0, \
+					current_objects, added_objects); \
+			return added_objects.size(); \
+		}); \
+		clearManager(mgr); \
+	};
+
+TEST_CASE("benchmark_activeobjectmgr")
+{
+	BENCH_INSIDE_RADIUS(200)
+	BENCH_INSIDE_RADIUS(1450)
+	BENCH_INSIDE_RADIUS(10000)
+
+	BENCH_IN_AREA(200)
+	BENCH_IN_AREA(1450)
+	BENCH_IN_AREA(10000)
+
+	BENCH_ADDED_AROUND_POS(200)
+	BENCH_ADDED_AROUND_POS(1450)
+	BENCH_ADDED_AROUND_POS(10000)
+}
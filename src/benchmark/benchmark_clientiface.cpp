@@ -0,0 +1,198 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "block_send_queue.h"
+#include "constants.h"
+#include "face_position_cache.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "util/numeric.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+	Simulates the block selection of RemoteClient::GetNextBlocks() for
+	clients walking and turning around, without a map. Blocks are
+	acknowledged by the client two steps after they were selected.
+	"rescan" checks the face positions for sight on every step, as was
+	done before BlockSendQueue.
+*/
+
+static const s16 SEND_DISTANCE = 10;
+static const u32 MAX_SIMUL_SENDS = 8;
+static const u32 ACK_DELAY_STEPS = 2;
+static const f32 CAMERA_FOV = 72.0f * core::DEGTORAD;
+
+struct SimClient
+{
+	v3f pos;
+	f32 yaw;
+	BlockSendQueue queue;
+	std::unordered_set<v3s16> sent;
+	// Selected blocks and the step they were selected in
+	std::unordered_map<v3s16, u32> sending;
+	u32 step = 0;
+	s16 nearest_unsent_d = 0;
+	// Used when rescanning the face positions every step
+	v3s16 last_center;
+	v3f last_camera_dir;
+};
+
+static void initClients(std::vector<SimClient> &clients, u32 count, u32 seed)
+{
+	PcgRandom pr(seed);
+	clients.resize(count);
+	for (SimClient &c : clients) {
+		c.pos = v3f(pr.range(-2000, 2000), pr.range(-100, 100),
+				pr.range(-2000, 2000)) * BS;
+		c.yaw = pr.range(0, 628) / 100.0f;
+	}
+}
+
+// Returns the number of blocks selected
+static u32 stepClient(SimClient &c, bool use_queue)
+{
+	const v3f dir(std::sin(c.yaw), 0.0f, std::cos(c.yaw));
+	c.pos += dir * 0.4f * BS;
+	c.yaw += 0.005f;
+	c.step++;
+
+	for (auto it = c.sending.begin(); it != c.sending.end();) {
+		if (c.step - it->second >= ACK_DELAY_STEPS) {
+			c.sent.insert(it->first);
+			it = c.sending.erase(it);
+		} else {
+			++it;
+		}
+	}
+	if (c.sending.size() >= MAX_SIMUL_SENDS)
+		return 0;
+	const u32 max_selected = MAX_SIMUL_SENDS - c.sending.size();
+
+	BlockSendQueue::View view;
+	view.center = getNodeBlockPos(floatToInt(c.pos, BS));
+	view.camera_pos = c.pos;
+	view.camera_dir = dir;
+	view.camera_fov = CAMERA_FOV;
+	view.speed_dir = dir;
+	view.range = SEND_DISTANCE * BS * MAP_BLOCKSIZE;
+
+	if (use_queue) {
+		if (c.queue.setView(view))
+			c.nearest_unsent_d = 0;
+	} else if (view.center != c.last_center ||
+			dir.dotProduct(c.last_camera_dir) < std::cos(CAMERA_FOV * 0.1f)) {
+		c.nearest_unsent_d = 0;
+		c.last_center = view.center;
+		c.last_camera_dir = dir;
+	}
+
+	u32 selected = 0;
+	BlockSendQueue::WalkResult walked;
+	if (use_queue) {
+		walked = c.queue.walk(c.nearest_unsent_d, SEND_DISTANCE,
+				[&] (const BlockSendQueue::Entry &entry, s16 d, bool sent) {
+			if (selected >= max_selected)
+				return BlockSendQueue::WALK_STOP;
+			if (sent || c.sending.count(entry.pos))
+				return BlockSendQueue::WALK_SKIP;
+			if (c.sent.count(entry.pos))
+				return BlockSendQueue::WALK_SENT;
+			c.sending[entry.pos] = c.step;
+			selected++;
+			return BlockSendQueue::WALK_SELECTED;
+		});
+		if (walked.completed)
+			c.queue.resetVisited();
+	} else {
+		// The face positions are checked for sight again on every call
+		const s16 d_max = std::min<s16>(SEND_DISTANCE,
+				c.nearest_unsent_d + BlockSendQueue::MAX_D_INCREMENT);
+		s16 d;
+		for (d = c.nearest_unsent_d; d <= d_max; d++) {
+			for (const v3s16 &offset : FacePositionCache::getFacePositions(d)) {
+				if (selected >= max_selected)
+					goto stop;
+				v3s16 p = view.center + offset;
+				if (blockpos_over_max_limit(p))
+					continue;
+				if (!(isBlockInSight(p, view.camera_pos, dir, CAMERA_FOV,
+							view.range) ||
+						isBlockInSight(p, view.camera_pos, dir, 0.1f, view.range)))
+					continue;
+				if (c.sending.count(p) || c.sent.count(p))
+					continue;
+				c.sending[p] = c.step;
+				selected++;
+				if (walked.nearest_selected_d == -1)
+					walked.nearest_selected_d = d;
+			}
+		}
+	stop:
+		walked.d = d;
+		walked.completed = d > SEND_DISTANCE;
+	}
+	c.nearest_unsent_d = walked.getNextStart();
+	return selected;
+}
+
+static void benchSelect(const std::string &name, u32 client_count, u32 blocks,
+		bool use_queue)
+{
+	u32 total_blocks = 0;
+	std::chrono::steady_clock::duration total_time{};
+
+	BENCHMARK_ADVANCED(name + "_" + std::to_string(blocks) + "_blocks_" +
+			std::to_string(client_count) + "_clients")
+			(Catch::Benchmark::Chronometer meter) {
+		std::vector<std::vector<SimClient>> runs(meter.runs());
+		for (size_t i = 0; i < runs.size(); i++)
+			initClients(runs[i], client_count, i);
+		meter.measure([&] (int i) {
+			const auto start = std::chrono::steady_clock::now();
+			u32 run_blocks = 0;
+			for (SimClient &c : runs[i]) {
+				u32 selected = 0;
+				while (selected < blocks)
+					selected += stepClient(c, use_queue);
+				run_blocks += selected;
+			}
+			total_time += std::chrono::steady_clock::now() - start;
+			total_blocks += run_blocks;
+			return run_blocks;
+		});
+	};
+
+	const double ms = std::chrono::duration<double, std::milli>(total_time).count();
+	std::cout << name << ", " << blocks << " blocks, " << client_count
+		<< " clients: " << (ms > 0 ? total_blocks / ms : 0.0)
+		<< " blocks selected per ms" << std::endl;
+}
+
+TEST_CASE("benchmark_clientiface")
+{
+	benchSelect("send_queue", 100, 64, true);
+	benchSelect("send_queue", 100, 512, true);
+	benchSelect("rescan", 100, 64, false);
+	benchSelect("rescan", 100, 512, false);
+}
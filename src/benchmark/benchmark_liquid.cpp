@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "map_liquids.h"
+#include "nodedef.h"
+#include "util/directiontables.h"
+
+TEST_CASE("benchmark_liquid")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t c_floor;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		c_floor = ndef->set(f.name, f);
+	}
+	content_t c_source;
+	{
+		ContentFeatures f;
+		f.name = "water_source";
+		f.liquid_type = LIQUID_SOURCE;
+		f.liquid_alternative_source = "water_source";
+		f.liquid_alternative_flowing = "water_flowing";
+		c_source = ndef->set(f.name, f);
+		f.name = "water_flowing";
+		f.liquid_type = LIQUID_FLOWING;
+		f.param_type_2 = CPT2_FLOWINGLIQUID;
+		ndef->set(f.name, f);
+	}
+	ndef->resolveCrossrefs();
+
+	// An area of 8x2x8 blocks flooded from above
+	v3s16 pmin(-64, -16, -64);
+	v3s16 pmax(63, 15, 63);
+	DummyMap map(&gamedef, getNodeBlockPos(pmin), getNodeBlockPos(pmax));
+	LiquidTransformer transformer(&map, &gamedef);
+
+	for (s16 z = pmin.Z; z <= pmax.Z; z++)
+	for (s16 y = pmin.Y; y <= pmax.Y; y++)
+	for (s16 x = pmin.X; x <= pmax.X; x++)
+		map.setNode(v3s16(x, y, z), MapNode(y == pmin.Y ? c_floor : CONTENT_AIR));
+
+	auto run = [&] (UniqueQueue<v3s16> &queue, u32 loop_max) {
+		std::map<v3s16, MapBlock *> modified_blocks;
+		LiquidTransformer::Result result;
+		u32 processed = 0;
+		// Like the server, never more than was queued at the start of a step
+		while (queue.size() != 0) {
+			transformer.transform(queue, MYMIN(queue.size(), loop_max),
+				modified_blocks, result);
+			for (v3s16 p : result.must_reflow)
+				queue.push_back(p);
+			processed += result.processed;
+		}
+		return processed;
+	};
+
+	// Floods the area from a grid of sources in the top layer, then removes
+	// them and lets the liquid drain. Where flows meet, a few flowing nodes
+	// may stay behind; they do not change anymore, so every later run does
+	// the same work.
+	auto flood_and_drain = [&] (s16 grid_size, u32 loop_max) {
+		std::vector<v3s16> sources;
+		const s16 spacing = (pmax.X - pmin.X + 1) / grid_size;
+		for (s16 z = 0; z < grid_size; z++)
+		for (s16 x = 0; x < grid_size; x++) {
+			sources.emplace_back(pmin.X + spacing * x + spacing / 2,
+				pmax.Y - 1, pmin.Z + spacing * z + spacing / 2);
+		}
+
+		UniqueQueue<v3s16> queue;
+		for (v3s16 p : sources) {
+			map.setNode(p, MapNode(c_source));
+			queue.push_back(p);
+		}
+		u32 processed = run(queue, loop_max);
+
+		// Queue the neighbors of the removed sources so the liquid drains
+		for (v3s16 p : sources) {
+			map.setNode(p, MapNode(CONTENT_AIR));
+			queue.push_back(p);
+			for (const v3s16 &dir : g_6dirs)
+				queue.push_back(p + dir);
+		}
+		return processed + run(queue, loop_max);
+	};
+
+	BENCHMARK_ADVANCED("flood_few_sources")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { return flood_and_drain(2, 100000); });
+	};
+
+	BENCHMARK_ADVANCED("flood_many_sources")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { return flood_and_drain(12, 100000); });
+	};
+
+	BENCHMARK_ADVANCED("flood_small_steps")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { return flood_and_drain(12, 1000); });
+	};
+}
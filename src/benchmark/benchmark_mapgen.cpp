@@ -0,0 +1,348 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "emerge.h"
+#include "map.h"
+#include "mapgen/mapgen.h"
+#include "mapgen/mg_biome.h"
+#include "mapgen/mg_decoration.h"
+#include "mapgen/mg_ore.h"
+#include "mapgen/mg_schematic.h"
+#include "nodedef.h"
+#include "profiler.h"
+#include "settings.h"
+#include "util/thread.h"
+
+// Fixed so that every run generates the same terrain
+static const char *BENCHMARK_SEED = "1234567890";
+
+// Chunks generated per mapgen: 2x2 columns, one underground and one at the surface
+static const v3s16 CHUNK_GRID_MIN(0, -1, 0);
+static const v3s16 CHUNK_GRID_MAX(1, 0, 1);
+
+// Mapgen workers for the parallel runs
+static const unsigned int BENCHMARK_WORKERS = 3;
+
+static void registerNodes(NodeDefManager *ndef)
+{
+	static const char *solid_nodes[] = {
+		"mapgen_stone", "mapgen_dirt", "mapgen_dirt_with_grass", "mapgen_sand",
+		"mapgen_gravel", "mapgen_desert_stone", "mapgen_desert_sand",
+		"mapgen_dirt_with_snow", "mapgen_snowblock", "mapgen_ice",
+		"mapgen_cobble", "mapgen_mossycobble", "mapgen_stair_cobble",
+		"mapgen_stair_desert_stone", "mapgen_tree", "mapgen_jungletree",
+		"mapgen_pine_tree", "mapgen_stone_with_coal", "mapgen_stone_with_iron",
+	};
+	for (const char *name : solid_nodes) {
+		ContentFeatures f;
+		f.name = name;
+		f.is_ground_content = true;
+		ndef->set(f.name, f);
+	}
+
+	static const char *plant_nodes[] = {
+		"mapgen_leaves", "mapgen_apple", "mapgen_jungleleaves",
+		"mapgen_pine_needles", "mapgen_junglegrass", "mapgen_grass",
+		"mapgen_snow",
+	};
+	for (const char *name : plant_nodes) {
+		ContentFeatures f;
+		f.name = name;
+		f.param_type = CPT_LIGHT;
+		f.light_propagates = true;
+		f.sunlight_propagates = true;
+		ndef->set(f.name, f);
+	}
+
+	static const char *liquid_nodes[] = {
+		"mapgen_water_source", "mapgen_river_water_source", "mapgen_lava_source",
+	};
+	for (const char *name : liquid_nodes) {
+		ContentFeatures f;
+		f.name = name;
+		f.drawtype = NDT_LIQUID;
+		f.param_type = CPT_LIGHT;
+		f.light_propagates = true;
+		f.walkable = false;
+		f.liquid_type = LIQUID_SOURCE;
+		ndef->set(f.name, f);
+	}
+}
+
+static void registerBiome(const NodeDefManager *ndef, BiomeManager *biomemgr,
+	const std::string &name, const std::string &top, const std::string &filler,
+	float heat_point, float humidity_point)
+{
+	Biome *b = BiomeManager::create(BIOMETYPE_NORMAL);
+	b->name = name;
+	b->flags = 0;
+	b->depth_top = 1;
+	b->depth_filler = 3;
+	b->depth_water_top = 0;
+	b->depth_riverbed = 2;
+	b->heat_point = heat_point;
+	b->humidity_point = humidity_point;
+	b->vertical_blend = 0;
+	b->min_pos = v3s16(-31000, -31000, -31000);
+	b->max_pos = v3s16(31000, 31000, 31000);
+
+	std::vector<std::string> &nn = b->m_nodenames;
+	nn.push_back(top);
+	nn.push_back(filler);
+	nn.push_back("mapgen_stone");
+	nn.push_back("");
+	nn.push_back("mapgen_water_source");
+	nn.push_back("mapgen_river_water_source");
+	nn.push_back("mapgen_sand");
+	nn.push_back("");
+	nn.push_back("ignore");
+	b->m_nnlistsizes.push_back(1);
+	nn.push_back("mapgen_cobble");
+	nn.push_back("mapgen_mossycobble");
+	nn.push_back("mapgen_stair_cobble");
+	ndef->pendNodeResolve(b);
+
+	biomemgr->add(b);
+}
+
+static void registerOre(const NodeDefManager *ndef, OreManager *oremgr,
+	OreType type, const std::string &name, u32 clust_scarcity, s16 clust_size)
+{
+	Ore *ore = OreManager::create(type);
+	ore->name = name;
+	ore->ore_param2 = 0;
+	ore->clust_scarcity = clust_scarcity;
+	ore->clust_num_ores = clust_size * clust_size;
+	ore->clust_size = clust_size;
+	ore->y_min = -31000;
+	ore->y_max = 64;
+	ore->nthresh = 0.0f;
+	ore->flags = 0;
+	if (ore->needs_noise) {
+		ore->np = NoiseParams(0, 1, v3f(5, 5, 5), 766, 2, 0.7, 2.0);
+		ore->flags |= OREFLAG_USE_NOISE;
+	}
+
+	ore->m_nodenames.push_back(name);
+	ore->m_nodenames.push_back("mapgen_stone");
+	ore->m_nnlistsizes.push_back(1);
+	ndef->pendNodeResolve(ore);
+
+	oremgr->add(ore);
+}
+
+// A 5x7x5 tree: trunk with a cube of leaves around its top
+static Schematic *createTreeSchematic(const NodeDefManager *ndef)
+{
+	Schematic *schem = SchematicManager::create(SCHEMATIC_NORMAL);
+	schem->name = "tree";
+	schem->flags = 0;
+	schem->size = v3s16(5, 7, 5);
+
+	enum { AIR, TRUNK, LEAVES };
+	schem->m_nodenames = {"air", "mapgen_tree", "mapgen_leaves"};
+	schem->m_nnlistsizes.push_back(schem->m_nodenames.size());
+
+	u32 volume = schem->size.X * schem->size.Y * schem->size.Z;
+	schem->schemdata = new MapNode[volume];
+	schem->slice_probs = new u8[schem->size.Y];
+	u32 i = 0;
+	for (s16 z = 0; z < schem->size.Z; z++)
+	for (s16 y = 0; y < schem->size.Y; y++)
+	for (s16 x = 0; x < schem->size.X; x++, i++) {
+		bool trunk = x == 2 && z == 2 && y < 5;
+		bool leaves = !trunk && y >= 3;
+		schem->schemdata[i] = MapNode(trunk ? TRUNK : leaves ? LEAVES : AIR,
+			trunk || leaves ? MTSCHEM_PROB_ALWAYS : MTSCHEM_PROB_NEVER, 0);
+	}
+	for (s16 y = 0; y < schem->size.Y; y++)
+		schem->slice_probs[y] = MTSCHEM_PROB_ALWAYS;
+	ndef->pendNodeResolve(schem);
+
+	return schem;
+}
+
+static void registerDecorations(const NodeDefManager *ndef,
+	DecorationManager *decomgr, SchematicManager *schemmgr)
+{
+	{
+		DecoSimple *deco = (DecoSimple *)DecorationManager::create(DECO_SIMPLE);
+		deco->name = "grass";
+		deco->fill_ratio = 0.1f;
+		deco->sidelen = 16;
+		deco->y_min = 1;
+		deco->y_max = 31000;
+		deco->nspawnby = -1;
+		deco->deco_height = 1;
+		deco->deco_height_max = 0;
+		deco->deco_param2 = 0;
+		deco->deco_param2_max = 0;
+
+		std::vector<std::string> &nn = deco->m_nodenames;
+		nn.push_back("mapgen_dirt_with_grass");
+		deco->m_nnlistsizes.push_back(1);
+		deco->m_nnlistsizes.push_back(0);
+		nn.push_back("mapgen_grass");
+		deco->m_nnlistsizes.push_back(1);
+		ndef->pendNodeResolve(deco);
+
+		decomgr->add(deco);
+	}
+
+	{
+		Schematic *schem = createTreeSchematic(ndef);
+		schemmgr->add(schem);
+
+		DecoSchematic *deco = (DecoSchematic *)DecorationManager::create(DECO_SCHEMATIC);
+		deco->name = "tree";
+		deco->flags = DECO_PLACE_CENTER_X | DECO_PLACE_CENTER_Z;
+		deco->np = NoiseParams(0.01, 0.02, v3f(250, 250, 250), 2, 3, 0.66, 2.0);
+		deco->flags |= DECO_USE_NOISE;
+		deco->sidelen = 16;
+		deco->y_min = 1;
+		deco->y_max = 31000;
+		deco->nspawnby = -1;
+		deco->rotation = ROTATE_RAND;
+		deco->schematic = schem;
+
+		std::vector<std::string> &nn = deco->m_nodenames;
+		nn.push_back("mapgen_dirt_with_grass");
+		nn.push_back("mapgen_dirt_with_snow");
+		deco->m_nnlistsizes.push_back(2);
+		deco->m_nnlistsizes.push_back(0);
+		ndef->pendNodeResolve(deco);
+
+		decomgr->add(deco);
+	}
+}
+
+static void printStageTimes(const std::string &name, u32 chunks)
+{
+	// Formatted separately to leave the flags of std::cout alone
+	std::ostringstream os;
+	os << name << ", ms per chunk:" << std::fixed << std::setprecision(3);
+	for (int i = 0; i < MGSTAGE_MAX; i++) {
+		MapgenStage stage = (MapgenStage)i;
+		float ms = g_profiler->getValue(
+			Profiler::getName(Mapgen::getStageProfilerId(stage)));
+		os << " " << Mapgen::getStageName(stage) << "="
+			<< (chunks ? ms / chunks : 0.0f);
+	}
+	std::cout << os.str() << std::endl;
+}
+
+TEST_CASE("benchmark_mapgen")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	registerNodes(ndef);
+
+	BiomeManager biomemgr(&gamedef);
+	OreManager oremgr(&gamedef);
+	DecorationManager decomgr(&gamedef);
+	SchematicManager schemmgr(&gamedef);
+
+	registerBiome(ndef, &biomemgr, "grassland", "mapgen_dirt_with_grass",
+		"mapgen_dirt", 50, 35);
+	registerBiome(ndef, &biomemgr, "desert", "mapgen_desert_sand",
+		"mapgen_desert_sand", 92, 16);
+	registerBiome(ndef, &biomemgr, "tundra", "mapgen_dirt_with_snow",
+		"mapgen_dirt", 0, 40);
+	registerOre(ndef, &oremgr, ORE_SCATTER, "mapgen_stone_with_coal", 8 * 8 * 8, 3);
+	registerOre(ndef, &oremgr, ORE_BLOB, "mapgen_stone_with_iron", 16 * 16 * 16, 5);
+	registerDecorations(ndef, &decomgr, &schemmgr);
+	ndef->runNodeResolveCallbacks();
+
+	// Engine defaults of the mapgen settings, with a fixed seed
+	SettingsHierarchy hierarchy(g_settings);
+	Settings settings("", &hierarchy, 1);
+	settings.set("seed", BENCHMARK_SEED);
+
+	std::vector<const char *> mgnames;
+	Mapgen::getMapgenNames(&mgnames, true);
+
+	WorkerThreadPool workers("MapgenWorker", BENCHMARK_WORKERS);
+
+	for (const char *mgname : mgnames) {
+		MapgenType mgtype = Mapgen::getMapgenType(mgname);
+		MapgenParams *params = Mapgen::createMapgenParams(mgtype);
+		params->readParams(&settings);
+		params->mgtype = mgtype;
+
+		s16 csize = params->chunksize;
+		v3s16 csize_nodes = v3s16(1, 1, 1) * (csize * MAP_BLOCKSIZE);
+		BiomeGen *biomegen = biomemgr.createBiomeGen(BIOMEGEN_ORIGINAL,
+			params->bparams, csize_nodes);
+
+		// Same chunk layout and borders as ServerMap::initBlockMake
+		std::vector<v3s16> chunks;
+		for (s16 z = CHUNK_GRID_MIN.Z; z <= CHUNK_GRID_MAX.Z; z++)
+		for (s16 y = CHUNK_GRID_MIN.Y; y <= CHUNK_GRID_MAX.Y; y++)
+		for (s16 x = CHUNK_GRID_MIN.X; x <= CHUNK_GRID_MAX.X; x++)
+			chunks.push_back(v3s16(x, y, z) * csize - v3s16(1, 1, 1) * (csize / 2));
+		const v3s16 extra_borders(1, 1, 1);
+		DummyMap map(&gamedef, chunks.front() - extra_borders,
+			chunks.back() + v3s16(1, 1, 1) * (csize - 1) + extra_borders);
+
+		// Once on the emerge thread only, once split up over the workers
+		for (WorkerThreadPool *pool : {(WorkerThreadPool *)nullptr, &workers}) {
+			std::string name = std::string("makeChunk ") + mgname;
+			if (pool)
+				name += ", " + std::to_string(pool->getThreadCount()) + " workers";
+
+			// Deleted by the mapgen
+			EmergeParams *emerge = new EmergeParams(ndef, biomegen,
+				&biomemgr, &oremgr, &decomgr, &schemmgr);
+			emerge->workers = pool;
+			Mapgen *mg = Mapgen::createMapgen(mgtype, params, emerge);
+
+			g_profiler->clear();
+			u32 chunks_made = 0;
+
+			BENCHMARK_ADVANCED(std::string(name))(Catch::Benchmark::Chronometer meter) {
+				meter.measure([&] (int i) {
+					BlockMakeData data;
+					data.seed = params->seed;
+					data.blockpos_min = chunks[i % chunks.size()];
+					data.blockpos_max = data.blockpos_min + v3s16(1, 1, 1) * (csize - 1);
+					data.nodedef = ndef;
+					data.vmanip = new MMVManip(&map);
+					data.vmanip->initialEmerge(data.blockpos_min - extra_borders,
+						data.blockpos_max + extra_borders, false);
+					mg->makeChunk(&data);
+					chunks_made++;
+				});
+			};
+
+			printStageTimes(name, chunks_made);
+
+			delete mg;
+		}
+
+		delete biomegen;
+		delete params;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "noise.h"
+
+// Terrain noise of mapgen v7 over one mapchunk
+static const NoiseParams np_terrain(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+// 3D noise similar to the mapgen v7 mountains
+static const NoiseParams np_mountain(-0.6, 1, v3f(250, 350, 250), 5333, 5, 0.63, 2.0);
+
+#define BENCH_NOISE(_level, _name) \
+	BENCHMARK_ADVANCED("perlinMap2D_" _name)(Catch::Benchmark::Chronometer meter) { \
+		noise_simd_set(_level); \
+		Noise noise(&np_terrain, 1337, 80, 80); \
+		meter.measure([&] { return noise.perlinMap2D(-40, 120)[0]; }); \
+	}; \
+	BENCHMARK_ADVANCED("perlinMap3D_" _name)(Catch::Benchmark::Chronometer meter) { \
+		noise_simd_set(_level); \
+		Noise noise(&np_mountain, 1337, 80, 82, 80); \
+		meter.measure([&] { return noise.perlinMap3D(-40, -41, 120)[0]; }); \
+	};
+
+TEST_CASE("benchmark_noise")
+{
+	const NoiseSimdLevel supported = noise_simd_supported();
+
+	BENCH_NOISE(NOISE_SIMD_NONE, "scalar")
+	if (supported >= NOISE_SIMD_SSE2) {
+		BENCH_NOISE(NOISE_SIMD_SSE2, "sse2")
+	}
+	if (supported >= NOISE_SIMD_AVX2) {
+		BENCH_NOISE(NOISE_SIMD_AVX2, "avx2")
+	}
+
+	noise_simd_set(supported);
+}
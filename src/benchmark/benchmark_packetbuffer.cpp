@@ -0,0 +1,98 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include <list>
+#include <string>
+#include <vector>
+
+// Same as the server's connection
+static const u32 max_packet_size = 512;
+
+// Does what Server::SendBlockData() and the send thread do for a reliable
+// mapblock, up to the point where the packets are given to the socket
+static size_t sendBlock(const std::string &blockdata, u16 &seqnum,
+		std::vector<con::BufferedPacketPtr> &out)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + blockdata.size(), 1);
+	pkt << v3s16(1, 2, 3);
+	pkt.putRawString(blockdata);
+
+	PacketBuffer data = pkt.forgePacket();
+
+	const u32 chunksize_max = max_packet_size - BASE_HEADER_SIZE
+		- RELIABLE_HEADER_SIZE;
+	std::list<PacketBuffer> originals;
+	u16 split_seqnum = 0;
+	con::makeAutoSplitPacket(data, chunksize_max, split_seqnum, &originals);
+
+	Address address(127, 0, 0, 1, 30000);
+	for (PacketBuffer &original : originals) {
+		PacketBuffer reliable = con::makeReliablePacket(std::move(original),
+			seqnum++);
+		out.push_back(con::makePacket(address, std::move(reliable),
+			PROTOCOL_ID, PEER_ID_SERVER, 2));
+	}
+	return out.size();
+}
+
+static void benchBlock(const char *name, size_t blocksize)
+{
+	const std::string blockdata(blocksize, 'x');
+	std::vector<con::BufferedPacketPtr> out;
+	u16 seqnum = 0;
+
+	// Fill the pool, as a running server would have
+	for (int i = 0; i < 10; i++) {
+		sendBlock(blockdata, seqnum, out);
+		out.clear();
+	}
+
+	const int count = 100;
+	PacketBufferStats before = PacketBuffer::getStats();
+	for (int i = 0; i < count; i++) {
+		sendBlock(blockdata, seqnum, out);
+		out.clear();
+	}
+	PacketBufferStats after = PacketBuffer::getStats();
+
+	WARN(name << ": per sent mapblock "
+		<< (double)(after.allocations - before.allocations) / count
+		<< " packet buffer allocations, "
+		<< (double)(after.copies - before.copies) / count
+		<< " payload copies");
+
+	BENCHMARK_ADVANCED(name)(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			size_t n = sendBlock(blockdata, seqnum, out);
+			out.clear();
+			return n;
+		});
+	};
+}
+
+TEST_CASE("benchmark_packetbuffer")
+{
+	// Fits into one packet
+	benchBlock("send_block_small", 400);
+	// Typical compressed mapblock, split into several packets
+	benchBlock("send_block_split", 4000);
+}
@@ -0,0 +1,78 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "benchmark_setup.h"
+#include "network/socket.h"
+#include <string>
+#include <vector>
+
+// Number of datagrams moved per benchmark iteration
+static const int datagram_count = UDPSocket::max_batch_size;
+
+TEST_CASE("benchmark_socket")
+{
+	const Address address(127, 0, 0, 1, 30010);
+	UDPSocket receiver(false);
+	receiver.Bind(address);
+	UDPSocket sender(false);
+
+	// About the size of a mapblock packet chunk
+	const std::string payload(512, 'x');
+	std::vector<UDPOutgoingDatagram> outgoing(datagram_count,
+		{address, payload.data(), (int)payload.size()});
+
+	std::vector<u8> buffer(datagram_count * 1500);
+	std::vector<UDPIncomingDatagram> incoming(datagram_count);
+	for (int i = 0; i < datagram_count; i++) {
+		incoming[i].data = &buffer[i * 1500];
+		incoming[i].capacity = 1500;
+	}
+
+	// Loopback delivers datagrams before the send call returns, so they
+	// can be read back right away
+
+	BENCHMARK_ADVANCED("loopback_single")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			for (const UDPOutgoingDatagram &d : outgoing)
+				sender.Send(d.destination, d.data, d.size);
+			int received = 0;
+			Address from;
+			while (received < datagram_count &&
+					receiver.Receive(from, buffer.data(), 1500) >= 0)
+				received++;
+			return received;
+		});
+	};
+
+	BENCHMARK_ADVANCED("loopback_batch")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			sender.SendBatch(outgoing.data(), datagram_count);
+			int received = 0;
+			while (received < datagram_count) {
+				int n = receiver.ReceiveBatch(&incoming[received],
+					datagram_count - received);
+				if (n < 0)
+					break;
+				received += n;
+			}
+			return received;
+		});
+	};
+}
@@ -0,0 +1,124 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "block_send_queue.h"
+#include <cassert>
+#include <cmath>
+#include "face_position_cache.h"
+#include "mapblock.h"
+#include "util/numeric.h"
+
+bool BlockSendQueue::setView(const View &view)
+{
+	bool reset = !m_valid ||
+		view.center != m_view.center ||
+		view.range != m_view.range ||
+		// Same tolerance as isBlockInSight, which allows for an extra 10%
+		view.camera_dir.dotProduct(m_view.camera_dir) <
+			std::cos(view.camera_fov * 0.1f) ||
+		std::fabs(view.camera_fov - m_view.camera_fov) >
+			m_view.camera_fov * 0.1f ||
+		// The view cone in the direction of movement is narrow
+		(view.speed_dir != v3f() &&
+			view.speed_dir.dotProduct(m_view.speed_dir) < std::cos(0.1f));
+
+	if (reset) {
+		m_view = view;
+		clear();
+		m_valid = true;
+	} else {
+		// Used for the shells computed from now on
+		m_view.camera_pos = view.camera_pos;
+	}
+	return reset;
+}
+
+BlockSendQueue::Shell &BlockSendQueue::getShell(s16 d)
+{
+	while ((s16)m_shells.size() <= d) {
+		const s16 shell_d = m_shells.size();
+		m_shells.emplace_back();
+		Shell &shell = m_shells.back();
+
+		for (const v3s16 &offset : FacePositionCache::getFacePositions(shell_d)) {
+			Entry e;
+			e.pos = m_view.center + offset;
+			if (blockpos_over_max_limit(e.pos) || !isInSight(e.pos, &e.dist))
+				continue;
+			shell.entries.push_back(e);
+		}
+		shell.unsent = shell.entries.size();
+	}
+	return m_shells[d];
+}
+
+void BlockSendQueue::markSent(s16 d, size_t i)
+{
+	Shell &shell = m_shells[d];
+	assert(i < shell.unsent);
+
+	const size_t last = --shell.unsent;
+	std::swap(shell.entries[i], shell.entries[last]);
+	m_sent[shell.entries[last].pos] = std::make_pair(d, last);
+}
+
+void BlockSendQueue::markNotSent(v3s16 p)
+{
+	auto it = m_sent.find(p);
+	if (it == m_sent.end())
+		return;
+	Shell &shell = m_shells[it->second.first];
+	const size_t i = it->second.second;
+	m_sent.erase(it);
+
+	// Swap with the first entry marked as sent
+	const size_t first = shell.unsent++;
+	if (i != first) {
+		std::swap(shell.entries[i], shell.entries[first]);
+		m_sent[shell.entries[i].pos].second = i;
+	}
+}
+
+void BlockSendQueue::resetVisited()
+{
+	for (Shell &shell : m_shells)
+		shell.visited = false;
+}
+
+void BlockSendQueue::clear()
+{
+	m_shells.clear();
+	m_sent.clear();
+}
+
+bool BlockSendQueue::isInSight(v3s16 p, f32 *dist) const
+{
+	/*
+		FIXME This only works if the client uses a small enough
+		FOV setting. The default of 72 degrees is fine.
+		Also retrieve a smaller view cone in the direction of the player's
+		movement.
+		(0.1 is about 4 degrees)
+	*/
+	return isBlockInSight(p, m_view.camera_pos, m_view.camera_dir,
+			m_view.camera_fov, m_view.range, dist) ||
+		(m_view.speed_dir != v3f() &&
+			isBlockInSight(p, m_view.camera_pos, m_view.speed_dir, 0.1f,
+				m_view.range));
+}
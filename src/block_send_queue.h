@@ -0,0 +1,202 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+
+/*
+	Candidate blocks for sending to one client.
+
+	The positions in sight of the client are grouped in shells by their
+	distance from the center block, in the order of FacePositionCache.
+	Shells are computed lazily as they are reached and kept until the
+	client crosses a block boundary or the view changes noticeably, so
+	that the sight checks are not redone for every GetNextBlocks() call
+	and blocks the client already has can be skipped cheaply.
+*/
+class BlockSendQueue
+{
+public:
+	struct View
+	{
+		v3s16 center;
+		v3f camera_pos;
+		// Unit vector
+		v3f camera_dir;
+		// Radians
+		f32 camera_fov = 0.0f;
+		// Unit vector of the movement direction, zero if not moving
+		v3f speed_dir;
+		// Maximum distance of a block in sight (in world units)
+		f32 range = 0.0f;
+	};
+
+	struct Entry
+	{
+		v3s16 pos;
+		// Distance from the camera, used for the send priority
+		f32 dist = 0.0f;
+	};
+
+	struct Shell
+	{
+		/*
+			Entries [0, unsent) have not been marked as sent. Marking
+			reorders the entries, so the ones still to be sent can be
+			iterated without looking at the others.
+		*/
+		std::vector<Entry> entries;
+		size_t unsent = 0;
+		// Set by walk(), cleared when the shell is computed
+		bool visited = false;
+	};
+
+	// What the callback of walk() did with an entry
+	enum WalkAction
+	{
+		// Not selected, look at it again next time
+		WALK_SKIP,
+		// The client has the block already, mark it as sent
+		WALK_SENT,
+		// Selected for sending
+		WALK_SELECTED,
+		// Nothing more can be selected, stop before this entry
+		WALK_STOP,
+	};
+
+	struct WalkResult
+	{
+		// Shell the walk stopped in, one past the last shell if it did not stop
+		s16 d = 0;
+		// Nearest shell an entry was selected from, -1 if none
+		s32 nearest_selected_d = -1;
+		// All shells up to the full distance were walked
+		bool completed = false;
+
+		// Where the next walk starts, unless the caller knows better
+		s16 getNextStart() const
+		{
+			if (completed)
+				return 0;
+			return nearest_selected_d != -1 ? nearest_selected_d : d;
+		}
+	};
+
+	// Shells walked at most per call of walk(), so that far away shells
+	// are not computed before the near ones were sent
+	static const s16 MAX_D_INCREMENT = 2;
+
+	/*
+		Walks the shells from d_start to at most MAX_D_INCREMENT further,
+		without going past full_d_max, and calls
+		visit(const Entry &entry, s16 d, bool sent) for the entries.
+
+		Entries marked as sent are only visited the first time a shell is
+		walked after it was computed or resetVisited() was called, so that
+		the caller can look at them (e.g. to keep the blocks loaded). The
+		callback must not return WALK_SENT or WALK_SELECTED for them.
+
+		Entries the callback returned WALK_SENT for are marked as sent.
+	*/
+	template <typename F>
+	WalkResult walk(s16 d_start, s16 full_d_max, F &&visit);
+
+	/*
+		Sets the current view of the client. Returns true if it differs
+		enough from the view the shells were computed for to drop them.
+	*/
+	bool setView(const View &view);
+	const View &getView() const { return m_view; }
+
+	// Blocks in sight at a distance of d blocks from the center
+	Shell &getShell(s16 d);
+
+	/*
+		Marks entry i of shell d as sent. This moves another entry to
+		index i, so when marking several entries of a shell, do it in
+		descending order of their index.
+	*/
+	void markSent(s16 d, size_t i);
+	// Marks a block as not sent, if it was marked before
+	void markNotSent(v3s16 p);
+
+	// Clears the visited flag of all shells
+	void resetVisited();
+
+	// Drops all shells
+	void clear();
+
+	size_t getShellCount() const { return m_shells.size(); }
+
+private:
+	bool isInSight(v3s16 p, f32 *dist) const;
+
+	View m_view;
+	bool m_valid = false;
+	std::vector<Shell> m_shells;
+	// Shell and index of the entries marked as sent
+	std::unordered_map<v3s16, std::pair<s16, size_t>> m_sent;
+};
+
+template <typename F>
+BlockSendQueue::WalkResult BlockSendQueue::walk(s16 d_start, s16 full_d_max,
+		F &&visit)
+{
+	const s16 d_max = std::min<s16>(full_d_max, d_start + MAX_D_INCREMENT);
+
+	WalkResult result;
+	// Shell and index of the entries found to be sent already
+	std::vector<std::pair<s16, size_t>> newly_sent;
+
+	s16 d;
+	for (d = d_start; d <= d_max; d++) {
+		Shell &shell = getShell(d);
+		const size_t count = shell.visited ? shell.unsent : shell.entries.size();
+
+		for (size_t i = 0; i < count; i++) {
+			switch (visit(shell.entries[i], d, i >= shell.unsent)) {
+			case WALK_SKIP:
+				break;
+			case WALK_SENT:
+				newly_sent.emplace_back(d, i);
+				break;
+			case WALK_SELECTED:
+				if (result.nearest_selected_d == -1)
+					result.nearest_selected_d = d;
+				break;
+			case WALK_STOP:
+				goto stop;
+			}
+		}
+		shell.visited = true;
+	}
+stop:
+	result.d = d;
+	result.completed = d > full_d_max;
+
+	// Marking reorders the entries of a shell, so go from the back
+	for (auto it = newly_sent.rbegin(); it != newly_sent.rend(); ++it)
+		markSent(it->first, it->second);
+
+	return result;
+}
@@ -233,6 +233,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_MediaPush(NetworkPacket *pkt);
 	void handleCommand_MinimapModes(NetworkPacket *pkt);
 	void handleCommand_SetLighting(NetworkPacket *pkt);
+	void handleCommand_NodeChanges(NetworkPacket *pkt);
 
 	void ProcessData(NetworkPacket *pkt);
 
@@ -1658,6 +1658,28 @@ bool GenericCAO::visualExpiryRequired(const ObjectProperties &new_) const
 		(uses_legacy_texture && old.textures != new_.textures);
 }
 
+void GenericCAO::applyPositionUpdate(bool do_interpolate, bool is_end_position,
+		float update_interval)
+{
+	// Place us a bit higher if we're physical, to not sink into
+	// the ground due to sucky collision detection...
+	if(m_prop.physical)
+		m_position += v3f(0,0.002,0);
+
+	if(getParent() != NULL) // Just in case
+		return;
+
+	if(do_interpolate)
+	{
+		if(!m_prop.physical)
+			pos_translator.update(m_position, is_end_position, update_interval);
+	} else {
+		pos_translator.init(m_position);
+	}
+	rot_translator.update(m_rotation, false, update_interval);
+	updateNodePos();
+}
+
 void GenericCAO::processMessage(const std::string &data)
 {
 	//infostream<<"GenericCAO: Got message"<<std::endl;
@@ -1730,23 +1752,37 @@ void GenericCAO::processMessage(const std::string &data)
 		bool is_end_position = readU8(is);
 		float update_interval = readF32(is);
 
-		// Place us a bit higher if we're physical, to not sink into
-		// the ground due to sucky collision detection...
-		if(m_prop.physical)
-			m_position += v3f(0,0.002,0);
+		// Keyframe for the following AO_CMD_UPDATE_POSITION_DELTA messages
+		if (is.peek() != std::istream::traits_type::eof()) {
+			m_keyframe_id = readU8(is);
+			m_keyframe_position = m_position;
+			m_have_keyframe = true;
+		}
 
-		if(getParent() != NULL) // Just in case
+		applyPositionUpdate(do_interpolate, is_end_position, update_interval);
+	} else if (cmd == AO_CMD_UPDATE_POSITION_DELTA) {
+		// Sent unreliably, it may arrive before the keyframe it refers to
+		u8 keyframe_id = readU8(is);
+		if (!m_have_keyframe || keyframe_id != m_keyframe_id)
 			return;
 
-		if(do_interpolate)
-		{
-			if(!m_prop.physical)
-				pos_translator.update(m_position, is_end_position, update_interval);
-		} else {
-			pos_translator.init(m_position);
-		}
-		rot_translator.update(m_rotation, false, update_interval);
-		updateNodePos();
+		v3f delta, velocity, acceleration;
+		for (f32 *v : {&delta.X, &delta.Y, &delta.Z})
+			*v = readS16(is) * 0.01f;
+		for (f32 *v : {&velocity.X, &velocity.Y, &velocity.Z})
+			*v = readS16(is) * 0.01f;
+		for (f32 *v : {&acceleration.X, &acceleration.Y, &acceleration.Z})
+			*v = readS16(is) * 0.01f;
+		for (f32 *v : {&m_rotation.X, &m_rotation.Y, &m_rotation.Z})
+			*v = readU16(is) * (360.0f / 65536.0f);
+		u8 flags = readU8(is);
+		float update_interval = readU8(is) * 0.01f;
+
+		m_position = m_keyframe_position + delta;
+		m_velocity = velocity;
+		m_acceleration = acceleration;
+
+		applyPositionUpdate(flags & 1, flags & 2, update_interval);
 	} else if (cmd == AO_CMD_SET_TEXTURE_MOD) {
 		std::string mod = deSerializeString16(is);
 
@@ -92,6 +92,10 @@ class GenericCAO : public ClientActiveObject
 	v3f m_rotation;
 	u16 m_hp = 1;
 	SmoothTranslator<v3f> pos_translator;
+	// Last position keyframe, AO_CMD_UPDATE_POSITION_DELTA is relative to it
+	v3f m_keyframe_position;
+	u8 m_keyframe_id = 0;
+	bool m_have_keyframe = false;
 	SmoothTranslatorWrappedv3f rot_translator;
 	// Spritesheet/animation stuff
 	v2f m_tx_size = v2f(1,1);
@@ -268,6 +272,10 @@ class GenericCAO : public ClientActiveObject
 
 	void processMessage(const std::string &data);
 
+	// Applies m_position, m_rotation etc. after a position update
+	void applyPositionUpdate(bool do_interpolate, bool is_end_position,
+			float update_interval);
+
 	bool directReportPunch(v3f dir, const ItemStack *punchitem=NULL,
 			float time_from_last_punch=1000000);
 
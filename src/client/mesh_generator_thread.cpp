@@ -225,7 +225,9 @@ void MeshUpdateWorkerThread::doUpdate()
 	while ((q = m_queue_in->pop())) {
 		if (m_generation_interval)
 			sleep_ms(m_generation_interval);
-		ScopeProfiler sp(g_profiler, "Client: Mesh making (sum)");
+		static const ProfilerId profiler_id =
+				ScopeProfiler::getId("Client: Mesh making (sum)");
+		ScopeProfiler sp(g_profiler, profiler_id);
 
 		MapBlockMesh *mesh_new = new MapBlockMesh(q->data, *m_camera_offset);
 
@@ -31,7 +31,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/player_sao.h"
 #include "log.h"
 #include "util/srp.h"
-#include "face_position_cache.h"
 
 const char *ClientInterface::statenames[] = {
 	"Invalid",
@@ -109,6 +108,7 @@ void RemoteClient::GetNextBlocks (
 				<< std::endl;
 		m_map_send_completion_timer = 0.0f;
 		m_nearest_unsent_d = 0;
+		m_send_queue.resetVisited();
 	}
 
 	if (m_nothing_to_send_pause_timer >= 0)
@@ -180,31 +180,6 @@ void RemoteClient::GetNextBlocks (
 	s16 wanted_range = sao->getWantedRange() + 1;
 	float camera_fov = sao->getFov();
 
-	/*
-		Get the starting value of the block finder radius.
-	*/
-	if (m_last_center != center) {
-		m_nearest_unsent_d = 0;
-		m_last_center = center;
-		m_map_send_completion_timer = 0.0f;
-	}
-	// reset the unsent distance if the view angle has changed more that 10% of the fov
-	// (this matches isBlockInSight which allows for an extra 10%)
-	if (camera_dir.dotProduct(m_last_camera_dir) < std::cos(camera_fov * 0.1f)) {
-		m_nearest_unsent_d = 0;
-		m_last_camera_dir = camera_dir;
-		m_map_send_completion_timer = 0.0f;
-	}
-	if (m_nearest_unsent_d > 0) {
-		// make sure any blocks modified since the last time we sent blocks are resent
-		for (const v3s16 &p : m_blocks_modified) {
-			m_nearest_unsent_d = std::min(m_nearest_unsent_d, center.getDistanceFrom(p));
-		}
-	}
-	m_blocks_modified.clear();
-
-	s16 d_start = m_nearest_unsent_d;
-
 	// Distrust client-sent FOV and get server-set player object property
 	// zoom FOV (degrees) as a check to avoid hacked clients using FOV to load
 	// distant world.
@@ -222,13 +197,6 @@ void RemoteClient::GetNextBlocks (
 	s16 d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
 		wanted_range);
 
-	s16 d_max = full_d_max;
-
-	// Don't loop very much at a time
-	s16 max_d_increment_at_time = 2;
-	if (d_max > d_start + max_d_increment_at_time)
-		d_max = d_start + max_d_increment_at_time;
-
 	// cos(angle between velocity and camera) * |velocity|
 	// Limit to 0.0f in case player moves backwards.
 	f32 dot = rangelim(camera_dir.dotProduct(playerspeed), 0.0f, 300.0f);
@@ -237,162 +205,156 @@ void RemoteClient::GetNextBlocks (
 	// limit max fov effect to 50%, 60% at 20n/s fly speed
 	camera_fov = camera_fov / (1 + dot / 300.0f);
 
+	/*
+		Get the starting value of the block finder radius.
+		Start over if the player has moved to another block or the view
+		has changed, as that changes which blocks are in sight.
+	*/
+	BlockSendQueue::View view;
+	view.center = center;
+	view.camera_pos = camera_pos;
+	view.camera_dir = camera_dir;
+	view.camera_fov = camera_fov;
+	view.speed_dir = playerspeeddir;
+	view.range = d_blocks_in_sight;
+	if (m_send_queue.setView(view)) {
+		m_nearest_unsent_d = 0;
+		m_map_send_completion_timer = 0.0f;
+	}
+	if (m_nearest_unsent_d > 0) {
+		// make sure any blocks modified since the last time we sent blocks are resent
+		for (const v3s16 &p : m_blocks_modified) {
+			m_nearest_unsent_d = std::min(m_nearest_unsent_d, center.getDistanceFrom(p));
+		}
+	}
+	m_blocks_modified.clear();
+
 	s32 nearest_emerged_d = -1;
 	s32 nearest_emergefull_d = -1;
-	s32 nearest_sent_d = -1;
 	//bool queue_is_full = false;
 
 	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
 
-	s16 d;
-	for (d = d_start; d <= d_max; d++) {
+	/*
+		Go through the blocks in sight on the borders of "d-radiused"
+		boxes, starting from the nearest one that may have something unsent
+	*/
+	BlockSendQueue::WalkResult walked = m_send_queue.walk(m_nearest_unsent_d, full_d_max,
+			[&] (const BlockSendQueue::Entry &entry, s16 d, bool sent) {
+		const v3s16 p = entry.pos;
+
 		/*
-			Get the border/face dot coordinates of a "d-radiused"
-			box
+			Send throttling
+			- Don't allow too many simultaneous transfers
+			- EXCEPT when the blocks are very close
+
+			Also, don't send blocks that are already flying.
 		*/
-		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
 
-		std::vector<v3s16>::iterator li;
-		for (li = list.begin(); li != list.end(); ++li) {
-			v3s16 p = *li + center;
+		// Start with the usual maximum
+		u16 max_simul_dynamic = max_simul_sends_usually;
 
-			/*
-				Send throttling
-				- Don't allow too many simultaneous transfers
-				- EXCEPT when the blocks are very close
+		// If block is very close, allow full maximum
+		if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
+			max_simul_dynamic = m_max_simul_sends;
 
-				Also, don't send blocks that are already flying.
-			*/
+		// If this is true, inexistent block will be made from scratch
+		bool generate = d <= d_max_gen;
 
-			// Start with the usual maximum
-			u16 max_simul_dynamic = max_simul_sends_usually;
+		/*
+			Check if map has this block
+		*/
+		MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+		if (block) {
+			// First: Reset usage timer, this block will be of use in the future.
+			block->resetUsageTimer();
+		}
 
-			// If block is very close, allow full maximum
-			if (d <= BLOCK_SEND_DISABLE_LIMITS_MAX_D)
-				max_simul_dynamic = m_max_simul_sends;
+		// Don't select too many blocks for sending
+		if (num_blocks_selected >= max_simul_dynamic) {
+			//queue_is_full = true;
+			return BlockSendQueue::WALK_STOP;
+		}
 
-			/*
-				Do not go over max mapgen limit
-			*/
-			if (blockpos_over_max_limit(p))
-				continue;
+		// Don't send blocks that are currently being transferred
+		if (m_blocks_sending.find(p) != m_blocks_sending.end())
+			return BlockSendQueue::WALK_SKIP;
 
-			// If this is true, inexistent block will be made from scratch
-			bool generate = d <= d_max_gen;
+		/*
+			Don't send already sent blocks
+		*/
+		if (sent)
+			return BlockSendQueue::WALK_SKIP;
+		if (m_blocks_sent.find(p) != m_blocks_sent.end())
+			return BlockSendQueue::WALK_SENT;
 
-			/*
-				Don't generate or send if not in sight
-				FIXME This only works if the client uses a small enough
-				FOV setting. The default of 72 degrees is fine.
-				Also retrieve a smaller view cone in the direction of the player's
-				movement.
-				(0.1 is about 4 degrees)
-			*/
-			f32 dist;
-			if (!(isBlockInSight(p, camera_pos, camera_dir, camera_fov,
-						d_blocks_in_sight, &dist) ||
-					(playerspeed.getLength() > 1.0f * BS &&
-					isBlockInSight(p, camera_pos, playerspeeddir, 0.1f,
-						d_blocks_in_sight)))) {
-				continue;
-			}
+		bool block_not_found = false;
+		if (block) {
+			// Check whether the block exists (with data)
+			if (!block->isGenerated())
+				block_not_found = true;
 
 			/*
-				Check if map has this block
-			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
-			if (block) {
-				// First: Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
-			}
-
-			// Don't select too many blocks for sending
-			if (num_blocks_selected >= max_simul_dynamic) {
-				//queue_is_full = true;
-				goto queue_full_break;
-			}
-
-			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
-				continue;
+				If block is not close, don't send it unless it is near
+				ground level.
 
-			/*
-				Don't send already sent blocks
+				Block is near ground level if night-time mesh
+				differs from day-time mesh.
 			*/
-			if (m_blocks_sent.find(p) != m_blocks_sent.end())
-				continue;
-
-			bool block_not_found = false;
-			if (block) {
-				// Check whether the block exists (with data)
-				if (!block->isGenerated())
-					block_not_found = true;
-
-				/*
-					If block is not close, don't send it unless it is near
-					ground level.
-
-					Block is near ground level if night-time mesh
-					differs from day-time mesh.
-				*/
-				if (d >= d_opt) {
-					if (!block->getIsUnderground() && !block->getDayNightDiff())
-						continue;
-				}
-
-				/*
-					Check occlusion cache first.
-				 */
-				if (m_blocks_occ.find(p) != m_blocks_occ.end())
-					continue;
-
-				if (m_occ_cull && !block_not_found &&
-						env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
-					m_blocks_occ.insert(p);
-					continue;
-				}
+			if (d >= d_opt) {
+				if (!block->getIsUnderground() && !block->getDayNightDiff())
+					return BlockSendQueue::WALK_SKIP;
 			}
 
 			/*
-				If block has been marked to not exist on disk (dummy) or is
-				not generated and generating new ones is not wanted, skip block.
-			*/
-			if (!generate && block_not_found) {
-				// get next one.
-				continue;
+				Check occlusion cache first.
+			 */
+			if (m_blocks_occ.find(p) != m_blocks_occ.end())
+				return BlockSendQueue::WALK_SKIP;
+
+			if (m_occ_cull && !block_not_found &&
+					env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
+				m_blocks_occ.insert(p);
+				return BlockSendQueue::WALK_SKIP;
 			}
+		}
 
-			/*
-				Add inexistent block to emerge queue.
-			*/
-			if (block == NULL || block_not_found) {
-				if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
-					if (nearest_emerged_d == -1)
-						nearest_emerged_d = d;
-				} else {
-					if (nearest_emergefull_d == -1)
-						nearest_emergefull_d = d;
-					goto queue_full_break;
-				}
-
-				// get next one.
-				continue;
+		/*
+			If block has been marked to not exist on disk (dummy) or is
+			not generated and generating new ones is not wanted, skip block.
+		*/
+		if (!generate && block_not_found) {
+			// get next one.
+			return BlockSendQueue::WALK_SKIP;
+		}
+
+		/*
+			Add inexistent block to emerge queue.
+		*/
+		if (block == NULL || block_not_found) {
+			if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
+				if (nearest_emerged_d == -1)
+					nearest_emerged_d = d;
+			} else {
+				if (nearest_emergefull_d == -1)
+					nearest_emergefull_d = d;
+				return BlockSendQueue::WALK_STOP;
 			}
 
-			if (nearest_sent_d == -1)
-				nearest_sent_d = d;
+			// get next one.
+			return BlockSendQueue::WALK_SKIP;
+		}
 
-			/*
-				Add block to send queue
-			*/
-			PrioritySortedBlockTransfer q((float)dist, p, peer_id);
+		/*
+			Add block to send queue
+		*/
+		PrioritySortedBlockTransfer q(entry.dist, p, peer_id);
 
-			dest.push_back(q);
+		dest.push_back(q);
 
-			num_blocks_selected += 1;
-		}
-	}
-queue_full_break:
+		num_blocks_selected += 1;
+		return BlockSendQueue::WALK_SELECTED;
+	});
 
 	// If nothing was found for sending and nothing was queued for
 	// emerging, continue next time browsing from here
@@ -401,17 +363,13 @@ void RemoteClient::GetNextBlocks (
 	} else if (nearest_emergefull_d != -1) {
 		new_nearest_unsent_d = nearest_emergefull_d;
 	} else {
-		if (d > full_d_max) {
-			new_nearest_unsent_d = 0;
+		if (walked.completed) {
+			m_send_queue.resetVisited();
 			m_nothing_to_send_pause_timer = 2.0f;
 			infostream << "Server: Player " << m_name << ", RemoteClient " << peer_id << ": full map send completed after " << m_map_send_completion_timer << "s, restarting" << std::endl;
 			m_map_send_completion_timer = 0.0f;
-		} else {
-			if (nearest_sent_d != -1)
-				new_nearest_unsent_d = nearest_sent_d;
-			else
-				new_nearest_unsent_d = d;
 		}
+		new_nearest_unsent_d = walked.getNextStart();
 	}
 
 	if (new_nearest_unsent_d != -1 && m_nearest_unsent_d != new_nearest_unsent_d) {
@@ -448,8 +406,10 @@ void RemoteClient::SetBlockNotSent(v3s16 p)
 
 	// remove the block from sending and sent sets,
 	// and mark as modified if found
-	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
+	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0) {
 		m_blocks_modified.insert(p);
+		m_send_queue.markNotSent(p);
+	}
 }
 
 void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
@@ -460,8 +420,10 @@ void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 		v3s16 p = block.first;
 		// remove the block from sending and sent sets,
 		// and mark as modified if found
-		if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
+		if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0) {
 			m_blocks_modified.insert(p);
+			m_send_queue.markNotSent(p);
+		}
 	}
 }
 
@@ -29,6 +29,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "threading/mutex_auto_lock.h"
 #include "clientdynamicinfo.h"
+#include "block_send_queue.h"
+#include "server/object_update_encoder.h"
 
 #include <list>
 #include <vector>
@@ -309,6 +311,12 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Position updates of the known objects, relative to the last
+		keyframe sent to this client.
+	*/
+	ObjectPositionEncoder m_position_encoder;
+
 	ClientState getState() const { return m_state; }
 
 	std::string getName() const { return m_name; }
@@ -389,9 +397,14 @@ class RemoteClient
 	 */
 	std::unordered_set<v3s16> m_blocks_occ;
 
+	/*
+		Blocks in sight, grouped by distance from the center block.
+		Recomputed when the player crosses a block boundary or the
+		view changes.
+	*/
+	BlockSendQueue m_send_queue;
+
 	s16 m_nearest_unsent_d = 0;
-	v3s16 m_last_center;
-	v3f m_last_camera_dir;
 
 	const u16 m_max_simul_sends;
 	const float m_min_time_from_building;
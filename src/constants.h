@@ -44,8 +44,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define RESEND_TIMEOUT_MIN 0.1
 #define RESEND_TIMEOUT_MAX 3.0
-// resend_timeout = avg_rtt * this
-#define RESEND_TIMEOUT_FACTOR 4
 
 /*
     Server
@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -90,6 +91,41 @@ bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Read all blocks from the same snapshot
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+	for (size_t i = 0; i < positions.size(); i++) {
+		std::string &block = (*blocks)[i];
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(positions[i])), &block);
+		if (!status.ok())
+			block.clear();
+	}
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
+bool Database_LevelDB::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	leveldb::WriteBatch batch;
+	for (const auto &it : blocks)
+		batch.Put(i64tos(getBlockAsInteger(it.first)), it.second);
+
+	leveldb::Status status = m_database->Write(leveldb::WriteOptions(), &batch);
+	if (!status.ok()) {
+		warningstream << "saveBlocks: LevelDB error saving "
+			<< blocks.size() << " blocks: " << status.ToString() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	leveldb::Iterator* it = m_database->NewIterator(leveldb::ReadOptions());
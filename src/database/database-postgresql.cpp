@@ -38,7 +38,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "util/string.h"
 #include <cstdlib>
+#include <cstring>
+#include <unordered_map>
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string,
 	const char *type) :
@@ -220,6 +223,14 @@ void MapDatabasePostgreSQL::initStatements()
 				"UPDATE SET data = $4::bytea");
 	}
 
+	// Multi-argument unnest() needs 9.4
+	if (getPGVersion() >= 90400) {
+		prepareStatement("read_blocks",
+			"SELECT posX, posY, posZ, data FROM blocks "
+				"WHERE (posX, posY, posZ) IN (SELECT * FROM "
+				"unnest($1::int4[], $2::int4[], $3::int4[]))");
+	}
+
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
 		"posX = $1::int4 AND posY = $2::int4 AND posZ = $3::int4");
 
@@ -283,6 +294,140 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blocks)
+{
+	if (positions.size() <= 1 || getPGVersion() < 90400) {
+		MapDatabase::loadBlocks(positions, blocks);
+		return;
+	}
+
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Fetch the whole batch in a single round-trip. The coordinates are
+	// passed as text arrays, the result is returned in binary form.
+	std::string xs("{"), ys("{"), zs("{");
+	std::unordered_map<v3s16, size_t> index;
+	index.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &pos = positions[i];
+		const char *sep = i ? "," : "";
+		xs.append(sep).append(itos(pos.X));
+		ys.append(sep).append(itos(pos.Y));
+		zs.append(sep).append(itos(pos.Z));
+		index[pos] = i;
+	}
+	xs.append("}");
+	ys.append("}");
+	zs.append("}");
+
+	const void *args[] = { xs.c_str(), ys.c_str(), zs.c_str() };
+	const int argFmt[] = { 0, 0, 0 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		NULL, argFmt, false);
+
+	auto get_int = [results] (int row, int col) -> s16 {
+		u32 val;
+		memcpy(&val, PQgetvalue(results, row, col), sizeof(val));
+		return (s16)(s32)ntohl(val);
+	};
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		v3s16 pos(get_int(row, 0), get_int(row, 1), get_int(row, 2));
+		auto it = index.find(pos);
+		if (it != index.end())
+			(*blocks)[it->second] = pg_to_string(results, row, 3);
+	}
+
+	PQclear(results);
+}
+
+bool MapDatabasePostgreSQL::saveBlocks(
+	const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	if (blocks.size() <= 1 || getPGVersion() < 90500)
+		return MapDatabase::saveBlocks(blocks);
+
+	verifyDatabase();
+
+	// A single upsert may not touch the same row twice, keep the last
+	// data given for each position.
+	std::unordered_map<v3s16, size_t> last;
+	last.reserve(blocks.size());
+	for (size_t i = 0; i < blocks.size(); i++)
+		last[blocks[i].first] = i;
+
+	// Stay well below the protocol limit of 65535 parameters
+	const size_t rows_per_query = 256;
+
+	std::vector<s32> coords;
+	std::vector<const void *> args;
+	std::vector<int> argLen, argFmt;
+	std::string sql;
+	bool ok = true;
+
+	auto flush = [&] () {
+		if (args.empty())
+			return;
+		sql.append(" ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+			"UPDATE SET data = EXCLUDED.data");
+		execParams(sql, args.size(), args.data(), argLen.data(), argFmt.data());
+		coords.clear();
+		args.clear();
+		argLen.clear();
+		argFmt.clear();
+	};
+
+	coords.reserve(rows_per_query * 3);
+	for (size_t i = 0; i < blocks.size(); i++) {
+		const v3s16 &pos = blocks[i].first;
+		const std::string &data = blocks[i].second;
+		if (last[pos] != i)
+			continue;
+
+		if (data.size() > INT_MAX) {
+			errorstream << "Database_PostgreSQL::saveBlocks: Data truncation! "
+				<< "data.size() over 0xFFFFFFFF (== " << data.size()
+				<< ")" << std::endl;
+			ok = false;
+			continue;
+		}
+
+		if (args.empty())
+			sql = "INSERT INTO blocks (posX, posY, posZ, data) VALUES ";
+		else
+			sql.append(",");
+
+		// coords never reallocates as it's reserved for a full query
+		size_t n = args.size();
+		sql.append("($").append(itos(n + 1)).append("::int4, $")
+			.append(itos(n + 2)).append("::int4, $")
+			.append(itos(n + 3)).append("::int4, $")
+			.append(itos(n + 4)).append("::bytea)");
+		coords.push_back(htonl(pos.X));
+		coords.push_back(htonl(pos.Y));
+		coords.push_back(htonl(pos.Z));
+		for (size_t j = coords.size() - 3; j < coords.size(); j++) {
+			args.push_back(&coords[j]);
+			argLen.push_back(sizeof(s32));
+		}
+		args.push_back(data.c_str());
+		argLen.push_back((int)data.size());
+		argFmt.insert(argFmt.end(), 4, 1);
+
+		if (args.size() >= rows_per_query * 4)
+			flush();
+	}
+	flush();
+
+	return ok;
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -87,6 +87,15 @@ class Database_PostgreSQL: public Database
 			(const void **)params, NULL, NULL, clear, nobinary);
 	}
 
+	inline PGresult *execParams(const std::string &sql, const int paramsNumber,
+		const void **params, const int *paramsLengths, const int *paramsFormats,
+		bool clear = true)
+	{
+		return checkResults(PQexecParams(m_conn, sql.c_str(), paramsNumber,
+			NULL, (const char* const*) params, paramsLengths, paramsFormats,
+			1), clear);
+	}
+
 	void createTableIfNotExists(const std::string &table_name, const std::string &definition);
 	void verifyDatabase();
 
@@ -123,6 +132,9 @@ class MapDatabasePostgreSQL : private Database_PostgreSQL, public MapDatabase
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	void beginSave() { Database_PostgreSQL::beginSave(); }
@@ -174,6 +174,90 @@ bool Database_Redis::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// One HMGET for the whole batch
+	std::vector<std::string> keys;
+	keys.reserve(positions.size());
+	for (const v3s16 &pos : positions)
+		keys.push_back(i64tos(getBlockAsInteger(pos)));
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	argv.reserve(keys.size() + 2);
+	argvlen.reserve(keys.size() + 2);
+	argv.push_back("HMGET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const std::string &key : keys) {
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' errored: ") + errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != positions.size()) {
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *elem = reply->element[i];
+		if (elem->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(elem->str, elem->len);
+	}
+	freeReplyObject(reply);
+}
+
+bool Database_Redis::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	// Pipeline the writes: queue all commands, then collect the replies
+	for (const auto &it : blocks) {
+		std::string tmp = i64tos(getBlockAsInteger(it.first));
+		redisAppendCommand(ctx, "HSET %s %s %b", hash.c_str(), tmp.c_str(),
+			it.second.c_str(), it.second.size());
+	}
+
+	bool ok = true;
+	for (const auto &it : blocks) {
+		redisReply *reply = nullptr;
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK || !reply) {
+			warningstream << "saveBlocks: redis command 'HSET' failed on "
+				"block " << PP(it.first) << ": " << ctx->errstr << std::endl;
+			// The connection is unusable from here on
+			return false;
+		}
+
+		if (reply->type == REDIS_REPLY_ERROR) {
+			warningstream << "saveBlocks: saving block " << PP(it.first)
+				<< " failed: " << std::string(reply->str, reply->len) << std::endl;
+			ok = false;
+		}
+		freeReplyObject(reply);
+	}
+	return ok;
+}
+
 void Database_Redis::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "HKEYS %s", hash.c_str()));
@@ -41,6 +41,9 @@ class Database_Redis : public MapDatabase
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 private:
@@ -261,24 +261,56 @@ bool MapDatabaseSQLite3::saveBlock(const v3s16 &pos, const std::string &data)
 {
 	verifyDatabase();
 
+	writeBlock(pos, data);
+	return true;
+}
+
+void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
+{
+	verifyDatabase();
+
+	readBlock(pos, block);
+}
+
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	// The read statement is prepared once, so a batch only costs one
+	// step per block.
+	blocks->clear();
+	blocks->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		readBlock(positions[i], &(*blocks)[i]);
+}
+
+bool MapDatabaseSQLite3::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	verifyDatabase();
+
+	for (const auto &it : blocks)
+		writeBlock(it.first, it.second);
+	return true;
+}
+
+void MapDatabaseSQLite3::writeBlock(const v3s16 &pos, const std::string &data)
+{
 	bindPos(m_stmt_write, pos);
 	SQLOK(sqlite3_bind_blob(m_stmt_write, 2, data.data(), data.size(), NULL),
 		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
 
 	SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
 	sqlite3_reset(m_stmt_write);
-
-	return true;
 }
 
-void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
+void MapDatabaseSQLite3::readBlock(const v3s16 &pos, std::string *block)
 {
-	verifyDatabase();
-
 	bindPos(m_stmt_read, pos);
 
 	if (sqlite3_step(m_stmt_read) != SQLITE_ROW) {
 		sqlite3_reset(m_stmt_read);
+		block->clear();
 		return;
 	}
 
@@ -149,6 +149,9 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	void beginSave() { Database_SQLite3::beginSave(); }
@@ -159,6 +162,9 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 private:
 	void bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index = 1);
+	// Like loadBlock/saveBlock, without verifying the database first
+	void readBlock(const v3s16 &pos, std::string *block);
+	void writeBlock(const v3s16 &pos, const std::string &data);
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
@@ -48,6 +48,25 @@ static inline s64 pythonmodulo(s64 i, s16 mod)
 }
 
 
+void MapDatabase::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		loadBlock(positions[i], &(*blocks)[i]);
+}
+
+
+bool MapDatabase::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	bool ok = true;
+	for (const auto &it : blocks)
+		ok &= saveBlock(it.first, it.second);
+	return ok;
+}
+
+
 s64 MapDatabase::getBlockAsInteger(const v3s16 &pos)
 {
 	return (u64) pos.Z * 0x1000000 +
@@ -21,8 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <deque>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -38,7 +38,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_ore.h"
 #include "mapgen/mg_decoration.h"
 #include "mapgen/mg_schematic.h"
+#include "mapgen/noisecache.h"
 #include "nodedef.h"
+#include "porting.h"
 #include "profiler.h"
 #include "scripting_server.h"
 #include "server.h"
@@ -50,7 +52,7 @@ class EmergeThread : public Thread {
 	bool enable_mapgen_debug_info;
 	int id;
 
-	EmergeThread(Server *server, int ethreadid);
+	EmergeThread(Server *server, int ethreadid, MetricsBackend *mb);
 	~EmergeThread() = default;
 
 	void *run();
@@ -58,6 +60,9 @@ class EmergeThread : public Thread {
 
 	// Requires queue mutex held
 	bool pushBlock(const v3s16 &pos);
+	// Number of queued blocks, including the one being processed.
+	// Requires queue mutex held
+	size_t getLoad() const { return m_block_queue.size() + (m_busy ? 1 : 0); }
 
 	void cancelPendingItems();
 
@@ -73,10 +78,31 @@ class EmergeThread : public Thread {
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
 
+	struct QueuedBlock
+	{
+		v3s16 pos;
+		u64 time_queued;
+	};
+
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	// Protected by the queue mutex
+	std::deque<QueuedBlock> m_block_queue;
+	bool m_busy = false;
+	v3s16 m_current_pos;
+
+	MetricGaugePtr m_queue_gauge;
+	MetricCounterPtr m_completed_counter;
+	MetricCounterPtr m_latency_counter;
+	// By EmergeAction
+	MetricHistogramPtr m_latency_histogram[5];
+	MetricCounterPtr m_stolen_counter;
+
+	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata, u64 *time_queued);
+	// Requires queue mutex held
+	bool stealBlock();
 
-	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	// Requires env mutex held
+	void prefetchNeighborhood(const v3s16 &pos);
 
 	EmergeAction getBlockOrStartGen(
 		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
@@ -111,6 +137,9 @@ class MapEditEventAreaIgnorer
 	VoxelArea *m_ignorevariable;
 };
 
+// Used by EmergeParams without an EmergeManager
+static const std::set<u32> s_no_deco_ids;
+
 EmergeParams::~EmergeParams()
 {
 	infostream << "EmergeParams: destroying " << this << std::endl;
@@ -126,10 +155,21 @@ EmergeParams::EmergeParams(EmergeManager *parent, const BiomeGen *biomegen,
 	const BiomeManager *biomemgr,
 	const OreManager *oremgr, const DecorationManager *decomgr,
 	const SchematicManager *schemmgr) :
-	ndef(parent->ndef),
-	enable_mapgen_debug_info(parent->enable_mapgen_debug_info),
-	gen_notify_on(parent->gen_notify_on),
-	gen_notify_on_deco_ids(&parent->gen_notify_on_deco_ids),
+	EmergeParams(parent->ndef, biomegen, biomemgr, oremgr, decomgr, schemmgr)
+{
+	enable_mapgen_debug_info = parent->enable_mapgen_debug_info;
+	gen_notify_on = parent->gen_notify_on;
+	gen_notify_on_deco_ids = &parent->gen_notify_on_deco_ids;
+}
+
+EmergeParams::EmergeParams(const NodeDefManager *ndef, const BiomeGen *biomegen,
+	const BiomeManager *biomemgr,
+	const OreManager *oremgr, const DecorationManager *decomgr,
+	const SchematicManager *schemmgr) :
+	ndef(ndef),
+	enable_mapgen_debug_info(false),
+	gen_notify_on(0),
+	gen_notify_on_deco_ids(&s_no_deco_ids),
 	biomemgr(biomemgr->clone()), oremgr(oremgr->clone()),
 	decomgr(decomgr->clone()), schemmgr(schemmgr->clone())
 {
@@ -191,9 +231,19 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
 
 	for (s16 i = 0; i < nthreads; i++)
-		m_threads.push_back(new EmergeThread(server, i));
+		m_threads.push_back(new EmergeThread(server, i, mb));
 
 	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
+
+	u16 worker_threads = g_settings->getU16("mapgen_worker_threads");
+	if (worker_threads > 0) {
+		m_mapgen_workers = std::make_unique<WorkerThreadPool>(
+				"MapgenWorker", worker_threads);
+	}
+
+	u32 noise_cache_size = g_settings->getU32("mapgen_noise_cache_size");
+	if (noise_cache_size > 0)
+		m_noise_cache = std::make_unique<NoiseCache>(noise_cache_size, mb);
 }
 
 
@@ -264,6 +314,8 @@ void EmergeManager::initMapgens(MapgenParams *params)
 	for (u32 i = 0; i != m_threads.size(); i++) {
 		EmergeParams *p = new EmergeParams(this, biomegen,
 			biomemgr, oremgr, decomgr, schemmgr);
+		p->workers = m_mapgen_workers.get();
+		p->noise_cache = m_noise_cache.get();
 		infostream << "EmergeManager: Created params " << p
 			<< " for thread " << i << std::endl;
 		m_mapgens.push_back(Mapgen::createMapgen(params->mgtype, params, p));
@@ -488,11 +540,13 @@ EmergeThread *EmergeManager::getOptimalThread()
 
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
+	// Count the block being processed, so that idle threads are
+	// preferred over ones stuck in a slow mapgen chunk
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->getLoad();
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = m_threads[i]->getLoad();
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -513,7 +567,7 @@ void EmergeManager::reportCompletedEmerge(EmergeAction action)
 //// EmergeThread
 ////
 
-EmergeThread::EmergeThread(Server *server, int ethreadid) :
+EmergeThread::EmergeThread(Server *server, int ethreadid, MetricsBackend *mb) :
 	enable_mapgen_debug_info(false),
 	id(ethreadid),
 	m_server(server),
@@ -522,6 +576,31 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_mapgen(NULL)
 {
 	m_name = "Emerge-" + itos(ethreadid);
+
+	const std::string thread_id = itos(ethreadid);
+	m_queue_gauge = mb->addGauge(
+		"minetest_emerge_queue_length", "Number of blocks queued for an emerge thread",
+		{{"thread", thread_id}});
+	m_completed_counter = mb->addCounter(
+		"minetest_emerge_thread_completed", "Number of emerges completed by a thread",
+		{{"thread", thread_id}});
+	m_latency_counter = mb->addCounter(
+		"minetest_emerge_latency",
+		"Time from queueing to completion of emerges (in microseconds)",
+		{{"thread", thread_id}});
+	m_stolen_counter = mb->addCounter(
+		"minetest_emerge_stolen", "Number of blocks taken from the queue of other threads",
+		{{"thread", thread_id}});
+
+	STATIC_ASSERT(ARRLEN(emergeActionStrs) == ARRLEN(m_latency_histogram),
+		enum_size_mismatches);
+	for (u32 i = 0; i < ARRLEN(m_latency_histogram); i++) {
+		m_latency_histogram[i] = mb->addHistogram(
+			"minetest_emerge_latency_seconds",
+			"Time from queueing to completion of emerges",
+			MetricsBackend::getDurationBuckets(),
+			{{"thread", thread_id}, {"status", emergeActionStrs[i]}});
+	}
 }
 
 
@@ -533,7 +612,8 @@ void EmergeThread::signal()
 
 bool EmergeThread::pushBlock(const v3s16 &pos)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back({pos, porting::getTimeUs()});
+	m_queue_gauge->set(m_block_queue.size());
 	return true;
 }
 
@@ -546,13 +626,15 @@ void EmergeThread::cancelPendingItems()
 		BlockEmergeData bedata;
 		v3s16 pos;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+		pos = m_block_queue.front().pos;
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
 		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
 	}
+	m_busy = false;
+	m_queue_gauge->set(0);
 }
 
 
@@ -573,15 +655,24 @@ void EmergeThread::runCompletionCallbacks(const v3s16 &pos, EmergeAction action,
 }
 
 
-bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
+bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata,
+	u64 *time_queued)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
+	// The previous block is done
+	m_busy = false;
+
+	if (m_block_queue.empty() && !stealBlock())
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	*pos = m_block_queue.front().pos;
+	*time_queued = m_block_queue.front().time_queued;
+	m_block_queue.pop_front();
+	m_queue_gauge->set(m_block_queue.size());
+
+	m_busy = true;
+	m_current_pos = *pos;
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -589,6 +680,68 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+bool EmergeThread::stealBlock()
+{
+	// Take work from the thread with the most blocks waiting
+	EmergeThread *victim = nullptr;
+	for (EmergeThread *thread : m_emerge->m_threads) {
+		if (thread != this && !thread->m_block_queue.empty() &&
+				(!victim || thread->m_block_queue.size() > victim->m_block_queue.size()))
+			victim = thread;
+	}
+	if (!victim)
+		return false;
+
+	// Blocks of the chunk the victim is generating would only be cancelled
+	// here, as a chunk can't be generated twice at the same time
+	const s16 chunksize = m_emerge->mgparams->chunksize;
+	v3s16 victim_chunk;
+	if (victim->m_busy)
+		victim_chunk = EmergeManager::getContainingChunk(victim->m_current_pos, chunksize);
+
+	// Take from the back, the victim continues at the front
+	for (auto it = victim->m_block_queue.rbegin();
+			it != victim->m_block_queue.rend(); ++it) {
+		if (victim->m_busy &&
+				EmergeManager::getContainingChunk(it->pos, chunksize) == victim_chunk)
+			continue;
+
+		m_block_queue.push_back(*it);
+		victim->m_block_queue.erase(std::next(it).base());
+		victim->m_queue_gauge->set(victim->m_block_queue.size());
+		m_stolen_counter->increment();
+		return true;
+	}
+	return false;
+}
+
+
+void EmergeThread::prefetchNeighborhood(const v3s16 &pos)
+{
+	// Emerge requests come in clusters around the players, so fetch the
+	// surrounding blocks in the same database round-trip.
+	if (m_map->isBlockPrefetched(pos))
+		return;
+
+	const s16 r = 1;
+	std::vector<v3s16> positions;
+	positions.reserve((2 * r + 1) * (2 * r + 1) * (2 * r + 1));
+	positions.push_back(pos);
+	v3s16 p;
+	for (p.Z = pos.Z - r; p.Z <= pos.Z + r; p.Z++)
+	for (p.Y = pos.Y - r; p.Y <= pos.Y + r; p.Y++)
+	for (p.X = pos.X - r; p.X <= pos.X + r; p.X++) {
+		if (p != pos && !blockpos_over_max_limit(p))
+			positions.push_back(p);
+	}
+
+	static const ProfilerId profiler_id =
+			ScopeProfiler::getId("EmergeThread: prefetch blocks");
+	ScopeProfiler sp(g_profiler, profiler_id, SPT_AVG);
+	m_map->prefetchBlocks(positions);
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -601,6 +754,7 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 			return EMERGE_FROM_MEMORY;
 	} else {
 		// 2). Attempt to load block from disk if it was not in the memory
+		prefetchNeighborhood(pos);
 		*block = m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
@@ -619,8 +773,9 @@ MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 	std::map<v3s16, MapBlock *> *modified_blocks)
 {
 	MutexAutoLock envlock(m_server->m_env_mutex);
-	ScopeProfiler sp(g_profiler,
-		"EmergeThread: after Mapgen::makeChunk", SPT_AVG);
+	static const ProfilerId profiler_id =
+			ScopeProfiler::getId("EmergeThread: after Mapgen::makeChunk");
+	ScopeProfiler sp(g_profiler, profiler_id, SPT_AVG);
 
 	/*
 		Perform post-processing on blocks (invalidate lighting, queue liquid
@@ -691,8 +846,9 @@ void *EmergeThread::run()
 		BlockMakeData bmdata;
 		EmergeAction action;
 		MapBlock *block = nullptr;
+		u64 time_queued;
 
-		if (!popBlockEmerge(&pos, &bedata)) {
+		if (!popBlockEmerge(&pos, &bedata, &time_queued)) {
 			m_queue_event.wait();
 			continue;
 		}
@@ -706,8 +862,9 @@ void *EmergeThread::run()
 		action = getBlockOrStartGen(pos, allow_gen, &block, &bmdata);
 		if (action == EMERGE_GENERATED) {
 			{
-				ScopeProfiler sp(g_profiler,
-					"EmergeThread: Mapgen::makeChunk", SPT_AVG);
+				static const ProfilerId profiler_id =
+						ScopeProfiler::getId("EmergeThread: Mapgen::makeChunk");
+				ScopeProfiler sp(g_profiler, profiler_id, SPT_AVG);
 
 				m_mapgen->makeChunk(&bmdata);
 			}
@@ -718,6 +875,10 @@ void *EmergeThread::run()
 		}
 
 		runCompletionCallbacks(pos, action, bedata.callbacks);
+		m_completed_counter->increment();
+		const u64 latency = porting::getTimeUs() - time_queued;
+		m_latency_counter->increment(latency);
+		m_latency_histogram[action]->observe(latency / 1000000.0);
 
 		if (block)
 			modified_blocks[pos] = block;
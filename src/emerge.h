@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <map>
+#include <memory>
 #include <mutex>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
@@ -46,6 +47,8 @@ class DecorationManager;
 class SchematicManager;
 class Server;
 class ModApiMapgen;
+class WorkerThreadPool;
+class NoiseCache;
 
 // Structure containing inputs/outputs for chunk generation
 struct BlockMakeData {
@@ -99,6 +102,12 @@ class EmergeParams {
 	friend class EmergeManager;
 public:
 	EmergeParams() = delete;
+	// Without an EmergeManager, e.g. for benchmarks.
+	// Clones the managers and biomegen like the EmergeManager does.
+	EmergeParams(const NodeDefManager *ndef, const BiomeGen *biomegen,
+		const BiomeManager *biomemgr,
+		const OreManager *oremgr, const DecorationManager *decomgr,
+		const SchematicManager *schemmgr);
 	~EmergeParams();
 	DISABLE_CLASS_COPY(EmergeParams);
 
@@ -114,6 +123,11 @@ class EmergeParams {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Helpers shared by all mapgens to split up a chunk, may be null
+	WorkerThreadPool *workers = nullptr;
+	// 2D noise maps shared by all mapgens, may be null
+	NoiseCache *noise_cache = nullptr;
+
 private:
 	EmergeParams(EmergeManager *parent, const BiomeGen *biomegen,
 		const BiomeManager *biomemgr,
@@ -197,6 +211,8 @@ class EmergeManager {
 	std::vector<Mapgen *> m_mapgens;
 	std::vector<EmergeThread *> m_threads;
 	bool m_threads_active = false;
+	std::unique_ptr<WorkerThreadPool> m_mapgen_workers;
+	std::unique_ptr<NoiseCache> m_noise_cache;
 
 	std::mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "map.h"
+#include "map_save_thread.h"
 #include "mapsector.h"
 #include "mapblock.h"
 #include "filesys.h"
@@ -33,6 +34,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "gamedef.h"
 #include "util/directiontables.h"
 #include "util/basic_macros.h"
+#include "threading/mutex_auto_lock.h"
 #include "rollback_interface.h"
 #include "environment.h"
 #include "reflowscan.h"
@@ -478,40 +480,6 @@ void Map::PrintInfo(std::ostream &out)
 	out<<"Map: ";
 }
 
-#define WATER_DROP_BOOST 4
-
-const static v3s16 liquid_6dirs[6] = {
-	// order: upper before same level before lower
-	v3s16( 0, 1, 0),
-	v3s16( 0, 0, 1),
-	v3s16( 1, 0, 0),
-	v3s16( 0, 0,-1),
-	v3s16(-1, 0, 0),
-	v3s16( 0,-1, 0)
-};
-
-enum NeighborType : u8 {
-	NEIGHBOR_UPPER,
-	NEIGHBOR_SAME_LEVEL,
-	NEIGHBOR_LOWER
-};
-
-struct NodeNeighbor {
-	MapNode n;
-	NeighborType t;
-	v3s16 p;
-
-	NodeNeighbor()
-		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
-	{ }
-
-	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
-		: n(node),
-		  t(n_type),
-		  p(pos)
-	{ }
-};
-
 void ServerMap::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
 }
@@ -519,336 +487,34 @@ void ServerMap::transforming_liquid_add(v3s16 p) {
 void ServerMap::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 		ServerEnvironment *env)
 {
-	u32 loopcount = 0;
-	u32 initial_size = m_transforming_liquid.size();
-
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
-
-	// list of nodes that due to viscosity have not reached their max level height
-	std::vector<v3s16> must_reflow;
-
-	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
-
-	std::vector<v3s16> check_for_falling;
+	const u64 start_time = porting::getTimeUs();
 
 	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
-	u32 loop_max = liquid_loop_max;
-
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
-			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
-		m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNode(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = cf.liquid_alternative_flowing_id;
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		bool floating_node_above = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 0:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 5:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + liquid_6dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			if (nt == NEIGHBOR_UPPER && cfnb.floats)
-				floating_node_above = true;
-			switch (cfnb.liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = cfnb.liquid_alternative_flowing_id;
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(nt != NEIGHBOR_LOWER)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					if (nb.t != NEIGHBOR_SAME_LEVEL ||
-						(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
-						// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-						// but exclude falling liquids on the same level, they cannot flow here anyway
-						if (liquid_kind == CONTENT_AIR)
-							liquid_kind = cfnb.liquid_alternative_flowing_id;
-					}
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
-
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighboring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
-
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-
-		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
-			continue;
-
-		/*
-			check if there is a floating node above that needs to be updated.
-		 */
-		if (floating_node_above && new_node_content == CONTENT_AIR)
-			check_for_falling.push_back(p0);
-
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bits to 0
-			n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-
-		// change the node.
-		n0.setContent(new_node_content);
-
-		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
-		}
-
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		ContentLightingFlags f0 = m_nodedef->getLightingFlags(n0);
-		n0.setLight(LIGHTBANK_DAY, 0, f0);
-		n0.setLight(LIGHTBANK_NIGHT, 0, f0);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
-
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			changed_nodes.emplace_back(p0, n00);
-		}
+	u32 loop_max = MYMIN(liquid_loop_max, m_transforming_liquid.size());
 
-		/*
-			enqueue neighbors for update if necessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
-		}
-	}
-	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
+	m_liquid_transformer.on_flood = [env] (v3s16 p, MapNode oldnode, MapNode newnode) {
+		return env->getScriptIface()->node_on_flood(p, oldnode, newnode);
+	};
+	LiquidTransformer::Result result;
+	m_liquid_transformer.transform(m_transforming_liquid, loop_max,
+		modified_blocks, result);
 
-	for (const auto &iter : must_reflow)
+	for (const auto &iter : result.must_reflow)
 		m_transforming_liquid.push_back(iter);
 
-	voxalgo::update_lighting_nodes(this, changed_nodes, modified_blocks);
+	voxalgo::update_lighting_nodes(this, result.changed_nodes, modified_blocks);
 
-	for (const v3s16 &p : check_for_falling) {
+	for (const v3s16 &p : result.check_for_falling) {
 		env->getScriptIface()->check_for_falling(p);
 	}
 
-	env->getScriptIface()->on_liquid_transformed(changed_nodes);
+	env->getScriptIface()->on_liquid_transformed(result.changed_nodes);
+
+	m_liquid_processed_counter->increment(result.processed);
+	m_liquid_changed_counter->increment(result.changed_nodes.size());
+	m_liquid_blocks_counter->increment(result.block_groups);
+	m_liquid_time_counter->increment(porting::getTimeUs() - start_time);
+	m_liquid_queue_gauge->set(m_transforming_liquid.size());
 
 	/* ----------------------------------------------------------------------
 	 * Manage the queue so that it does not grow indefinitely
@@ -896,6 +562,7 @@ void ServerMap::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 
 		m_queue_size_timer_started = false; // optimistically assume we can keep up now
 		m_unprocessed_count = m_transforming_liquid.size();
+		m_liquid_queue_gauge->set(m_unprocessed_count);
 	}
 }
 
@@ -1204,7 +871,8 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 		EmergeManager *emerge, MetricsBackend *mb):
 	Map(gamedef),
 	settings_mgr(savedir + DIR_DELIM + "map_meta.txt"),
-	m_emerge(emerge)
+	m_emerge(emerge),
+	m_liquid_transformer(this, gamedef)
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
@@ -1241,9 +909,28 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 		"minetest_map_saved_blocks", "Number of blocks saved");
 	m_loaded_blocks_gauge = mb->addGauge(
 		"minetest_map_loaded_blocks", "Number of loaded blocks");
+	m_liquid_processed_counter = mb->addCounter(
+		"minetest_liquid_processed_nodes", "Number of queued liquid nodes processed");
+	m_liquid_changed_counter = mb->addCounter(
+		"minetest_liquid_changed_nodes", "Number of nodes changed by liquid flow");
+	m_liquid_blocks_counter = mb->addCounter(
+		"minetest_liquid_processed_blocks",
+		"Number of block groups processed by the liquid transformer");
+	m_liquid_time_counter = mb->addCounter(
+		"minetest_liquid_transform_time",
+		"Time spent transforming liquids (in microseconds)");
+	m_liquid_queue_gauge = mb->addGauge(
+		"minetest_liquid_queue_length", "Number of liquid nodes waiting for an update");
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	if (g_settings->getBool("server_map_save_thread")) {
+		m_save_thread = std::make_unique<MapSaveThread>(dbase, m_db_mutex,
+			m_map_compression_level,
+			g_settings->getU32("server_map_save_queue_size"), mb);
+		m_save_thread->start();
+	}
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -1304,6 +991,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Write out everything that is still queued
+	m_save_thread.reset();
+
 	/*
 		Close database if it was opened
 	*/
@@ -1650,6 +1340,10 @@ void ServerMap::save(ModifiedState save_level)
 	// Don't do anything with sqlite unless something is really saved
 	bool save_started = false;
 
+	// Blocks are handed to the database in batches
+	const size_t batch_size = 256;
+	MapBlockVect batch;
+
 	for (auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 
@@ -1668,12 +1362,19 @@ void ServerMap::save(ModifiedState save_level)
 
 				modprofiler.add(block->getModifiedReasonString(), 1);
 
-				saveBlock(block);
+				batch.push_back(block);
+				if (batch.size() >= batch_size) {
+					saveBlocks(batch);
+					batch.clear();
+				}
 				block_count++;
 			}
 		}
 	}
 
+	if (!batch.empty())
+		saveBlocks(batch);
+
 	if(save_started)
 		endSave();
 
@@ -1697,7 +1398,12 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
-	dbase->listAllLoadableBlocks(dst);
+	if (m_save_thread)
+		m_save_thread->flush();
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		dbase->listAllLoadableBlocks(dst);
+	}
 	if (dbase_ro)
 		dbase_ro->listAllLoadableBlocks(dst);
 }
@@ -1747,23 +1453,45 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// The save thread uses its own transactions
+	if (m_save_thread)
+		return;
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_save_thread)
+		return;
 	dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	m_prefetched_blocks.erase(block->getPos());
+
+	if (m_save_thread) {
+		queueBlockSave(block);
+		return true;
+	}
 	return saveBlock(block, dbase, m_map_compression_level);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+void ServerMap::queueBlockSave(MapBlock *block)
 {
-	v3s16 p3d = block->getPos();
+	// Only take a snapshot here, compression and the database write
+	// happen on the save thread
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	block->serializeContents(os, version, true, m_map_compression_level);
+	m_save_thread->push(block->getPos(), version, os.str());
+
+	// The data is on its way to the disk
+	block->resetModified();
+}
 
+static std::string serializeBlock(MapBlock *block, int compression_level)
+{
 	// Format used for writing
 	u8 version = SER_FMT_VER_HIGHEST_WRITE;
 
@@ -1774,8 +1502,13 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
 	block->serialize(o, version, true, compression_level);
+	return o.str();
+}
 
-	bool ret = db->saveBlock(p3d, o.str());
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+{
+	bool ret = db->saveBlock(block->getPos(),
+		serializeBlock(block, compression_level));
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
@@ -1783,6 +1516,32 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	return ret;
 }
 
+bool ServerMap::saveBlocks(const MapBlockVect &blocks)
+{
+	if (m_save_thread) {
+		for (MapBlock *block : blocks) {
+			m_prefetched_blocks.erase(block->getPos());
+			queueBlockSave(block);
+		}
+		return true;
+	}
+
+	std::vector<std::pair<v3s16, std::string>> data;
+	data.reserve(blocks.size());
+	for (MapBlock *block : blocks) {
+		m_prefetched_blocks.erase(block->getPos());
+		data.emplace_back(block->getPos(),
+			serializeBlock(block, m_map_compression_level));
+	}
+
+	bool ret = dbase->saveBlocks(data);
+	if (ret) {
+		for (MapBlock *block : blocks)
+			block->resetModified();
+	}
+	return ret;
+}
+
 void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load)
 {
 	try {
@@ -1844,6 +1603,33 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 	}
 }
 
+void ServerMap::prefetchBlocks(const std::vector<v3s16> &positions)
+{
+	std::vector<v3s16> wanted;
+	wanted.reserve(positions.size());
+	for (v3s16 p : positions) {
+		// Blocks that are being written would be read in an outdated state
+		if (isBlockPrefetched(p) || getBlockNoCreateNoEx(p) ||
+				(m_save_thread && m_save_thread->isPending(p)))
+			continue;
+		wanted.push_back(p);
+	}
+	if (wanted.empty())
+		return;
+
+	// Data that was never asked for is not worth keeping forever
+	if (m_prefetched_blocks.size() + wanted.size() > max_prefetched_blocks)
+		m_prefetched_blocks.clear();
+
+	std::vector<std::string> blobs;
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		dbase->loadBlocks(wanted, &blobs);
+	}
+	for (size_t i = 0; i < wanted.size(); i++)
+		m_prefetched_blocks[wanted[i]] = std::move(blobs[i]);
+}
+
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 {
 	bool created_new = (getBlockNoCreateNoEx(blockpos) == NULL);
@@ -1851,7 +1637,16 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
+	auto it = m_prefetched_blocks.find(blockpos);
+	if (it != m_prefetched_blocks.end()) {
+		ret = std::move(it->second);
+		m_prefetched_blocks.erase(it);
+	} else {
+		if (m_save_thread)
+			m_save_thread->waitFor(blockpos);
+		MutexAutoLock dblock(m_db_mutex);
+		dbase->loadBlock(blockpos, &ret);
+	}
 	if (!ret.empty()) {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 	} else if (dbase_ro) {
@@ -1881,8 +1676,14 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	m_prefetched_blocks.erase(blockpos);
+	if (m_save_thread)
+		m_save_thread->waitFor(blockpos);
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
@@ -24,6 +24,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h"
@@ -36,10 +39,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "map_liquids.h"
 #include "debug.h"
 
 class Settings;
 class MapDatabase;
+class MapSaveThread;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -408,10 +413,21 @@ class ServerMap : public Map
 
 	bool saveBlock(MapBlock *block) override;
 	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	// Saves several blocks with one database call, like saveBlock()
+	bool saveBlocks(const MapBlockVect &blocks);
 	MapBlock* loadBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
+	// Reads the given blocks from the database in a single batch and keeps
+	// the data around for the following loadBlock() calls.
+	// Blocks that are already in memory or prefetched are skipped.
+	void prefetchBlocks(const std::vector<v3s16> &positions);
+	bool isBlockPrefetched(v3s16 p) const
+	{
+		return m_prefetched_blocks.find(p) != m_prefetched_blocks.end();
+	}
+
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
 	// when deleteBlock() is called.
@@ -454,6 +470,9 @@ class ServerMap : public Map
 private:
 	friend class LuaVoxelManip;
 
+	// Snapshots the block and hands it to the save thread
+	void queueBlockSave(MapBlock *block);
+
 	// Emerge manager
 	EmergeManager *m_emerge;
 
@@ -469,6 +488,7 @@ class ServerMap : public Map
 
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
+	LiquidTransformer m_liquid_transformer;
 	f32 m_transforming_liquid_loop_count_multiplier = 1.0f;
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
@@ -482,10 +502,25 @@ class ServerMap : public Map
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
 
+	// Serializes access to dbase while the save thread is running
+	std::mutex m_db_mutex;
+	// Writes saved blocks in the background if enabled
+	std::unique_ptr<MapSaveThread> m_save_thread;
+
+	// Block data read ahead by prefetchBlocks(). An empty string means the
+	// block is not in dbase. Entries are dropped when used or overwritten.
+	std::unordered_map<v3s16, std::string> m_prefetched_blocks;
+	static const size_t max_prefetched_blocks = 4096;
+
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
 	MetricCounterPtr m_save_time_counter;
 	MetricCounterPtr m_save_count_counter;
+	MetricCounterPtr m_liquid_processed_counter;
+	MetricCounterPtr m_liquid_changed_counter;
+	MetricCounterPtr m_liquid_blocks_counter;
+	MetricCounterPtr m_liquid_time_counter;
+	MetricGaugePtr m_liquid_queue_gauge;
 };
 
 
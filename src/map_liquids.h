@@ -0,0 +1,103 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "util/container.h"
+
+class Map;
+class MapBlock;
+class IGameDef;
+class NodeDefManager;
+
+/*
+	Applies one step of liquid flow to the positions queued for a Map.
+
+	The positions taken from the queue in one step are processed grouped by
+	MapBlock, and nodes are read through a cache of the 3x3x3 blocks around
+	the current one instead of looking up the sector for every neighbor.
+*/
+class LiquidTransformer
+{
+public:
+	LiquidTransformer(Map *map, IGameDef *gamedef);
+
+	// Called before a floodable node is replaced. Returning true keeps
+	// the node as it is. The map may be modified by the callback.
+	std::function<bool(v3s16 p, MapNode oldnode, MapNode newnode)> on_flood;
+
+	struct Result
+	{
+		// Positions and old nodes of all changed nodes
+		std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+		// Nodes that due to viscosity have not reached their max level height
+		std::vector<v3s16> must_reflow;
+		// Nodes that turned to air below a floating node
+		std::vector<v3s16> check_for_falling;
+
+		u32 processed = 0;
+		u32 block_groups = 0;
+	};
+
+	// Transforms up to max_count positions from the front of the queue.
+	// Neighbors that need to be updated are pushed back to the queue.
+	void transform(UniqueQueue<v3s16> &queue, u32 max_count,
+		std::map<v3s16, MapBlock *> &modified_blocks, Result &result);
+
+private:
+	void transformNode(v3s16 p0, std::map<v3s16, MapBlock *> &modified_blocks,
+		Result &result);
+	void setNode(v3s16 p, MapNode n);
+
+	// Pushes p to the queue unless it is still to be processed in this step
+	void enqueue(v3s16 p);
+
+	// Neighborhood cache
+	void setCenter(v3s16 blockpos);
+	void invalidateCache() { setCenter(m_center); }
+	MapBlock *getBlock(v3s16 blockpos);
+	MapNode getNode(v3s16 p);
+
+	Map *m_map;
+	IGameDef *m_gamedef;
+	const NodeDefManager *m_nodedef;
+
+	UniqueQueue<v3s16> *m_queue = nullptr;
+	// Positions taken from the queue that were not processed yet
+	std::unordered_set<v3s16> m_pending;
+
+	// Buffers for grouping positions by block, kept between steps
+	std::vector<v3s16> m_batch;
+	std::vector<u32> m_batch_group;
+	std::vector<u32> m_group_start;
+	std::vector<v3s16> m_sorted;
+	std::unordered_map<v3s16, u32> m_group_index;
+
+	v3s16 m_center;
+	MapBlock *m_blocks[27];
+	bool m_block_cached[27];
+};
@@ -0,0 +1,193 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "map_save_thread.h"
+#include <sstream>
+#include "database/database.h"
+#include "debug.h"
+#include "log.h"
+#include "porting.h"
+#include "serialization.h"
+#include "threading/mutex_auto_lock.h"
+
+MapSaveThread::MapSaveThread(MapDatabase *db, std::mutex &db_mutex,
+		int compression_level, size_t max_queued, MetricsBackend *mb) :
+	Thread("MapSave"),
+	m_db(db),
+	m_db_mutex(db_mutex),
+	m_compression_level(compression_level),
+	m_max_queued(MYMAX(max_queued, (size_t)1))
+{
+	m_queue_gauge = mb->addGauge(
+		"minetest_map_save_queue_length", "Number of blocks waiting to be written");
+	m_write_time_counter = mb->addCounter(
+		"minetest_map_save_thread_time",
+		"Time spent compressing and writing blocks (in microseconds)");
+	m_written_counter = mb->addCounter(
+		"minetest_map_save_thread_blocks", "Number of blocks written by the save thread");
+	m_wait_time_counter = mb->addCounter(
+		"minetest_map_save_wait_time",
+		"Time spent waiting for the save thread (in microseconds)");
+}
+
+MapSaveThread::~MapSaveThread()
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		stop();
+	}
+	m_queue_cv.notify_all();
+	wait();
+}
+
+void MapSaveThread::push(v3s16 pos, u8 version, std::string &&data)
+{
+	MutexAutoLock lock(m_mutex);
+
+	if (m_queue.size() >= m_max_queued) {
+		const u64 start_time = porting::getTimeUs();
+		m_written_cv.wait(lock, [this] {
+			return m_queue.size() < m_max_queued;
+		});
+		m_wait_time_counter->increment(porting::getTimeUs() - start_time);
+	}
+
+	m_queue.push_back({pos, version, std::move(data)});
+	m_pending[pos]++;
+	m_queue_gauge->set(m_queue.size());
+
+	lock.unlock();
+	m_queue_cv.notify_one();
+}
+
+bool MapSaveThread::isPending(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	return m_pending.find(pos) != m_pending.end();
+}
+
+void MapSaveThread::waitFor(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_pending.find(pos) == m_pending.end())
+		return;
+
+	const u64 start_time = porting::getTimeUs();
+	m_written_cv.wait(lock, [this, pos] {
+		return m_pending.find(pos) == m_pending.end();
+	});
+	m_wait_time_counter->increment(porting::getTimeUs() - start_time);
+}
+
+void MapSaveThread::flush()
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_pending.empty())
+		return;
+
+	const u64 start_time = porting::getTimeUs();
+	m_written_cv.wait(lock, [this] {
+		return m_pending.empty();
+	});
+	m_wait_time_counter->increment(porting::getTimeUs() - start_time);
+}
+
+void *MapSaveThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	std::vector<QueuedBlock> batch;
+	batch.reserve(max_batch_size);
+
+	while (true) {
+		{
+			MutexAutoLock lock(m_mutex);
+			m_queue_cv.wait(lock, [this] {
+				return !m_queue.empty() || stopRequested();
+			});
+			// Drain the queue before stopping
+			if (m_queue.empty())
+				break;
+
+			while (!m_queue.empty() && batch.size() < max_batch_size) {
+				batch.push_back(std::move(m_queue.front()));
+				m_queue.pop_front();
+			}
+			m_queue_gauge->set(m_queue.size());
+		}
+		// There is room in the queue again
+		m_written_cv.notify_all();
+
+		writeBatch(batch);
+
+		{
+			MutexAutoLock lock(m_mutex);
+			for (const QueuedBlock &block : batch) {
+				auto it = m_pending.find(block.pos);
+				if (--it->second == 0)
+					m_pending.erase(it);
+			}
+		}
+		m_written_cv.notify_all();
+		batch.clear();
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+void MapSaveThread::writeBatch(std::vector<QueuedBlock> &batch)
+{
+	const u64 start_time = porting::getTimeUs();
+
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	blocks.reserve(batch.size());
+	for (QueuedBlock &block : batch) {
+		/*
+			[0] u8 serialization version
+			[1] data
+		*/
+		std::ostringstream os(std::ios_base::binary);
+		os.write((char*) &block.version, 1);
+		if (block.version >= 29)
+			compress(block.data, os, block.version, m_compression_level);
+		else
+			os << block.data;
+		blocks.emplace_back(block.pos, os.str());
+		// Free the uncompressed copy early
+		std::string().swap(block.data);
+	}
+
+	try {
+		MutexAutoLock lock(m_db_mutex);
+		m_db->beginSave();
+		if (!m_db->saveBlocks(blocks)) {
+			errorstream << "MapSaveThread: Failed to write some of "
+				<< blocks.size() << " blocks" << std::endl;
+		}
+		m_db->endSave();
+	} catch (std::exception &e) {
+		errorstream << "MapSaveThread: Failed to write " << blocks.size()
+			<< " blocks: " << e.what() << std::endl;
+	}
+
+	m_written_counter->increment(blocks.size());
+	m_write_time_counter->increment(porting::getTimeUs() - start_time);
+}
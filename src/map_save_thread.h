@@ -0,0 +1,95 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+#include "threading/thread.h"
+#include "util/metricsbackend.h"
+
+class MapDatabase;
+
+/*
+	Compresses serialized MapBlocks and writes them to the map database
+	in the background, so that saving the map on the server thread only
+	costs a snapshot of the modified blocks.
+
+	Writes are done in queue order. Any other user of the database must
+	hold the database mutex, and must wait for pending writes of a block
+	before reading or deleting it.
+*/
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapDatabase *db, std::mutex &db_mutex, int compression_level,
+		size_t max_queued, MetricsBackend *mb);
+	// Writes out everything still queued
+	~MapSaveThread();
+
+	// Queues a block serialized with MapBlock::serializeContents() in the
+	// given format version. Waits while the queue is full.
+	void push(v3s16 pos, u8 version, std::string &&data);
+
+	// Whether a write of this block is queued or in progress
+	bool isPending(v3s16 pos);
+	// Waits until no write of this block is pending
+	void waitFor(v3s16 pos);
+	// Waits until everything queued so far is written
+	void flush();
+
+	void *run();
+
+private:
+	struct QueuedBlock
+	{
+		v3s16 pos;
+		u8 version;
+		std::string data;
+	};
+
+	// Maximum number of blocks written in one transaction
+	static const size_t max_batch_size = 64;
+
+	void writeBatch(std::vector<QueuedBlock> &batch);
+
+	MapDatabase *m_db;
+	std::mutex &m_db_mutex;
+	const int m_compression_level;
+	const size_t m_max_queued;
+
+	std::mutex m_mutex;
+	// Signalled when blocks are queued or the thread should stop
+	std::condition_variable m_queue_cv;
+	// Signalled when blocks are written
+	std::condition_variable m_written_cv;
+	std::deque<QueuedBlock> m_queue;
+	// Number of queued or in-progress writes per block
+	std::unordered_map<v3s16, u32> m_pending;
+
+	MetricGaugePtr m_queue_gauge;
+	MetricCounterPtr m_write_time_counter;
+	MetricCounterPtr m_written_counter;
+	MetricCounterPtr m_wait_time_counter;
+};
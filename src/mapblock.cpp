@@ -65,6 +65,8 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+std::atomic<u64> MapBlock::s_next_contents_version(1);
+
 MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef):
 		m_parent(parent),
 		m_pos(pos),
@@ -200,6 +202,37 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	updateContentsCache();
+	m_contents_version_valid = false;
+}
+
+void MapBlock::updateContentsCache()
+{
+	contents.clear();
+	contents_cached = false;
+
+	content_t previous_c = CONTENT_IGNORE;
+	bool have_previous = false;
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		// Runs of the same content are very common
+		if (have_previous && c == previous_c)
+			continue;
+		previous_c = c;
+		have_previous = true;
+
+		auto it = std::lower_bound(contents.begin(), contents.end(), c);
+		if (it != contents.end() && *it == c)
+			continue;
+		if (contents.size() >= max_cached_contents) {
+			// Too many different nodes... don't try to cache
+			contents.clear();
+			return;
+		}
+		contents.insert(it, c);
+	}
+	contents_cached = true;
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -372,15 +405,24 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 }
 
 void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+{
+	if (version >= 29) {
+		std::ostringstream os_raw(std::ios_base::binary);
+		serializeContents(os_raw, version, disk, compression_level);
+		// now compress the whole thing
+		compress(os_raw.str(), os_compressed, version, compression_level);
+	} else {
+		serializeContents(os_compressed, version, disk, compression_level);
+	}
+}
+
+void MapBlock::serializeContents(std::ostream &os, u8 version, bool disk, int compression_level)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialization version error");
 
-	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
-
 	// First byte
 	u8 flags = 0;
 	if(is_underground)
@@ -439,7 +481,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if (version >= 29) {
 		m_node_metadata.serialize(os, version, disk);
 	} else {
-		// use os_raw from above to avoid allocating another stream object
+		std::ostringstream os_raw(std::ios_base::binary);
 		m_node_metadata.serialize(os_raw, version, disk);
 		// prior to 29 node data was compressed individually
 		compress(os_raw.str(), os, version, compression_level);
@@ -470,11 +512,6 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			m_node_timers.serialize(os, version);
 		}
 	}
-
-	if (version >= 29) {
-		// now compress the whole thing
-		compress(os_raw.str(), os_compressed, version, compression_level);
-	}
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os)
@@ -490,10 +527,12 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	m_contents_version_valid = false;
 
 	if(version <= 21)
 	{
 		deSerialize_pre22(in_compressed, version, disk);
+		updateContentsCache();
 		return;
 	}
 
@@ -617,6 +656,8 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 	}
 
+	updateContentsCache();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <set>
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -65,6 +67,14 @@ class VoxelManipulator;
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+// Modifications that only affect the on-disk format of a block
+#define MOD_REASONS_DISK_ONLY (MOD_REASON_SET_TIMESTAMP | \
+	MOD_REASON_CLEAR_ALL_OBJECTS | MOD_REASON_BLOCK_EXPIRED | \
+	MOD_REASON_ADD_ACTIVE_OBJECT_RAW | MOD_REASON_REMOVE_OBJECTS_REMOVE | \
+	MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | MOD_REASON_TOO_MANY_OBJECTS | \
+	MOD_REASON_STATIC_DATA_ADDED | MOD_REASON_STATIC_DATA_REMOVED | \
+	MOD_REASON_STATIC_DATA_CHANGED)
+
 ////
 //// MapBlock itself
 ////
@@ -102,6 +112,8 @@ class MapBlock
 	{
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		contents.assign(1, CONTENT_IGNORE);
+		contents_cached = true;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -115,6 +127,9 @@ class MapBlock
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		if (reason & ~MOD_REASONS_DISK_ONLY)
+			m_contents_version_valid = false;
+
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -123,8 +138,6 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents_cached = false;
 	}
 
 	inline u32 getModified()
@@ -139,6 +152,18 @@ class MapBlock
 
 	std::string getModifiedReasonString();
 
+	// Identifies the current state of everything sent to clients.
+	// Changes with every such modification and is never shared between
+	// two blocks, even if one replaces the other at the same position.
+	u64 getContentsVersion()
+	{
+		if (!m_contents_version_valid) {
+			m_contents_version = s_next_contents_version++;
+			m_contents_version_valid = true;
+		}
+		return m_contents_version;
+	}
+
 	inline void resetModified()
 	{
 		m_modified = MOD_STATE_CLEAN;
@@ -277,6 +302,7 @@ class MapBlock
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -302,6 +328,7 @@ class MapBlock
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -439,6 +466,10 @@ class MapBlock
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
+	// Like serialize(), but leaves out the final compression step of
+	// version >= 29. The output can be compressed later, possibly on
+	// another thread, with compress(data, os, version, compression_level).
+	void serializeContents(std::ostream &os, u8 version, bool disk, int compression_level);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
@@ -455,6 +486,23 @@ class MapBlock
 		Private methods
 	*/
 
+	// Adds a content type to the cache when a node is set
+	inline void addContent(content_t c)
+	{
+		if (!contents_cached)
+			return;
+		auto it = std::lower_bound(contents.begin(), contents.end(), c);
+		if (it != contents.end() && *it == c)
+			return;
+		if (contents.size() >= max_cached_contents) {
+			// Too many different nodes... don't try to cache
+			contents_cached = false;
+			contents.clear();
+			return;
+		}
+		contents.insert(it, c);
+	}
+
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
 public:
@@ -475,12 +523,17 @@ class MapBlock
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
 	//// ABM optimizations ////
-	// Cache of content types
-	std::unordered_set<content_t> contents;
-	// True if content types are cached
+	// Rebuilds the content type cache from the node data
+	void updateContentsCache();
+
+	// Limit of cached content types, blocks with more are always scanned
+	static const u32 max_cached_contents = 64;
+
+	// Sorted cache of content types. It is kept up to date on node changes
+	// but may still list types that have since been removed.
+	std::vector<content_t> contents;
+	// True if content types are cached, false if there are too many
 	bool contents_cached = false;
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
 	// marks the sides which are opaque: 00+Z-Z+Y-Y+X-X
 	u8 solid_sides {0};
 
@@ -512,6 +565,10 @@ class MapBlock
 	u32 m_modified = MOD_STATE_WRITE_NEEDED;
 	u32 m_modified_reason = MOD_REASON_INITIAL;
 
+	u64 m_contents_version = 0;
+	bool m_contents_version_valid = false;
+	static std::atomic<u64> s_next_contents_version;
+
 	/*
 		When propagating sunlight and the above block doesn't exist,
 		sunlight is assumed if this is false.
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "util/numeric.h"
+#include "util/thread.h"
 #include <cmath>
 #include "map.h"
 #include "mapgen.h"
@@ -69,18 +70,29 @@ CavesNoiseIntersection::~CavesNoiseIntersection()
 
 
 void CavesNoiseIntersection::generateCaves(MMVManip *vm,
-	v3s16 nmin, v3s16 nmax, biome_t *biomemap)
+	v3s16 nmin, v3s16 nmax, biome_t *biomemap, WorkerThreadPool *workers)
 {
 	assert(vm);
 	assert(biomemap);
 
-	noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
-	noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
+	parallel_run(workers, {
+		[&] { noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z); },
+		[&] { noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z); },
+	});
+
+	// Columns only touch their own nodes, so rows can be carved at the same time
+	parallel_for(workers, nmax.Z - nmin.Z + 1, [&] (size_t zr) {
+		generateCavesRow(vm, nmin.Z + zr, nmin, nmax, biomemap);
+	});
+}
+
 
+void CavesNoiseIntersection::generateCavesRow(MMVManip *vm, s16 z,
+	v3s16 nmin, v3s16 nmax, biome_t *biomemap)
+{
 	const v3s16 &em = vm->m_area.getExtent();
-	u32 index2d = 0;  // Biomemap index
+	u32 index2d = (z - nmin.Z) * m_csize.X;  // Biomemap index
 
-	for (s16 z = nmin.Z; z <= nmax.Z; z++)
 	for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
 		bool column_is_open = false;  // Is column open to overground
 		bool is_under_river = false;  // Is column under river water
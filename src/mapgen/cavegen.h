@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
 
 class GenerateNotifier;
+class WorkerThreadPool;
 
 /*
 	CavesNoiseIntersection is a cave digging algorithm that carves smooth,
@@ -46,9 +47,14 @@ class CavesNoiseIntersection
 		NoiseParams *np_cave2, s32 seed, float cave_width);
 	~CavesNoiseIntersection();
 
-	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, biome_t *biomemap);
+	// The noise and the columns are split up over workers, if not null
+	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, biome_t *biomemap,
+		WorkerThreadPool *workers = nullptr);
 
 private:
+	void generateCavesRow(MMVManip *vm, s16 z, v3s16 nmin, v3s16 nmax,
+		biome_t *biomemap);
+
 	const NodeDefManager *m_ndef;
 	BiomeManager *m_bmgr;
 
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "gamedef.h"
 #include "mg_biome.h"
+#include "noisecache.h"
 #include "mapblock.h"
 #include "mapnode.h"
 #include "map.h"
@@ -39,6 +40,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/numeric.h"
 #include "util/directiontables.h"
+#include "util/thread.h"
 #include "filesys.h"
 #include "log.h"
 #include "mapgen_carpathian.h"
@@ -103,6 +105,20 @@ STATIC_ASSERT(
 	ARRLEN(g_reg_mapgens) == MAPGEN_INVALID,
 	registered_mapgens_is_wrong_size);
 
+static const char *mapgen_stage_names[] = {
+	"noise",
+	"biomes",
+	"caves",
+	"dungeons",
+	"ores",
+	"decorations",
+	"lighting",
+};
+
+STATIC_ASSERT(
+	ARRLEN(mapgen_stage_names) == MGSTAGE_MAX,
+	mapgen_stage_names_is_wrong_size);
+
 ////
 //// Mapgen
 ////
@@ -131,7 +147,11 @@ Mapgen::Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge) :
 	*/
 	seed = (s32)params->seed;
 
-	ndef      = emerge->ndef;
+	ndef        = emerge->ndef;
+	workers     = emerge->workers;
+	noise_cache = emerge->noise_cache;
+
+	enable_mapgen_debug_info = emerge->enable_mapgen_debug_info;
 }
 
 
@@ -227,6 +247,25 @@ void Mapgen::setDefaultSettings(Settings *settings)
 	}
 }
 
+const char *Mapgen::getStageName(MapgenStage stage)
+{
+	assert(stage < MGSTAGE_MAX);
+	return mapgen_stage_names[stage];
+}
+
+ProfilerId Mapgen::getStageProfilerId(MapgenStage stage)
+{
+	static const std::vector<ProfilerId> ids = [] {
+		std::vector<ProfilerId> ids;
+		for (const char *name : mapgen_stage_names)
+			ids.push_back(ScopeProfiler::getId(std::string("Mapgen: ") + name + " (sum)"));
+		return ids;
+	}();
+
+	assert(stage < MGSTAGE_MAX);
+	return ids[stage];
+}
+
 u32 Mapgen::getBlockSeed(v3s16 p, s32 seed)
 {
 	return (u32)seed   +
@@ -415,7 +454,9 @@ void Mapgen::updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nm
 
 void Mapgen::setLighting(u8 light, v3s16 nmin, v3s16 nmax)
 {
-	ScopeProfiler sp(g_profiler, "EmergeThread: update lighting", SPT_AVG);
+	static const ProfilerId profiler_id =
+			ScopeProfiler::getId("EmergeThread: update lighting");
+	ScopeProfiler sp(g_profiler, profiler_id, SPT_AVG);
 	VoxelArea a(nmin, nmax);
 
 	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
@@ -468,7 +509,10 @@ void Mapgen::lightSpread(VoxelArea &a, std::queue<std::pair<v3s16, u8>> &queue,
 void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 	bool propagate_shadow)
 {
-	ScopeProfiler sp(g_profiler, "EmergeThread: update lighting", SPT_AVG);
+	static const ProfilerId profiler_id =
+			ScopeProfiler::getId("EmergeThread: update lighting");
+	ScopeProfiler sp(g_profiler, profiler_id, SPT_AVG);
+	ScopeProfiler sp_stage(g_profiler, getStageProfilerId(MGSTAGE_LIGHTING));
 
 	propagateSunlight(nmin, nmax, propagate_shadow);
 	spreadLight(full_nmin, full_nmax);
@@ -594,6 +638,8 @@ MapgenBasic::MapgenBasic(int mapgenid, MapgenParams *params, EmergeParams *emerg
 	//// Initialize biome generator
 	biomegen = emerge->biomegen;
 	biomegen->assertChunkSize(csize);
+	biomegen->workers = workers;
+	biomegen->noise_cache = noise_cache;
 	biomemap = biomegen->biomemap;
 
 	//// Look up some commonly used content
@@ -627,16 +673,26 @@ MapgenBasic::~MapgenBasic()
 
 void MapgenBasic::generateBiomes()
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_BIOMES));
+
 	// can't generate biomes without a biome generator!
 	assert(biomegen);
 	assert(biomemap);
 
-	const v3s16 &em = vm->m_area.getExtent();
-	u32 index = 0;
+	NoiseCache::perlinMap2D(noise_cache, noise_filler_depth, node_min.X, node_min.Z);
+
+	// Columns only touch their own nodes, so rows can be done at the same time
+	parallel_for(workers, csize.Z, [&] (size_t zr) {
+		generateBiomesRow(node_min.Z + zr);
+	});
+}
 
-	noise_filler_depth->perlinMap2D(node_min.X, node_min.Z);
 
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
+void MapgenBasic::generateBiomesRow(s16 z)
+{
+	const v3s16 &em = vm->m_area.getExtent();
+	u32 index = (z - node_min.Z) * csize.X;
+
 	for (s16 x = node_min.X; x <= node_max.X; x++, index++) {
 		Biome *biome = NULL;
 		biome_t water_biome_index = 0;
@@ -828,6 +884,8 @@ void MapgenBasic::dustTopNodes()
 
 void MapgenBasic::generateCavesNoiseIntersection(s16 max_stone_y)
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_CAVES));
+
 	// cave_width >= 10 is used to disable generation and avoid the intensive
 	// 3D noise calculations. Tunnels already have zero width when cave_width > 1.
 	if (node_min.Y > max_stone_y || cave_width >= 10.0f)
@@ -836,12 +894,14 @@ void MapgenBasic::generateCavesNoiseIntersection(s16 max_stone_y)
 	CavesNoiseIntersection caves_noise(ndef, m_bmgr, csize,
 		&np_cave1, &np_cave2, seed, cave_width);
 
-	caves_noise.generateCaves(vm, node_min, node_max, biomemap);
+	caves_noise.generateCaves(vm, node_min, node_max, biomemap, workers);
 }
 
 
 void MapgenBasic::generateCavesRandomWalk(s16 max_stone_y, s16 large_cave_ymax)
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_CAVES));
+
 	if (node_min.Y > max_stone_y)
 		return;
 
@@ -873,6 +933,8 @@ void MapgenBasic::generateCavesRandomWalk(s16 max_stone_y, s16 large_cave_ymax)
 
 bool MapgenBasic::generateCavernsNoise(s16 max_stone_y)
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_CAVES));
+
 	if (node_min.Y > max_stone_y || node_min.Y > cavern_limit)
 		return false;
 
@@ -885,6 +947,8 @@ bool MapgenBasic::generateCavernsNoise(s16 max_stone_y)
 
 void MapgenBasic::generateDungeons(s16 max_stone_y)
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_DUNGEONS));
+
 	if (node_min.Y > max_stone_y || node_min.Y > dungeon_ymax ||
 			node_max.Y < dungeon_ymin)
 		return;
@@ -39,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define MG_ORES        0x80
 
 typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
+typedef u32 ProfilerId;  // copy from profiler.h to avoid an unnecessary include
 
 class Settings;
 class MMVManip;
@@ -58,6 +59,8 @@ class VoxelManipulator;
 struct BlockMakeData;
 class VoxelArea;
 class Map;
+class WorkerThreadPool;
+class NoiseCache;
 
 enum MapgenObject {
 	MGOBJ_VMANIP,
@@ -114,6 +117,18 @@ enum MapgenType {
 	MAPGEN_INVALID,
 };
 
+// Parts of chunk generation that are timed separately by the profiler
+enum MapgenStage {
+	MGSTAGE_NOISE,
+	MGSTAGE_BIOMES,
+	MGSTAGE_CAVES,
+	MGSTAGE_DUNGEONS,
+	MGSTAGE_ORES,
+	MGSTAGE_DECORATIONS,
+	MGSTAGE_LIGHTING,
+	MGSTAGE_MAX,
+};
+
 struct MapgenParams {
 	MapgenParams() = default;
 	virtual ~MapgenParams();
@@ -173,6 +188,15 @@ class Mapgen {
 	BiomeGen *biomegen = nullptr;
 	GenerateNotifier gennotify;
 
+	// Helpers to split up the chunk, shared with the other mapgens. May be null.
+	// See parallel_for() and parallel_run().
+	WorkerThreadPool *workers = nullptr;
+	// 2D noise maps shared with the other mapgens, may be null.
+	// See NoiseCache::perlinMap2D().
+	NoiseCache *noise_cache = nullptr;
+	// Profile expensive parts in more detail, e.g. each decoration
+	bool enable_mapgen_debug_info = false;
+
 	Mapgen() = default;
 	Mapgen(int mapgenid, MapgenParams *params, EmergeParams *emerge);
 	virtual ~Mapgen() = default;
@@ -243,6 +267,10 @@ class Mapgen {
 	static void getMapgenNames(std::vector<const char *> *mgnames, bool include_hidden);
 	static void setDefaultSettings(Settings *settings);
 
+	static const char *getStageName(MapgenStage stage);
+	// Id of the ScopeProfiler that sums up the time spent in stage
+	static ProfilerId getStageProfilerId(MapgenStage stage);
+
 private:
 	/**
 	 * Spread light to the node at the given position, add to queue if changed.
@@ -289,6 +317,9 @@ class MapgenBasic : public Mapgen {
 	virtual void generateDungeons(s16 max_stone_y);
 
 protected:
+	// One row of columns of generateBiomes()
+	void generateBiomesRow(s16 z);
+
 	EmergeParams *m_emerge;
 	BiomeManager *m_bmgr;
 
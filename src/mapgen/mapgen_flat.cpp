@@ -27,7 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "nodedef.h"
 #include "voxelalgorithms.h"
-//#include "profiler.h" // For TimeTaker
+#include "profiler.h"
 #include "settings.h" // For g_settings
 #include "emerge.h"
 #include "dungeongen.h"
@@ -35,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mg_biome.h"
 #include "mg_ore.h"
 #include "mg_decoration.h"
+#include "noisecache.h"
 #include "mapgen_flat.h"
 
 
@@ -289,6 +290,8 @@ void MapgenFlat::makeChunk(BlockMakeData *data)
 
 s16 MapgenFlat::generateTerrain()
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_NOISE));
+
 	MapNode n_air(CONTENT_AIR);
 	MapNode n_stone(c_stone);
 	MapNode n_water(c_water_source);
@@ -299,7 +302,7 @@ s16 MapgenFlat::generateTerrain()
 
 	bool use_noise = (spflags & MGFLAT_LAKES) || (spflags & MGFLAT_HILLS);
 	if (use_noise)
-		noise_terrain->perlinMap2D(node_min.X, node_min.Z);
+		NoiseCache::perlinMap2D(noise_cache, noise_terrain, node_min.X, node_min.Z);
 
 	for (s16 z = node_min.Z; z <= node_max.Z; z++)
 	for (s16 x = node_min.X; x <= node_max.X; x++, ni2d++) {
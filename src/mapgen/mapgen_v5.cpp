@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 
 #include "mapgen.h"
+#include <algorithm>
 #include "voxel.h"
 #include "noise.h"
 #include "mapblock.h"
@@ -27,14 +28,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "nodedef.h"
 #include "voxelalgorithms.h"
-//#include "profiler.h" // For TimeTaker
+#include "profiler.h"
 #include "settings.h" // For g_settings
 #include "emerge.h"
+#include "util/thread.h"
 #include "dungeongen.h"
 #include "cavegen.h"
 #include "mg_biome.h"
 #include "mg_ore.h"
 #include "mg_decoration.h"
+#include "noisecache.h"
 #include "mapgen_v5.h"
 
 
@@ -283,17 +286,25 @@ void MapgenV5::makeChunk(BlockMakeData *data)
 
 int MapgenV5::generateBaseTerrain()
 {
-	u32 index = 0;
-	u32 index2d = 0;
-	int stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_NOISE));
 
-	noise_factor->perlinMap2D(node_min.X, node_min.Z);
-	noise_height->perlinMap2D(node_min.X, node_min.Z);
-	noise_ground->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	parallel_run(workers, {
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_factor, node_min.X, node_min.Z); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_height, node_min.X, node_min.Z); },
+		[&] { noise_ground->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z); },
+	});
+
+	// Highest stone of each z slice, slices are placed at the same time
+	std::vector<int> slice_max_y(csize.Z, -MAX_MAP_GENERATION_LIMIT);
+
+	parallel_for(workers, csize.Z, [&] (size_t zr) {
+		s16 z = node_min.Z + zr;
+		int &stone_surface_max_y = slice_max_y[zr];
+		u32 index = zr * zstride_1u1d;
 
-	for (s16 z=node_min.Z; z<=node_max.Z; z++) {
 		for (s16 y=node_min.Y - 1; y<=node_max.Y + 1; y++) {
 			u32 vi = vm->m_area.index(node_min.X, y, z);
+			u32 index2d = zr * ystride;
 			for (s16 x=node_min.X; x<=node_max.X; x++, vi++, index++, index2d++) {
 				if (vm->m_data[vi].getContent() != CONTENT_IGNORE)
 					continue;
@@ -316,10 +327,8 @@ int MapgenV5::generateBaseTerrain()
 						stone_surface_max_y = y;
 				}
 			}
-			index2d -= ystride;
 		}
-		index2d += ystride;
-	}
+	});
 
-	return stone_surface_max_y;
+	return *std::max_element(slice_max_y.begin(), slice_max_y.end());
 }
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 
 #include "mapgen.h"
+#include <algorithm>
 #include <cmath>
 #include "voxel.h"
 #include "noise.h"
@@ -28,14 +29,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "nodedef.h"
 #include "voxelalgorithms.h"
-//#include "profiler.h" // For TimeTaker
+#include "profiler.h"
 #include "settings.h" // For g_settings
 #include "emerge.h"
+#include "util/thread.h"
 #include "dungeongen.h"
 #include "cavegen.h"
 #include "mg_biome.h"
 #include "mg_ore.h"
 #include "mg_decoration.h"
+#include "noisecache.h"
 #include "mapgen_v7.h"
 
 
@@ -482,39 +485,61 @@ bool MapgenV7::getFloatlandTerrainFromMap(int idx_xyz, float float_offset)
 
 int MapgenV7::generateTerrain()
 {
+	ScopeProfiler sp(g_profiler, getStageProfilerId(MGSTAGE_NOISE));
+
 	MapNode n_air(CONTENT_AIR);
 	MapNode n_stone(c_stone);
 	MapNode n_water(c_water_source);
 
-	//// Calculate noise for terrain generation
-	noise_terrain_persist->perlinMap2D(node_min.X, node_min.Z);
-	float *persistmap = noise_terrain_persist->result;
-
-	noise_terrain_base->perlinMap2D(node_min.X, node_min.Z, persistmap);
-	noise_terrain_alt->perlinMap2D(node_min.X, node_min.Z, persistmap);
-	noise_height_select->perlinMap2D(node_min.X, node_min.Z);
-
-	if (spflags & MGV7_MOUNTAINS) {
-		noise_mount_height->perlinMap2D(node_min.X, node_min.Z);
-		noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
-	}
-
 	//// Floatlands
 	// 'Generate floatlands in this mapchunk' bool for
 	// simplification of condition checks in y-loop.
-	bool gen_floatlands = false;
-	u8 cache_index = 0;
+	bool gen_floatlands = (spflags & MGV7_FLOATLANDS) &&
+		node_max.Y >= floatland_ymin && node_min.Y <= floatland_ymax;
 	// Y values where floatland tapering starts
 	s16 float_taper_ymax = floatland_ymax - floatland_taper;
 	s16 float_taper_ymin = floatland_ymin + floatland_taper;
 
-	if ((spflags & MGV7_FLOATLANDS) &&
-			node_max.Y >= floatland_ymin && node_min.Y <= floatland_ymax) {
-		gen_floatlands = true;
-		// Calculate noise for floatland generation
-		noise_floatland->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	// 'Generate rivers in this mapchunk' bool for
+	// simplification of condition checks in y-loop.
+	bool gen_rivers = (spflags & MGV7_RIDGES) && node_max.Y >= water_level - 16 &&
+		!gen_floatlands;
 
+	//// Calculate noise for terrain generation
+	NoiseCache::perlinMap2D(noise_cache, noise_terrain_persist, node_min.X, node_min.Z);
+
+	parallel_run(workers, {
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_terrain_base,
+			node_min.X, node_min.Z, noise_terrain_persist); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_terrain_alt,
+			node_min.X, node_min.Z, noise_terrain_persist); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_height_select, node_min.X, node_min.Z); },
+		[&] {
+			if (spflags & MGV7_MOUNTAINS)
+				NoiseCache::perlinMap2D(noise_cache, noise_mount_height, node_min.X, node_min.Z);
+		},
+		[&] {
+			if (spflags & MGV7_MOUNTAINS)
+				noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		},
+		[&] {
+			// Calculate noise for floatland generation
+			if (gen_floatlands)
+				noise_floatland->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		},
+		[&] {
+			if (gen_rivers)
+				noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		},
+		[&] {
+			if (gen_rivers)
+				NoiseCache::perlinMap2D(noise_cache, noise_ridge_uwater, node_min.X, node_min.Z);
+		},
+	});
+
+	if (gen_floatlands) {
 		// Cache floatland noise offset values, for floatland tapering
+		u8 cache_index = 0;
 		for (s16 y = node_min.Y - 1; y <= node_max.Y + 1; y++, cache_index++) {
 			float float_offset = 0.0f;
 			if (y > float_taper_ymax) {
@@ -528,63 +553,59 @@ int MapgenV7::generateTerrain()
 		}
 	}
 
-	// 'Generate rivers in this mapchunk' bool for
-	// simplification of condition checks in y-loop.
-	bool gen_rivers = (spflags & MGV7_RIDGES) && node_max.Y >= water_level - 16 &&
-		!gen_floatlands;
-	if (gen_rivers) {
-		noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
-		noise_ridge_uwater->perlinMap2D(node_min.X, node_min.Z);
-	}
-
 	//// Place nodes
 	const v3s16 &em = vm->m_area.getExtent();
-	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
-	u32 index2d = 0;
-
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
-	for (s16 x = node_min.X; x <= node_max.X; x++, index2d++) {
-		s16 surface_y = baseTerrainLevelFromMap(index2d);
-		if (surface_y > stone_surface_max_y)
-			stone_surface_max_y = surface_y;
-
-		cache_index = 0;
-		u32 vi = vm->m_area.index(x, node_min.Y - 1, z);
-		u32 index3d = (z - node_min.Z) * zstride_1u1d + (x - node_min.X);
-
-		for (s16 y = node_min.Y - 1; y <= node_max.Y + 1;
-				y++,
-				index3d += ystride,
-				VoxelArea::add_y(em, vi, 1),
-				cache_index++) {
-			if (vm->m_data[vi].getContent() != CONTENT_IGNORE)
-				continue;
-
-			bool is_river_channel = gen_rivers &&
-				getRiverChannelFromMap(index3d, index2d, y);
-			if (y <= surface_y && !is_river_channel) {
-				vm->m_data[vi] = n_stone; // Base terrain
-			} else if ((spflags & MGV7_MOUNTAINS) &&
-					getMountainTerrainFromMap(index3d, index2d, y) &&
-					!is_river_channel) {
-				vm->m_data[vi] = n_stone; // Mountain terrain
-				if (y > stone_surface_max_y)
-					stone_surface_max_y = y;
-			} else if (gen_floatlands &&
-					getFloatlandTerrainFromMap(index3d,
-					float_offset_cache[cache_index])) {
-				vm->m_data[vi] = n_stone; // Floatland terrain
-				if (y > stone_surface_max_y)
-					stone_surface_max_y = y;
-			} else if (y <= water_level) { // Surface water
-				vm->m_data[vi] = n_water;
-			} else if (gen_floatlands && y >= float_taper_ymax && y <= floatland_ywater) {
-				vm->m_data[vi] = n_water; // Water for solid floatland layer only
-			} else {
-				vm->m_data[vi] = n_air; // Air
+	// Highest stone of each row, rows are placed at the same time
+	std::vector<s16> row_max_y(csize.Z, -MAX_MAP_GENERATION_LIMIT);
+
+	parallel_for(workers, csize.Z, [&] (size_t zr) {
+		s16 z = node_min.Z + zr;
+		s16 &stone_surface_max_y = row_max_y[zr];
+		u32 index2d = zr * csize.X;
+
+		for (s16 x = node_min.X; x <= node_max.X; x++, index2d++) {
+			s16 surface_y = baseTerrainLevelFromMap(index2d);
+			if (surface_y > stone_surface_max_y)
+				stone_surface_max_y = surface_y;
+
+			u8 cache_index = 0;
+			u32 vi = vm->m_area.index(x, node_min.Y - 1, z);
+			u32 index3d = (z - node_min.Z) * zstride_1u1d + (x - node_min.X);
+
+			for (s16 y = node_min.Y - 1; y <= node_max.Y + 1;
+					y++,
+					index3d += ystride,
+					VoxelArea::add_y(em, vi, 1),
+					cache_index++) {
+				if (vm->m_data[vi].getContent() != CONTENT_IGNORE)
+					continue;
+
+				bool is_river_channel = gen_rivers &&
+					getRiverChannelFromMap(index3d, index2d, y);
+				if (y <= surface_y && !is_river_channel) {
+					vm->m_data[vi] = n_stone; // Base terrain
+				} else if ((spflags & MGV7_MOUNTAINS) &&
+						getMountainTerrainFromMap(index3d, index2d, y) &&
+						!is_river_channel) {
+					vm->m_data[vi] = n_stone; // Mountain terrain
+					if (y > stone_surface_max_y)
+						stone_surface_max_y = y;
+				} else if (gen_floatlands &&
+						getFloatlandTerrainFromMap(index3d,
+						float_offset_cache[cache_index])) {
+					vm->m_data[vi] = n_stone; // Floatland terrain
+					if (y > stone_surface_max_y)
+						stone_surface_max_y = y;
+				} else if (y <= water_level) { // Surface water
+					vm->m_data[vi] = n_water;
+				} else if (gen_floatlands && y >= float_taper_ymax && y <= floatland_ywater) {
+					vm->m_data[vi] = n_water; // Water for solid floatland layer only
+				} else {
+					vm->m_data[vi] = n_air; // Air
+				}
 			}
 		}
-	}
+	});
 
-	return stone_surface_max_y;
+	return *std::max_element(row_max_y.begin(), row_max_y.end());
 }
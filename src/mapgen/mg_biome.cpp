@@ -20,12 +20,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mg_biome.h"
 #include "mg_decoration.h"
+#include "noisecache.h"
 #include "emerge.h"
 #include "server.h"
 #include "nodedef.h"
 #include "map.h" //for MMVManip
 #include "util/numeric.h"
+#include "util/thread.h"
 #include "porting.h"
+#include "profiler.h"
 #include "settings.h"
 
 
@@ -33,10 +36,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 
 BiomeManager::BiomeManager(Server *server) :
-	ObjDefManager(server, OBJDEF_BIOME)
+	BiomeManager(static_cast<IGameDef *>(server))
 {
 	m_server = server;
+}
+
 
+BiomeManager::BiomeManager(IGameDef *gamedef) :
+	ObjDefManager(gamedef, OBJDEF_BIOME)
+{
 	// Create default biome to be used in case none exist
 	Biome *b = new Biome;
 
@@ -75,6 +83,7 @@ BiomeManager::BiomeManager(Server *server) :
 
 void BiomeManager::clear()
 {
+	assert(m_server);
 	EmergeManager *emerge = m_server->getEmergeManager();
 
 	// Remove all dangling references in Decorations
@@ -184,12 +193,16 @@ Biome *BiomeGenOriginal::calcBiomeAtPoint(v3s16 pos) const
 
 void BiomeGenOriginal::calcBiomeNoise(v3s16 pmin)
 {
+	ScopeProfiler sp(g_profiler, Mapgen::getStageProfilerId(MGSTAGE_BIOMES));
+
 	m_pmin = pmin;
 
-	noise_heat->perlinMap2D(pmin.X, pmin.Z);
-	noise_humidity->perlinMap2D(pmin.X, pmin.Z);
-	noise_heat_blend->perlinMap2D(pmin.X, pmin.Z);
-	noise_humidity_blend->perlinMap2D(pmin.X, pmin.Z);
+	parallel_run(workers, {
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_heat, pmin.X, pmin.Z); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_humidity, pmin.X, pmin.Z); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_heat_blend, pmin.X, pmin.Z); },
+		[&] { NoiseCache::perlinMap2D(noise_cache, noise_humidity_blend, pmin.X, pmin.Z); },
+	});
 
 	for (s32 i = 0; i < m_csize.X * m_csize.Z; i++) {
 		noise_heat->result[i]     += noise_heat_blend->result[i];
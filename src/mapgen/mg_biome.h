@@ -27,6 +27,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class Server;
 class Settings;
 class BiomeManager;
+class WorkerThreadPool;
+class NoiseCache;
 
 ////
 //// Biome
@@ -131,6 +133,11 @@ class BiomeGen {
 	// Result of calcBiomes bulk computation.
 	biome_t *biomemap = nullptr;
 
+	// Used to compute noise in parallel if not null
+	WorkerThreadPool *workers = nullptr;
+	// Used to reuse noise of other chunks if not null
+	NoiseCache *noise_cache = nullptr;
+
 protected:
 	BiomeManager *m_bmgr = nullptr;
 	v3s16 m_pmin;
@@ -207,6 +214,8 @@ class BiomeGenOriginal : public BiomeGen {
 class BiomeManager : public ObjDefManager {
 public:
 	BiomeManager(Server *server);
+	// Without a server, e.g. for benchmarks. clear() can not be used.
+	BiomeManager(IGameDef *gamedef);
 	virtual ~BiomeManager() = default;
 
 	BiomeManager *clone() const;
@@ -247,6 +256,6 @@ class BiomeManager : public ObjDefManager {
 private:
 	BiomeManager() {};
 
-	Server *m_server;
+	Server *m_server = nullptr;
 
 };
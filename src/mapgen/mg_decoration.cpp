@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "map.h"
 #include "log.h"
+#include "profiler.h"
 #include "util/numeric.h"
 #include <algorithm>
 #include <vector>
@@ -50,9 +51,92 @@ DecorationManager::DecorationManager(IGameDef *gamedef) :
 }
 
 
+void DecorationManager::clear()
+{
+	ObjDefManager::clear();
+	m_index_valid = false;
+}
+
+
+u32 DecorationManager::addRaw(ObjDef *obj)
+{
+	m_index_valid = false;
+	return ObjDefManager::addRaw(obj);
+}
+
+
+ObjDef *DecorationManager::setRaw(u32 index, ObjDef *obj)
+{
+	m_index_valid = false;
+	return ObjDefManager::setRaw(index, obj);
+}
+
+
+void DecorationManager::updateBiomeIndex()
+{
+	m_biome_decos.clear();
+	m_any_biome_decos.clear();
+	m_profiler_ids.clear();
+
+	for (size_t i = 0; i != m_objects.size(); i++) {
+		Decoration *deco = (Decoration *)m_objects[i];
+		if (!deco)
+			continue;
+
+		if (deco->biomes.empty()) {
+			m_any_biome_decos.push_back(i);
+			continue;
+		}
+
+		for (biome_t biome : deco->biomes) {
+			if (biome >= m_biome_decos.size())
+				m_biome_decos.resize(biome + 1);
+			m_biome_decos[biome].push_back(i);
+		}
+	}
+
+	m_index_valid = true;
+}
+
+
 size_t DecorationManager::placeAllDecos(Mapgen *mg, u32 blockseed,
 	v3s16 nmin, v3s16 nmax)
 {
+	ScopeProfiler sp(g_profiler, Mapgen::getStageProfilerId(MGSTAGE_DECORATIONS));
+
+	if (!m_index_valid)
+		updateBiomeIndex();
+
+	// Decorations limited to biomes that are not in the area can't be placed.
+	// Without a biomemap placeDeco() ignores the biomes, so all are tried.
+	std::vector<bool> selected(m_objects.size(), !mg->biomemap);
+	if (mg->biomemap) {
+		for (u32 i : m_any_biome_decos)
+			selected[i] = true;
+
+		std::vector<bool> biome_seen(m_biome_decos.size(), false);
+		size_t area = (size_t)(nmax.X - nmin.X + 1) * (nmax.Z - nmin.Z + 1);
+		for (size_t i = 0; i != area; i++) {
+			biome_t biome = mg->biomemap[i];
+			if (biome >= biome_seen.size() || biome_seen[biome])
+				continue;
+
+			biome_seen[biome] = true;
+			for (u32 deco_index : m_biome_decos[biome])
+				selected[deco_index] = true;
+		}
+	}
+
+	if (mg->enable_mapgen_debug_info && m_profiler_ids.empty()) {
+		for (size_t i = 0; i != m_objects.size(); i++) {
+			const ObjDef *deco = m_objects[i];
+			std::string name = (deco && !deco->name.empty()) ?
+				deco->name : "#" + std::to_string(i);
+			m_profiler_ids.push_back(ScopeProfiler::getId(
+				"Mapgen: decoration " + name + " (sum)"));
+		}
+	}
+
 	size_t nplaced = 0;
 
 	for (size_t i = 0; i != m_objects.size(); i++) {
@@ -60,8 +144,19 @@ size_t DecorationManager::placeAllDecos(Mapgen *mg, u32 blockseed,
 		if (!deco)
 			continue;
 
-		nplaced += deco->placeDeco(mg, blockseed, nmin, nmax);
-		blockseed++;
+		// The seed of each decoration must not depend on which are skipped
+		u32 deco_seed = blockseed++;
+
+		// All positions tried by placeDeco() are inside of the area
+		if (!selected[i] || deco->y_max < nmin.Y || deco->y_min > nmax.Y)
+			continue;
+
+		if (mg->enable_mapgen_debug_info) {
+			ScopeProfiler sp_deco(g_profiler, m_profiler_ids[i]);
+			nplaced += deco->placeDeco(mg, deco_seed, nmin, nmax);
+		} else {
+			nplaced += deco->placeDeco(mg, deco_seed, nmin, nmax);
+		}
 	}
 
 	return nplaced;
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 
 typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
+typedef u32 ProfilerId;  // copy from profiler.h to avoid an unnecessary include
 
 class Mapgen;
 class MMVManip;
@@ -145,8 +146,25 @@ class DecorationManager : public ObjDefManager {
 		}
 	}
 
+	// Decorations are invalidated by these, see updateBiomeIndex()
+	void clear();
+	u32 addRaw(ObjDef *obj);
+	ObjDef *setRaw(u32 index, ObjDef *obj);
+
+	// Places the decorations that can appear in the biomes and the
+	// height range of the area, skipping all others
 	size_t placeAllDecos(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax);
 
 private:
 	DecorationManager() {};
+
+	// Sorts the decorations by the biomes they are limited to
+	void updateBiomeIndex();
+
+	bool m_index_valid = false;
+	// Indexes of the decorations for each biome, and of those for all biomes
+	std::vector<std::vector<u32>> m_biome_decos;
+	std::vector<u32> m_any_biome_decos;
+	// Per-decoration timings, only used with enable_mapgen_debug_info
+	std::vector<ProfilerId> m_profiler_ids;
 };
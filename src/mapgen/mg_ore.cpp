@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "noise.h"
 #include "map.h"
 #include "log.h"
+#include "profiler.h"
 #include "util/numeric.h"
 #include <cmath>
 #include <algorithm>
@@ -47,6 +48,8 @@ OreManager::OreManager(IGameDef *gamedef) :
 
 size_t OreManager::placeAllOres(Mapgen *mg, u32 blockseed, v3s16 nmin, v3s16 nmax)
 {
+	ScopeProfiler sp(g_profiler, Mapgen::getStageProfilerId(MGSTAGE_ORES));
+
 	size_t nplaced = 0;
 
 	for (size_t i = 0; i != m_objects.size(); i++) {
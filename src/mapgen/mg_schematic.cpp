@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include <fstream>
 #include <typeinfo>
 #include "mg_schematic.h"
@@ -43,6 +44,12 @@ SchematicManager::SchematicManager(Server *server) :
 }
 
 
+SchematicManager::SchematicManager(IGameDef *gamedef) :
+	ObjDefManager(gamedef, OBJDEF_SCHEMATIC)
+{
+}
+
+
 SchematicManager *SchematicManager::clone() const
 {
 	auto mgr = new SchematicManager();
@@ -54,6 +61,7 @@ SchematicManager *SchematicManager::clone() const
 
 void SchematicManager::clear()
 {
+	assert(m_server);
 	EmergeManager *emerge = m_server->getEmergeManager();
 
 	// Remove all dangling references in Decorations
@@ -104,6 +112,7 @@ ObjDef *Schematic::clone() const
 
 void Schematic::resolveNodeNames()
 {
+	clearCompiled();
 	c_nodes.clear();
 	getIdsFromNrBacklog(&c_nodes, true, CONTENT_AIR);
 
@@ -126,6 +135,71 @@ void Schematic::blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_pla
 	assert(schemdata && slice_probs);
 	sanity_check(m_ndef != NULL);
 
+	const Compiled &compiled = getCompiled(rot);
+	const VoxelArea &area = vm->m_area;
+
+	s16 y_map = p.Y;
+	for (s16 y = 0; y != size.Y; y++) {
+		if ((slice_probs[y] != MTSCHEM_PROB_ALWAYS) &&
+			(slice_probs[y] <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
+			continue;
+
+		if (y_map < area.MinEdge.Y || y_map > area.MaxEdge.Y) {
+			y_map++;
+			continue;
+		}
+
+		for (u32 s = compiled.slice_spans[y]; s != compiled.slice_spans[y + 1]; s++) {
+			const Compiled::Span &span = compiled.spans[s];
+			s32 z_map = p.Z + span.z;
+			if (z_map < area.MinEdge.Z || z_map > area.MaxEdge.Z)
+				continue;
+
+			// Clip the span to the voxelmanip
+			s32 x_map = p.X + span.x;
+			s32 begin = std::max(0, area.MinEdge.X - x_map);
+			s32 end = std::min<s32>(span.count, area.MaxEdge.X - x_map + 1);
+			if (begin >= end)
+				continue;
+
+			const MapNode *nodes = &compiled.nodes[span.first];
+			const u8 *param1s = &compiled.param1s[span.first];
+			u32 vi = area.index(x_map + begin, y_map, z_map);
+
+			if (span.always && (force_place || span.forced)) {
+				std::copy(nodes + begin, nodes + end, &vm->m_data[vi]);
+				continue;
+			}
+
+			for (s32 i = begin; i != end; i++, vi++) {
+				if (!force_place && !(param1s[i] & MTSCHEM_FORCE_PLACE)) {
+					content_t c = vm->m_data[vi].getContent();
+					if (c != CONTENT_AIR && c != CONTENT_IGNORE)
+						continue;
+				}
+
+				u8 placement_prob = param1s[i] & MTSCHEM_PROB_MASK;
+				if ((placement_prob != MTSCHEM_PROB_ALWAYS) &&
+					(placement_prob <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
+					continue;
+
+				vm->m_data[vi] = nodes[i];
+			}
+		}
+		y_map++;
+	}
+}
+
+
+const Schematic::Compiled &Schematic::getCompiled(Rotation rot)
+{
+	assert(rot < ROTATE_RAND);
+	std::unique_ptr<Compiled> &compiled = m_compiled[rot];
+	if (compiled)
+		return *compiled;
+
+	compiled = std::make_unique<Compiled>();
+
 	int xstride = 1;
 	int ystride = size.X;
 	int zstride = size.X * size.Y;
@@ -159,48 +233,50 @@ void Schematic::blitToVManip(MMVManip *vm, v3s16 p, Rotation rot, bool force_pla
 			i_step_z = zstride;
 	}
 
-	s16 y_map = p.Y;
 	for (s16 y = 0; y != sy; y++) {
-		if ((slice_probs[y] != MTSCHEM_PROB_ALWAYS) &&
-			(slice_probs[y] <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
-			continue;
+		compiled->slice_spans.push_back(compiled->spans.size());
 
 		for (s16 z = 0; z != sz; z++) {
+			bool in_span = false;
 			u32 i = z * i_step_z + y * ystride + i_start;
 			for (s16 x = 0; x != sx; x++, i += i_step_x) {
-				v3s16 pos(p.X + x, y_map, p.Z + z);
-				if (!vm->m_area.contains(pos))
-					continue;
-
-				if (schemdata[i].getContent() == CONTENT_IGNORE)
+				u8 placement_prob = schemdata[i].param1 & MTSCHEM_PROB_MASK;
+				if (schemdata[i].getContent() == CONTENT_IGNORE ||
+						placement_prob == MTSCHEM_PROB_NEVER) {
+					in_span = false;
 					continue;
-
-				u8 placement_prob     = schemdata[i].param1 & MTSCHEM_PROB_MASK;
-				bool force_place_node = schemdata[i].param1 & MTSCHEM_FORCE_PLACE;
-
-				if (placement_prob == MTSCHEM_PROB_NEVER)
-					continue;
-
-				u32 vi = vm->m_area.index(pos);
-				if (!force_place && !force_place_node) {
-					content_t c = vm->m_data[vi].getContent();
-					if (c != CONTENT_AIR && c != CONTENT_IGNORE)
-						continue;
 				}
 
-				if ((placement_prob != MTSCHEM_PROB_ALWAYS) &&
-					(placement_prob <= myrand_range(1, MTSCHEM_PROB_ALWAYS)))
-					continue;
+				if (!in_span) {
+					compiled->spans.push_back({x, z, 0,
+						(u32)compiled->nodes.size(), true, true});
+					in_span = true;
+				}
 
-				vm->m_data[vi] = schemdata[i];
-				vm->m_data[vi].param1 = 0;
+				Compiled::Span &span = compiled->spans.back();
+				span.count++;
+				span.always &= placement_prob == MTSCHEM_PROB_ALWAYS;
+				span.forced &= (schemdata[i].param1 & MTSCHEM_FORCE_PLACE) != 0;
 
+				MapNode n = schemdata[i];
+				n.param1 = 0;
 				if (rot)
-					vm->m_data[vi].rotateAlongYAxis(m_ndef, rot);
+					n.rotateAlongYAxis(m_ndef, rot);
+				compiled->nodes.push_back(n);
+				compiled->param1s.push_back(schemdata[i].param1);
 			}
 		}
-		y_map++;
 	}
+	compiled->slice_spans.push_back(compiled->spans.size());
+
+	return *compiled;
+}
+
+
+void Schematic::clearCompiled()
+{
+	for (auto &compiled : m_compiled)
+		compiled.reset();
 }
 
 
@@ -334,6 +410,7 @@ bool Schematic::deserializeFromMts(std::istream *is)
 	//// Read node data
 	size_t nodecount = size.X * size.Y * size.Z;
 
+	clearCompiled();
 	delete []schemdata;
 	schemdata = new MapNode[nodecount];
 
@@ -555,6 +632,7 @@ bool Schematic::getSchematicFromMap(Map *map, v3s16 p1, v3s16 p2)
 	vm->initialEmerge(bp1, bp2);
 
 	size = p2 - p1 + 1;
+	clearCompiled();
 
 	slice_probs = new u8[size.Y];
 	for (s16 y = 0; y != size.Y; y++)
@@ -585,6 +663,8 @@ void Schematic::applyProbabilities(v3s16 p0,
 	std::vector<std::pair<v3s16, u8> > *plist,
 	std::vector<std::pair<s16, u8> > *splist)
 {
+	clearCompiled();
+
 	for (size_t i = 0; i != plist->size(); i++) {
 		v3s16 p = (*plist)[i].first - p0;
 		int index = p.Z * (size.Y * size.X) + p.Y * size.X + p.X;
@@ -613,6 +693,7 @@ void Schematic::condenseContentIds()
 
 	// Reset node resolve fields
 	NodeResolver::reset();
+	clearCompiled();
 
 	size_t nodecount = size.X * size.Y * size.Z;
 	for (size_t i = 0; i != nodecount; i++) {
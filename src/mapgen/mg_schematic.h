@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <map>
+#include <memory>
+#include <vector>
 #include "mg_decoration.h"
 #include "util/string.h"
 
@@ -125,13 +127,42 @@ class Schematic : public ObjDef, public NodeResolver {
 	u8 *slice_probs = nullptr;
 
 private:
+	/*
+		The schematic rotated once and prepared for blitToVManip(): nodes
+		that are never placed are left out, and those in between are
+		grouped into spans along X that are copied together.
+	*/
+	struct Compiled {
+		struct Span {
+			s16 x, z; // position in the rotated schematic
+			u16 count;
+			u32 first; // index in nodes and param1s
+			bool always; // no node has a placement probability
+			bool forced; // all nodes have the force placement bit
+		};
+
+		std::vector<MapNode> nodes; // rotated, param1 cleared
+		std::vector<u8> param1s; // probability and force placement bit
+		std::vector<Span> spans; // ordered by y, z and x
+		std::vector<u32> slice_spans; // first span of each y slice and the end
+	};
+
 	// Counterpart to the node resolver: Condense content_t to a sequential "m_nodenames" list
 	void condenseContentIds();
+
+	const Compiled &getCompiled(Rotation rot);
+	// Must be called when schemdata changes
+	void clearCompiled();
+
+	// Built when a rotation is first placed
+	std::unique_ptr<Compiled> m_compiled[ROTATE_RAND];
 };
 
 class SchematicManager : public ObjDefManager {
 public:
 	SchematicManager(Server *server);
+	// Without a server, e.g. for benchmarks. clear() can not be used.
+	SchematicManager(IGameDef *gamedef);
 	virtual ~SchematicManager() = default;
 
 	SchematicManager *clone() const;
@@ -151,6 +182,6 @@ class SchematicManager : public ObjDefManager {
 private:
 	SchematicManager() {};
 
-	Server *m_server;
+	Server *m_server = nullptr;
 };
 
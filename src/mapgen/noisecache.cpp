@@ -0,0 +1,143 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noisecache.h"
+#include <cstring>
+#include "noise.h"
+#include "threading/mutex_auto_lock.h"
+
+static inline u32 float_bits(float f)
+{
+	u32 bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static size_t add_params(u32 *out, const NoiseParams &np)
+{
+	out[0] = float_bits(np.offset);
+	out[1] = float_bits(np.scale);
+	out[2] = float_bits(np.spread.X);
+	out[3] = float_bits(np.spread.Y);
+	out[4] = float_bits(np.spread.Z);
+	out[5] = (u32)np.seed;
+	out[6] = np.octaves;
+	out[7] = float_bits(np.persist);
+	out[8] = float_bits(np.lacunarity);
+	out[9] = np.flags;
+	return 10;
+}
+
+NoiseCache::NoiseCache(size_t max_maps, MetricsBackend *mb) :
+	m_max_maps(max_maps)
+{
+	m_hits = mb->addCounter("minetest_mapgen_noise_cache_hits",
+		"Number of 2D mapgen noise maps taken from the cache");
+	m_misses = mb->addCounter("minetest_mapgen_noise_cache_misses",
+		"Number of 2D mapgen noise maps that had to be computed");
+}
+
+float *NoiseCache::perlinMap2D(NoiseCache *cache, Noise *noise, float x, float y,
+		const Noise *persist)
+{
+	float *persistence_map = persist ? persist->result : nullptr;
+	if (!cache)
+		return noise->perlinMap2D(x, y, persistence_map);
+
+	const size_t count = noise->sx * noise->sy;
+	const Key key = makeKey(noise, x, y, persist);
+	if (cache->get(key, noise->result, count))
+		return noise->result;
+
+	// Computed outside of the lock, two threads may race to add the same map
+	noise->perlinMap2D(x, y, persistence_map);
+	cache->put(key, noise->result, count);
+	return noise->result;
+}
+
+size_t NoiseCache::size()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_entries.size();
+}
+
+NoiseCache::Key NoiseCache::makeKey(const Noise *noise, float x, float y,
+		const Noise *persist)
+{
+	Key key{};
+	size_t i = add_params(&key[0], noise->np);
+	key[i++] = (u32)noise->seed;
+	key[i++] = float_bits(x);
+	key[i++] = float_bits(y);
+	key[i++] = noise->sx;
+	key[i++] = noise->sy;
+	if (persist) {
+		// np.persist is unused when there is a persistence map
+		key[7] = 0;
+		key[i++] = 1;
+		i += add_params(&key[i], persist->np);
+		key[i++] = (u32)persist->seed;
+	}
+	return key;
+}
+
+size_t NoiseCache::KeyHash::operator()(const Key &key) const
+{
+	// FNV-1a over the words
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (u32 word : key) {
+		hash ^= word;
+		hash *= 0x100000001b3ULL;
+	}
+	return (size_t)hash;
+}
+
+bool NoiseCache::get(const Key &key, float *result, size_t count)
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_index.find(key);
+		if (it != m_index.end() && it->second->map.size() == count) {
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			memcpy(result, it->second->map.data(), count * sizeof(float));
+			m_hits->increment();
+			return true;
+		}
+	}
+	m_misses->increment();
+	return false;
+}
+
+void NoiseCache::put(const Key &key, const float *map, size_t count)
+{
+	if (m_max_maps == 0)
+		return;
+
+	MutexAutoLock lock(m_mutex);
+	if (m_index.find(key) != m_index.end())
+		return;
+
+	m_entries.push_front(Entry{key, std::vector<float>(map, map + count)});
+	m_index.emplace(key, m_entries.begin());
+
+	while (m_entries.size() > m_max_maps) {
+		m_index.erase(m_entries.back().key);
+		m_entries.pop_back();
+	}
+}
@@ -0,0 +1,84 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <array>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+#include "util/metricsbackend.h"
+
+class Noise;
+struct NoiseParams;
+
+/*
+	Recently computed 2D noise maps, shared by the mapgens of all emerge
+	threads. Chunks stacked on top of each other use the same 2D maps, so
+	in tall worlds most of them only need to be computed once per column.
+
+	Entries are keyed by everything the result depends on and the least
+	recently used one is dropped when the cache is full. Thread-safe.
+*/
+class NoiseCache
+{
+public:
+	NoiseCache(size_t max_maps, MetricsBackend *mb);
+	DISABLE_CLASS_COPY(NoiseCache);
+
+	// Same as noise->perlinMap2D(x, y, persist->result), but reuses a cached
+	// result if there is one. cache may be null. persist must have been
+	// computed at the same position with the same size.
+	static float *perlinMap2D(NoiseCache *cache, Noise *noise, float x, float y,
+			const Noise *persist = nullptr);
+
+	size_t size();
+
+private:
+	typedef std::array<u32, 27> Key;
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		std::vector<float> map;
+	};
+
+	static Key makeKey(const Noise *noise, float x, float y, const Noise *persist);
+
+	bool get(const Key &key, float *result, size_t count);
+	void put(const Key &key, const float *map, size_t count);
+
+	const size_t m_max_maps;
+
+	std::mutex m_mutex;
+	// Most recently used first
+	std::list<Entry> m_entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+	MetricCounterPtr m_hits;
+	MetricCounterPtr m_misses;
+};
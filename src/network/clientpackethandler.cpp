@@ -266,6 +266,30 @@ void Client::handleCommand_AddNode(NetworkPacket* pkt)
 	addNode(p, n, remove_metadata);
 }
 
+void Client::handleCommand_NodeChanges(NetworkPacket *pkt)
+{
+	u16 count;
+	*pkt >> count;
+
+	// Update the meshes once, not after every node
+	std::map<v3s16, MapBlock*> modified_blocks;
+	for (u16 i = 0; i < count; i++) {
+		v3s16 p;
+		MapNode n;
+		u8 keep_metadata;
+		*pkt >> p >> n.param0 >> n.param1 >> n.param2 >> keep_metadata;
+
+		try {
+			m_env.getMap().addNodeAndUpdate(p, n, modified_blocks,
+				!keep_metadata);
+		} catch (InvalidPositionException &e) {
+		}
+	}
+
+	for (const auto &modified_block : modified_blocks)
+		addUpdateMeshTaskWithEdge(modified_block.first, false, true);
+}
+
 void Client::handleCommand_NodemetaChanged(NetworkPacket *pkt)
 {
 	if (pkt->getSize() < 1)
@@ -0,0 +1,101 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "congestioncontrol.h"
+#include "util/numeric.h"
+#include <cmath>
+
+namespace con
+{
+
+// Assumed round trip time before the first measurement
+#define DEFAULT_RTT 0.1f
+
+CongestionControl::CongestionControl(float initial_window, float min_window,
+		float max_window) :
+	m_window(initial_window),
+	m_min_window(min_window),
+	m_max_window(max_window),
+	m_ssthresh(max_window)
+{
+}
+
+void CongestionControl::setWindow(float window)
+{
+	m_window = rangelim(window, m_min_window, m_max_window);
+}
+
+void CongestionControl::onAck(u32 packets, u64 now_ms, float rtt)
+{
+	if (inSlowStart()) {
+		setWindow(m_window + packets);
+		return;
+	}
+
+	// Where the cubic curve will be one round trip from now
+	float t = (now_ms - m_epoch_start_ms) / 1000.0f + MYMAX(rtt, 0.0f);
+	float target = C * std::pow(t - m_k, 3.0f) + m_w_max;
+
+	if (target > m_window)
+		setWindow(m_window + (target - m_window) / m_window * packets);
+	else
+		setWindow(m_window + 0.01f * packets / m_window);
+}
+
+void CongestionControl::onLoss(u64 now_ms, float rtt)
+{
+	if (rtt <= 0.0f)
+		rtt = DEFAULT_RTT;
+	if (m_had_loss && now_ms < m_last_loss_ms + (u64)(rtt * 1000.0f))
+		return;
+
+	m_had_loss = true;
+	m_last_loss_ms = now_ms;
+	m_epoch_start_ms = now_ms;
+
+	m_w_max = m_window;
+	setWindow(m_window * BETA);
+	m_ssthresh = m_window;
+	m_k = std::cbrt(m_w_max * (1.0f - BETA) / C);
+}
+
+bool CongestionControl::pace(u64 now_ms, float rtt)
+{
+	if (rtt <= 0.0f)
+		return true;
+
+	// Packets per second to send one window per round trip
+	float rate = m_window / rtt;
+	float max_tokens = MYMAX(rate * MAX_BURST_TIME, 1.0f);
+
+	if (m_last_pace_ms == 0)
+		m_pacing_tokens = max_tokens;
+	else if (now_ms > m_last_pace_ms)
+		m_pacing_tokens += rate * (now_ms - m_last_pace_ms) / 1000.0f;
+	m_pacing_tokens = MYMIN(m_pacing_tokens, max_tokens);
+	m_last_pace_ms = now_ms;
+
+	if (m_pacing_tokens < 1.0f)
+		return false;
+
+	m_pacing_tokens -= 1.0f;
+	return true;
+}
+
+}
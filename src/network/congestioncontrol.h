@@ -0,0 +1,83 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+
+namespace con
+{
+
+/*
+	CUBIC congestion control (RFC 8312) for the reliable packets of a
+	channel, counted in packets instead of bytes.
+
+	The window doubles every round trip until the first loss. A loss
+	shrinks it to BETA times its size; it then grows back along a cubic
+	curve that is flat around the size at which the loss happened.
+
+	Packets are paced: no more than one window is sent per round trip,
+	in bursts no longer than the send thread sleeps.
+
+	Not thread-safe, Channel locks around it.
+*/
+class CongestionControl
+{
+public:
+	CongestionControl(float initial_window, float min_window, float max_window);
+
+	// packets were acknowledged. rtt is the smoothed round trip time in
+	// seconds, or negative if not known yet.
+	void onAck(u32 packets, u64 now_ms, float rtt);
+	// Packets were lost. Only the first loss in a round trip counts, the
+	// others are usually from the same congestion event.
+	void onLoss(u64 now_ms, float rtt);
+
+	float getWindow() const { return m_window; }
+	bool inSlowStart() const { return m_window < m_ssthresh; }
+
+	// Returns true if another packet may be sent now
+	bool pace(u64 now_ms, float rtt);
+
+	static constexpr float C = 0.4f;
+	static constexpr float BETA = 0.7f;
+	// Longest burst, should be about the send thread's sleep time
+	static constexpr float MAX_BURST_TIME = 0.05f;
+
+private:
+	void setWindow(float window);
+
+	float m_window;
+	float m_min_window;
+	float m_max_window;
+	float m_ssthresh;
+
+	// Window before the last loss
+	float m_w_max = 0.0f;
+	// Time from the last loss until the window is back at m_w_max
+	float m_k = 0.0f;
+	u64 m_epoch_start_ms = 0;
+	u64 m_last_loss_ms = 0;
+	bool m_had_loss = false;
+
+	float m_pacing_tokens = 0.0f;
+	u64 m_last_pace_ms = 0;
+};
+
+}
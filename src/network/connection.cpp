@@ -59,39 +59,36 @@ u16 BufferedPacket::getSeqnum() const
 	return readU16(&data[BASE_HEADER_SIZE + 1]);
 }
 
-BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
+BufferedPacketPtr makePacket(Address &address, PacketBuffer data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 packet_size = data.getSize() + BASE_HEADER_SIZE;
+	u8 *header = data.prepend(BASE_HEADER_SIZE);
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
 
-	auto p = std::make_shared<BufferedPacket>(packet_size);
+	auto p = std::make_shared<BufferedPacket>(std::move(data));
 	p->address = address;
 
-	writeU32(&p->data[0], protocol_id);
-	writeU16(&p->data[4], sender_peer_id);
-	writeU8(&p->data[6], channel);
-
-	memcpy(&p->data[BASE_HEADER_SIZE], *data, data.getSize());
-
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
+BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	return makePacket(address, PacketBuffer(*data, data.getSize()),
+			protocol_id, sender_peer_id, channel);
+}
 
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
+PacketBuffer makeOriginalPacket(PacketBuffer data)
+{
+	writeU8(data.prepend(ORIGINAL_HEADER_SIZE), PACKET_TYPE_ORIGINAL);
+	return data;
 }
 
 // Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+void makeSplitPacket(const PacketBuffer &data, u32 chunksize_max, u16 seqnum,
+		std::list<PacketBuffer> *chunks)
 {
 	// Chunk packets, containing the TYPE_SPLIT header
 	u32 chunk_header_size = 7;
@@ -106,17 +103,16 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 			end = data.getSize() - 1;
 
 		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
 
-		SharedBuffer<u8> chunk(packet_size);
+		PacketBuffer chunk(&data[start], payload_size);
+		u8 *header = chunk.prepend(chunk_header_size);
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
+		writeU8(&header[0], PACKET_TYPE_SPLIT);
+		writeU16(&header[1], seqnum);
 		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+		writeU16(&header[5], chunk_num);
 
-		chunks->push_back(chunk);
+		chunks->push_back(std::move(chunk));
 		chunk_count++;
 
 		start = end + 1;
@@ -124,18 +120,16 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 	}
 	while (end != data.getSize() - 1);
 
-	for (SharedBuffer<u8> &chunk : *chunks) {
+	for (PacketBuffer &chunk : *chunks) {
 		// Write chunk_count
 		writeU16(&(chunk[3]), chunk_count);
 	}
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+void makeAutoSplitPacket(const PacketBuffer &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketBuffer> *list)
 {
-	u32 original_header_size = 1;
-
-	if (data.getSize() + original_header_size > chunksize_max) {
+	if (data.getSize() + ORIGINAL_HEADER_SIZE > chunksize_max) {
 		makeSplitPacket(data, chunksize_max, split_seqnum, list);
 		split_seqnum++;
 		return;
@@ -144,18 +138,29 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 	list->push_back(makeOriginalPacket(data));
 }
 
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
+PacketBuffer makeReliablePacket(PacketBuffer data, u16 seqnum)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	u8 *header = data.prepend(RELIABLE_HEADER_SIZE);
+	writeU8(&header[0], PACKET_TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
 
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
+	return data;
+}
 
-	memcpy(&b[header_size], *data, data.getSize());
+PacketBuffer makeSelectiveAck(u16 next_expected, const SeqnumRanges &ranges)
+{
+	const u8 count = MYMIN(ranges.size(), (size_t)SACK_MAX_RANGES);
 
-	return b;
+	PacketBuffer data(5 + 4 * count);
+	writeU8(&data[0], PACKET_TYPE_CONTROL);
+	writeU8(&data[1], CONTROLTYPE_SACK);
+	writeU16(&data[2], next_expected);
+	writeU8(&data[4], count);
+	for (u8 i = 0; i < count; i++) {
+		writeU16(&data[5 + 4 * i], ranges[i].first);
+		writeU16(&data[7 + 4 * i], ranges[i].second);
+	}
+	return data;
 }
 
 /*
@@ -339,6 +344,73 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
 }
 
+SeqnumRanges ReliablePacketBuffer::getSeqnumRanges(u32 max_ranges)
+{
+	MutexAutoLock listlock(m_list_mutex);
+	SeqnumRanges ranges;
+	for (auto &packet : m_list) {
+		const u16 seqnum = packet->getSeqnum();
+		if (!ranges.empty() && seqnum == (u16)(ranges.back().second + 1)) {
+			ranges.back().second = seqnum;
+			continue;
+		}
+		if (ranges.size() >= max_ranges)
+			break;
+		ranges.emplace_back(seqnum, seqnum);
+	}
+	return ranges;
+}
+
+std::vector<BufferedPacketPtr> ReliablePacketBuffer::popAcked(u16 next_expected,
+		const SeqnumRanges &ranges)
+{
+	MutexAutoLock listlock(m_list_mutex);
+	std::vector<BufferedPacketPtr> acked;
+	for (auto it = m_list.begin(); it != m_list.end();) {
+		const u16 seqnum = (*it)->getSeqnum();
+		bool is_acked = seqnum_higher(next_expected, seqnum);
+		for (size_t i = 0; !is_acked && i < ranges.size(); i++) {
+			const u16 first = ranges[i].first;
+			is_acked = (u16)(seqnum - first) <= (u16)(ranges[i].second - first);
+		}
+
+		if (is_acked) {
+			acked.push_back(*it);
+			it = m_list.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	if (m_list.empty()) {
+		m_oldest_non_answered_ack = 0;
+	} else {
+		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	}
+	return acked;
+}
+
+u32 ReliablePacketBuffer::markLost(u16 highest_acked, u16 threshold)
+{
+	MutexAutoLock listlock(m_list_mutex);
+	u32 count = 0;
+	// The list is sorted, so the packets after the first one that is too
+	// new are too new as well
+	for (auto &packet : m_list) {
+		const u16 seqnum = packet->getSeqnum();
+		if (!seqnum_higher(highest_acked, seqnum) ||
+				(u16)(highest_acked - seqnum) <= threshold)
+			break;
+
+		// Resent packets are left to the timeout
+		if (packet->resend_count == 0 && !packet->lost) {
+			packet->lost = true;
+			count++;
+		}
+	}
+	return count;
+}
+
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
@@ -354,12 +426,14 @@ std::list<ConstSharedPtr<BufferedPacket>>
 	MutexAutoLock listlock(m_list_mutex);
 	std::list<ConstSharedPtr<BufferedPacket>> timed_outs;
 	for (auto &packet : m_list) {
-		if (packet->time < timeout)
+		const float backoff = 1 << MYMIN(packet->resend_count, 3U);
+		if (!packet->lost && packet->time < timeout * backoff)
 			continue;
 
 		// caller will resend packet so reset time and increase counter
 		packet->time = 0.0f;
 		packet->resend_count++;
+		packet->lost = false;
 
 		timed_outs.emplace_back(packet);
 
@@ -555,31 +629,73 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = pkt->forgePacket();
 	return c;
 }
 
-ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, const Buffer<u8> &data)
+ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, const PacketBuffer &data)
 {
 	auto c = create(CONCMD_ACK);
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data = data;
 	return c;
 }
 
-ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buffer<u8> &data)
+ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const PacketBuffer &data)
 {
 	auto c = create(CONCMD_CREATE_PEER);
 	c->peer_id = peer_id;
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data = data;
+	return c;
+}
+
+ConnectionCommandPtr ConnectionCommand::extensions(session_t peer_id, u8 flags)
+{
+	auto c = create(CONCMD_EXTENSIONS);
+	c->peer_id = peer_id;
+	c->channelnum = 0;
+	c->reliable = true;
+	c->raw = true;
+	c->data = PacketBuffer(3);
+	writeU8(&c->data[0], PACKET_TYPE_CONTROL);
+	writeU8(&c->data[1], CONTROLTYPE_EXTENSIONS);
+	writeU8(&c->data[2], flags);
 	return c;
 }
 
+/*
+	PeerMetrics
+*/
+
+PeerMetrics::PeerMetrics(MetricsBackend *backend, session_t peer_id)
+{
+	const std::string peer = std::to_string(peer_id);
+
+	// One family, told apart by type: sent counts acknowledged reliable
+	// packets, lost counts resent ones
+	const std::string bytes_help = "Bytes transferred per peer";
+	bytes_sent = backend->addCounter("minetest_core_con_peer_bytes",
+			bytes_help, {{"peer", peer}, {"type", "sent"}});
+	bytes_received = backend->addCounter("minetest_core_con_peer_bytes",
+			bytes_help, {{"peer", peer}, {"type", "received"}});
+	bytes_lost = backend->addCounter("minetest_core_con_peer_bytes",
+			bytes_help, {{"peer", peer}, {"type", "lost"}});
+	resends = backend->addCounter("minetest_core_con_peer_resends",
+			"Number of resent reliable packets", {{"peer", peer}});
+	queued_reliables = backend->addGauge("minetest_core_con_peer_queued_reliables",
+			"Reliable packets waiting to be sent", {{"peer", peer}});
+	reliables_in_flight = backend->addGauge("minetest_core_con_peer_reliables_in_flight",
+			"Reliable packets waiting for an ack", {{"peer", peer}});
+	rtt = backend->addHistogram("minetest_core_con_peer_rtt_seconds",
+			"Round trip times of reliable packets",
+			{0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5}, {{"peer", peer}});
+}
+
 /*
 	Channel
 */
@@ -664,94 +780,58 @@ bool Channel::putBackSequenceNumber(u16 seqnum)
 	return false;
 }
 
-void Channel::UpdateBytesSent(unsigned int bytes, unsigned int packets)
+void Channel::UpdateBytesSent(unsigned int bytes)
 {
+	if (m_metrics)
+		m_metrics->bytes_sent->increment(bytes);
+
 	MutexAutoLock internal(m_internal_mutex);
 	current_bytes_transfered += bytes;
-	current_packet_successful += packets;
 }
 
 void Channel::UpdateBytesReceived(unsigned int bytes) {
+	if (m_metrics)
+		m_metrics->bytes_received->increment(bytes);
+
 	MutexAutoLock internal(m_internal_mutex);
 	current_bytes_received += bytes;
 }
 
 void Channel::UpdateBytesLost(unsigned int bytes)
 {
+	if (m_metrics) {
+		m_metrics->bytes_lost->increment(bytes);
+		m_metrics->resends->increment();
+	}
+
 	MutexAutoLock internal(m_internal_mutex);
 	current_bytes_lost += bytes;
 }
 
 
-void Channel::UpdatePacketLossCounter(unsigned int count)
+void Channel::onPacketsAcked(u32 count, float rtt)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion.onAck(count, porting::getTimeMs(), rtt);
+	m_window_size = (u16)m_congestion.getWindow();
+}
+
+void Channel::onPacketsLost(float rtt)
 {
 	MutexAutoLock internal(m_internal_mutex);
-	current_packet_loss += count;
+	m_congestion.onLoss(porting::getTimeMs(), rtt);
+	m_window_size = (u16)m_congestion.getWindow();
 }
 
-void Channel::UpdatePacketTooLateCounter()
+bool Channel::pacePacket(float rtt)
 {
 	MutexAutoLock internal(m_internal_mutex);
-	current_packet_too_late++;
+	return m_congestion.pace(porting::getTimeMs(), rtt);
 }
 
 void Channel::UpdateTimers(float dtime)
 {
 	bpm_counter += dtime;
-	packet_loss_counter += dtime;
-
-	if (packet_loss_counter > 1.0f) {
-		packet_loss_counter -= 1.0f;
-
-		unsigned int packet_loss = 11; /* use a neutral value for initialization */
-		unsigned int packets_successful = 0;
-		//unsigned int packet_too_late = 0;
-
-		bool reasonable_amount_of_data_transmitted = false;
-
-		{
-			MutexAutoLock internal(m_internal_mutex);
-			packet_loss = current_packet_loss;
-			//packet_too_late = current_packet_too_late;
-			packets_successful = current_packet_successful;
-
-			if (current_bytes_transfered > (unsigned int) (m_window_size*512/2)) {
-				reasonable_amount_of_data_transmitted = true;
-			}
-			current_packet_loss = 0;
-			current_packet_too_late = 0;
-			current_packet_successful = 0;
-		}
-
-		/* dynamic window size */
-		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
-
-		if (packets_successful > 0) {
-			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
-			setWindowSize(m_window_size - 10);
-			done = true;
-		}
-
-		if (!done) {
-			if (successful_to_lost_ratio < 0.01f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 100);
-			} else if (successful_to_lost_ratio < 0.05f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 50);
-			} else if (successful_to_lost_ratio > 0.15f) {
-				setWindowSize(m_window_size - 100);
-			} else if (successful_to_lost_ratio > 0.1f) {
-				setWindowSize(m_window_size - 50);
-			}
-		}
-	}
 
 	if (bpm_counter > 10.0f) {
 		{
@@ -949,8 +1029,13 @@ void Peer::Drop()
 UDPPeer::UDPPeer(u16 a_id, Address a_address, Connection* connection) :
 	Peer(a_address,a_id,connection)
 {
+}
+
+void UDPPeer::enableMetrics(MetricsBackend *metrics)
+{
+	m_metrics = std::make_unique<PeerMetrics>(metrics, id);
 	for (Channel &channel : channels)
-		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
+		channel.setMetrics(m_metrics.get());
 }
 
 bool UDPPeer::getAddress(MTProtocols type,Address& toset)
@@ -970,18 +1055,23 @@ void UDPPeer::reportRTT(float rtt)
 		return;
 	}
 	RTTStatistics(rtt,"rudp",MAX_RELIABLE_WINDOW_SIZE*10);
-
-	float timeout = getStat(AVG_RTT) * RESEND_TIMEOUT_FACTOR;
-	if (timeout < RESEND_TIMEOUT_MIN)
-		timeout = RESEND_TIMEOUT_MIN;
-	if (timeout > RESEND_TIMEOUT_MAX)
-		timeout = RESEND_TIMEOUT_MAX;
+	if (m_metrics)
+		m_metrics->rtt->observe(rtt);
 
 	MutexAutoLock usage_lock(m_exclusive_access_mutex);
-	resend_timeout = timeout;
+	if (m_srtt < 0.0f) {
+		m_srtt = rtt;
+		m_rttvar = rtt / 2.0f;
+	} else {
+		m_rttvar = 0.75f * m_rttvar + 0.25f * std::fabs(m_srtt - rtt);
+		m_srtt = 0.875f * m_srtt + 0.125f * rtt;
+	}
+
+	resend_timeout = rangelim(m_srtt + 4.0f * m_rttvar,
+		RESEND_TIMEOUT_MIN, RESEND_TIMEOUT_MAX);
 }
 
-bool UDPPeer::Ping(float dtime,SharedBuffer<u8>& data)
+bool UDPPeer::Ping(float dtime, PacketBuffer &data)
 {
 	m_ping_timer += dtime;
 	if (m_ping_timer >= PING_TIMEOUT)
@@ -995,6 +1085,20 @@ bool UDPPeer::Ping(float dtime,SharedBuffer<u8>& data)
 	return false;
 }
 
+void UDPPeer::updateQueueMetrics()
+{
+	if (!m_metrics)
+		return;
+
+	u32 queued = 0, in_flight = 0;
+	for (Channel &channel : channels) {
+		queued += channel.queued_reliables.size() + channel.queued_commands.size();
+		in_flight += channel.outgoing_reliables_sent.size();
+	}
+	m_metrics->queued_reliables->set(queued);
+	m_metrics->reliables_in_flight->set(in_flight);
+}
+
 void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 		unsigned int max_packet_size)
 {
@@ -1042,7 +1146,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketBuffer> originals;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
 
 	if (c.raw) {
@@ -1057,7 +1161,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (PacketBuffer &original : originals) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1070,10 +1174,10 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
+		PacketBuffer reliable = makeReliablePacket(std::move(original), seqnum);
 
 		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
+		BufferedPacketPtr p = con::makePacket(address, std::move(reliable),
 				m_connection->GetProtocolID(), m_connection->GetPeerID(),
 				c.channelnum);
 
@@ -1503,6 +1607,25 @@ float Connection::getPeerStat(session_t peer_id, rtt_stat_type type)
 	return peer->getStat(type);
 }
 
+void Connection::setMetricsBackend(std::shared_ptr<MetricsBackend> metrics)
+{
+	MutexAutoLock lock(m_info_mutex);
+	m_metrics_backend = metrics;
+	m_send_loop_time.reset();
+	if (metrics) {
+		m_send_loop_time = metrics->addHistogram(
+				"minetest_core_con_send_loop_seconds",
+				"Time spent in one iteration of the connection send thread",
+				{0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05});
+	}
+}
+
+std::shared_ptr<MetricsBackend> Connection::getMetricsBackend()
+{
+	MutexAutoLock lock(m_info_mutex);
+	return m_metrics_backend;
+}
+
 float Connection::getLocalStat(rate_stat_type type)
 {
 	PeerHelper peer = getPeerNoEx(PEER_ID_SERVER);
@@ -1570,8 +1693,9 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 	}
 
 	// Create a peer
-	Peer *peer = 0;
-	peer = new UDPPeer(peer_id_new, sender, this);
+	UDPPeer *peer = new UDPPeer(peer_id_new, sender, this);
+	if (std::shared_ptr<MetricsBackend> metrics = getMetricsBackend())
+		peer->enableMetrics(metrics.get());
 
 	m_peers[peer->id] = peer;
 	m_peer_ids.push_back(peer->id);
@@ -1582,10 +1706,11 @@ u16 Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
 			<< "createPeer(): giving peer_id=" << peer_id_new << std::endl);
 
 	{
-		Buffer<u8> reply(4);
+		PacketBuffer reply(5);
 		writeU8(&reply[0], PACKET_TYPE_CONTROL);
 		writeU8(&reply[1], CONTROLTYPE_SET_PEER_ID);
 		writeU16(&reply[2], peer_id_new);
+		writeU8(&reply[4], PROTOCOL_EXTENSIONS);
 		putCommand(ConnectionCommand::createPeer(peer_id_new, reply));
 	}
 
@@ -1617,7 +1742,7 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 			" channel: " << (channelnum & 0xFF) <<
 			" seqnum: " << seqnum << std::endl);
 
-	SharedBuffer<u8> ack(4);
+	PacketBuffer ack(4);
 	writeU8(&ack[0], PACKET_TYPE_CONTROL);
 	writeU8(&ack[1], CONTROLTYPE_ACK);
 	writeU16(&ack[2], seqnum);
@@ -1634,6 +1759,8 @@ UDPPeer* Connection::createServerPeer(Address& address)
 	}
 
 	UDPPeer *peer = new UDPPeer(PEER_ID_SERVER, address, this);
+	if (std::shared_ptr<MetricsBackend> metrics = getMetricsBackend())
+		peer->enableMetrics(metrics.get());
 
 	{
 		MutexAutoLock lock(m_peers_mutex);
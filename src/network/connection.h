@@ -27,7 +27,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/container.h"
 #include "util/thread.h"
 #include "util/numeric.h"
+#include "util/metricsbackend.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
+#include "congestioncontrol.h"
 #include <iostream>
 #include <vector>
 #include <map>
@@ -66,18 +69,41 @@ controltype and data description:
 		[2] u16 seqnum
 	CONTROLTYPE_SET_PEER_ID
 		[2] session_t peer_id_new
+		[4] u8 extensions (optional, ProtocolExtension flags of the server)
 	CONTROLTYPE_PING
 	- There is no actual reply, but this can be sent in a reliable
 	  packet to get a reply
 	CONTROLTYPE_DISCO
+	CONTROLTYPE_EXTENSIONS
+	- Reply of the client to a SET_PEER_ID with extensions, sent reliably.
+	  Only sent to servers that announced extensions.
+		[2] u8 extensions (ProtocolExtension flags of the client)
+	CONTROLTYPE_SACK
+	- Acknowledges every packet before next_expected and the packets in
+	  the given ranges. Only sent to peers that announced PROTOCOL_EXT_SACK.
+		[2] u16 next_expected
+		[4] u8 range_count
+		[5] (u16 first, u16 last) * range_count
 */
 enum ControlType : u8 {
 	CONTROLTYPE_ACK = 0,
 	CONTROLTYPE_SET_PEER_ID = 1,
 	CONTROLTYPE_PING = 2,
 	CONTROLTYPE_DISCO = 3,
+	CONTROLTYPE_EXTENSIONS = 4,
+	CONTROLTYPE_SACK = 5,
 };
 
+enum ProtocolExtension : u8 {
+	// Understands CONTROLTYPE_SACK
+	PROTOCOL_EXT_SACK = 0x01,
+};
+
+// Extensions supported by this version
+#define PROTOCOL_EXTENSIONS PROTOCOL_EXT_SACK
+// Most ranges sent in one CONTROLTYPE_SACK
+#define SACK_MAX_RANGES 32
+
 /*
 ORIGINAL: This is a plain packet with no control and no error
 checking at all.
@@ -181,20 +207,20 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
 /*
 	Struct for all kinds of packets. Includes following data:
 		BASE_HEADER
-		u8[] packet data (usually copied from SharedBuffer<u8>)
+		u8[] packet data
 */
 struct BufferedPacket {
-	BufferedPacket(u32 a_size)
+	BufferedPacket(PacketBuffer &&buffer) :
+		m_buffer(std::move(buffer))
 	{
-		m_data.resize(a_size);
-		data = &m_data[0];
+		data = m_buffer.data();
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_buffer.getSize(); }
 
 	u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
@@ -202,25 +228,35 @@ struct BufferedPacket {
 	u64 absolute_send_time = -1;
 	Address address; // Sender or destination
 	unsigned int resend_count = 0;
+	bool lost = false; // Reported missing by the receiver, resend now
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	PacketBuffer m_buffer; // Data of the packet, including headers
 };
 
 typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
 
 
-// This adds the base headers to the data and makes a packet out of it
+// This adds the base headers to the data and makes a packet out of it.
+// The headers go into the free space in front of the data if possible.
+BufferedPacketPtr makePacket(Address &address, PacketBuffer data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
 BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
 // Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
 // Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+void makeAutoSplitPacket(const PacketBuffer &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketBuffer> *list);
 
 // Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
+PacketBuffer makeReliablePacket(PacketBuffer data, u16 seqnum);
+
+// Inclusive ranges of sequence numbers
+typedef std::vector<std::pair<u16, u16>> SeqnumRanges;
+
+// Make a CONTROLTYPE_SACK packet
+PacketBuffer makeSelectiveAck(u16 next_expected, const SeqnumRanges &ranges);
 
 struct IncomingSplitPacket
 {
@@ -263,7 +299,19 @@ class ReliablePacketBuffer
 	BufferedPacketPtr popSeqnum(u16 seqnum);
 	void insert(BufferedPacketPtr &p_ptr, u16 next_expected);
 
+	// Returns the ranges of buffered sequence numbers, at most max_ranges
+	SeqnumRanges getSeqnumRanges(u32 max_ranges);
+	// Removes the packets acknowledged by a CONTROLTYPE_SACK
+	std::vector<BufferedPacketPtr> popAcked(u16 next_expected,
+			const SeqnumRanges &ranges);
+	// Marks packets as lost that are more than threshold sequence numbers
+	// older than the newest acknowledged one and were not resent yet.
+	// Returns the number of newly lost packets.
+	u32 markLost(u16 highest_acked, u16 threshold = 3);
+
 	void incrementTimeouts(float dtime);
+	// Returns packets that were not acknowledged in time or were marked lost.
+	// The timeout doubles with each resend of a packet, up to 8 times.
 	std::list<ConstSharedPtr<BufferedPacket>> getTimedOuts(float timeout, u32 max_packets);
 
 	void print();
@@ -313,7 +361,8 @@ enum ConnectionCommandType{
 	CONNCMD_SEND,
 	CONNCMD_SEND_TO_ALL,
 	CONCMD_ACK,
-	CONCMD_CREATE_PEER
+	CONCMD_CREATE_PEER,
+	CONCMD_EXTENSIONS
 };
 
 struct ConnectionCommand;
@@ -326,7 +375,7 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	PacketBuffer data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -337,8 +386,9 @@ struct ConnectionCommand
 	static ConnectionCommandPtr disconnect();
 	static ConnectionCommandPtr disconnect_peer(session_t peer_id);
 	static ConnectionCommandPtr send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
-	static ConnectionCommandPtr ack(session_t peer_id, u8 channelnum, const Buffer<u8> &data);
-	static ConnectionCommandPtr createPeer(session_t peer_id, const Buffer<u8> &data);
+	static ConnectionCommandPtr ack(session_t peer_id, u8 channelnum, const PacketBuffer &data);
+	static ConnectionCommandPtr createPeer(session_t peer_id, const PacketBuffer &data);
+	static ConnectionCommandPtr extensions(session_t peer_id, u8 flags);
 
 private:
 	ConnectionCommand(ConnectionCommandType type_) :
@@ -357,6 +407,26 @@ struct ConnectionCommand
 /* minimum value for window size */
 #define MIN_RELIABLE_WINDOW_SIZE 0x40
 
+/*
+	Metrics of one peer, labeled with its peer id
+*/
+struct PeerMetrics
+{
+	PeerMetrics(MetricsBackend *backend, session_t peer_id);
+
+	// Bytes of acknowledged reliable packets
+	MetricCounterPtr bytes_sent;
+	MetricCounterPtr bytes_received;
+	// Bytes of resent reliable packets
+	MetricCounterPtr bytes_lost;
+	MetricCounterPtr resends;
+	// Reliable packets waiting to be sent, in all channels
+	MetricGaugePtr queued_reliables;
+	// Reliable packets waiting for an ack, in all channels
+	MetricGaugePtr reliables_in_flight;
+	MetricHistogramPtr rtt;
+};
+
 class Channel
 {
 
@@ -389,12 +459,14 @@ class Channel
 	Channel() = default;
 	~Channel() = default;
 
-	void UpdatePacketLossCounter(unsigned int count);
-	void UpdatePacketTooLateCounter();
-	void UpdateBytesSent(unsigned int bytes,unsigned int packages=1);
+	void UpdateBytesSent(unsigned int bytes);
+	// Called for every resent packet
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
 
+	// metrics must outlive the channel, may be null
+	void setMetrics(PeerMetrics *metrics) { m_metrics = metrics; }
+
 	void UpdateTimers(float dtime);
 
 	float getCurrentDownloadRateKB()
@@ -421,25 +493,24 @@ class Channel
 
 	u16 getWindowSize() const { return m_window_size; };
 
-	void setWindowSize(long size)
-	{
-		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
-	}
+	// rtt is the smoothed round trip time, negative if not known yet
+	void onPacketsAcked(u32 count, float rtt);
+	void onPacketsLost(float rtt);
+	// Returns true if another queued reliable packet may be sent now
+	bool pacePacket(float rtt);
 
 private:
 	std::mutex m_internal_mutex;
-	u16 m_window_size = MIN_RELIABLE_WINDOW_SIZE;
+	PeerMetrics *m_metrics = nullptr;
+	CongestionControl m_congestion{START_RELIABLE_WINDOW_SIZE,
+		MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE};
+	u16 m_window_size = START_RELIABLE_WINDOW_SIZE;
 
 	u16 next_incoming_seqnum = SEQNUM_INITIAL;
 
 	u16 next_outgoing_seqnum = SEQNUM_INITIAL;
 	u16 next_outgoing_split_seqnum = SEQNUM_INITIAL;
 
-	unsigned int current_packet_loss = 0;
-	unsigned int current_packet_too_late = 0;
-	unsigned int current_packet_successful = 0;
-	float packet_loss_counter = 0.0f;
-
 	unsigned int current_bytes_transfered = 0;
 	unsigned int current_bytes_received = 0;
 	unsigned int current_bytes_lost = 0;
@@ -534,7 +605,7 @@ class Peer {
 			return SharedBuffer<u8>(0);
 		};
 
-		virtual bool Ping(float dtime, SharedBuffer<u8>& data) { return false; };
+		virtual bool Ping(float dtime, PacketBuffer &data) { return false; };
 
 		virtual float getStat(rtt_stat_type type) const {
 			switch (type) {
@@ -616,6 +687,10 @@ class UDPPeer : public Peer
 
 	bool getAddress(MTProtocols type, Address& toset);
 
+	// Exports the metrics of this peer. Only for peers of the connection,
+	// not for temporary copies.
+	void enableMetrics(MetricsBackend *metrics);
+
 	u16 getNextSplitSequenceNumber(u8 channel);
 	void setNextSplitSequenceNumber(u8 channel, u16 seqnum);
 
@@ -624,11 +699,15 @@ class UDPPeer : public Peer
 
 protected:
 	/*
-		Calculates avg_rtt and resend_timeout.
-		rtt=-1 only recalculates resend_timeout
+		Updates the smoothed rtt and resend_timeout (RFC 6298).
+		rtt=-1 is ignored
 	*/
 	void reportRTT(float rtt);
 
+	// Returns -1 before the first measurement
+	float getSmoothedRTT()
+		{ MutexAutoLock lock(m_exclusive_access_mutex); return m_srtt; }
+
 	void RunCommandQueues(
 					unsigned int max_packet_size,
 					unsigned int maxcommands,
@@ -639,13 +718,24 @@ class UDPPeer : public Peer
 
 	void setResendTimeout(float timeout)
 		{ MutexAutoLock lock(m_exclusive_access_mutex); resend_timeout = timeout; }
-	bool Ping(float dtime,SharedBuffer<u8>& data);
+	bool Ping(float dtime, PacketBuffer &data);
+
+	// Updates the queue gauges of m_metrics, send thread only
+	void updateQueueMetrics();
 
 	Channel channels[CHANNEL_COUNT];
 	bool m_pending_disconnect = false;
+	// ProtocolExtension flags the peer announced.
+	// Only used by the receive thread.
+	u8 m_extensions = 0;
 private:
 	// This is changed dynamically
 	float resend_timeout = 0.5;
+	float m_srtt = -1.0f;
+	float m_rttvar = 0.0f;
+
+	// Null if the connection exports no metrics
+	std::unique_ptr<PeerMetrics> m_metrics;
 
 	bool processReliableSendCommand(
 					ConnectionCommandPtr &c_ptr,
@@ -724,6 +814,13 @@ class Connection
 	u32 GetProtocolID() const { return m_protocol_id; };
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
+	// Drops this fraction of the sent datagrams, for testing
+	void SimulatePacketLoss(float loss) { m_udpSocket.setPacketLoss(loss); }
+
+	// Exports per-peer and send thread metrics to metrics, applies to
+	// peers created afterwards
+	void setMetricsBackend(std::shared_ptr<MetricsBackend> metrics);
+	std::shared_ptr<MetricsBackend> getMetricsBackend();
 
 protected:
 	PeerHelper getPeerNoEx(session_t peer_id);
@@ -743,6 +840,13 @@ class Connection
 		return m_peer_ids;
 	}
 
+	// Null without metrics backend
+	MetricHistogramPtr getSendLoopTimeMetric()
+	{
+		MutexAutoLock lock(m_info_mutex);
+		return m_send_loop_time;
+	}
+
 	UDPSocket m_udpSocket;
 	// Command queue: user -> SendThread
 	MutexedQueue<ConnectionCommandPtr> m_command_queue;
@@ -773,6 +877,10 @@ class Connection
 
 	mutable std::mutex m_info_mutex;
 
+	// Protected by m_info_mutex
+	std::shared_ptr<MetricsBackend> m_metrics_backend;
+	MetricHistogramPtr m_send_loop_time;
+
 	// Backwards compatibility
 	PeerHandler *m_bc_peerhandler;
 	u32 m_bc_receive_timeout = 0;
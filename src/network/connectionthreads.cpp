@@ -100,6 +100,7 @@ void *ConnectionSendThread::run()
 		lasttime = curtime;
 		curtime = porting::getTimeMs();
 		float dtime = CALC_DTIME(lasttime, curtime);
+		const u64 loop_start = porting::getTimeUs();
 
 		/* first resend timed-out packets */
 		runTimeouts(dtime);
@@ -123,6 +124,12 @@ void *ConnectionSendThread::run()
 		/* send queued packets */
 		sendPackets(dtime);
 
+		/* hand everything from this iteration to the socket */
+		flushSendBatch();
+
+		if (MetricHistogramPtr loop_time = m_connection->getSendLoopTimeMetric())
+			loop_time->observe((porting::getTimeUs() - loop_start) / 1000000.0);
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -188,7 +195,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 		PROFILE(ScopeProfiler
 		peerprofiler(g_profiler, peerIdentifier.str(), SPT_AVG));
 
-		SharedBuffer<u8> data(2); // data for sending ping, required here because of goto
+		PacketBuffer data(2); // data for sending ping, required here because of goto
 
 		/*
 			Check peer timeout
@@ -217,7 +224,8 @@ void ConnectionSendThread::runTimeouts(float dtime)
 			auto timed_outs = channel.outgoing_reliables_sent.getTimedOuts(resend_timeout,
 				(m_max_data_packets_per_iteration / numpeers));
 
-			channel.UpdatePacketLossCounter(timed_outs.size());
+			if (!timed_outs.empty())
+				channel.onPacketsLost(udpPeer->getSmoothedRTT());
 			g_profiler->graphAdd("packets_lost", timed_outs.size());
 
 			m_iteration_packets_avaialble -= timed_outs.size();
@@ -237,7 +245,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 					<< ", seqnum=" << seqnum
 					<< std::endl);
 
-				rawSend(k.get());
+				rawSend(k);
 
 				// do not handle rtt here as we can't decide if this packet was
 				// lost or really takes more time to transmit
@@ -245,6 +253,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 
 			channel.UpdateTimers(dtime);
 		}
+		udpPeer->updateQueueMetrics();
 
 		/* send ping if necessary */
 		if (udpPeer->Ping(dtime, data)) {
@@ -270,18 +279,36 @@ void ConnectionSendThread::runTimeouts(float dtime)
 	}
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= (size_t)UDPSocket::max_batch_size)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	UDPOutgoingDatagram datagrams[UDPSocket::max_batch_size];
+	const int count = m_send_batch.size();
+	for (int i = 0; i < count; i++) {
+		const BufferedPacket *p = m_send_batch[i].get();
+		datagrams[i] = {p->address, p->data, (int)p->size()};
+	}
+
+	int failed = m_connection->m_udpSocket.SendBatch(datagrams, count);
+	if (failed > 0) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+			<< "Connection::rawSend(): failed to send " << failed
+			<< " of " << count << " packets" << std::endl);
 	}
+	LOG(dout_con << m_connection->getDesc()
+		<< " rawSend: " << (count - failed)
+		<< " packets sent" << std::endl);
+
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -300,11 +327,11 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool reliable)
+	const PacketBuffer &data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -322,12 +349,12 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		if (!have_seqnum)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
+		PacketBuffer reliable = makeReliablePacket(data, seqnum);
 		Address peer_address;
 		peer->getAddress(MTP_MINETEST_RELIABLE_UDP, peer_address);
 
 		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(peer_address, reliable,
+		BufferedPacketPtr p = con::makePacket(peer_address, std::move(reliable),
 			m_connection->GetProtocolID(), m_connection->GetPeerID(),
 			channelnum);
 
@@ -357,7 +384,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// Send the packet
-		rawSend(p.get());
+		rawSend(p);
 		return true;
 	}
 
@@ -390,8 +417,10 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			return;
 
 		case CONCMD_CREATE_PEER:
+		case CONCMD_EXTENSIONS:
 			LOG(dout_con << m_connection->getDesc()
-				<< "UDP processing reliable CONCMD_CREATE_PEER" << std::endl);
+				<< "UDP processing reliable " << (c->type == CONCMD_CREATE_PEER ?
+					"CONCMD_CREATE_PEER" : "CONCMD_EXTENSIONS") << std::endl);
 			if (!rawSendAsPacket(c->peer_id, c->channelnum, c->data, c->reliable)) {
 				/* put to queue if we couldn't send it immediately */
 				sendReliable(c);
@@ -457,6 +486,7 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 			sendAsPacket(c.peer_id, c.channelnum, c.data, true);
 			return;
 		case CONCMD_CREATE_PEER:
+		case CONCMD_EXTENSIONS:
 			FATAL_ERROR("Got command that should be reliable as unreliable command");
 		default:
 			LOG(dout_con << m_connection->getDesc()
@@ -509,7 +539,7 @@ void ConnectionSendThread::disconnect()
 	LOG(dout_con << m_connection->getDesc() << " disconnecting" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
+	PacketBuffer data(2);
 	writeU8(&data[0], PACKET_TYPE_CONTROL);
 	writeU8(&data[1], CONTROLTYPE_DISCO);
 
@@ -527,7 +557,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 	LOG(dout_con << m_connection->getDesc() << " disconnecting peer" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
+	PacketBuffer data(2);
 	writeU8(&data[0], PACKET_TYPE_CONTROL);
 	writeU8(&data[1], CONTROLTYPE_DISCO);
 	sendAsPacket(peer_id, 0, data, false);
@@ -545,7 +575,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketBuffer &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -565,13 +595,13 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketBuffer> originals;
 
 	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (const PacketBuffer &original : originals) {
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -585,7 +615,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketBuffer &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -684,10 +714,12 @@ void ConnectionSendThread::sendPackets(float dtime)
 				<< channel.queued_commands.size()
 				<< std::endl);
 
+			const float rtt = udpPeer->getSmoothedRTT();
 			while (!channel.queued_reliables.empty() &&
 					channel.outgoing_reliables_sent.size()
 					< channel.getWindowSize() &&
-					peer->m_increment_packets_remaining > 0) {
+					peer->m_increment_packets_remaining > 0 &&
+					channel.pacePacket(rtt)) {
 				BufferedPacketPtr p = channel.queued_reliables.front();
 				channel.queued_reliables.pop();
 
@@ -761,7 +793,7 @@ void ConnectionSendThread::sendPackets(float dtime)
 }
 
 void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool ack)
+	const PacketBuffer &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -787,7 +819,14 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	// Buffers for receiving several packets per system call
+	const int batch_size = UDPSocket::max_batch_size;
+	std::vector<u8> packetdata(batch_size * packet_maxsize);
+	UDPIncomingDatagram datagrams[batch_size];
+	for (int i = 0; i < batch_size; i++) {
+		datagrams[i].data = &packetdata[i * packet_maxsize];
+		datagrams[i].capacity = packet_maxsize;
+	}
 
 	bool packet_queued = true;
 
@@ -809,7 +848,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(datagrams, batch_size, packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -869,141 +908,191 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
+void ConnectionReceiveThread::receive(UDPIncomingDatagram *datagrams, int count,
 		bool &packet_queued)
 {
 	try {
 		// First, see if there any buffered packets we can process now
-		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
+		processBuffered(packet_queued);
+
+		// Wait for incoming data and take everything that is there
+		int received = m_connection->m_udpSocket.ReceiveBatch(datagrams, count);
+
+		for (int i = 0; i < received; i++) {
+			try {
+				// Packets buffered before may be ready after the previous one
+				if (i > 0)
+					processBuffered(packet_queued);
+
+				processDatagram(datagrams[i].sender,
+					(const u8 *)datagrams[i].data, datagrams[i].size,
+					packet_queued);
+			}
+			catch (InvalidIncomingDataException &e) {
 			}
-			packet_queued = false;
 		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
-
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+		// Acknowledge what the batch completed in one packet per channel
+		if (!m_pending_sacks.empty()) {
+			processBuffered(packet_queued);
+			sendSelectiveAcks();
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+void ConnectionReceiveThread::sendSelectiveAcks()
+{
+	for (const auto &pending : m_pending_sacks) {
+		PeerHelper peer = m_connection->getPeerNoEx(pending.first);
+		if (!peer)
+			continue;
+		UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+		if (!udpPeer)
+			continue;
 
-		if (channelnum > CHANNEL_COUNT - 1) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (u32)channelnum << std::endl);
-			return;
-		}
+		Channel &channel = udpPeer->channels[pending.second];
+		PacketBuffer sack = makeSelectiveAck(channel.readNextIncomingSeqNum(),
+			channel.incoming_reliables.getSeqnumRanges(SACK_MAX_RANGES));
 
-		/* Try to identify peer by sender address (may happen on join) */
-		if (peer_id == PEER_ID_INEXISTENT) {
-			peer_id = m_connection->lookupPeer(sender);
-			// We do not have to remind the peer of its
-			// peer id as the CONTROLTYPE_SET_PEER_ID
-			// command was sent reliably.
-		}
+		LOG(dout_con << m_connection->getDesc()
+			<< " Queuing SACK command to peer_id: " << pending.first
+			<< " channel: " << (pending.second & 0xFF) << std::endl);
+		m_connection->putCommand(ConnectionCommand::ack(pending.first,
+			pending.second, sack));
+	}
+	m_pending_sacks.clear();
+	m_connection->TriggerSend();
+}
 
-		if (peer_id == PEER_ID_INEXISTENT) {
-			/* Ignore it if we are a client */
-			if (m_connection->ConnectedToServer())
-				return;
-			/* The peer was not found in our lists. Add it. */
-			peer_id = m_connection->createPeer(sender, MTP_MINETEST_RELIABLE_UDP, 0);
-		}
+void ConnectionReceiveThread::processBuffered(bool &packet_queued)
+{
+	if (!packet_queued)
+		return;
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
-			return;
+	session_t peer_id;
+	SharedBuffer<u8> resultdata;
+	while (true) {
+		try {
+			if (!getFromBuffers(peer_id, resultdata))
+				break;
+
+			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 		}
+		catch (ProcessedSilentlyException &e) {
+			/* try reading again */
+		}
+	}
+	packet_queued = false;
+}
+
+void ConnectionReceiveThread::processDatagram(Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+			<< std::endl);
+		return;
+	}
 
-		// Validate peer address
+	session_t peer_id = readPeerId(packetdata);
+	u8 channelnum = readChannel(packetdata);
 
-		Address peer_address;
-		if (peer->getAddress(MTP_UDP, peer_address)) {
-			if (peer_address != sender) {
-				LOG(derr_con << m_connection->getDesc()
-					<< " Peer " << peer_id << " sending from different address."
-					" Ignoring." << std::endl);
-				return;
-			}
-		} else {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " doesn't have an address?!"
-				" Ignoring." << std::endl);
+	if (channelnum > CHANNEL_COUNT - 1) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (u32)channelnum << std::endl);
+		return;
+	}
+
+	/* Try to identify peer by sender address (may happen on join) */
+	if (peer_id == PEER_ID_INEXISTENT) {
+		peer_id = m_connection->lookupPeer(sender);
+		// We do not have to remind the peer of its
+		// peer id as the CONTROLTYPE_SET_PEER_ID
+		// command was sent reliably.
+	}
+
+	if (peer_id == PEER_ID_INEXISTENT) {
+		/* Ignore it if we are a client */
+		if (m_connection->ConnectedToServer())
 			return;
-		}
+		/* The peer was not found in our lists. Add it. */
+		peer_id = m_connection->createPeer(sender, MTP_MINETEST_RELIABLE_UDP, 0);
+	}
 
-		peer->ResetTimeout();
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		Channel *channel = nullptr;
-		if (dynamic_cast<UDPPeer *>(&peer)) {
-			channel = &dynamic_cast<UDPPeer *>(&peer)->channels[channelnum];
-		} else {
+	// Validate peer address
+
+	Address peer_address;
+	if (peer->getAddress(MTP_UDP, peer_address)) {
+		if (peer_address != sender) {
 			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+				<< " Peer " << peer_id << " sending from different address."
 				" Ignoring." << std::endl);
 			return;
 		}
+	} else {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " doesn't have an address?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		channel->UpdateBytesReceived(received_size);
+	peer->ResetTimeout();
 
-		// Throw the received packet to channel->processPacket()
+	Channel *channel = nullptr;
+	if (dynamic_cast<UDPPeer *>(&peer)) {
+		channel = &dynamic_cast<UDPPeer *>(&peer)->channels[channelnum];
+	} else {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	channel->UpdateBytesReceived(received_size);
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	// Throw the received packet to channel->processPacket()
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
-		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
-		}
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, strippeddata, peer_id, channelnum, false);
+
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 	}
-	catch (InvalidIncomingDataException &e) {
+	catch (ProcessedSilentlyException &e) {
+	}
+	catch (ProcessedQueued &e) {
+		// we set it to true anyway (see below)
 	}
+
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
@@ -1101,6 +1190,22 @@ const ConnectionReceiveThread::PacketTypeHandler
 	{&ConnectionReceiveThread::handlePacketType_Reliable},
 };
 
+void ConnectionReceiveThread::reportAckedRTT(UDPPeer *peer, const BufferedPacket &p)
+{
+	// Can't tell which transmission of a resent packet got acknowledged
+	// (Karn's algorithm)
+	if (p.resend_count > 0)
+		return;
+
+	// an overflow is quite unlikely but as it'd result in major
+	// rtt miscalculation we handle it here
+	u64 current_time = porting::getTimeMs();
+	if (current_time > p.absolute_send_time)
+		peer->reportRTT((current_time - p.absolute_send_time) / 1000.0);
+	else if (p.totaltime > 0)
+		peer->reportRTT(p.totaltime);
+}
+
 SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *channel,
 	const SharedBuffer<u8> &packetdata, Peer *peer, u8 channelnum, bool reliable)
 {
@@ -1124,41 +1229,73 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 
 		try {
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
+			UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(peer);
 
-			// the rtt calculation will be a bit off for re-sent packets but that's okay
-			{
-				// Get round trip time
-				u64 current_time = porting::getTimeMs();
-
-				// an overflow is quite unlikely but as it'd result in major
-				// rtt miscalculation we handle it here
-				if (current_time > p->absolute_send_time) {
-					float rtt = (current_time - p->absolute_send_time) / 1000.0;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
-					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				} else if (p->totaltime > 0) {
-					float rtt = p->totaltime;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
-					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				}
-			}
+			reportAckedRTT(udpPeer, *p);
 
 			// put bytes for max bandwidth calculation
-			channel->UpdateBytesSent(p->size(), 1);
+			channel->UpdateBytesSent(p->size());
+			channel->onPacketsAcked(1, udpPeer->getSmoothedRTT());
 			if (channel->outgoing_reliables_sent.size() == 0)
 				m_connection->TriggerSend();
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
 				<< "WARNING: ACKed packet not in outgoing queue"
 				<< " seqnum=" << seqnum << std::endl);
-			channel->UpdatePacketTooLateCounter();
 		}
 
 		throw ProcessedSilentlyException("Got an ACK");
+	} else if (controltype == CONTROLTYPE_SACK) {
+		assert(channel != NULL);
+
+		if (packetdata.getSize() < 5) {
+			throw InvalidIncomingDataException(
+				"packetdata.getSize() < 5 (SACK header size)");
+		}
+
+		const u16 next_expected = readU16(&packetdata[2]);
+		const u8 range_count = readU8(&packetdata[4]);
+		if (packetdata.getSize() < 5 + 4 * (u32)range_count)
+			throw InvalidIncomingDataException("SACK ranges truncated");
+
+		SeqnumRanges ranges;
+		ranges.reserve(range_count);
+		for (u8 i = 0; i < range_count; i++) {
+			ranges.emplace_back(readU16(&packetdata[5 + 4 * i]),
+				readU16(&packetdata[7 + 4 * i]));
+		}
+		LOG(dout_con << m_connection->getDesc() << " [ CONTROLTYPE_SACK: channelnum="
+			<< ((int) channelnum & 0xff) << ", peer_id=" << peer->id
+			<< ", next_expected=" << next_expected
+			<< ", ranges=" << (u32)range_count << " ]" << std::endl);
+
+		UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(peer);
+		std::vector<BufferedPacketPtr> acked =
+			channel->outgoing_reliables_sent.popAcked(next_expected, ranges);
+
+		// One sample per SACK, from the packet sent last
+		const BufferedPacket *newest = nullptr;
+		for (const BufferedPacketPtr &p : acked) {
+			channel->UpdateBytesSent(p->size());
+			if (p->resend_count == 0 && (!newest ||
+					p->absolute_send_time > newest->absolute_send_time))
+				newest = p.get();
+		}
+		if (newest)
+			reportAckedRTT(udpPeer, *newest);
+
+		if (!acked.empty())
+			channel->onPacketsAcked(acked.size(), udpPeer->getSmoothedRTT());
+
+		// Packets the receiver skipped over are most likely lost
+		const u16 highest_acked = ranges.empty() ?
+			(u16)(next_expected - 1) : ranges.back().second;
+		u32 lost = channel->outgoing_reliables_sent.markLost(highest_acked);
+
+		if (lost > 0 || channel->outgoing_reliables_sent.size() == 0)
+			m_connection->TriggerSend();
+
+		throw ProcessedSilentlyException("Got a SACK");
 	} else if (controltype == CONTROLTYPE_SET_PEER_ID) {
 		// Got a packet to set our peer id
 		if (packetdata.getSize() < 4)
@@ -1177,7 +1314,26 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 			m_connection->SetPeerID(peer_id_new);
 		}
 
+		// Servers that know about extensions tell us theirs
+		if (packetdata.getSize() >= 5) {
+			UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(peer);
+			udpPeer->m_extensions = readU8(&packetdata[4]) & PROTOCOL_EXTENSIONS;
+			m_connection->putCommand(ConnectionCommand::extensions(peer->id,
+				PROTOCOL_EXTENSIONS));
+		}
+
 		throw ProcessedSilentlyException("Got a SET_PEER_ID");
+	} else if (controltype == CONTROLTYPE_EXTENSIONS) {
+		if (packetdata.getSize() < 3)
+			throw InvalidIncomingDataException
+				("packetdata.getSize() < 3 (EXTENSIONS header size)");
+
+		UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(peer);
+		udpPeer->m_extensions = readU8(&packetdata[2]) & PROTOCOL_EXTENSIONS;
+		LOG(dout_con << m_connection->getDesc() << "Got extensions "
+			<< (u32)udpPeer->m_extensions << " of peer " << peer->id << std::endl);
+
+		throw ProcessedSilentlyException("Got EXTENSIONS");
 	} else if (controltype == CONTROLTYPE_PING) {
 		// Just ignore it, the incoming data already reset
 		// the timeout counter
@@ -1263,10 +1419,16 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Reliable(Channel *cha
 	bool is_future_packet = false;
 	bool is_old_packet = false;
 
+	const bool sack = dynamic_cast<UDPPeer *>(peer)->m_extensions
+		& PROTOCOL_EXT_SACK;
+
 	/* packet is within our receive window send ack */
 	if (seqnum_in_window(seqnum,
 		channel->readNextIncomingSeqNum(), MAX_RELIABLE_WINDOW_SIZE)) {
-		m_connection->sendAck(peer->id, channelnum, seqnum);
+		if (sack)
+			m_pending_sacks.emplace(peer->id, channelnum);
+		else
+			m_connection->sendAck(peer->id, channelnum, seqnum);
 	} else {
 		is_future_packet = seqnum_higher(seqnum, channel->readNextIncomingSeqNum());
 		is_old_packet = seqnum_higher(channel->readNextIncomingSeqNum(), seqnum);
@@ -1283,7 +1445,10 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Reliable(Channel *cha
 				<< "RE-SENDING ACK: peer_id: " << peer->id
 				<< ", channel: " << (channelnum & 0xFF)
 				<< ", seqnum: " << seqnum << std::endl;)
-			m_connection->sendAck(peer->id, channelnum, seqnum);
+			if (sack)
+				m_pending_sacks.emplace(peer->id, channelnum);
+			else
+				m_connection->sendAck(peer->id, channelnum, seqnum);
 
 			// we already have this packet so this one was on wire at least
 			// the current timeout
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <cassert>
+#include <set>
 #include "threading/thread.h"
 #include "connection.h"
 
@@ -33,11 +34,11 @@ struct OutgoingPacket
 {
 	session_t peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	PacketBuffer data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(session_t peer_id_, u8 channelnum_, const SharedBuffer<u8> &data_,
+	OutgoingPacket(session_t peer_id_, u8 channelnum_, const PacketBuffer &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -70,9 +71,12 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime);
-	void rawSend(const BufferedPacket *p);
+	// Queues a packet for the socket. Queued packets are sent in batches
+	// when enough are collected and at the end of every iteration.
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
-			const SharedBuffer<u8> &data, bool reliable);
+			const PacketBuffer &data, bool reliable);
 
 	void processReliableCommand(ConnectionCommandPtr &c);
 	void processNonReliableCommand(ConnectionCommandPtr &c);
@@ -80,14 +84,14 @@ class ConnectionSendThread : public Thread
 	void connect(Address address);
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketBuffer &data);
 	void sendReliable(ConnectionCommandPtr &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketBuffer &data);
 	void sendToAllReliable(ConnectionCommandPtr &c);
 
 	void sendPackets(float dtime);
 
-	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
+	void sendAsPacket(session_t peer_id, u8 channelnum, const PacketBuffer &data,
 			bool ack = false);
 
 	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel);
@@ -98,6 +102,7 @@ class ConnectionSendThread : public Thread
 	unsigned int m_max_packet_size;
 	float m_timeout;
 	std::queue<OutgoingPacket> m_outgoing_queue;
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
 	Semaphore m_send_sleep_semaphore;
 
 	unsigned int m_iteration_packets_avaialble;
@@ -120,7 +125,14 @@ class ConnectionReceiveThread : public Thread
 	}
 
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(UDPIncomingDatagram *datagrams, int count, bool &packet_queued);
+	// Sends one CONTROLTYPE_SACK for every channel in m_pending_sacks
+	void sendSelectiveAcks();
+
+	// Creates events for buffered packets that can be processed now
+	void processBuffered(bool &packet_queued);
+	void processDatagram(Address &sender, const u8 *packetdata,
+			s32 received_size, bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -142,6 +154,9 @@ class ConnectionReceiveThread : public Thread
 			const SharedBuffer<u8> &packetdata, session_t peer_id,
 			u8 channelnum, bool reliable);
 
+	// Feeds the round trip time of an acknowledged packet to the peer
+	void reportAckedRTT(UDPPeer *peer, const BufferedPacket &p);
+
 	SharedBuffer<u8> handlePacketType_Control(Channel *channel,
 			const SharedBuffer<u8> &packetdata, Peer *peer, u8 channelnum,
 			bool reliable);
@@ -165,5 +180,7 @@ class ConnectionReceiveThread : public Thread
 	static const PacketTypeHandler packetTypeRouter[PACKET_TYPE_MAX];
 
 	Connection *m_connection = nullptr;
+	// (peer_id, channel) that received reliables since the last SACK
+	std::set<std::pair<session_t, u8>> m_pending_sacks;
 };
 }
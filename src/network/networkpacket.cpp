@@ -35,11 +35,6 @@ m_datasize(datasize), m_command(command)
 	m_data.resize(m_datasize);
 }
 
-NetworkPacket::~NetworkPacket()
-{
-	m_data.clear();
-}
-
 void NetworkPacket::checkReadOffset(u32 from_offset, u32 field_size)
 {
 	if (from_offset + field_size > m_datasize) {
@@ -68,7 +63,7 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 
 void NetworkPacket::clear()
 {
-	m_data.clear();
+	m_data = PacketBuffer();
 	m_datasize = 0;
 	m_read_offset = 0;
 	m_command = 0;
@@ -87,6 +82,8 @@ void NetworkPacket::putRawString(const char* src, u32 len)
 	if (m_read_offset + len > m_datasize) {
 		m_datasize = m_read_offset + len;
 		m_data.resize(m_datasize);
+	} else {
+		m_data.makeUnique();
 	}
 
 	if (len == 0)
@@ -557,3 +554,11 @@ Buffer<u8> NetworkPacket::oldForgePacket()
 
 	return sb;
 }
+
+PacketBuffer NetworkPacket::forgePacket()
+{
+	PacketBuffer buf = m_data;
+	writeU16(buf.prepend(2), m_command);
+
+	return buf;
+}
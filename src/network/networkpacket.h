@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/pointer.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
 #include <SColor.h>
 
 class NetworkPacket
@@ -32,7 +33,7 @@ class NetworkPacket
 	NetworkPacket(u16 command, u32 datasize);
 	NetworkPacket() = default;
 
-	~NetworkPacket();
+	~NetworkPacket() = default;
 
 	void putRawPacket(const u8 *data, u32 datasize, session_t peer_id);
 	void clear();
@@ -118,6 +119,10 @@ class NetworkPacket
 	// ^ this comment has been here for 4 years
 	Buffer<u8> oldForgePacket();
 
+	// Returns the command and data, sharing the data instead of copying it.
+	// Later writes to this packet do not change the returned buffer.
+	PacketBuffer forgePacket();
+
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size);
 
@@ -126,10 +131,12 @@ class NetworkPacket
 		if (m_read_offset + field_size > m_datasize) {
 			m_datasize = m_read_offset + field_size;
 			m_data.resize(m_datasize);
+		} else {
+			m_data.makeUnique();
 		}
 	}
 
-	std::vector<u8> m_data;
+	PacketBuffer m_data;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0;
 	u16 m_command = 0;
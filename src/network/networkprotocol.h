@@ -215,9 +215,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		new fields for TOCLIENT_SET_LIGHTING and TOCLIENT_SET_SKY
 		Send forgotten TweenedParameter properties
 		[scheduled bump for 5.7.0]
+	PROTOCOL VERSION 43:
+		AO_CMD_UPDATE_POSITION may carry a keyframe id
+		AO_CMD_UPDATE_POSITION_DELTA added
+		TOCLIENT_NODE_CHANGES added
 */
 
-#define LATEST_PROTOCOL_VERSION 42
+#define LATEST_PROTOCOL_VERSION 43
 #define LATEST_PROTOCOL_VERSION_STRING TOSTRING(LATEST_PROTOCOL_VERSION)
 
 // Server's supported network protocol range
@@ -862,7 +866,20 @@ enum ToClientCommand
 			f32 center_weight_power
 	*/
 
-	TOCLIENT_NUM_MSG_TYPES = 0x64,
+	TOCLIENT_NODE_CHANGES = 0x64,
+	/*
+		All node changes of a server step, replaces TOCLIENT_ADDNODE and
+		TOCLIENT_REMOVENODE since protocol version 43
+		u16 count
+		for each change
+			v3s16 position
+			u16 param0
+			u8 param1
+			u8 param2
+			u8 keep_metadata
+	*/
+
+	TOCLIENT_NUM_MSG_TYPES = 0x65,
 };
 
 enum ToServerCommand
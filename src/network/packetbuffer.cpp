@@ -0,0 +1,221 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "packetbuffer.h"
+#include "threading/mutex_auto_lock.h"
+#include <cstring>
+#include <mutex>
+
+static std::atomic<u64> s_allocations{0};
+static std::atomic<u64> s_reuses{0};
+static std::atomic<u64> s_copies{0};
+
+class PacketBufferPool
+{
+public:
+	// Storage bigger than this is freed instead of kept for reuse
+	static constexpr size_t max_pooled_capacity = 64 * 1024;
+	static constexpr size_t max_pooled_count = 256;
+
+	static PacketBufferPool &get()
+	{
+		// Never destroyed, so buffers freed during shutdown still have a pool
+		static PacketBufferPool *pool = new PacketBufferPool();
+		return *pool;
+	}
+
+	// Returns storage holding size zeroed bytes
+	PacketBuffer::Storage *take(u32 size)
+	{
+		PacketBuffer::Storage *storage = nullptr;
+		{
+			MutexAutoLock lock(m_mutex);
+			if (!m_free.empty()) {
+				storage = m_free.back();
+				m_free.pop_back();
+			}
+		}
+
+		if (storage) {
+			storage->refcount.store(1, std::memory_order_relaxed);
+			storage->bytes.clear();
+			s_reuses++;
+		} else {
+			storage = new PacketBuffer::Storage();
+			s_allocations++;
+		}
+
+		if (size > storage->bytes.capacity())
+			s_allocations++;
+		storage->bytes.resize(size);
+		return storage;
+	}
+
+	void give(PacketBuffer::Storage *storage)
+	{
+		if (storage->bytes.capacity() <= max_pooled_capacity) {
+			MutexAutoLock lock(m_mutex);
+			if (m_free.size() < max_pooled_count) {
+				m_free.push_back(storage);
+				return;
+			}
+		}
+		delete storage;
+	}
+
+private:
+	PacketBufferPool() = default;
+
+	std::mutex m_mutex;
+	std::vector<PacketBuffer::Storage *> m_free;
+};
+
+PacketBuffer::PacketBuffer(u32 size)
+{
+	allocate(size);
+}
+
+PacketBuffer::PacketBuffer(const u8 *data, u32 size)
+{
+	allocate(size);
+	if (size != 0)
+		memcpy(this->data(), data, size);
+}
+
+PacketBuffer::PacketBuffer(const PacketBuffer &other) :
+	m_storage(other.m_storage),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	if (m_storage)
+		m_storage->refcount.fetch_add(1, std::memory_order_relaxed);
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other) noexcept :
+	m_storage(other.m_storage),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	other.m_storage = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+}
+
+PacketBuffer &PacketBuffer::operator=(const PacketBuffer &other)
+{
+	if (this == &other)
+		return *this;
+	if (other.m_storage)
+		other.m_storage->refcount.fetch_add(1, std::memory_order_relaxed);
+	release();
+	m_storage = other.m_storage;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	return *this;
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+	release();
+	m_storage = other.m_storage;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	other.m_storage = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+	return *this;
+}
+
+u8 *PacketBuffer::prepend(u32 n)
+{
+	if (m_storage && m_offset >= n) {
+		u32 expected = m_offset;
+		if (m_storage->head.compare_exchange_strong(expected, m_offset - n,
+				std::memory_order_relaxed)) {
+			m_offset -= n;
+			m_size += n;
+			return data();
+		}
+	}
+
+	// No room left in front of the data, or another handle took it
+	PacketBuffer copy(n + m_size);
+	if (m_size != 0)
+		memcpy(copy.data() + n, data(), m_size);
+	if (m_storage)
+		s_copies++;
+	*this = std::move(copy);
+	return data();
+}
+
+void PacketBuffer::resize(u32 size)
+{
+	if (!m_storage) {
+		allocate(size);
+		return;
+	}
+
+	makeUnique();
+	if (m_offset + size > m_storage->bytes.capacity())
+		s_allocations++;
+	m_storage->bytes.resize(m_offset + size);
+	m_size = size;
+}
+
+void PacketBuffer::makeUnique()
+{
+	if (!m_storage)
+		return;
+
+	if (m_storage->refcount.load(std::memory_order_acquire) == 1) {
+		// Nobody else uses the space in front of the data any more
+		m_storage->head.store(m_offset, std::memory_order_relaxed);
+		return;
+	}
+
+	*this = PacketBuffer(data(), m_size);
+	s_copies++;
+}
+
+PacketBufferStats PacketBuffer::getStats()
+{
+	PacketBufferStats stats;
+	stats.allocations = s_allocations.load();
+	stats.reuses = s_reuses.load();
+	stats.copies = s_copies.load();
+	return stats;
+}
+
+void PacketBuffer::allocate(u32 size)
+{
+	m_storage = PacketBufferPool::get().take(HEADROOM + size);
+	m_storage->head.store(HEADROOM, std::memory_order_relaxed);
+	m_offset = HEADROOM;
+	m_size = size;
+}
+
+void PacketBuffer::release()
+{
+	if (m_storage && m_storage->refcount.fetch_sub(1,
+			std::memory_order_acq_rel) == 1)
+		PacketBufferPool::get().give(m_storage);
+	m_storage = nullptr;
+}
@@ -0,0 +1,108 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <atomic>
+#include <vector>
+
+struct PacketBufferStats
+{
+	// Heap allocations made for packet storage
+	u64 allocations = 0;
+	// Storage taken from the pool without allocating
+	u64 reuses = 0;
+	// Payloads copied because the storage or its headroom was in use
+	u64 copies = 0;
+};
+
+/*
+	Reference-counted byte buffer for packets on their way to the socket.
+
+	Free space is kept in front of the data so that every protocol layer
+	can put its header there with prepend() instead of copying the data
+	into a bigger buffer. Copies of a PacketBuffer share the storage.
+	The first one to prepend takes the free space; the others get their
+	own copy of the data when they prepend.
+
+	Storage comes from a pool and goes back to it when the last
+	PacketBuffer using it is gone.
+
+	Handles may be passed between threads, but one handle must not be
+	used by two threads at once. Shared data must not be written to; call
+	makeUnique() first.
+*/
+class PacketBuffer
+{
+public:
+	// Free space reserved in front of new data. Enough for the command,
+	// split, reliable and base headers.
+	static constexpr u32 HEADROOM = 24;
+
+	PacketBuffer() = default;
+	// Allocates size bytes of zeroed data
+	explicit PacketBuffer(u32 size);
+	// Copies size bytes of data
+	PacketBuffer(const u8 *data, u32 size);
+
+	PacketBuffer(const PacketBuffer &other);
+	PacketBuffer(PacketBuffer &&other) noexcept;
+	PacketBuffer &operator=(const PacketBuffer &other);
+	PacketBuffer &operator=(PacketBuffer &&other) noexcept;
+
+	~PacketBuffer() { release(); }
+
+	u8 *operator*() const { return data(); }
+	u8 &operator[](u32 i) const { return data()[i]; }
+
+	u8 *data() const
+	{
+		return m_storage ? m_storage->bytes.data() + m_offset : nullptr;
+	}
+	u32 getSize() const { return m_size; }
+
+	// Grows the data by n bytes at the front and returns a pointer to them
+	u8 *prepend(u32 n);
+	// Changes the size of the data, keeping what fits
+	void resize(u32 size);
+	// Copies the data if another PacketBuffer shares it
+	void makeUnique();
+
+	static PacketBufferStats getStats();
+
+private:
+	friend class PacketBufferPool;
+
+	struct Storage
+	{
+		std::atomic<u32> refcount{1};
+		// Start of the data used by any handle. Headers are only written
+		// below it, by the handle that moves it down.
+		std::atomic<u32> head{0};
+		std::vector<u8> bytes;
+	};
+
+	void allocate(u32 size);
+	void release();
+
+	Storage *m_storage = nullptr;
+	u32 m_offset = 0;
+	u32 m_size = 0;
+};
@@ -31,10 +31,26 @@ enum ToServerConnectionState {
 	TOSERVER_STATE_INGAME,
 	TOSERVER_STATE_ALL,
 };
+
+/*
+	Where a command is handled, depending on the state its handler touches
+*/
+enum ToServerCommandContext {
+	// Environment, scripting or other server state:
+	// server thread, environment locked
+	TOSERVER_CONTEXT_ENV,
+	// Only RemoteClient state, behind the client lock:
+	// server thread, environment not locked
+	TOSERVER_CONTEXT_SERVER,
+	// Slow and thread-safe: packet handler threads, see Server::handleCommand
+	TOSERVER_CONTEXT_WORKER,
+};
+
 struct ToServerCommandHandler
 {
     const std::string name;
     ToServerConnectionState state;
+    ToServerCommandContext context;
     void (Server::*handler)(NetworkPacket* pkt);
 };
 
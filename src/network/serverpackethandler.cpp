@@ -232,15 +232,15 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	std::string encpwd; // encrypted Password field for the user
 	bool has_auth = m_script->getAuth(playername, &encpwd, nullptr);
 	u32 auth_mechs = 0;
-
-	client->chosen_mech = AUTH_MECHANISM_NONE;
+	std::string enc_pwd;
+	bool create_player_on_auth_success = false;
 
 	if (has_auth) {
 		std::vector<std::string> pwd_components = str_split(encpwd, '#');
 		if (pwd_components.size() == 4) {
 			if (pwd_components[1] == "1") { // 1 means srp
 				auth_mechs |= AUTH_MECHANISM_SRP;
-				client->enc_pwd = encpwd;
+				enc_pwd = encpwd;
 			} else {
 				actionstream << "User " << playername << " tried to log in, "
 					"but password field was invalid (unknown mechcode)." <<
@@ -250,7 +250,7 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 			}
 		} else if (base64_is_valid(encpwd)) {
 			auth_mechs |= AUTH_MECHANISM_LEGACY_PASSWORD;
-			client->enc_pwd = encpwd;
+			enc_pwd = encpwd;
 		} else {
 			actionstream << "User " << playername << " tried to log in, but "
 				"password field was invalid (invalid base64)." << std::endl;
@@ -263,13 +263,22 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 			auth_mechs |= AUTH_MECHANISM_FIRST_SRP;
 		} else {
 			// Take care of default passwords.
-			client->enc_pwd = get_encoded_srp_verifier(playerName, default_password);
+			enc_pwd = get_encoded_srp_verifier(playerName, default_password);
 			auth_mechs |= AUTH_MECHANISM_SRP;
 			// Allocate player in db, but only on successful login.
-			client->create_player_on_auth_success = true;
+			create_player_on_auth_success = true;
 		}
 	}
 
+	{
+		// Also used by handleCommand_SrpBytesA on the packet handler threads
+		ClientInterface::AutoLock lock(m_clients);
+		client->chosen_mech = AUTH_MECHANISM_NONE;
+		client->enc_pwd = enc_pwd;
+		client->create_player_on_auth_success = create_player_on_auth_success;
+		client->allowed_auth_mechs = auth_mechs;
+	}
+
 	/*
 		Answer with a TOCLIENT_HELLO
 	*/
@@ -286,7 +295,6 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 
 	Send(&resp_pkt);
 
-	client->allowed_auth_mechs = auth_mechs;
 	client->setDeployedCompressionMode(depl_compress_mode);
 
 	m_clients.event(peer_id, CSE_Hello);
@@ -449,6 +457,8 @@ void Server::handleCommand_GotBlocks(NetworkPacket* pkt)
 
 	ClientInterface::AutoLock lock(m_clients);
 	RemoteClient *client = m_clients.lockedGetClientNoEx(pkt->getPeerId());
+	if (!client)
+		return;
 
 	for (u16 i = 0; i < count; i++) {
 		v3s16 p;
@@ -557,13 +567,16 @@ void Server::handleCommand_DeletedBlocks(NetworkPacket* pkt)
 	u8 count;
 	*pkt >> count;
 
-	RemoteClient *client = getClient(pkt->getPeerId());
-
 	if ((s16)pkt->getSize() < 1 + (int)count * 6) {
 		throw con::InvalidIncomingDataException
 				("DELETEDBLOCKS length is too short");
 	}
 
+	ClientInterface::AutoLock lock(m_clients);
+	RemoteClient *client = m_clients.lockedGetClientNoEx(pkt->getPeerId());
+	if (!client)
+		return;
+
 	for (u16 i = 0; i < count; i++) {
 		v3s16 p;
 		*pkt >> p;
@@ -1497,7 +1510,12 @@ void Server::handleCommand_FirstSrp(NetworkPacket* pkt)
 
 	// Either this packet is sent because the user is new or to change the password
 	if (cstate == CS_HelloSent) {
-		if (!client->isMechAllowed(AUTH_MECHANISM_FIRST_SRP)) {
+		bool mech_allowed;
+		{
+			ClientInterface::AutoLock lock(m_clients);
+			mech_allowed = client->isMechAllowed(AUTH_MECHANISM_FIRST_SRP);
+		}
+		if (!mech_allowed) {
 			actionstream << "Server: Client from " << addr_s
 					<< " tried to set password without being "
 					<< "authenticated, or the username being new." << std::endl;
@@ -1564,107 +1582,143 @@ void Server::handleCommand_FirstSrp(NetworkPacket* pkt)
 
 void Server::handleCommand_SrpBytesA(NetworkPacket* pkt)
 {
+	/*
+		Handled by the packet handler threads: the client is only touched
+		with the client list locked and access is denied on the server thread.
+		Computing the verifier is the slow part and needs no lock.
+	*/
 	session_t peer_id = pkt->getPeerId();
-	RemoteClient *client = getClient(peer_id, CS_Invalid);
-	ClientState cstate = client->getState();
-
-	if (!((cstate == CS_HelloSent) || (cstate == CS_Active))) {
-		actionstream << "Server: got SRP _A packet in wrong state " << cstate <<
-			" from " << getPeerAddress(peer_id).serializeString() <<
-			". Ignoring." << std::endl;
-		return;
-	}
+	auto deny_access = [this, peer_id] (AccessDeniedCode reason) {
+		runOnServerThread([this, peer_id, reason] () {
+			DenyAccess(peer_id, reason);
+		});
+	};
 
-	const bool wantSudo = (cstate == CS_Active);
+	std::string bytes_A;
+	u8 based_on;
+	AuthMechanism chosen;
+	ClientState cstate;
+	std::string playername, enc_pwd;
+	{
+		ClientInterface::AutoLock lock(m_clients);
+		RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Invalid);
+		if (!client)
+			return;
+		cstate = client->getState();
 
-	if (client->chosen_mech != AUTH_MECHANISM_NONE) {
-		actionstream << "Server: got SRP _A packet, while auth is already "
-			"going on with mech " << client->chosen_mech << " from " <<
-			getPeerAddress(peer_id).serializeString() <<
-			" (wantSudo=" << wantSudo << "). Ignoring." << std::endl;
-		if (wantSudo) {
-			DenySudoAccess(peer_id);
+		if (!((cstate == CS_HelloSent) || (cstate == CS_Active))) {
+			actionstream << "Server: got SRP _A packet in wrong state " << cstate <<
+				" from " << getPeerAddress(peer_id).serializeString() <<
+				". Ignoring." << std::endl;
 			return;
 		}
 
-		DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
-		return;
-	}
-
-	std::string bytes_A;
-	u8 based_on;
-	*pkt >> bytes_A >> based_on;
+		const bool wantSudo = (cstate == CS_Active);
 
-	infostream << "Server: TOSERVER_SRP_BYTES_A received with "
-		<< "based_on=" << int(based_on) << " and len_A="
-		<< bytes_A.length() << "." << std::endl;
-
-	AuthMechanism chosen = (based_on == 0) ?
-		AUTH_MECHANISM_LEGACY_PASSWORD : AUTH_MECHANISM_SRP;
+		if (client->chosen_mech != AUTH_MECHANISM_NONE) {
+			actionstream << "Server: got SRP _A packet, while auth is already "
+				"going on with mech " << client->chosen_mech << " from " <<
+				getPeerAddress(peer_id).serializeString() <<
+				" (wantSudo=" << wantSudo << "). Ignoring." << std::endl;
+			if (wantSudo) {
+				DenySudoAccess(peer_id);
+				return;
+			}
 
-	if (wantSudo) {
-		if (!client->isSudoMechAllowed(chosen)) {
-			actionstream << "Server: Player \"" << client->getName() <<
-				"\" at " << getPeerAddress(peer_id).serializeString() <<
-				" tried to change password using unallowed mech " << chosen <<
-				"." << std::endl;
-			DenySudoAccess(peer_id);
+			deny_access(SERVER_ACCESSDENIED_UNEXPECTED_DATA);
 			return;
 		}
-	} else {
-		if (!client->isMechAllowed(chosen)) {
-			actionstream << "Server: Client tried to authenticate from " <<
-				getPeerAddress(peer_id).serializeString() <<
-				" using unallowed mech " << chosen << "." << std::endl;
-			DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
-			return;
+
+		*pkt >> bytes_A >> based_on;
+
+		infostream << "Server: TOSERVER_SRP_BYTES_A received with "
+			<< "based_on=" << int(based_on) << " and len_A="
+			<< bytes_A.length() << "." << std::endl;
+
+		chosen = (based_on == 0) ?
+			AUTH_MECHANISM_LEGACY_PASSWORD : AUTH_MECHANISM_SRP;
+
+		if (wantSudo) {
+			if (!client->isSudoMechAllowed(chosen)) {
+				actionstream << "Server: Player \"" << client->getName() <<
+					"\" at " << getPeerAddress(peer_id).serializeString() <<
+					" tried to change password using unallowed mech " << chosen <<
+					"." << std::endl;
+				DenySudoAccess(peer_id);
+				return;
+			}
+		} else {
+			if (!client->isMechAllowed(chosen)) {
+				actionstream << "Server: Client tried to authenticate from " <<
+					getPeerAddress(peer_id).serializeString() <<
+					" using unallowed mech " << chosen << "." << std::endl;
+				deny_access(SERVER_ACCESSDENIED_UNEXPECTED_DATA);
+				return;
+			}
 		}
-	}
 
-	client->chosen_mech = chosen;
+		client->chosen_mech = chosen;
+		playername = client->getName();
+		enc_pwd = client->enc_pwd;
+	}
 
+	const bool wantSudo = (cstate == CS_Active);
 	std::string salt, verifier;
 
 	if (based_on == 0) {
 
-		generate_srp_verifier_and_salt(client->getName(), client->enc_pwd,
+		generate_srp_verifier_and_salt(playername, enc_pwd,
 			&verifier, &salt);
-	} else if (!decode_srp_verifier_and_salt(client->enc_pwd, &verifier, &salt)) {
+	} else if (!decode_srp_verifier_and_salt(enc_pwd, &verifier, &salt)) {
 		// Non-base64 errors should have been catched in the init handler
-		actionstream << "Server: User " << client->getName() <<
+		actionstream << "Server: User " << playername <<
 			" tried to log in, but srp verifier field was invalid (most likely "
 			"invalid base64)." << std::endl;
-		DenyAccess(peer_id, SERVER_ACCESSDENIED_SERVER_FAIL);
+		deny_access(SERVER_ACCESSDENIED_SERVER_FAIL);
 		return;
 	}
 
 	char *bytes_B = 0;
 	size_t len_B = 0;
 
-	client->auth_data = srp_verifier_new(SRP_SHA256, SRP_NG_2048,
-		client->getName().c_str(),
+	SRPVerifier *auth_data = srp_verifier_new(SRP_SHA256, SRP_NG_2048,
+		playername.c_str(),
 		(const unsigned char *) salt.c_str(), salt.size(),
 		(const unsigned char *) verifier.c_str(), verifier.size(),
 		(const unsigned char *) bytes_A.c_str(), bytes_A.size(),
 		NULL, 0,
 		(unsigned char **) &bytes_B, &len_B, NULL, NULL);
 
-	if (!bytes_B) {
-		actionstream << "Server: User " << client->getName()
-			<< " tried to log in, SRP-6a safety check violated in _A handler."
-			<< std::endl;
-		if (wantSudo) {
-			DenySudoAccess(peer_id);
-			client->resetChosenMech();
+	// bytes_B belongs to auth_data, which the client may free once unlocked
+	NetworkPacket resp_pkt(TOCLIENT_SRP_BYTES_S_B, 0, peer_id);
+	{
+		ClientInterface::AutoLock lock(m_clients);
+		RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Invalid);
+		// Gone or reset while the verifier was computed
+		if (!client || client->getState() != cstate ||
+				client->chosen_mech != chosen || client->auth_data) {
+			srp_verifier_delete(auth_data);
 			return;
 		}
+		client->auth_data = auth_data;
 
-		DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
-		return;
+		if (!bytes_B) {
+			actionstream << "Server: User " << playername
+				<< " tried to log in, SRP-6a safety check violated in _A handler."
+				<< std::endl;
+			if (wantSudo) {
+				DenySudoAccess(peer_id);
+				client->resetChosenMech();
+				return;
+			}
+
+			deny_access(SERVER_ACCESSDENIED_UNEXPECTED_DATA);
+			return;
+		}
+
+		resp_pkt << salt << std::string(bytes_B, len_B);
 	}
 
-	NetworkPacket resp_pkt(TOCLIENT_SRP_BYTES_S_B, 0, peer_id);
-	resp_pkt << salt << std::string(bytes_B, len_B);
 	Send(&resp_pkt);
 }
 
@@ -1686,35 +1740,49 @@ void Server::handleCommand_SrpBytesM(NetworkPacket* pkt)
 		return;
 	}
 
-	if (client->chosen_mech != AUTH_MECHANISM_SRP &&
-			client->chosen_mech != AUTH_MECHANISM_LEGACY_PASSWORD) {
-		warningstream << "Server: got SRP_M packet, while auth "
-			"is going on with mech " << client->chosen_mech << " from "
-			<< addr_s << " (wantSudo=" << wantSudo << "). Denying." << std::endl;
-		if (wantSudo) {
-			DenySudoAccess(peer_id);
+	std::string bytes_M;
+	*pkt >> bytes_M;
+
+	unsigned char *bytes_HAMK = 0;
+	{
+		// chosen_mech and auth_data are set by the packet handler threads
+		ClientInterface::AutoLock lock(m_clients);
+
+		if (client->chosen_mech != AUTH_MECHANISM_SRP &&
+				client->chosen_mech != AUTH_MECHANISM_LEGACY_PASSWORD) {
+			warningstream << "Server: got SRP_M packet, while auth "
+				"is going on with mech " << client->chosen_mech << " from "
+				<< addr_s << " (wantSudo=" << wantSudo << "). Denying." << std::endl;
+			if (wantSudo) {
+				DenySudoAccess(peer_id);
+				return;
+			}
+
+			DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
 			return;
 		}
 
-		DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
-		return;
-	}
-
-	std::string bytes_M;
-	*pkt >> bytes_M;
+		if (!client->auth_data) {
+			actionstream << "Server: User " << playername << " at " << addr_s
+				<< " sent bytes_M before bytes_A was handled." << std::endl;
+			DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
+			return;
+		}
 
-	if (srp_verifier_get_session_key_length((SRPVerifier *) client->auth_data)
-			!= bytes_M.size()) {
-		actionstream << "Server: User " << playername << " at " << addr_s
-			<< " sent bytes_M with invalid length " << bytes_M.size() << std::endl;
-		DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
-		return;
-	}
+		if (srp_verifier_get_session_key_length((SRPVerifier *) client->auth_data)
+				!= bytes_M.size()) {
+			actionstream << "Server: User " << playername << " at " << addr_s
+				<< " sent bytes_M with invalid length " << bytes_M.size() << std::endl;
+			DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
+			return;
+		}
 
-	unsigned char *bytes_HAMK = 0;
+		srp_verifier_verify_session((SRPVerifier *) client->auth_data,
+			(unsigned char *)bytes_M.c_str(), &bytes_HAMK);
 
-	srp_verifier_verify_session((SRPVerifier *) client->auth_data,
-		(unsigned char *)bytes_M.c_str(), &bytes_HAMK);
+		if (!bytes_HAMK && wantSudo)
+			client->resetChosenMech();
+	}
 
 	if (!bytes_HAMK) {
 		if (wantSudo) {
@@ -1722,7 +1790,6 @@ void Server::handleCommand_SrpBytesM(NetworkPacket* pkt)
 				<< " tried to change their password, but supplied wrong"
 				<< " (SRP) password for authentication." << std::endl;
 			DenySudoAccess(peer_id);
-			client->resetChosenMech();
 			return;
 		}
 
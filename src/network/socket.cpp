@@ -54,6 +54,13 @@ typedef int socklen_t;
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+// sendmmsg() and recvmmsg()
+#if defined(__linux__)
+#define USE_BATCH_IO 1
+#else
+#define USE_BATCH_IO 0
+#endif
+
 // Set to true to enable verbose debug output
 bool socket_enable_debug_output = false; // yuck
 
@@ -188,30 +195,68 @@ void UDPSocket::Bind(Address addr)
 	}
 }
 
-void UDPSocket::Send(const Address &destination, const void *data, int size)
+static void print_datagram(std::ostream &os, const void *data, int size)
+{
+	os << ", size=" << size << ", data=";
+	for (int i = 0; i < size && i < 20; i++) {
+		if (i % 2 == 0)
+			os << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		os << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+	if (size > 20)
+		os << "...";
+}
+
+static socklen_t to_sockaddr(const Address &addr, struct sockaddr_storage *out)
+{
+	memset(out, 0, sizeof(*out));
+	if (addr.isIPv6()) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(out);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *address = reinterpret_cast<struct sockaddr_in *>(out);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address from_sockaddr(const struct sockaddr_storage &in)
+{
+	if (in.ss_family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&in);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(address->sin6_port));
+	}
+
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&in);
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
+bool UDPSocket::prepareSend(const Address &destination, const void *data, int size)
 {
 	bool dumping_packet = false; // for INTERNET_SIMULATOR
 
 	if (INTERNET_SIMULATOR)
 		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
 
+	const float loss = m_packet_loss.load(std::memory_order_relaxed);
+	if (loss > 0.0f && !dumping_packet) {
+		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+		dumping_packet = dist(m_loss_random) < loss;
+	}
+
 	if (socket_enable_debug_output) {
-		// Print packet destination and size
+		// Print packet destination, size and contents
 		tracestream << (int)m_handle << " -> ";
 		destination.print(tracestream);
-		tracestream << ", size=" << size;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < size && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
-		}
-
-		if (size > 20)
-			tracestream << "...";
+		print_datagram(tracestream, data, size);
 
 		if (dumping_packet)
 			tracestream << " (DUMPED BY INTERNET_SIMULATOR)";
@@ -223,98 +268,183 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 		// Lol let's forget it
 		tracestream << "UDPSocket::Send(): INTERNET_SIMULATOR: dumping packet."
 			<< std::endl;
-		return;
+		return false;
 	}
 
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
+	return true;
+}
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
+void UDPSocket::Send(const Address &destination, const void *data, int size)
+{
+	if (!prepareSend(destination, data, size))
+		return;
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	struct sockaddr_storage address;
+	socklen_t address_len = to_sockaddr(destination, &address);
+
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
 }
 
+int UDPSocket::SendBatch(const UDPOutgoingDatagram *datagrams, int count)
+{
+	int failed = 0;
+
+#if USE_BATCH_IO
+	struct mmsghdr msgs[max_batch_size];
+	struct iovec iovs[max_batch_size];
+	struct sockaddr_storage addresses[max_batch_size];
+
+	int next = 0;
+	while (next < count && m_batch_io) {
+		// Fill in the next batch, leaving out dropped datagrams
+		int n = 0;
+		for (; next < count && n < max_batch_size; next++) {
+			const UDPOutgoingDatagram &d = datagrams[next];
+			try {
+				if (!prepareSend(d.destination, d.data, d.size))
+					continue;
+			} catch (SendFailedException &e) {
+				failed++;
+				continue;
+			}
+
+			iovs[n].iov_base = const_cast<void *>(d.data);
+			iovs[n].iov_len = d.size;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addresses[n];
+			msgs[n].msg_hdr.msg_namelen = to_sockaddr(d.destination, &addresses[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			n++;
+		}
+
+		int done = 0;
+		while (done < n) {
+			int sent = -1;
+			if (m_batch_io) {
+				sent = sendmmsg(m_handle, &msgs[done], n - done, 0);
+				if (sent < 0 && errno == ENOSYS)
+					m_batch_io = false;
+			}
+			if (!m_batch_io)
+				sent = sendmsg(m_handle, &msgs[done].msg_hdr, 0) < 0 ? -1 : 1;
+
+			if (sent <= 0) {
+				// Skip the datagram that failed
+				failed++;
+				done++;
+			} else {
+				done += sent;
+			}
+		}
+	}
+	// Send the rest one by one if batching turned out to be unsupported
+	datagrams += next;
+	count -= next;
+#endif
+
+	for (int i = 0; i < count; i++) {
+		try {
+			Send(datagrams[i].destination, datagrams[i].data, datagrams[i].size);
+		} catch (SendFailedException &e) {
+			failed++;
+		}
+	}
+	return failed;
+}
+
 int UDPSocket::Receive(Address &sender, void *data, int size)
 {
 	// Return on timeout
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
-
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
-
-		if (received < 0)
-			return -1;
-
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
-
-		socklen_t address_len = sizeof(address);
+	return receiveNow(sender, data, size);
+}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+int UDPSocket::receiveNow(Address &sender, void *data, int size)
+{
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
 
-		if (received < 0)
-			return -1;
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+	if (received < 0)
+		return -1;
 
-		sender = Address(address_ip, address_port);
-	}
+	sender = from_sockaddr(address);
 
 	if (socket_enable_debug_output) {
-		// Print packet sender and size
+		// Print packet sender, size and contents
 		tracestream << (int)m_handle << " <- ";
 		sender.print(tracestream);
-		tracestream << ", size=" << received;
-
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
-		}
-		if (received > 20)
-			tracestream << "...";
-
+		print_datagram(tracestream, data, received);
 		tracestream << std::endl;
 	}
 
 	return received;
 }
 
+int UDPSocket::ReceiveBatch(UDPIncomingDatagram *datagrams, int count)
+{
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return -1;
+
+#if USE_BATCH_IO
+	if (m_batch_io) {
+		struct mmsghdr msgs[max_batch_size];
+		struct iovec iovs[max_batch_size];
+		struct sockaddr_storage addresses[max_batch_size];
+
+		const int n = MYMIN(count, max_batch_size);
+		for (int i = 0; i < n; i++) {
+			iovs[i].iov_base = datagrams[i].data;
+			iovs[i].iov_len = datagrams[i].capacity;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// Only take what is already there
+		int received = recvmmsg(m_handle, msgs, n, MSG_DONTWAIT, nullptr);
+		if (received < 0 && errno == ENOSYS) {
+			m_batch_io = false;
+		} else if (received <= 0) {
+			return -1;
+		} else {
+			for (int i = 0; i < received; i++) {
+				UDPIncomingDatagram &d = datagrams[i];
+				d.sender = from_sockaddr(addresses[i]);
+				d.size = msgs[i].msg_len;
+
+				if (socket_enable_debug_output) {
+					tracestream << (int)m_handle << " <- ";
+					d.sender.print(tracestream);
+					print_datagram(tracestream, d.data, d.size);
+					tracestream << std::endl;
+				}
+			}
+			return received;
+		}
+	}
+#endif
+
+	UDPIncomingDatagram &d = datagrams[0];
+	d.size = receiveNow(d.sender, d.data, d.capacity);
+	return d.size < 0 ? -1 : 1;
+}
+
 int UDPSocket::GetHandle()
 {
 	return m_handle;
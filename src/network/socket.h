@@ -19,8 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <ostream>
 #include <cstring>
+#include <random>
 #include "address.h"
 #include "irrlichttypes.h"
 #include "networkexceptions.h"
@@ -30,9 +32,30 @@ extern bool socket_enable_debug_output;
 void sockets_init();
 void sockets_cleanup();
 
+// A datagram passed to UDPSocket::SendBatch()
+struct UDPOutgoingDatagram
+{
+	Address destination;
+	const void *data;
+	int size;
+};
+
+// A buffer passed to UDPSocket::ReceiveBatch()
+struct UDPIncomingDatagram
+{
+	Address sender;
+	void *data;
+	int capacity;
+	// Set to the size of the received data
+	int size;
+};
+
 class UDPSocket
 {
 public:
+	// Most datagrams moved by one system call in the batched functions
+	static const int max_batch_size = 64;
+
 	UDPSocket() = default;
 
 	UDPSocket(bool ipv6);
@@ -42,15 +65,34 @@ class UDPSocket
 	bool init(bool ipv6, bool noExceptions = false);
 
 	void Send(const Address &destination, const void *data, int size);
+	// Sends several datagrams with as few system calls as possible.
+	// Returns the number of datagrams that could not be sent.
+	int SendBatch(const UDPOutgoingDatagram *datagrams, int count);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+	// Waits like Receive(), then receives up to count datagrams that are
+	// already there. Returns the number received, or -1 if there is no data.
+	int ReceiveBatch(UDPIncomingDatagram *datagrams, int count);
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
+	// Drops this fraction of the sent datagrams, for testing
+	void setPacketLoss(float loss) { m_packet_loss = loss; }
 
 private:
+	// Handles debug output, INTERNET_SIMULATOR and setPacketLoss().
+	// Returns false if the datagram should be dropped.
+	bool prepareSend(const Address &destination, const void *data, int size);
+	// Receives one datagram without waiting
+	int receiveNow(Address &sender, void *data, int size);
+
 	int m_handle;
 	int m_timeout_ms;
 	int m_addr_family;
+	// Cleared if the system does not support sendmmsg()/recvmmsg()
+	bool m_batch_io = true;
+	std::atomic<float> m_packet_loss{0.0f};
+	// Only used by the sending thread
+	std::minstd_rand m_loss_random;
 };
@@ -23,6 +23,8 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include "noise.h"
 #include <iostream>
@@ -464,6 +466,533 @@ void Noise::resizeNoiseBuf(bool is3d)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+	Kernels for the noise maps.
+
+	The SIMD versions do the same float operations in the same order as
+	the scalar ones, without fused multiply-add, so all of them give
+	bit-identical results.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define NOISE_X86_SIMD 1
+	#include <immintrin.h>
+#else
+	#define NOISE_X86_SIMD 0
+#endif
+
+namespace {
+
+struct NoiseKernels {
+	// out[i] = noise2d(x0 + i, y, seed)
+	void (*lattice2D)(float *out, u32 count, s32 x0, s32 y, s32 seed);
+	// out[i] = noise3d(x0 + i, y, z, seed)
+	void (*lattice3D)(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed);
+	// Interpolates a lattice row at the given columns and weights
+	void (*interpX)(float *out, const float *row, const u32 *index,
+		const float *weight, u32 count);
+	void (*interpY)(float *out, const float *a, const float *b, float t,
+		u32 count);
+	void (*interpYZ)(float *out, const float *a, const float *b,
+		const float *c, const float *d, float ty, float tz, u32 count);
+	// result[i] += g * gradient[i]
+	void (*accumulate)(float *result, const float *gradient, float g,
+		size_t count);
+	// result[i] += g * |gradient[i]|
+	void (*accumulateAbs)(float *result, const float *gradient, float g,
+		size_t count);
+	// result[i] += gmap[i] * gradient[i], gmap[i] *= persistence[i]
+	void (*accumulatePersist)(float *result, const float *gradient,
+		float *gmap, const float *persistence, size_t count);
+	// result[i] += gmap[i] * |gradient[i]|, gmap[i] *= persistence[i]
+	void (*accumulatePersistAbs)(float *result, const float *gradient,
+		float *gmap, const float *persistence, size_t count);
+};
+
+// Scalar
+
+void lattice2D_scalar(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noise2d(x0 + i, y, seed);
+}
+
+void lattice3D_scalar(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noise3d(x0 + i, y, z, seed);
+}
+
+void interpX_scalar(float *out, const float *row, const u32 *index,
+	const float *weight, u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = linearInterpolation(row[index[i]], row[index[i] + 1], weight[i]);
+}
+
+void interpY_scalar(float *out, const float *a, const float *b, float t,
+	u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+void interpYZ_scalar(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	for (u32 i = 0; i != count; i++) {
+		float u = linearInterpolation(a[i], b[i], ty);
+		float v = linearInterpolation(c[i], d[i], ty);
+		out[i] = linearInterpolation(u, v, tz);
+	}
+}
+
+void accumulate_scalar(float *result, const float *gradient, float g,
+	size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		result[i] += g * gradient[i];
+}
+
+void accumulateAbs_scalar(float *result, const float *gradient, float g,
+	size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		result[i] += g * std::fabs(gradient[i]);
+}
+
+void accumulatePersist_scalar(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	for (size_t i = 0; i != count; i++) {
+		result[i] += gmap[i] * gradient[i];
+		gmap[i] *= persistence[i];
+	}
+}
+
+void accumulatePersistAbs_scalar(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	for (size_t i = 0; i != count; i++) {
+		result[i] += gmap[i] * std::fabs(gradient[i]);
+		gmap[i] *= persistence[i];
+	}
+}
+
+const NoiseKernels kernels_scalar = {
+	lattice2D_scalar,
+	lattice3D_scalar,
+	interpX_scalar,
+	interpY_scalar,
+	interpYZ_scalar,
+	accumulate_scalar,
+	accumulateAbs_scalar,
+	accumulatePersist_scalar,
+	accumulatePersistAbs_scalar,
+};
+
+#if NOISE_X86_SIMD
+
+// The hash of noise2d() and noise3d() without the coordinate terms
+inline u32 noise_hash_base(s32 y, s32 z, s32 seed)
+{
+	return (u32)NOISE_MAGIC_Y * (u32)y + (u32)NOISE_MAGIC_Z * (u32)z +
+		NOISE_MAGIC_SEED * (u32)seed;
+}
+
+// SSE2
+
+#define SSE2_FN __attribute__((target("sse2")))
+
+SSE2_FN inline __m128i mullo_sse2(__m128i a, __m128i b)
+{
+	// SSE2 has no 32 bit multiplication keeping the low halves
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+SSE2_FN inline __m128 noise_sse2(__m128i x, u32 base)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	__m128i n = _mm_add_epi32(mullo_sse2(x, _mm_set1_epi32(NOISE_MAGIC_X)),
+		_mm_set1_epi32(base));
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i t = _mm_add_epi32(
+		mullo_sse2(mullo_sse2(n, n), _mm_set1_epi32(60493)),
+		_mm_set1_epi32(19990303));
+	n = _mm_add_epi32(mullo_sse2(n, t), _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(n, mask);
+	return _mm_sub_ps(_mm_set1_ps(1.f),
+		_mm_div_ps(_mm_cvtepi32_ps(n), _mm_set1_ps((float)0x40000000)));
+}
+
+SSE2_FN void lattice_sse2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m128i offsets = _mm_setr_epi32(0, 1, 2, 3);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i x = _mm_add_epi32(_mm_set1_epi32(x0 + i), offsets);
+		_mm_storeu_ps(out + i, noise_sse2(x, base));
+	}
+	for (; i != count; i++) {
+		__m128i x = _mm_set1_epi32(x0 + i);
+		out[i] = _mm_cvtss_f32(noise_sse2(x, base));
+	}
+}
+
+SSE2_FN void lattice2D_sse2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	lattice_sse2(out, count, x0, noise_hash_base(y, 0, seed));
+}
+
+SSE2_FN void lattice3D_sse2(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	lattice_sse2(out, count, x0, noise_hash_base(y, z, seed));
+}
+
+SSE2_FN inline __m128 lerp_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+SSE2_FN void interpX_sse2(float *out, const float *row, const u32 *index,
+	const float *weight, u32 count)
+{
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v0 = _mm_setr_ps(row[index[i]], row[index[i + 1]],
+			row[index[i + 2]], row[index[i + 3]]);
+		__m128 v1 = _mm_setr_ps(row[index[i] + 1], row[index[i + 1] + 1],
+			row[index[i + 2] + 1], row[index[i + 3] + 1]);
+		_mm_storeu_ps(out + i, lerp_sse2(v0, v1, _mm_loadu_ps(weight + i)));
+	}
+	interpX_scalar(out + i, row, index + i, weight + i, count - i);
+}
+
+SSE2_FN void interpY_sse2(float *out, const float *a, const float *b, float t,
+	u32 count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(out + i,
+			lerp_sse2(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), vt));
+	}
+	interpY_scalar(out + i, a + i, b + i, t, count - i);
+}
+
+SSE2_FN void interpYZ_sse2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+	const __m128 vtz = _mm_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 u = lerp_sse2(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), vty);
+		__m128 v = lerp_sse2(_mm_loadu_ps(c + i), _mm_loadu_ps(d + i), vty);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, vtz));
+	}
+	interpYZ_scalar(out + i, a + i, b + i, c + i, d + i, ty, tz, count - i);
+}
+
+SSE2_FN inline __m128 abs_sse2(__m128 v)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+}
+
+SSE2_FN void accumulate_sse2(float *result, const float *gradient, float g,
+	size_t count)
+{
+	const __m128 vg = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(vg, _mm_loadu_ps(gradient + i)));
+		_mm_storeu_ps(result + i, r);
+	}
+	accumulate_scalar(result + i, gradient + i, g, count - i);
+}
+
+SSE2_FN void accumulateAbs_sse2(float *result, const float *gradient, float g,
+	size_t count)
+{
+	const __m128 vg = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(vg, abs_sse2(_mm_loadu_ps(gradient + i))));
+		_mm_storeu_ps(result + i, r);
+	}
+	accumulateAbs_scalar(result + i, gradient + i, g, count - i);
+}
+
+SSE2_FN void accumulatePersist_sse2(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 g = _mm_loadu_ps(gmap + i);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(g, _mm_loadu_ps(gradient + i)));
+		_mm_storeu_ps(result + i, r);
+		_mm_storeu_ps(gmap + i, _mm_mul_ps(g, _mm_loadu_ps(persistence + i)));
+	}
+	accumulatePersist_scalar(result + i, gradient + i, gmap + i,
+		persistence + i, count - i);
+}
+
+SSE2_FN void accumulatePersistAbs_sse2(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 g = _mm_loadu_ps(gmap + i);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(g, abs_sse2(_mm_loadu_ps(gradient + i))));
+		_mm_storeu_ps(result + i, r);
+		_mm_storeu_ps(gmap + i, _mm_mul_ps(g, _mm_loadu_ps(persistence + i)));
+	}
+	accumulatePersistAbs_scalar(result + i, gradient + i, gmap + i,
+		persistence + i, count - i);
+}
+
+#undef SSE2_FN
+
+const NoiseKernels kernels_sse2 = {
+	lattice2D_sse2,
+	lattice3D_sse2,
+	interpX_sse2,
+	interpY_sse2,
+	interpYZ_sse2,
+	accumulate_sse2,
+	accumulateAbs_sse2,
+	accumulatePersist_sse2,
+	accumulatePersistAbs_sse2,
+};
+
+// AVX2
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN inline __m256 noise_avx2(__m256i x, u32 base)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	__m256i n = _mm256_add_epi32(
+		_mm256_mullo_epi32(x, _mm256_set1_epi32(NOISE_MAGIC_X)),
+		_mm256_set1_epi32(base));
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i t = _mm256_add_epi32(
+		_mm256_mullo_epi32(_mm256_mullo_epi32(n, n), _mm256_set1_epi32(60493)),
+		_mm256_set1_epi32(19990303));
+	n = _mm256_add_epi32(_mm256_mullo_epi32(n, t), _mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(n, mask);
+	return _mm256_sub_ps(_mm256_set1_ps(1.f),
+		_mm256_div_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps((float)0x40000000)));
+}
+
+AVX2_FN void lattice_avx2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m256i offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0 + i), offsets);
+		_mm256_storeu_ps(out + i, noise_avx2(x, base));
+	}
+	if (i != count) {
+		float tail[8];
+		__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0 + i), offsets);
+		_mm256_storeu_ps(tail, noise_avx2(x, base));
+		for (u32 j = 0; i != count; i++, j++)
+			out[i] = tail[j];
+	}
+}
+
+AVX2_FN void lattice2D_avx2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	lattice_avx2(out, count, x0, noise_hash_base(y, 0, seed));
+}
+
+AVX2_FN void lattice3D_avx2(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	lattice_avx2(out, count, x0, noise_hash_base(y, z, seed));
+}
+
+AVX2_FN inline __m256 lerp_avx2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+AVX2_FN void interpX_avx2(float *out, const float *row, const u32 *index,
+	const float *weight, u32 count)
+{
+	const __m256i one = _mm256_set1_epi32(1);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i *)(index + i));
+		__m256 v0 = _mm256_i32gather_ps(row, idx, 4);
+		__m256 v1 = _mm256_i32gather_ps(row, _mm256_add_epi32(idx, one), 4);
+		_mm256_storeu_ps(out + i, lerp_avx2(v0, v1, _mm256_loadu_ps(weight + i)));
+	}
+	interpX_scalar(out + i, row, index + i, weight + i, count - i);
+}
+
+AVX2_FN void interpY_avx2(float *out, const float *a, const float *b, float t,
+	u32 count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(out + i,
+			lerp_avx2(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vt));
+	}
+	interpY_scalar(out + i, a + i, b + i, t, count - i);
+}
+
+AVX2_FN void interpYZ_avx2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float ty, float tz, u32 count)
+{
+	const __m256 vty = _mm256_set1_ps(ty);
+	const __m256 vtz = _mm256_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 u = lerp_avx2(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vty);
+		__m256 v = lerp_avx2(_mm256_loadu_ps(c + i), _mm256_loadu_ps(d + i), vty);
+		_mm256_storeu_ps(out + i, lerp_avx2(u, v, vtz));
+	}
+	interpYZ_scalar(out + i, a + i, b + i, c + i, d + i, ty, tz, count - i);
+}
+
+AVX2_FN inline __m256 abs_avx2(__m256 v)
+{
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.f), v);
+}
+
+AVX2_FN void accumulate_avx2(float *result, const float *gradient, float g,
+	size_t count)
+{
+	const __m256 vg = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(vg, _mm256_loadu_ps(gradient + i)));
+		_mm256_storeu_ps(result + i, r);
+	}
+	accumulate_scalar(result + i, gradient + i, g, count - i);
+}
+
+AVX2_FN void accumulateAbs_avx2(float *result, const float *gradient, float g,
+	size_t count)
+{
+	const __m256 vg = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(vg, abs_avx2(_mm256_loadu_ps(gradient + i))));
+		_mm256_storeu_ps(result + i, r);
+	}
+	accumulateAbs_scalar(result + i, gradient + i, g, count - i);
+}
+
+AVX2_FN void accumulatePersist_avx2(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 g = _mm256_loadu_ps(gmap + i);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(g, _mm256_loadu_ps(gradient + i)));
+		_mm256_storeu_ps(result + i, r);
+		_mm256_storeu_ps(gmap + i, _mm256_mul_ps(g, _mm256_loadu_ps(persistence + i)));
+	}
+	accumulatePersist_scalar(result + i, gradient + i, gmap + i,
+		persistence + i, count - i);
+}
+
+AVX2_FN void accumulatePersistAbs_avx2(float *result, const float *gradient,
+	float *gmap, const float *persistence, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 g = _mm256_loadu_ps(gmap + i);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(g, abs_avx2(_mm256_loadu_ps(gradient + i))));
+		_mm256_storeu_ps(result + i, r);
+		_mm256_storeu_ps(gmap + i, _mm256_mul_ps(g, _mm256_loadu_ps(persistence + i)));
+	}
+	accumulatePersistAbs_scalar(result + i, gradient + i, gmap + i,
+		persistence + i, count - i);
+}
+
+#undef AVX2_FN
+
+const NoiseKernels kernels_avx2 = {
+	lattice2D_avx2,
+	lattice3D_avx2,
+	interpX_avx2,
+	interpY_avx2,
+	interpYZ_avx2,
+	accumulate_avx2,
+	accumulateAbs_avx2,
+	accumulatePersist_avx2,
+	accumulatePersistAbs_avx2,
+};
+
+#endif // NOISE_X86_SIMD
+
+NoiseSimdLevel detect_simd_level()
+{
+#if NOISE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return NOISE_SIMD_SSE2;
+#endif
+	return NOISE_SIMD_NONE;
+}
+
+const NoiseSimdLevel simd_supported = detect_simd_level();
+std::atomic<int> simd_level(simd_supported);
+
+const NoiseKernels &get_kernels()
+{
+	switch (simd_level.load(std::memory_order_relaxed)) {
+#if NOISE_X86_SIMD
+	case NOISE_SIMD_AVX2:
+		return kernels_avx2;
+	case NOISE_SIMD_SSE2:
+		return kernels_sse2;
+#endif
+	default:
+		return kernels_scalar;
+	}
+}
+
+} // namespace
+
+NoiseSimdLevel noise_simd_supported()
+{
+	return simd_supported;
+}
+
+void noise_simd_set(NoiseSimdLevel level)
+{
+	simd_level = std::min(level, simd_supported);
+}
+
+NoiseSimdLevel noise_simd_get()
+{
+	return (NoiseSimdLevel)simd_level.load();
+}
+
+
 /*
  * NB:  This algorithm is not optimal in terms of space complexity.  The entire
  * integer lattice of noise points could be done as 2 lines instead, and for 3D,
@@ -474,58 +1003,66 @@ void Noise::resizeNoiseBuf(bool is3d)
  * Another optimization that could save half as many noise calls is to carry over
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
+ *
+ * The lattice rows are first interpolated along X, which is the same for every
+ * row, and the results are then interpolated along Y (and Z) in bulk.
  */
-#define idx(x, y) ((y) * nlx + (x))
+void Noise::prepareColumns(float u, float step_x, bool eased)
+{
+	column_index.resize(sx);
+	column_weight.resize(sx);
+
+	u32 noisex = 0;
+	for (u32 i = 0; i != sx; i++) {
+		column_index[i] = noisex;
+		column_weight[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 j, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
+	const NoiseKernels &kernels = get_kernels();
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
 	x0 = std::floor(x);
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		kernels.lattice2D(&noise_buf[j * nlx], nlx, x0, y0 + j, seed);
+
+	//interpolate the lattice rows along X
+	prepareColumns(u, step_x, eased);
+	interp_buf.resize(nly * sx);
+	for (j = 0; j != nly; j++) {
+		kernels.interpX(&interp_buf[j * sx], &noise_buf[j * nlx],
+			column_index.data(), column_weight.data(), sx);
+	}
 
 	//calculate interpolations
-	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		kernels.interpY(&gradient_buf[j * sx],
+			&interp_buf[noisey * sx], &interp_buf[(noisey + 1) * sx],
+			eased ? easeCurve(v) : v, sx);
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -534,22 +1071,19 @@ void Noise::gradientMap2D(
 		}
 	}
 }
-#undef idx
 
 
-#define idx(x, y, z) ((z) * nly * nlx + (y) * nlx + (x))
 void Noise::gradientMap3D(
 		float x, float y, float z,
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 j, k, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
+	const NoiseKernels &kernels = get_kernels();
 	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = std::floor(x);
@@ -558,59 +1092,47 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			kernels.lattice3D(&noise_buf[(k * nly + j) * nlx], nlx,
+				x0, y0 + j, z0 + k, seed);
+
+	//the lattice rows of two Z planes interpolated along X
+	prepareColumns(u, step_x, eased);
+	interp_buf.resize(2 * nly * sx);
+	u32 plane_z[2] = {U32_MAX, U32_MAX};
+	auto get_plane = [&] (u32 z) {
+		float *plane = &interp_buf[(z & 1) * nly * sx];
+		if (plane_z[z & 1] != z) {
+			for (u32 row = 0; row != nly; row++) {
+				kernels.interpX(&plane[row * sx], &noise_buf[(z * nly + row) * nlx],
+					column_index.data(), column_weight.data(), sx);
+			}
+			plane_z[z & 1] = z;
+		}
+		return plane;
+	};
 
 	//calculate interpolations
-	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		const float *plane0 = get_plane(noisez);
+		const float *plane1 = get_plane(noisez + 1);
+		const float tz = eased ? easeCurve(w) : w;
+
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+			kernels.interpYZ(&gradient_buf[(k * sy + j) * sx],
+				&plane0[noisey * sx], &plane0[(noisey + 1) * sx],
+				&plane1[noisey * sx], &plane1[(noisey + 1) * sx],
+				eased ? easeCurve(v) : v, tz, sx);
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -626,7 +1148,6 @@ void Noise::gradientMap3D(
 		}
 	}
 }
-#undef idx
 
 
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
@@ -707,27 +1228,19 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 void Noise::updateResults(float g, float *gmap,
 	const float *persistence_map, size_t bufsize)
 {
-	// This looks very ugly, but it is 50-70% faster than having
-	// conditional statements inside the loop
+	const NoiseKernels &kernels = get_kernels();
+
 	if (np.flags & NOISE_FLAG_ABSVALUE) {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * std::fabs(gradient_buf[i]);
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * std::fabs(gradient_buf[i]);
-		}
+		if (persistence_map)
+			kernels.accumulatePersistAbs(result, gradient_buf, gmap,
+				persistence_map, bufsize);
+		else
+			kernels.accumulateAbs(result, gradient_buf, g, bufsize);
 	} else {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * gradient_buf[i];
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
-		}
+		if (persistence_map)
+			kernels.accumulatePersist(result, gradient_buf, gmap,
+				persistence_map, bufsize);
+		else
+			kernels.accumulate(result, gradient_buf, g, bufsize);
 	}
 }
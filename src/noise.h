@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <vector>
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
@@ -185,13 +186,36 @@ class Noise {
 	}
 
 private:
+	// Lattice rows interpolated along X, and the lattice column and
+	// weight of each X coordinate
+	std::vector<float> interp_buf;
+	std::vector<u32> column_index;
+	std::vector<float> column_weight;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	void prepareColumns(float u, float step_x, bool eased);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
 };
 
+/*
+	Instruction sets used for the noise maps. All of them give
+	bit-identical results.
+*/
+enum NoiseSimdLevel {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+// Best level supported by the CPU
+NoiseSimdLevel noise_simd_supported();
+// Level used from now on, limited to the supported one. For tests and benchmarks.
+void noise_simd_set(NoiseSimdLevel level);
+NoiseSimdLevel noise_simd_get();
+
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
 float NoisePerlin3D(const NoiseParams *np, float x, float y, float z, s32 seed);
 
@@ -19,139 +19,385 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "profiler.h"
 #include "porting.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+static std::atomic<u64> s_next_profiler_serial{0};
 
 static Profiler main_profiler;
 Profiler *g_profiler = &main_profiler;
+
+/*
+	Values added by one thread to one Profiler.
+
+	Only the owning thread adds values, merge() takes them out by swapping
+	in NAN, which marks a value as unused. Both only use atomic operations,
+	so neither side ever waits for the other.
+
+	The sum and the number of averaged values share one word, so merge()
+	never takes a sum without the count that goes with it.
+*/
+struct Profiler::ThreadBuffer
+{
+	static constexpr u32 CHUNK_SIZE = 64;
+	// Values of names with larger ids are dropped
+	static constexpr u32 MAX_CHUNKS = 256;
+
+	struct Slot {
+		// See packSum()
+		std::atomic<u64> sum_count{packSum(NAN, 0)};
+		std::atomic<float> max{NAN};
+		std::atomic<float> graph{NAN};
+	};
+
+	// The bits of sum in the low half, count in the high half
+	static u64 packSum(float sum, u32 count)
+	{
+		u32 bits;
+		memcpy(&bits, &sum, sizeof(bits));
+		return (u64)count << 32 | bits;
+	}
+
+	static void unpackSum(u64 packed, float *sum, u32 *count)
+	{
+		u32 bits = packed & U32_MAX;
+		memcpy(sum, &bits, sizeof(bits));
+		*count = packed >> 32;
+	}
+
+	struct Chunk {
+		Slot slots[CHUNK_SIZE];
+		// Set after a slot changed, so merge() can skip untouched chunks
+		std::atomic<bool> dirty{false};
+	};
+
+	ThreadBuffer()
+	{
+		for (auto &chunk : chunks)
+			chunk.store(nullptr);
+	}
+
+	~ThreadBuffer()
+	{
+		for (auto &chunk : chunks)
+			delete chunk.load();
+	}
+
+	template <typename F>
+	void update(ProfilerId id, F f)
+	{
+		const u32 i = id / CHUNK_SIZE;
+		if (i >= MAX_CHUNKS)
+			return;
+
+		Chunk *chunk = chunks[i].load();
+		if (!chunk) {
+			chunk = new Chunk();
+			chunks[i].store(chunk);
+		}
+		f(chunk->slots[id % CHUNK_SIZE]);
+		if (!chunk->dirty.load())
+			chunk->dirty.store(true);
+	}
+
+	std::atomic<Chunk *> chunks[MAX_CHUNKS];
+	// The owning thread exited, no more values will be added
+	std::atomic<bool> thread_exited{false};
+	// The Profiler was destroyed, the buffer can be forgotten
+	std::atomic<bool> profiler_destroyed{false};
+};
+
+namespace {
+
+// Names are interned once for all profilers
+struct NameRegistry
+{
+	std::mutex mutex;
+	std::unordered_map<std::string, ProfilerId> ids;
+	std::deque<std::string> names;
+};
+
+NameRegistry &getNameRegistry()
+{
+	// Never destroyed, profiling may happen during static destruction
+	static NameRegistry *registry = new NameRegistry();
+	return *registry;
+}
+
+// The buffers of the current thread, one per Profiler it used
+struct ThreadBuffers
+{
+	struct Entry {
+		u64 profiler_serial;
+		std::shared_ptr<Profiler::ThreadBuffer> buffer;
+	};
+
+	~ThreadBuffers()
+	{
+		for (auto &entry : entries)
+			entry.buffer->thread_exited = true;
+	}
+
+	std::vector<Entry> entries;
+};
+
+thread_local ThreadBuffers t_buffers;
+
+template <typename F>
+void atomic_update(std::atomic<float> &a, float value, F combine)
+{
+	float old = a.load();
+	while (!a.compare_exchange_weak(old,
+			std::isnan(old) ? value : combine(old, value)))
+		;
+}
+
+// Adds value to the sum and count to the number of averaged values
+void atomic_add_sum(std::atomic<u64> &a, float value, u32 count)
+{
+	u64 old = a.load();
+	u64 updated;
+	do {
+		float sum;
+		u32 old_count;
+		Profiler::ThreadBuffer::unpackSum(old, &sum, &old_count);
+		updated = Profiler::ThreadBuffer::packSum(
+				std::isnan(sum) ? value : sum + value, old_count + count);
+	} while (!a.compare_exchange_weak(old, updated));
+}
+
+float sum(float a, float b) { return a + b; }
+float maximum(float a, float b) { return std::max(a, b); }
+
+} // namespace
+
 ScopeProfiler::ScopeProfiler(
 		Profiler *profiler, const std::string &name, ScopeProfilerType type) :
+		ScopeProfiler(profiler, profiler ? getId(name) : 0, type)
+{
+}
+
+ScopeProfiler::ScopeProfiler(
+		Profiler *profiler, ProfilerId id, ScopeProfilerType type) :
 		m_profiler(profiler),
-		m_name(name), m_type(type)
+		m_id(id), m_type(type)
 {
-	m_name.append(" [ms]");
 	if (m_profiler)
-		m_timer = new TimeTaker(m_name, nullptr, PRECISION_MILLI);
+		m_start_us = porting::getTimeUs();
 }
 
 ScopeProfiler::~ScopeProfiler()
 {
-	if (!m_timer)
+	if (!m_profiler)
 		return;
 
-	float duration_ms = m_timer->stop(true);
-	float duration = duration_ms;
-	if (m_profiler) {
-		switch (m_type) {
-		case SPT_ADD:
-			m_profiler->add(m_name, duration);
-			break;
-		case SPT_AVG:
-			m_profiler->avg(m_name, duration);
-			break;
-		case SPT_GRAPH_ADD:
-			m_profiler->graphAdd(m_name, duration);
-			break;
-		case SPT_MAX:
-			m_profiler->max(m_name, duration);
-			break;
-		}
+	float duration = (porting::getTimeUs() - m_start_us) / 1000.0f;
+	switch (m_type) {
+	case SPT_ADD:
+		m_profiler->add(m_id, duration);
+		break;
+	case SPT_AVG:
+		m_profiler->avg(m_id, duration);
+		break;
+	case SPT_GRAPH_ADD:
+		m_profiler->graphAdd(m_id, duration);
+		break;
+	case SPT_MAX:
+		m_profiler->max(m_id, duration);
+		break;
 	}
-	delete m_timer;
 }
 
-Profiler::Profiler()
+Profiler::Profiler() :
+	m_serial(s_next_profiler_serial++)
 {
 	m_start_time = porting::getTimeMs();
 }
 
-void Profiler::add(const std::string &name, float value)
+Profiler::~Profiler()
 {
 	MutexAutoLock lock(m_mutex);
+	for (auto &buffer : m_buffers)
+		buffer->profiler_destroyed = true;
+}
+
+ProfilerId Profiler::getId(const std::string &name)
+{
+	// Names are looked up in a cache of the thread first, without a lock
+	thread_local std::unordered_map<std::string, ProfilerId> t_ids;
+	auto it = t_ids.find(name);
+	if (it != t_ids.end())
+		return it->second;
+
+	NameRegistry &registry = getNameRegistry();
+	ProfilerId id;
 	{
-		/* No average shall have been used; mark add/max used as -2 */
-		std::map<std::string, int>::iterator n = m_avgcounts.find(name);
-		if (n == m_avgcounts.end()) {
-			m_avgcounts[name] = -2;
-		} else {
-			if (n->second == -1)
-				n->second = -2;
-			assert(n->second == -2);
-		}
-	}
-	{
-		std::map<std::string, float>::iterator n = m_data.find(name);
-		if (n == m_data.end())
-			m_data[name] = value;
-		else
-			n->second += value;
+		MutexAutoLock lock(registry.mutex);
+		auto added = registry.ids.emplace(name, registry.names.size());
+		if (added.second)
+			registry.names.push_back(name);
+		id = added.first->second;
 	}
+	t_ids.emplace(name, id);
+	return id;
 }
 
-void Profiler::max(const std::string &name, float value)
+std::string Profiler::getName(ProfilerId id)
 {
-	MutexAutoLock lock(m_mutex);
-	{
-		/* No average shall have been used; mark add/max used as -2 */
-		auto n = m_avgcounts.find(name);
-		if (n == m_avgcounts.end()) {
-			m_avgcounts[name] = -2;
-		} else {
-			if (n->second == -1)
-				n->second = -2;
-			assert(n->second == -2);
-		}
+	NameRegistry &registry = getNameRegistry();
+	MutexAutoLock lock(registry.mutex);
+	return id < registry.names.size() ? registry.names[id] : "";
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer()
+{
+	auto &entries = t_buffers.entries;
+	for (auto &entry : entries) {
+		if (entry.profiler_serial == m_serial)
+			return entry.buffer.get();
 	}
+
+	// First use of this profiler by the thread
+	entries.erase(std::remove_if(entries.begin(), entries.end(),
+		[] (const ThreadBuffers::Entry &entry) {
+			return entry.buffer->profiler_destroyed.load();
+		}), entries.end());
+
+	auto buffer = std::make_shared<ThreadBuffer>();
 	{
-		auto n = m_data.find(name);
-		if (n == m_data.end())
-			m_data[name] = value;
-		else if (value > n->second)
-			n->second = value;
+		MutexAutoLock lock(m_mutex);
+		// Frees the buffers of exited threads, which would pile up with
+		// short-lived threads if nothing reads the profiler
+		merge();
+		m_buffers.push_back(buffer);
 	}
+	entries.push_back({m_serial, buffer});
+	return buffer.get();
 }
 
-void Profiler::avg(const std::string &name, float value)
+void Profiler::add(ProfilerId id, float value)
 {
-	MutexAutoLock lock(m_mutex);
-	int &count = m_avgcounts[name];
+	getThreadBuffer()->update(id, [value] (ThreadBuffer::Slot &slot) {
+		atomic_add_sum(slot.sum_count, value, 0);
+	});
+}
+
+void Profiler::avg(ProfilerId id, float value)
+{
+	getThreadBuffer()->update(id, [value] (ThreadBuffer::Slot &slot) {
+		atomic_add_sum(slot.sum_count, value, 1);
+	});
+}
+
+void Profiler::max(ProfilerId id, float value)
+{
+	getThreadBuffer()->update(id, [value] (ThreadBuffer::Slot &slot) {
+		atomic_update(slot.max, value, maximum);
+	});
+}
+
+void Profiler::graphAdd(ProfilerId id, float value)
+{
+	getThreadBuffer()->update(id, [value] (ThreadBuffer::Slot &slot) {
+		atomic_update(slot.graph, value, sum);
+	});
+}
+
+Profiler::Value *Profiler::getMergedValue(ProfilerId id)
+{
+	if (id >= m_values.size())
+		m_values.resize(id + 1);
+	return &m_values[id];
+}
+
+void Profiler::merge()
+{
+	for (auto it = m_buffers.begin(); it != m_buffers.end();) {
+		ThreadBuffer &buffer = **it;
+		// Checked first, the values added before the exit are merged below
+		bool thread_exited = buffer.thread_exited.load();
+
+		for (u32 i = 0; i < ThreadBuffer::MAX_CHUNKS; i++) {
+			ThreadBuffer::Chunk *chunk = buffer.chunks[i].load();
+			if (!chunk || !chunk->dirty.exchange(false))
+				continue;
 
-	assert(count != -2);
-	count = MYMAX(count, 0) + 1;
-	m_data[name] += value;
+			for (u32 j = 0; j < ThreadBuffer::CHUNK_SIZE; j++) {
+				ThreadBuffer::Slot &slot = chunk->slots[j];
+				float sum;
+				u32 avgcount;
+				ThreadBuffer::unpackSum(
+						slot.sum_count.exchange(ThreadBuffer::packSum(NAN, 0)),
+						&sum, &avgcount);
+				float max = slot.max.exchange(NAN);
+				float graph = slot.graph.exchange(NAN);
+				if (std::isnan(sum) && avgcount == 0 && std::isnan(max) &&
+						std::isnan(graph))
+					continue;
+
+				Value &v = *getMergedValue(i * ThreadBuffer::CHUNK_SIZE + j);
+				if (avgcount != 0)
+					v.avgcount = MYMAX(v.avgcount, 0) + avgcount;
+				else if (v.avgcount == 0 && !(std::isnan(sum) && std::isnan(max)))
+					v.avgcount = -2;
+
+				if (!std::isnan(sum)) {
+					v.value += sum;
+					v.used = true;
+				}
+				if (!std::isnan(max)) {
+					v.value = v.used ? MYMAX(v.value, max) : max;
+					v.used = true;
+				}
+				if (!std::isnan(graph)) {
+					v.graph += graph;
+					v.graph_used = true;
+				}
+			}
+		}
+
+		if (thread_exited)
+			it = m_buffers.erase(it);
+		else
+			++it;
+	}
 }
 
 void Profiler::clear()
 {
 	MutexAutoLock lock(m_mutex);
-	for (auto &it : m_data) {
-		it.second = 0;
+	merge();
+	for (auto &v : m_values) {
+		v.value = 0;
+		v.avgcount = 0;
 	}
-	m_avgcounts.clear();
 	m_start_time = porting::getTimeMs();
 }
 
-float Profiler::getValue(const std::string &name) const
+float Profiler::getValue(const std::string &name)
 {
-	auto numerator = m_data.find(name);
-	if (numerator == m_data.end())
+	ProfilerId id = getId(name);
+	MutexAutoLock lock(m_mutex);
+	merge();
+	if (id >= m_values.size())
 		return 0.f;
 
-	auto denominator = m_avgcounts.find(name);
-	if (denominator != m_avgcounts.end()) {
-		if (denominator->second >= 1)
-			return numerator->second / denominator->second;
-	}
-
-	return numerator->second;
+	const Value &v = m_values[id];
+	return v.value / avgCount(v);
 }
 
-int Profiler::getAvgCount(const std::string &name) const
+int Profiler::getAvgCount(const std::string &name)
 {
-	auto n = m_avgcounts.find(name);
-
-	if (n != m_avgcounts.end() && n->second >= 1)
-		return n->second;
+	ProfilerId id = getId(name);
+	MutexAutoLock lock(m_mutex);
+	merge();
+	if (id >= m_values.size())
+		return 1;
 
-	return 1;
+	return avgCount(m_values[id]);
 }
 
 u64 Profiler::getElapsedMs() const
@@ -161,13 +407,14 @@ u64 Profiler::getElapsedMs() const
 
 int Profiler::print(std::ostream &o, u32 page, u32 pagecount)
 {
-	GraphValues values;
+	std::vector<std::pair<std::string, Value>> values;
 	getPage(values, page, pagecount);
 	char buffer[50];
 
 	for (const auto &i : values) {
+		const float value = i.second.value / avgCount(i.second);
 		o << "  " << i.first << " ";
-		if (i.second == 0) {
+		if (value == 0) {
 			o << std::endl;
 			continue;
 		}
@@ -181,29 +428,73 @@ int Profiler::print(std::ostream &o, u32 page, u32 pagecount)
 		}
 
 		porting::mt_snprintf(buffer, sizeof(buffer), "% 5ix % 7g",
-				getAvgCount(i.first), floor(i.second * 1000.0) / 1000.0);
+				avgCount(i.second), floor(value * 1000.0) / 1000.0);
 		o << buffer << std::endl;
 	}
 	return values.size();
 }
 
 void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
+{
+	std::vector<std::pair<std::string, Value>> values;
+	getPage(values, page, pagecount);
+
+	for (const auto &i : values)
+		o[i.first] = i.second.value / avgCount(i.second);
+}
+
+void Profiler::getPage(std::vector<std::pair<std::string, Value>> &o,
+		u32 page, u32 pagecount)
 {
 	MutexAutoLock lock(m_mutex);
+	merge();
+
+	// Pages are in the order of the names
+	std::vector<std::pair<std::string, Value>> values;
+	for (ProfilerId id = 0; id < m_values.size(); id++) {
+		if (m_values[id].used)
+			values.emplace_back(getName(id), m_values[id]);
+	}
+	std::sort(values.begin(), values.end(),
+		[] (const std::pair<std::string, Value> &a,
+				const std::pair<std::string, Value> &b) {
+			return a.first < b.first;
+		});
 
 	u32 minindex, maxindex;
-	paging(m_data.size(), page, pagecount, minindex, maxindex);
+	paging(values.size(), page, pagecount, minindex, maxindex);
 
-	for (const auto &i : m_data) {
-		if (maxindex == 0)
-			break;
-		maxindex--;
+	for (u32 i = minindex; i < maxindex; i++)
+		o.push_back(std::move(values[i]));
+}
+
+void Profiler::graphGet(GraphValues &result)
+{
+	MutexAutoLock lock(m_mutex);
+	merge();
 
-		if (minindex != 0) {
-			minindex--;
+	result.clear();
+	for (ProfilerId id = 0; id < m_values.size(); id++) {
+		Value &v = m_values[id];
+		if (!v.graph_used)
 			continue;
-		}
 
-		o[i.first] = i.second / getAvgCount(i.first);
+		result[getName(id)] = v.graph;
+		v.graph = 0;
+		v.graph_used = false;
 	}
 }
+
+void Profiler::remove(const std::string &name)
+{
+	ProfilerId id = getId(name);
+	MutexAutoLock lock(m_mutex);
+	merge();
+	if (id >= m_values.size())
+		return;
+
+	Value &v = m_values[id];
+	v.value = 0;
+	v.avgcount = 0;
+	v.used = false;
+}
@@ -20,12 +20,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include <atomic>
 #include <cassert>
 #include <string>
 #include <map>
+#include <memory>
 #include <ostream>
+#include <vector>
 
 #include "threading/mutex_auto_lock.h"
+#include "util/basic_macros.h"
 #include "util/timetaker.h"
 #include "util/numeric.h"      // paging()
 
@@ -33,22 +37,47 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class Profiler;
 extern Profiler *g_profiler;
 
+// Interned profiler value name, the same in every Profiler
+typedef u32 ProfilerId;
+
 /*
 	Time profiler
+
+	Values are accumulated in buffers owned by the calling thread without
+	taking a lock and merged when they are read, so profiling hot paths
+	in worker threads stays cheap. Names are interned to ids: hot paths
+	should look the id up once, e.g. into a static, and use the id overloads.
 */
 
 class Profiler
 {
 public:
 	Profiler();
+	~Profiler();
+
+	DISABLE_CLASS_COPY(Profiler);
+
+	// Returns the id of name, registering it if needed. Thread-safe.
+	static ProfilerId getId(const std::string &name);
+	static std::string getName(ProfilerId id);
+
+	void add(ProfilerId id, float value);
+	void avg(ProfilerId id, float value);
+	void max(ProfilerId id, float value);
+	void graphAdd(ProfilerId id, float value);
+
+	void add(const std::string &name, float value) { add(getId(name), value); }
+	void avg(const std::string &name, float value) { avg(getId(name), value); }
+	void max(const std::string &name, float value) { max(getId(name), value); }
+	void graphAdd(const std::string &name, float value)
+	{
+		graphAdd(getId(name), value);
+	}
 
-	void add(const std::string &name, float value);
-	void avg(const std::string &name, float value);
-	void max(const std::string &name, float value);
 	void clear();
 
-	float getValue(const std::string &name) const;
-	int getAvgCount(const std::string &name) const;
+	float getValue(const std::string &name);
+	int getAvgCount(const std::string &name);
 	u64 getElapsedMs() const;
 
 	typedef std::map<std::string, float> GraphValues;
@@ -57,36 +86,41 @@ class Profiler
 	int print(std::ostream &o, u32 page = 1, u32 pagecount = 1);
 	void getPage(GraphValues &o, u32 page, u32 pagecount);
 
+	void graphGet(GraphValues &result);
 
-	void graphAdd(const std::string &id, float value)
-	{
-		MutexAutoLock lock(m_mutex);
-		std::map<std::string, float>::iterator i =
-				m_graphvalues.find(id);
-		if(i == m_graphvalues.end())
-			m_graphvalues[id] = value;
-		else
-			i->second += value;
-	}
-	void graphGet(GraphValues &result)
-	{
-		MutexAutoLock lock(m_mutex);
-		result = m_graphvalues;
-		m_graphvalues.clear();
-	}
+	void remove(const std::string &name);
 
-	void remove(const std::string& name)
-	{
-		MutexAutoLock lock(m_mutex);
-		m_avgcounts.erase(name);
-		m_data.erase(name);
-	}
+	// Values of one thread, see profiler.cpp
+	struct ThreadBuffer;
 
 private:
+	struct Value {
+		float value = 0.0f;
+		// >= 1: number of averaged values, -2: used by add() or max()
+		int avgcount = 0;
+		bool used = false;
+
+		float graph = 0.0f;
+		bool graph_used = false;
+	};
+
+	void getPage(std::vector<std::pair<std::string, Value>> &o,
+			u32 page, u32 pagecount);
+
+	ThreadBuffer *getThreadBuffer();
+	// Moves the values of all thread buffers into m_values.
+	// m_mutex must be locked.
+	void merge();
+	Value *getMergedValue(ProfilerId id);
+	static int avgCount(const Value &v) { return v.avgcount >= 1 ? v.avgcount : 1; }
+
+	// Distinguishes thread buffers of different profilers
+	const u64 m_serial;
+
 	std::mutex m_mutex;
-	std::map<std::string, float> m_data;
-	std::map<std::string, int> m_avgcounts;
-	std::map<std::string, float> m_graphvalues;
+	std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+	// Indexed by id
+	std::vector<Value> m_values;
 	u64 m_start_time;
 };
 
@@ -102,10 +136,20 @@ class ScopeProfiler
 public:
 	ScopeProfiler(Profiler *profiler, const std::string &name,
 			ScopeProfilerType type = SPT_ADD);
+	// id as returned by getId()
+	ScopeProfiler(Profiler *profiler, ProfilerId id,
+			ScopeProfilerType type = SPT_ADD);
 	~ScopeProfiler();
+
+	// Returns the id of the value a ScopeProfiler named name records to
+	static ProfilerId getId(const std::string &name)
+	{
+		return Profiler::getId(name + " [ms]");
+	}
+
 private:
 	Profiler *m_profiler = nullptr;
-	std::string m_name;
-	TimeTaker *m_timer = nullptr;
+	ProfilerId m_id;
+	u64 m_start_us = 0;
 	enum ScopeProfilerType m_type;
 };
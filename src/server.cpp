@@ -63,6 +63,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "chatmessage.h"
 #include "chat_interface.h"
 #include "remoteplayer.h"
+#include "server/node_change_batch.h"
+#include "server/object_update_encoder.h"
 #include "server/player_sao.h"
 #include "server/serverinventorymgr.h"
 #include "translation.h"
@@ -265,12 +267,14 @@ Server::Server(
 
 #if USE_PROMETHEUS
 	if (!simple_singleplayer_mode)
-		m_metrics_backend = std::unique_ptr<MetricsBackend>(createPrometheusMetricsBackend());
+		m_metrics_backend = std::shared_ptr<MetricsBackend>(createPrometheusMetricsBackend());
 	else
 #else
 	if (true)
 #endif
-		m_metrics_backend = std::make_unique<MetricsBackend>();
+		m_metrics_backend = std::make_shared<MetricsBackend>();
+
+	m_con->setMetricsBackend(m_metrics_backend);
 
 	m_uptime_counter = m_metrics_backend->addCounter("minetest_core_server_uptime", "Server uptime (in seconds)");
 	m_player_gauge = m_metrics_backend->addGauge("minetest_core_player_number", "Number of connected players");
@@ -293,6 +297,19 @@ Server::Server(
 				{{"type", aom_types[i]}});
 	}
 
+	m_aom_coalesced_counter = m_metrics_backend->addCounter(
+			"minetest_core_aom_coalesced_count",
+			"Number of active object messages dropped because a later one replaced them");
+
+	const std::string position_types[] = {"full", "encoded"};
+	for (u32 i = 0; i < ARRLEN(position_types); i++) {
+		std::string help_str("Bytes of object position updates sent to clients (");
+		help_str.append(position_types[i]).append(")");
+		m_aom_position_bytes_counter[i] = m_metrics_backend->addCounter(
+				"minetest_core_aom_position_bytes", help_str,
+				{{"type", position_types[i]}});
+	}
+
 	m_packet_recv_counter = m_metrics_backend->addCounter(
 			"minetest_core_server_packet_recv",
 			"Processable packets received");
@@ -301,10 +318,45 @@ Server::Server(
 			"minetest_core_server_packet_recv_processed",
 			"Valid received packets processed");
 
+	m_packet_handle_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_server_packet_handle_seconds",
+			"Time spent handling a received packet on the server thread",
+			MetricsBackend::getDurationBuckets());
+
+	m_step_time_histogram = m_metrics_backend->addHistogram(
+			"minetest_core_server_step_seconds", "Duration of server steps",
+			MetricsBackend::getDurationBuckets());
+
+	m_packet_handler_queued_counter = m_metrics_backend->addCounter(
+			"minetest_core_server_packet_handler_queued",
+			"Received packets handled outside of the server thread");
+
 	m_map_edit_event_counter = m_metrics_backend->addCounter(
 			"minetest_core_map_edit_events",
 			"Number of map edit events");
 
+	m_block_cache_hit_counter = m_metrics_backend->addCounter(
+			"minetest_core_block_cache_hits",
+			"Number of block sends served from the serialized block cache");
+	m_block_cache_miss_counter = m_metrics_backend->addCounter(
+			"minetest_core_block_cache_misses",
+			"Number of blocks serialized for sending");
+	m_block_cache_size_gauge = m_metrics_backend->addGauge(
+			"minetest_core_block_cache_size",
+			"Number of blocks in the serialized block cache");
+
+	u16 serialize_threads = g_settings->getU16("block_send_serialize_threads");
+	if (serialize_threads > 0) {
+		m_block_serializers = std::make_unique<WorkerThreadPool>(
+				"BlockSerialize", serialize_threads);
+	}
+
+	u16 handler_threads = g_settings->getU16("packet_handler_threads");
+	if (handler_threads > 0) {
+		m_packet_handlers = std::make_unique<WorkerThreadPool>(
+				"PacketHandler", handler_threads);
+	}
+
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
 }
 
@@ -372,11 +424,16 @@ Server::~Server()
 		stop();
 		delete m_thread;
 	}
+	// Finishes the queued packets
+	m_packet_handlers.reset();
 
 	// Write any changes before deletion.
 	if (m_mod_storage_database)
 		m_mod_storage_database->endSave();
 
+	// Background serialization reads the definitions
+	m_definition_cache.clear();
+
 	// Delete things in the reverse order of creation
 	delete m_emerge;
 	delete m_env;
@@ -543,6 +600,9 @@ void Server::start()
 	// Start thread
 	m_thread->start();
 
+	// Have the definitions ready for the first clients
+	prepareDefinitionCache(LATEST_PROTOCOL_VERSION);
+
 	// ASCII art for the win!
 	std::cerr
 		<< "         __.               __.                 __.  " << std::endl
@@ -608,6 +668,7 @@ void Server::AsyncRunStep(bool initial_step)
 		return;
 
 	ScopeProfiler sp(g_profiler, "Server::AsyncRunStep()", SPT_AVG);
+	MetricScopeTimer step_timer(m_step_time_histogram);
 
 	{
 		MutexAutoLock lock1(m_step_dtime_mutex);
@@ -831,11 +892,18 @@ void Server::AsyncRunStep(bool initial_step)
 		m_aom_buffer_counter[0]->increment(count_reliable);
 		m_aom_buffer_counter[1]->increment(count_unreliable);
 
+		// Only the last update of each kind per object matters
+		u32 count_coalesced = 0;
+		for (auto &buffered_message : buffered_messages)
+			count_coalesced += coalesceObjectMessages(*buffered_message.second);
+		m_aom_coalesced_counter->increment(count_coalesced);
+		u32 position_bytes_full = 0, position_bytes_encoded = 0;
+
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
 			const RemoteClientMap &clients = m_clients.getClientList();
 			// Route data to every client
-			std::string reliable_data, unreliable_data;
+			std::string reliable_data, unreliable_data, encoded;
 			for (const auto &client_it : clients) {
 				reliable_data.clear();
 				unreliable_data.clear();
@@ -866,14 +934,25 @@ void Server::AsyncRunStep(bool initial_step)
 								continue;
 						}
 
+						const std::string *datastring = &aom.datastring;
+						bool reliable = aom.reliable;
+						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION &&
+								client->net_proto_version >= 43) {
+							if (client->m_position_encoder.encode(id, aom.datastring, encoded))
+								reliable = true;
+							datastring = &encoded;
+							position_bytes_full += aom.datastring.size();
+							position_bytes_encoded += encoded.size();
+						}
+
 						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
+						std::string &buffer = reliable ? reliable_data : unreliable_data;
 						char idbuf[2];
 						writeU16((u8*) idbuf, aom.id);
 						// u16 id
 						// std::string data
 						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						buffer.append(serializeString16(*datastring));
 					}
 				}
 				/*
@@ -890,6 +969,9 @@ void Server::AsyncRunStep(bool initial_step)
 			}
 		}
 
+		m_aom_position_bytes_counter[0]->increment(position_bytes_full);
+		m_aom_position_bytes_counter[1]->increment(position_bytes_encoded);
+
 		// Clear buffered_messages
 		for (auto &buffered_message : buffered_messages) {
 			delete buffered_message.second;
@@ -903,11 +985,6 @@ void Server::AsyncRunStep(bool initial_step)
 		// We will be accessing the environment
 		MutexAutoLock lock(m_env_mutex);
 
-		// Single change sending is disabled if queue size is big
-		bool disable_single_change_sending = false;
-		if(m_unsent_map_edit_queue.size() >= 4)
-			disable_single_change_sending = true;
-
 		const auto event_count = m_unsent_map_edit_queue.size();
 		m_map_edit_event_counter->increment(event_count);
 
@@ -915,28 +992,23 @@ void Server::AsyncRunStep(bool initial_step)
 		Profiler prof;
 
 		std::unordered_set<v3s16> node_meta_updates;
+		NodeChangeBatch node_changes;
 
 		while (!m_unsent_map_edit_queue.empty()) {
 			MapEditEvent* event = m_unsent_map_edit_queue.front();
 			m_unsent_map_edit_queue.pop();
 
-			// Players far away from the change are stored here.
-			// Instead of sending the changes, MapBlocks are set not sent
-			// for them.
-			std::unordered_set<u16> far_players;
-
 			switch (event->type) {
 			case MEET_ADDNODE:
 			case MEET_SWAPNODE:
 				prof.add("MEET_ADDNODE", 1);
-				sendAddNode(event->p, event->n, &far_players,
-						disable_single_change_sending ? 5 : 30,
-						event->type == MEET_ADDNODE);
+				node_changes.add(event->p, event->n,
+						event->type == MEET_ADDNODE, event->modified_blocks);
 				break;
 			case MEET_REMOVENODE:
 				prof.add("MEET_REMOVENODE", 1);
-				sendRemoveNode(event->p, &far_players,
-						disable_single_change_sending ? 5 : 30);
+				node_changes.add(event->p, MapNode(CONTENT_AIR), true,
+						event->modified_blocks);
 				break;
 			case MEET_BLOCK_NODE_METADATA_CHANGED: {
 				prof.add("MEET_BLOCK_NODE_METADATA_CHANGED", 1);
@@ -964,27 +1036,13 @@ void Server::AsyncRunStep(bool initial_step)
 				break;
 			}
 
-			/*
-				Set blocks not sent to far players
-			*/
-			if (!far_players.empty()) {
-				// Convert list format to that wanted by SetBlocksNotSent
-				std::map<v3s16, MapBlock*> modified_blocks2;
-				for (const v3s16 &modified_block : event->modified_blocks) {
-					modified_blocks2[modified_block] =
-							m_env->getMap().getBlockNoCreateNoEx(modified_block);
-				}
-
-				// Set blocks not sent
-				for (const u16 far_player : far_players) {
-					if (RemoteClient *client = getClient(far_player))
-						client->SetBlocksNotSent(modified_blocks2);
-				}
-			}
-
 			delete event;
 		}
 
+		// Send all node changes at once
+		if (!node_changes.empty())
+			sendNodeChanges(node_changes, 30);
+
 		if (event_count >= 5) {
 			infostream << "Server: MapEditEvents:" << std::endl;
 			prof.print(infostream);
@@ -1048,6 +1106,9 @@ void Server::Receive()
 	NetworkPacket pkt;
 	session_t peer_id;
 	bool first = true;
+
+	runServerThreadTasks();
+
 	for (;;) {
 		pkt.clear();
 		peer_id = 0;
@@ -1159,18 +1220,86 @@ PlayerSAO* Server::StageTwoClientInit(session_t peer_id)
 	return playersao;
 }
 
-inline void Server::handleCommand(NetworkPacket *pkt)
+void Server::handleCommand(NetworkPacket *pkt)
 {
 	const ToServerCommandHandler &opHandle = toServerCommandTable[pkt->getCommand()];
-	(this->*opHandle.handler)(pkt);
+	switch (opHandle.context) {
+	case TOSERVER_CONTEXT_WORKER:
+		if (m_packet_handlers) {
+			queueCommand(pkt, opHandle.handler);
+			break;
+		}
+		// fall through
+	case TOSERVER_CONTEXT_ENV: {
+		MutexAutoLock envlock(m_env_mutex);
+		(this->*opHandle.handler)(pkt);
+		break;
+	}
+	case TOSERVER_CONTEXT_SERVER:
+		(this->*opHandle.handler)(pkt);
+		break;
+	}
 }
 
-void Server::ProcessData(NetworkPacket *pkt)
+void Server::queueCommand(NetworkPacket *pkt, void (Server::*handler)(NetworkPacket *))
 {
-	// Environment is locked first.
+	// The packet is reused by Receive(), the copy shares its data
+	auto job_pkt = std::make_shared<NetworkPacket>(*pkt);
+	m_packet_handler_queued_counter->increment();
+
+	m_packet_handlers->enqueue([this, job_pkt, handler] () {
+		session_t peer_id = job_pkt->getPeerId();
+		try {
+			(this->*handler)(job_pkt.get());
+		} catch (const con::InvalidIncomingDataException &e) {
+			infostream << "Server::queueCommand(): InvalidIncomingDataException: what()="
+					<< e.what() << std::endl;
+		} catch (const SerializationError &e) {
+			infostream << "Server::queueCommand(): SerializationError: what()="
+					<< e.what() << std::endl;
+		} catch (const ClientStateError &e) {
+			errorstream << "ProcessData: peer=" << peer_id << " what()="
+					 << e.what() << std::endl;
+			runOnServerThread([this, peer_id] () {
+				DenyAccess(peer_id, SERVER_ACCESSDENIED_UNEXPECTED_DATA);
+			});
+		} catch (const ClientNotFoundException &e) {
+			// Do nothing
+		} catch (const con::PeerNotFoundException &e) {
+			// Do nothing
+		} catch (SendFailedException &e) {
+			errorstream << "Server::queueCommand(): SendFailedException: "
+					<< "what=" << e.what() << std::endl;
+		} catch (PacketError &e) {
+			actionstream << "Server::queueCommand(): PacketError: "
+					<< "what=" << e.what() << std::endl;
+		}
+	});
+}
+
+void Server::runOnServerThread(std::function<void()> task)
+{
+	m_server_thread_tasks.push_back(std::move(task));
+}
+
+void Server::runServerThreadTasks()
+{
+	if (m_server_thread_tasks.empty())
+		return;
+
 	MutexAutoLock envlock(m_env_mutex);
+	while (std::function<void()> task = m_server_thread_tasks.pop_frontNoEx(0))
+		task();
+}
 
-	ScopeProfiler sp(g_profiler, "Server: Process network packet (sum)");
+void Server::ProcessData(NetworkPacket *pkt)
+{
+	// The environment is only locked for handlers that need it,
+	// see toServerCommandTable.
+	static const ProfilerId profiler_id =
+			ScopeProfiler::getId("Server: Process network packet (sum)");
+	ScopeProfiler sp(g_profiler, profiler_id);
+	MetricScopeTimer packet_timer(m_packet_handle_histogram);
 	u32 peer_id = pkt->getPeerId();
 
 	try {
@@ -1182,6 +1311,7 @@ void Server::ProcessData(NetworkPacket *pkt)
 			std::string ban_name = m_banmanager->getBanName(addr_s);
 			infostream << "Server: A banned client tried to connect from "
 					<< addr_s << "; banned name was " << ban_name << std::endl;
+			MutexAutoLock envlock(m_env_mutex);
 			DenyAccess(peer_id, SERVER_ACCESSDENIED_CUSTOM_STRING,
 				"Your IP is banned. Banned name was " + ban_name);
 			return;
@@ -1446,6 +1576,38 @@ void Server::SendDeathscreen(session_t peer_id, bool set_camera_point_target,
 	Send(&pkt);
 }
 
+static std::string serializeItemDef(IItemDefManager *itemdef,
+		u16 protocol_version)
+{
+	std::ostringstream tmp_os(std::ios::binary);
+	itemdef->serialize(tmp_os, protocol_version);
+	std::ostringstream tmp_os2(std::ios::binary);
+	compressZlib(tmp_os.str(), tmp_os2);
+	return tmp_os2.str();
+}
+
+static std::string serializeNodeDef(const NodeDefManager *nodedef,
+		u16 protocol_version)
+{
+	std::ostringstream tmp_os(std::ios::binary);
+	nodedef->serialize(tmp_os, protocol_version);
+	std::ostringstream tmp_os2(std::ios::binary);
+	compressZlib(tmp_os.str(), tmp_os2);
+	return tmp_os2.str();
+}
+
+void Server::prepareDefinitionCache(u16 protocol_version)
+{
+	IItemDefManager *itemdef = m_itemdef;
+	const NodeDefManager *nodedef = m_nodedef;
+	m_definition_cache.prepare("itemdef " + itos(protocol_version), [=] {
+		return serializeItemDef(itemdef, protocol_version);
+	});
+	m_definition_cache.prepare("nodedef " + itos(protocol_version), [=] {
+		return serializeNodeDef(nodedef, protocol_version);
+	});
+}
+
 void Server::SendItemDef(session_t peer_id,
 		IItemDefManager *itemdef, u16 protocol_version)
 {
@@ -1456,11 +1618,11 @@ void Server::SendItemDef(session_t peer_id,
 		u32 length of the next item
 		zlib-compressed serialized ItemDefManager
 	*/
-	std::ostringstream tmp_os(std::ios::binary);
-	itemdef->serialize(tmp_os, protocol_version);
-	std::ostringstream tmp_os2(std::ios::binary);
-	compressZlib(tmp_os.str(), tmp_os2);
-	pkt.putLongString(tmp_os2.str());
+	std::shared_future<std::string> data = m_definition_cache.get(
+		"itemdef " + itos(protocol_version), [=] {
+			return serializeItemDef(itemdef, protocol_version);
+		});
+	pkt.putLongString(data.get());
 
 	// Make data buffer
 	verbosestream << "Server: Sending item definitions to id(" << peer_id
@@ -1479,12 +1641,11 @@ void Server::SendNodeDef(session_t peer_id,
 		u32 length of the next item
 		zlib-compressed serialized NodeDefManager
 	*/
-	std::ostringstream tmp_os(std::ios::binary);
-	nodedef->serialize(tmp_os, protocol_version);
-	std::ostringstream tmp_os2(std::ios::binary);
-	compressZlib(tmp_os.str(), tmp_os2);
-
-	pkt.putLongString(tmp_os2.str());
+	std::shared_future<std::string> data = m_definition_cache.get(
+		"nodedef " + itos(protocol_version), [=] {
+			return serializeNodeDef(nodedef, protocol_version);
+		});
+	pkt.putLongString(data.get());
 
 	// Make data buffer
 	verbosestream << "Server: Sending node definitions to id(" << peer_id
@@ -2085,6 +2246,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 
 		// Remove from known objects
 		client->m_known_objects.erase(id);
+		client->m_position_encoder.forget(id);
 
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
@@ -2121,6 +2283,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 
 		// Add to known objects
 		client->m_known_objects.insert(id);
+		client->m_position_encoder.forget(id);
 
 		obj->m_known_by_count++;
 	}
@@ -2287,37 +2450,14 @@ void Server::fadeSound(s32 handle, float step, float gain)
 		m_playing_sounds.erase(it);
 }
 
-void Server::sendRemoveNode(v3s16 p, std::unordered_set<u16> *far_players,
-		float far_d_nodes)
-{
-	v3f p_f = intToFloat(p, BS);
-	v3s16 block_pos = getNodeBlockPos(p);
-
-	NetworkPacket pkt(TOCLIENT_REMOVENODE, 6);
-	pkt << p;
-
-	sendNodeChangePkt(pkt, block_pos, p_f, far_d_nodes, far_players);
-}
-
-void Server::sendAddNode(v3s16 p, MapNode n, std::unordered_set<u16> *far_players,
-		float far_d_nodes, bool remove_metadata)
-{
-	v3f p_f = intToFloat(p, BS);
-	v3s16 block_pos = getNodeBlockPos(p);
-
-	NetworkPacket pkt(TOCLIENT_ADDNODE, 6 + 2 + 1 + 1 + 1);
-	pkt << p << n.param0 << n.param1 << n.param2
-			<< (u8) (remove_metadata ? 0 : 1);
-	sendNodeChangePkt(pkt, block_pos, p_f, far_d_nodes, far_players);
-}
-
-void Server::sendNodeChangePkt(NetworkPacket &pkt, v3s16 block_pos,
-		v3f p, float far_d_nodes, std::unordered_set<u16> *far_players)
+void Server::sendNodeChanges(const NodeChangeBatch &changes, float far_d_nodes)
 {
 	float maxd = far_d_nodes * BS;
 	std::vector<session_t> clients = m_clients.getClientIDs();
 	ClientInterface::AutoLock clientlock(m_clients);
 
+	std::string data;
+	std::map<v3s16, MapBlock*> resend_blocks;
 	for (session_t client_id : clients) {
 		RemoteClient *client = m_clients.lockedGetClientNoEx(client_id);
 		if (!client)
@@ -2326,26 +2466,79 @@ void Server::sendNodeChangePkt(NetworkPacket &pkt, v3s16 block_pos,
 		RemotePlayer *player = m_env->getPlayer(client_id);
 		PlayerSAO *sao = player ? player->getPlayerSAO() : nullptr;
 
-		// If player is far away, only set modified blocks not sent
-		if (!client->isBlockSent(block_pos) || (sao &&
-				sao->getBasePosition().getDistanceFrom(p) > maxd)) {
-			if (far_players)
-				far_players->emplace(client_id);
-			else
-				client->SetBlockNotSent(block_pos);
-			continue;
+		data.clear();
+		u32 count = 0;
+		for (const auto &it : changes.getBlocks()) {
+			const NodeChangeBatch::Block &block = it.second;
+			v3f block_center = intToFloat(it.first * MAP_BLOCKSIZE +
+				v3s16(MAP_BLOCKSIZE / 2), BS);
+
+			// Players that do not have the block or are far away get the
+			// block again. So does everyone if that is cheaper than the
+			// changes one by one.
+			if (!client->isBlockSent(it.first) ||
+					block.changes.size() > NodeChangeBatch::MAX_CHANGES_PER_BLOCK ||
+					(sao && sao->getBasePosition().getDistanceFrom(block_center) > maxd)) {
+				for (v3s16 modified_block : block.modified_blocks)
+					resend_blocks[modified_block] = nullptr;
+				continue;
+			}
+
+			if (client->net_proto_version < 43) {
+				for (const NodeChangeBatch::Change &change : block.changes) {
+					NetworkPacket pkt(TOCLIENT_ADDNODE, 6 + 2 + 1 + 1 + 1, client_id);
+					pkt << change.p << change.n.param0 << change.n.param1
+						<< change.n.param2 << (u8) (change.remove_metadata ? 0 : 1);
+					// Send as reliable
+					m_clients.send(client_id, 0, &pkt, true);
+				}
+				continue;
+			}
+
+			// Keep within the u16 count of the packet
+			if (count + block.changes.size() > U16_MAX) {
+				sendNodeChangesPkt(client_id, count, data);
+				data.clear();
+				count = 0;
+			}
+			NodeChangeBatch::serialize(block, data);
+			count += block.changes.size();
 		}
 
-		// Send as reliable
-		m_clients.send(client_id, 0, &pkt, true);
+		if (count > 0)
+			sendNodeChangesPkt(client_id, count, data);
+
+		if (!resend_blocks.empty()) {
+			client->SetBlocksNotSent(resend_blocks);
+			resend_blocks.clear();
+		}
 	}
 }
 
+void Server::sendNodeChangesPkt(session_t peer_id, u16 count, const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_NODE_CHANGES, 2 + data.size(), peer_id);
+	pkt << count;
+	pkt.putRawString(data.c_str(), data.size());
+	// Send as reliable
+	m_clients.send(peer_id, 0, &pkt, true);
+}
+
 void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, float far_d_nodes)
 {
 	NodeMetadataList meta_updates_list(false);
 	std::ostringstream os(std::ios::binary);
 
+	// Look the metadata up once and group it by block, interest is the
+	// same for all positions in a block
+	std::map<v3s16, std::vector<std::pair<v3s16, NodeMetadata *>>> blocks;
+	for (const v3s16 pos : positions) {
+		if (NodeMetadata *meta = m_env->getMap().getNodeMetadata(pos))
+			blocks[getNodeBlockPos(pos)].emplace_back(pos, meta);
+	}
+	if (blocks.empty())
+		return;
+
 	std::vector<session_t> clients = m_clients.getClientIDs();
 	ClientInterface::AutoLock clientlock(m_clients);
 
@@ -2359,21 +2552,19 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 		if (player)
 			player_pos = floatToInt(player->getBasePosition(), BS);
 
-		for (const v3s16 pos : positions) {
-			NodeMetadata *meta = m_env->getMap().getNodeMetadata(pos);
-
-			if (!meta)
-				continue;
-
-			v3s16 block_pos = getNodeBlockPos(pos);
+		for (const auto &block : blocks) {
+			v3s16 block_pos = block.first;
+			v3s16 block_center = block_pos * MAP_BLOCKSIZE +
+				v3s16(MAP_BLOCKSIZE / 2);
 			if (!client->isBlockSent(block_pos) ||
-					player_pos.getDistanceFrom(pos) > far_d_nodes) {
+					player_pos.getDistanceFrom(block_center) > far_d_nodes) {
 				client->SetBlockNotSent(block_pos);
 				continue;
 			}
 
-			// Add the change to send list
-			meta_updates_list.set(pos, meta);
+			// Add the changes to send list
+			for (const auto &it : block.second)
+				meta_updates_list.set(it.first, it.second);
 		}
 		if (meta_updates_list.size() == 0)
 			continue;
@@ -2393,35 +2584,116 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 	}
 }
 
-void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+static std::string serialize_block_for_net(MapBlock *block, u8 ver,
+	int compression_level)
+{
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, ver, false, compression_level);
+	block->serializeNetworkSpecific(os);
+	return os.str();
+}
+
+static int get_net_compression_level()
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
+	return net_compression_level;
+}
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
+const std::string &Server::getSerializedBlock(MapBlock *block, u8 ver)
+{
+	SerializedBlock &entry = m_block_cache[{block->getPos(), ver}];
+	entry.last_used = m_block_cache_step;
+
+	const u64 contents_version = block->getContentsVersion();
+	if (entry.contents_version != contents_version) {
+		entry.data = serialize_block_for_net(block, ver,
+			get_net_compression_level());
+		entry.contents_version = contents_version;
+		m_block_cache_miss_counter->increment();
+	} else {
+		m_block_cache_hit_counter->increment();
 	}
+	return entry.data;
+}
 
-	// Serialize the block in the right format
-	if (!sptr) {
-		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
-		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
+void Server::serializeBlocks(const std::vector<std::pair<MapBlock *, u8>> &blocks)
+{
+	struct Job {
+		MapBlock *block;
+		u8 ver;
+		// Element pointers into the map stay valid on insertion
+		SerializedBlock *entry;
+	};
+	std::vector<Job> missing;
+
+	for (const auto &it : blocks) {
+		MapBlock *block = it.first;
+		SerializedBlock &entry = m_block_cache[{block->getPos(), it.second}];
+		entry.last_used = m_block_cache_step;
+
+		const u64 contents_version = block->getContentsVersion();
+		if (entry.contents_version == contents_version)
+			continue;
+
+		// Mark as up to date so the same block is not queued twice
+		entry.contents_version = contents_version;
+		missing.push_back({block, it.second, &entry});
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+	m_block_cache_hit_counter->increment(blocks.size() - missing.size());
+	if (missing.empty())
+		return;
+	m_block_cache_miss_counter->increment(missing.size());
+
+	// Serializing only reads from the block, except for this lazily
+	// computed flag
+	for (const Job &job : missing)
+		job.block->getDayNightDiff();
+
+	const int compression_level = get_net_compression_level();
+	auto serialize = [&missing, compression_level] (size_t i) {
+		const Job &job = missing[i];
+		job.entry->data = serialize_block_for_net(job.block, job.ver,
+			compression_level);
+	};
+
+	if (m_block_serializers && missing.size() > 1) {
+		m_block_serializers->parallelFor(missing.size(), serialize);
+	} else {
+		for (size_t i = 0; i < missing.size(); i++)
+			serialize(i);
+	}
+}
+
+void Server::trimBlockCache()
+{
+	// Keep blocks that were sent during the last few minutes worth of
+	// steps, or only the very recent ones if that gets too large
+	const size_t max_size = 16384;
+	u32 max_unused_steps = m_block_cache.size() > max_size ? 10 : 2000;
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+	for (auto it = m_block_cache.begin(); it != m_block_cache.end();) {
+		if (m_block_cache_step - it->second.last_used > max_unused_steps)
+			it = m_block_cache.erase(it);
+		else
+			++it;
+	}
+	m_block_cache_size_gauge->set(m_block_cache.size());
+}
+
+void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
+		u16 net_proto_version)
+{
+	SendBlockData(peer_id, block->getPos(), getSerializedBlock(block, ver));
+}
+
+void Server::SendBlockData(session_t peer_id, v3s16 blockpos,
+		const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << blockpos;
+	pkt.putRawString(data);
+	Send(&pkt);
 }
 
 void Server::SendBlocks(float dtime)
@@ -2431,7 +2703,7 @@ void Server::SendBlocks(float dtime)
 
 	std::vector<PrioritySortedBlockTransfer> queue;
 
-	u32 total_sending = 0, unique_clients = 0;
+	u32 total_sending = 0;
 
 	{
 		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
@@ -2446,9 +2718,7 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
 			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
 		}
 	}
 
@@ -2467,11 +2737,13 @@ void Server::SendBlocks(float dtime)
 	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
 	Map &map = m_env->getMap();
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
+	struct BlockToSend {
+		session_t peer_id;
+		MapBlock *block;
+		u8 ver;
+	};
+	std::vector<BlockToSend> to_send;
+	std::vector<std::pair<MapBlock *, u8>> to_serialize;
 
 	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
 		if (total_sending >= max_blocks_to_send)
@@ -2486,12 +2758,24 @@ void Server::SendBlocks(float dtime)
 		if (!client)
 			continue;
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+		to_send.push_back({block_to_send.peer_id, block, client->serialization_version});
+		to_serialize.emplace_back(block, client->serialization_version);
 
 		client->SentBlock(block_to_send.pos);
 		total_sending++;
 	}
+
+	// Blocks needed by several clients are only serialized once
+	m_block_cache_step++;
+	serializeBlocks(to_serialize);
+
+	for (const BlockToSend &it : to_send) {
+		v3s16 pos = it.block->getPos();
+		SendBlockData(it.peer_id, pos, m_block_cache[{pos, it.ver}].data);
+	}
+
+	if (m_block_cache_step % 100 == 0)
+		trimBlockCache();
 }
 
 bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
@@ -2562,6 +2846,7 @@ bool Server::addMediaFile(const std::string &filename,
 
 	// Put in list
 	m_media[filename] = MediaInfo(filepath, sha1_base64);
+	m_media_announcement_cache.clear();
 	verbosestream << "Server: " << sha1_hex << " is " << filename
 			<< std::endl;
 
@@ -2605,35 +2890,46 @@ void Server::fillMediaCache()
 
 void Server::sendMediaAnnouncement(session_t peer_id, const std::string &lang_code)
 {
-	// Make packet
-	NetworkPacket pkt(TOCLIENT_ANNOUNCE_MEDIA, 0, peer_id);
+	// Same for every client with this language
+	std::shared_future<std::string> payload = m_media_announcement_cache.get(
+			lang_code, [&] {
+		NetworkPacket pkt(TOCLIENT_ANNOUNCE_MEDIA, 0);
 
-	u16 media_sent = 0;
-	std::string lang_suffix;
-	lang_suffix.append(".").append(lang_code).append(".tr");
-	for (const auto &i : m_media) {
-		if (i.second.no_announce)
-			continue;
-		if (str_ends_with(i.first, ".tr") && !str_ends_with(i.first, lang_suffix))
-			continue;
-		media_sent++;
-	}
+		u16 media_sent = 0;
+		std::string lang_suffix;
+		lang_suffix.append(".").append(lang_code).append(".tr");
+		for (const auto &i : m_media) {
+			if (i.second.no_announce)
+				continue;
+			if (str_ends_with(i.first, ".tr") && !str_ends_with(i.first, lang_suffix))
+				continue;
+			media_sent++;
+		}
 
-	pkt << media_sent;
+		pkt << media_sent;
 
-	for (const auto &i : m_media) {
-		if (i.second.no_announce)
-			continue;
-		if (str_ends_with(i.first, ".tr") && !str_ends_with(i.first, lang_suffix))
-			continue;
-		pkt << i.first << i.second.sha1_digest;
-	}
+		for (const auto &i : m_media) {
+			if (i.second.no_announce)
+				continue;
+			if (str_ends_with(i.first, ".tr") && !str_ends_with(i.first, lang_suffix))
+				continue;
+			pkt << i.first << i.second.sha1_digest;
+		}
+
+		pkt << g_settings->get("remote_media");
+
+		verbosestream << "Server: Announcing " << media_sent
+			<< " files for language \"" << lang_code << "\"" << std::endl;
+		return std::string(pkt.getString(0), pkt.getSize());
+	});
 
-	pkt << g_settings->get("remote_media");
+	// Make packet
+	NetworkPacket pkt(TOCLIENT_ANNOUNCE_MEDIA, 0, peer_id);
+	pkt.putRawString(payload.get());
 	Send(&pkt);
 
 	verbosestream << "Server: Announcing files to id(" << peer_id
-		<< "): count=" << media_sent << " size=" << pkt.getSize() << std::endl;
+		<< "): size=" << pkt.getSize() << std::endl;
 }
 
 struct SendableMedia
@@ -3723,16 +4019,20 @@ ICraftDefManager *Server::getCraftDefManager()
 
 u16 Server::allocateUnknownNodeId(const std::string &name)
 {
+	m_definition_cache.clear();
 	return m_nodedef->allocateDummy(name);
 }
 
+// Callers change the definitions, what was sent to clients is outdated
 IWritableItemDefManager *Server::getWritableItemDefManager()
 {
+	m_definition_cache.clear();
 	return m_itemdef;
 }
 
 NodeDefManager *Server::getWritableNodeDefManager()
 {
+	m_definition_cache.clear();
 	return m_nodedef;
 }
 
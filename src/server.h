@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "network/peerhandler.h"
 #include "network/address.h"
 #include "util/numeric.h"
+#include "util/container.h"
 #include "util/thread.h"
 #include "util/basic_macros.h"
 #include "util/metricsbackend.h"
@@ -38,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "chatmessage.h"
 #include "sound.h"
 #include "translation.h"
+#include "server/serialized_cache.h"
 #include <string>
 #include <list>
 #include <map>
@@ -72,6 +74,7 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class NodeChangeBatch;
 struct PackedValue;
 struct ParticleParameters;
 struct ParticleSpawnerParameters;
@@ -170,6 +173,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	 */
 
 	void handleCommand(NetworkPacket* pkt);
+	// Hands the command to the packet handler threads
+	void queueCommand(NetworkPacket *pkt, void (Server::*handler)(NetworkPacket *));
 
 	void handleCommand_Null(NetworkPacket* pkt) {};
 	void handleCommand_Deprecated(NetworkPacket* pkt);
@@ -426,10 +431,24 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		}
 	};
 
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
+	// Compressed network serialization of a block, shared by all clients
+	struct SerializedBlock {
+		// MapBlock::getContentsVersion() at serialization time, 0 if empty
+		u64 contents_version;
+		// Value of m_block_cache_step when last sent
+		u32 last_used;
+		std::string data;
+	};
+
+	// Keyed by block position and serialization version
+	typedef std::unordered_map<std::pair<v3s16, u16>, SerializedBlock, SBCHash> SerializedBlockCache;
 
 	void init();
 
+	// For packet handler threads: runs task on the server thread
+	void runOnServerThread(std::function<void()> task);
+	void runServerThreadTasks();
+
 	void SendMovement(session_t peer_id);
 	void SendHP(session_t peer_id, u16 hp, bool effect);
 	void SendBreath(session_t peer_id, u16 breath);
@@ -438,6 +457,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendAccessDenied_Legacy(session_t peer_id, const std::wstring &reason);
 	void SendDeathscreen(session_t peer_id, bool set_camera_point_target,
 		v3f camera_point_target);
+	void prepareDefinitionCache(u16 protocol_version);
 	void SendItemDef(session_t peer_id, IItemDefManager *itemdef, u16 protocol_version);
 	void SendNodeDef(session_t peer_id, const NodeDefManager *nodedef,
 		u16 protocol_version);
@@ -470,26 +490,29 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			const std::string &message, session_t from_peer);
 
 	/*
-		Send a node removal/addition event to all clients except ignore_id.
-		Additionally, if far_players!=NULL, players further away than
-		far_d_nodes are ignored and their peer_ids are added to far_players
+		Send the node changes of a server step to all clients. Players
+		further away than far_d_nodes get the changed blocks again instead.
 	*/
-	// Envlock and conlock should be locked when calling these
-	void sendRemoveNode(v3s16 p, std::unordered_set<u16> *far_players = nullptr,
-			float far_d_nodes = 100);
-	void sendAddNode(v3s16 p, MapNode n,
-			std::unordered_set<u16> *far_players = nullptr,
-			float far_d_nodes = 100, bool remove_metadata = true);
-	void sendNodeChangePkt(NetworkPacket &pkt, v3s16 block_pos,
-			v3f p, float far_d_nodes, std::unordered_set<u16> *far_players);
+	// Envlock should be locked when calling these
+	void sendNodeChanges(const NodeChangeBatch &changes, float far_d_nodes = 100);
+	void sendNodeChangesPkt(session_t peer_id, u16 count, const std::string &data);
 
 	void sendMetadataChanged(const std::unordered_set<v3s16> &positions,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version);
+	void SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data);
+
+	// Returns the serialization of the block from m_block_cache,
+	// serializing it first if needed. Environment must be locked.
+	const std::string &getSerializedBlock(MapBlock *block, u8 ver);
+	// Fills m_block_cache for all these blocks, in parallel when possible.
+	// Environment must be locked.
+	void serializeBlocks(const std::vector<std::pair<MapBlock *, u8>> &blocks);
+	// Drops cache entries that were not used recently
+	void trimBlockCache();
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -610,6 +633,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Craft definition manager
 	IWritableCraftDefManager *m_craftdef;
 
+	// Compressed item and node definitions per protocol version,
+	// cleared when the definitions change
+	SerializedCache m_definition_cache;
+
 	// Mods
 	std::unique_ptr<ServerModManager> m_modmgr;
 
@@ -683,6 +710,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// media files known to server
 	std::unordered_map<std::string, MediaInfo> m_media;
+	// TOCLIENT_ANNOUNCE_MEDIA payload per language, cleared when m_media changes
+	SerializedCache m_media_announcement_cache;
 
 	// pending dynamic media callbacks, clients inform the server when they have a file fetched
 	std::unordered_map<u32, PendingDynamicMediaCallback> m_pending_dyn_media;
@@ -708,8 +737,18 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Inventory manager
 	std::unique_ptr<ServerInventoryManager> m_inventory_mgr;
 
-	// Global server metrics backend
-	std::unique_ptr<MetricsBackend> m_metrics_backend;
+	// Serialized blocks, reused as long as the block does not change
+	SerializedBlockCache m_block_cache;
+	u32 m_block_cache_step = 0;
+	// Serializes and compresses blocks for SendBlocks()
+	std::unique_ptr<WorkerThreadPool> m_block_serializers;
+	// Handles TOSERVER_CONTEXT_WORKER commands
+	std::unique_ptr<WorkerThreadPool> m_packet_handlers;
+	// Work handed back to the server thread, run with the environment locked
+	MutexedQueue<std::function<void()>> m_server_thread_tasks;
+
+	// Global server metrics backend, shared with the connection
+	std::shared_ptr<MetricsBackend> m_metrics_backend;
 
 	// Server metrics
 	MetricCounterPtr m_uptime_counter;
@@ -717,9 +756,18 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	MetricGaugePtr m_timeofday_gauge;
 	MetricGaugePtr m_lag_gauge;
 	MetricCounterPtr m_aom_buffer_counter[2]; // [0] = rel, [1] = unrel
+	MetricCounterPtr m_aom_coalesced_counter;
+	// [0] = before, [1] = after delta encoding
+	MetricCounterPtr m_aom_position_bytes_counter[2];
 	MetricCounterPtr m_packet_recv_counter;
 	MetricCounterPtr m_packet_recv_processed_counter;
+	MetricHistogramPtr m_packet_handle_histogram;
+	MetricCounterPtr m_packet_handler_queued_counter;
+	MetricHistogramPtr m_step_time_histogram;
 	MetricCounterPtr m_map_edit_event_counter;
+	MetricCounterPtr m_block_cache_hit_counter;
+	MetricCounterPtr m_block_cache_miss_counter;
+	MetricGaugePtr m_block_cache_size_gauge;
 };
 
 /*
@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <cmath>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -25,6 +26,112 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 namespace server
 {
 
+// Side length of a spatial index cell
+static constexpr f32 CELL_SIZE = MAP_BLOCKSIZE * BS;
+
+static s16 getCellCoord(f32 v)
+{
+	f32 c = std::floor(v / CELL_SIZE);
+	// Objects can end up outside of the map (or at NaN), keep them in range
+	if (!(c > -32768.0f))
+		return -32768;
+	if (c > 32767.0f)
+		return 32767;
+	return (s16)c;
+}
+
+v3s16 ActiveObjectMgr::getCellPos(const v3f &pos)
+{
+	return v3s16(getCellCoord(pos.X), getCellCoord(pos.Y), getCellCoord(pos.Z));
+}
+
+void ActiveObjectMgr::addToCell(u16 id, const v3s16 &cell)
+{
+	m_cells[cell].push_back(id);
+	m_object_cells[id] = cell;
+}
+
+void ActiveObjectMgr::removeFromIndex(u16 id)
+{
+	m_player_ids.erase(id);
+
+	auto it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+
+	auto cell_it = m_cells.find(it->second);
+	if (cell_it != m_cells.end()) {
+		std::vector<u16> &ids = cell_it->second;
+		for (size_t i = 0; i < ids.size(); i++) {
+			if (ids[i] != id)
+				continue;
+			ids[i] = ids.back();
+			ids.pop_back();
+			break;
+		}
+		if (ids.empty())
+			m_cells.erase(cell_it);
+	}
+	m_object_cells.erase(it);
+}
+
+void ActiveObjectMgr::updateObjectPosition(u16 id, const v3f &pos)
+{
+	auto it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+
+	v3s16 cell = getCellPos(pos);
+	if (cell == it->second)
+		return;
+
+	bool is_player = m_player_ids.count(id) > 0;
+	removeFromIndex(id);
+	addToCell(id, cell);
+	if (is_player)
+		m_player_ids.insert(id);
+}
+
+void ActiveObjectMgr::getObjectsInCells(const v3f &minp, const v3f &maxp,
+		std::vector<ServerActiveObject *> &result)
+{
+	v3s16 cmin = getCellPos(minp);
+	v3s16 cmax = getCellPos(maxp);
+	if (cmin.X > cmax.X || cmin.Y > cmax.Y || cmin.Z > cmax.Z)
+		return;
+
+	auto append_cell = [&](const std::vector<u16> &ids) {
+		for (u16 id : ids) {
+			auto n = m_active_objects.find(id);
+			if (n != m_active_objects.end())
+				result.push_back(n->second);
+		}
+	};
+
+	u64 cell_count = (u64)(cmax.X - cmin.X + 1) * (cmax.Y - cmin.Y + 1) *
+			(cmax.Z - cmin.Z + 1);
+
+	// Huge query volumes: visiting the occupied cells is cheaper
+	if (cell_count > m_cells.size()) {
+		for (const auto &it : m_cells) {
+			const v3s16 &c = it.first;
+			if (c.X >= cmin.X && c.X <= cmax.X &&
+					c.Y >= cmin.Y && c.Y <= cmax.Y &&
+					c.Z >= cmin.Z && c.Z <= cmax.Z)
+				append_cell(it.second);
+		}
+		return;
+	}
+
+	for (s32 z = cmin.Z; z <= cmax.Z; z++)
+	for (s32 y = cmin.Y; y <= cmax.Y; y++)
+	for (s32 x = cmin.X; x <= cmax.X; x++) {
+		auto it = m_cells.find(v3s16(x, y, z));
+		if (it != m_cells.end())
+			append_cell(it->second);
+	}
+}
+
 void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)> &cb)
 {
 	// make a defensive copy in case the
@@ -35,6 +142,7 @@ void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)>
 		if (cb(it.second, it.first)) {
 			// Remove reference from m_active_objects
 			m_active_objects.erase(it.first);
+			removeFromIndex(it.first);
 		}
 	}
 }
@@ -86,6 +194,9 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 	}
 
 	m_active_objects[obj->getId()] = obj;
+	addToCell(obj->getId(), getCellPos(obj->getBasePosition()));
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.insert(obj->getId());
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
@@ -105,6 +216,7 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 
 	m_active_objects.erase(id);
+	removeFromIndex(id);
 	delete obj;
 }
 
@@ -113,9 +225,11 @@ void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
+	std::vector<ServerActiveObject *> candidates;
+	getObjectsInCells(pos - v3f(radius), pos + v3f(radius), candidates);
+
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	for (ServerActiveObject *obj : candidates) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
 			continue;
@@ -129,8 +243,10 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	std::vector<ServerActiveObject *> candidates;
+	getObjectsInCells(box.MinEdge, box.MaxEdge, candidates);
+
+	for (ServerActiveObject *obj : candidates) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (!box.isPointInside(objectpos))
 			continue;
@@ -145,38 +261,43 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player and all players,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second;
-		if (!object)
-			continue;
-
-		if (object->isGone())
-			continue;
+	auto add_if_new = [&](ServerActiveObject *object) {
+		if (!object || object->isGone())
+			return;
 
 		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
 		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
 			// Discard if too far
 			if (distance_f > player_radius && player_radius != 0)
-				continue;
+				return;
 		} else if (distance_f > radius)
-			continue;
+			return;
 
 		// Discard if already on current_objects
-		auto n = current_objects.find(id);
-		if (n != current_objects.end())
-			continue;
+		u16 id = object->getId();
+		if (current_objects.find(id) != current_objects.end())
+			return;
 		// Add to added_objects
 		added_objects.push(id);
+	};
+
+	std::vector<ServerActiveObject *> candidates;
+	getObjectsInCells(player_pos - v3f(radius), player_pos + v3f(radius),
+			candidates);
+	for (ServerActiveObject *object : candidates) {
+		// Players use a different radius, they are handled below
+		if (object->getType() != ACTIVEOBJECT_TYPE_PLAYER)
+			add_if_new(object);
 	}
+
+	for (u16 id : m_player_ids)
+		add_if_new(getActiveObject(id));
 }
 
 } // namespace server
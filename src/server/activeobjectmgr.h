@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
@@ -45,5 +47,29 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+	// Keeps the spatial index in sync, called when an object has moved.
+	// Unknown ids are ignored.
+	void updateObjectPosition(u16 id, const v3f &pos);
+
+private:
+	static v3s16 getCellPos(const v3f &pos);
+
+	void addToCell(u16 id, const v3s16 &cell);
+	void removeFromIndex(u16 id);
+
+	// Appends all objects that are stored in cells overlapping [minp, maxp]
+	void getObjectsInCells(const v3f &minp, const v3f &maxp,
+			std::vector<ServerActiveObject *> &result);
+
+	/*
+		Spatial index: objects are bucketed into cubic cells of
+		one mapblock each, so that area queries only need to look
+		at the objects close to the query instead of all of them.
+	*/
+	std::unordered_map<v3s16, std::vector<u16>> m_cells;
+	std::unordered_map<u16, v3s16> m_object_cells;
+	// Players may be sent regardless of distance (player_transfer_distance = 0)
+	std::unordered_set<u16> m_player_ids;
 };
 } // namespace server
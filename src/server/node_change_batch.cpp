@@ -0,0 +1,57 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "node_change_batch.h"
+#include "mapblock.h"
+#include "util/serialize.h"
+
+void NodeChangeBatch::add(v3s16 p, MapNode n, bool remove_metadata,
+		const std::vector<v3s16> &modified_blocks)
+{
+	v3s16 block_pos = getNodeBlockPos(p);
+	Block &block = m_blocks[block_pos];
+
+	block.modified_blocks.insert(block_pos);
+	block.modified_blocks.insert(modified_blocks.begin(), modified_blocks.end());
+
+	auto it = block.index.find(p);
+	if (it == block.index.end()) {
+		block.index.emplace(p, block.changes.size());
+		block.changes.push_back({p, n, remove_metadata});
+		return;
+	}
+
+	// Metadata removed by an earlier change stays removed
+	Change &change = block.changes[it->second];
+	change.n = n;
+	change.remove_metadata |= remove_metadata;
+}
+
+void NodeChangeBatch::serialize(const Block &block, std::string &out)
+{
+	u8 buf[SERIALIZED_CHANGE_SIZE];
+	for (const Change &change : block.changes) {
+		writeV3S16(&buf[0], change.p);
+		writeU16(&buf[6], change.n.param0);
+		writeU8(&buf[8], change.n.param1);
+		writeU8(&buf[9], change.n.param2);
+		writeU8(&buf[10], change.remove_metadata ? 0 : 1);
+		out.append((const char *)buf, sizeof(buf));
+	}
+}
@@ -0,0 +1,71 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include "mapnode.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+	Node changes of one server step, grouped by MapBlock so that every
+	client gets them in one TOCLIENT_NODE_CHANGES packet.
+*/
+class NodeChangeBatch
+{
+public:
+	struct Change {
+		v3s16 p;
+		MapNode n;
+		bool remove_metadata;
+	};
+
+	struct Block {
+		// Latest change of each node, in the order they first changed
+		std::vector<Change> changes;
+		// Blocks to resend instead, includes the block itself
+		std::unordered_set<v3s16> modified_blocks;
+
+		// Index into changes
+		std::unordered_map<v3s16, size_t> index;
+	};
+
+	void add(v3s16 p, MapNode n, bool remove_metadata,
+			const std::vector<v3s16> &modified_blocks);
+
+	const std::map<v3s16, Block> &getBlocks() const { return m_blocks; }
+	bool empty() const { return m_blocks.empty(); }
+	void clear() { m_blocks.clear(); }
+
+	// Appends the changes in the TOCLIENT_NODE_CHANGES format
+	static void serialize(const Block &block, std::string &out);
+
+	// Size of one change in a TOCLIENT_NODE_CHANGES packet
+	static constexpr u32 SERIALIZED_CHANGE_SIZE = 6 + 2 + 1 + 1 + 1;
+	// With more changes in one block, sending the block again is cheaper:
+	// compressed blocks are usually smaller than this many changes.
+	static constexpr u32 MAX_CHANGES_PER_BLOCK = 128;
+
+private:
+	std::map<v3s16, Block> m_blocks;
+};
@@ -0,0 +1,178 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "object_update_encoder.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+#include <set>
+
+// Size of an AO_CMD_UPDATE_POSITION message, see
+// UnitSAO::generateUpdatePositionCommand()
+#define UPDATE_POSITION_SIZE 55
+#define UPDATE_POSITION_INTERPOLATE_OFFSET 49
+
+static bool isFullState(u8 cmd)
+{
+	switch (cmd) {
+	case AO_CMD_SET_PROPERTIES:
+	case AO_CMD_UPDATE_POSITION:
+	case AO_CMD_UPDATE_ARMOR_GROUPS:
+	case AO_CMD_SET_ANIMATION:
+	case AO_CMD_ATTACH_TO:
+	case AO_CMD_SET_PHYSICS_OVERRIDE:
+	case AO_CMD_SET_ANIMATION_SPEED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+u32 coalesceObjectMessages(std::vector<ActiveObjectMessage> &messages)
+{
+	if (messages.size() < 2)
+		return 0;
+
+	// Walk backwards so the last message of each kind is the one that stays
+	std::set<std::pair<u8, bool>> seen;
+	std::vector<bool> keep(messages.size(), true);
+	u32 dropped = 0;
+	for (size_t i = messages.size(); i-- > 0;) {
+		const ActiveObjectMessage &aom = messages[i];
+		if (aom.datastring.empty())
+			continue;
+		u8 cmd = aom.datastring[0];
+		if (!isFullState(cmd))
+			continue;
+		// A teleport is not made obsolete by the updates that follow it
+		if (cmd == AO_CMD_UPDATE_POSITION &&
+				aom.datastring.size() > UPDATE_POSITION_INTERPOLATE_OFFSET &&
+				aom.datastring[UPDATE_POSITION_INTERPOLATE_OFFSET] == 0)
+			continue;
+
+		if (!seen.emplace(cmd, aom.reliable).second) {
+			keep[i] = false;
+			dropped++;
+		}
+	}
+
+	if (dropped == 0)
+		return 0;
+
+	size_t n = 0;
+	for (size_t i = 0; i < messages.size(); i++) {
+		if (keep[i])
+			messages[n++] = std::move(messages[i]);
+	}
+	messages.erase(messages.begin() + n, messages.end());
+	return dropped;
+}
+
+static bool quantize(float value, float unit, s16 &result)
+{
+	float q = std::round(value / unit);
+	// Also false for NaN
+	if (!(q >= S16_MIN && q <= S16_MAX))
+		return false;
+	result = q;
+	return true;
+}
+
+static bool quantize(const v3f &value, float unit, s16 result[3])
+{
+	return quantize(value.X, unit, result[0]) &&
+		quantize(value.Y, unit, result[1]) &&
+		quantize(value.Z, unit, result[2]);
+}
+
+static u16 quantizeAngle(float degrees)
+{
+	// 360 degrees wrap around to 0
+	return (u16)(u32)std::round(wrapDegrees_0_360(degrees) * (65536.0f / 360.0f));
+}
+
+bool ObjectPositionEncoder::encode(u16 id, const std::string &update,
+		std::string &out)
+{
+	if (update.size() != UPDATE_POSITION_SIZE ||
+			(u8)update[0] != AO_CMD_UPDATE_POSITION) {
+		out = update;
+		return false;
+	}
+
+	const u8 *data = (const u8 *)update.data();
+	v3f position = readV3F32(&data[1]);
+	v3f velocity = readV3F32(&data[13]);
+	v3f acceleration = readV3F32(&data[25]);
+	v3f rotation = readV3F32(&data[37]);
+	u8 do_interpolate = data[49];
+	u8 is_movement_end = data[50];
+	float update_interval = readF32(&data[51]);
+
+	s16 q_velocity[3], q_acceleration[3];
+	float q_interval = std::round(update_interval / INTERVAL_UNIT);
+	if (!quantize(velocity, SPEED_UNIT, q_velocity) ||
+			!quantize(acceleration, SPEED_UNIT, q_acceleration) ||
+			!(q_interval >= 0 && q_interval <= U8_MAX)) {
+		out = update;
+		return false;
+	}
+
+	s16 q_delta[3];
+	auto it = m_keyframes.find(id);
+	if (it == m_keyframes.end() || !do_interpolate ||
+			!quantize(position - it->second.position, POSITION_UNIT, q_delta)) {
+		// Keyframe, the client can not apply deltas before it has one
+		Keyframe &keyframe = m_keyframes[id];
+		if (it != m_keyframes.end())
+			keyframe.id++;
+		else
+			keyframe.id = 0;
+		keyframe.position = position;
+
+		out = update;
+		out.push_back((char)keyframe.id);
+		return true;
+	}
+
+	char buf[2];
+	out.clear();
+	out.reserve(28);
+	out.push_back((char)AO_CMD_UPDATE_POSITION_DELTA);
+	out.push_back((char)it->second.id);
+	for (s16 v : q_delta) {
+		writeS16((u8 *)buf, v);
+		out.append(buf, 2);
+	}
+	for (s16 v : q_velocity) {
+		writeS16((u8 *)buf, v);
+		out.append(buf, 2);
+	}
+	for (s16 v : q_acceleration) {
+		writeS16((u8 *)buf, v);
+		out.append(buf, 2);
+	}
+	for (float v : {rotation.X, rotation.Y, rotation.Z}) {
+		writeU16((u8 *)buf, quantizeAngle(v));
+		out.append(buf, 2);
+	}
+	out.push_back((char)((do_interpolate ? 1 : 0) | (is_movement_end ? 2 : 0)));
+	out.push_back((char)(u8)q_interval);
+	return false;
+}
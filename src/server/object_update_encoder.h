@@ -0,0 +1,70 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include "activeobject.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Drops the messages of one object that are made obsolete by a later
+	message of the same command, e.g. all but the last property or
+	position update of a server step.
+	Messages that are not a full state (texture modifiers, punches, ...)
+	and position updates that do not interpolate (teleports) are kept.
+	Returns the number of dropped messages.
+*/
+u32 coalesceObjectMessages(std::vector<ActiveObjectMessage> &messages);
+
+/*
+	Turns the position updates sent to one client into small deltas.
+
+	The first update of an object is sent reliably as a keyframe: the
+	AO_CMD_UPDATE_POSITION message with a keyframe id appended. The
+	following updates are sent as AO_CMD_UPDATE_POSITION_DELTA, with the
+	position relative to the keyframe and every value quantized. A new
+	keyframe is sent when the object moves too far from the last one.
+	Updates that can not be quantized are passed on as they are.
+*/
+class ObjectPositionEncoder
+{
+public:
+	// Encodes the AO_CMD_UPDATE_POSITION message update of object id into
+	// out. Returns true if out must be sent reliably.
+	bool encode(u16 id, const std::string &update, std::string &out);
+
+	// Called when the object is removed from or added to the client
+	void forget(u16 id) { m_keyframes.erase(id); }
+
+	// Units of the quantized values
+	static constexpr float POSITION_UNIT = 0.01f;
+	static constexpr float SPEED_UNIT = 0.01f;
+	static constexpr float INTERVAL_UNIT = 0.01f;
+
+private:
+	struct Keyframe {
+		u8 id;
+		v3f position;
+	};
+
+	std::unordered_map<u16, Keyframe> m_keyframes;
+};
@@ -0,0 +1,67 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "serialized_cache.h"
+#include "threading/mutex_auto_lock.h"
+
+std::shared_future<std::string> SerializedCache::get(const std::string &key,
+		const Builder &build)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		return it->second;
+
+	// Built by the first get() of the result, outside of the lock
+	std::shared_future<std::string> entry =
+		std::async(std::launch::deferred, build).share();
+	m_entries.emplace(key, entry);
+	return entry;
+}
+
+void SerializedCache::prepare(const std::string &key, const Builder &build)
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_entries.find(key) != m_entries.end())
+		return;
+
+	m_entries.emplace(key, std::async(std::launch::async, build).share());
+}
+
+void SerializedCache::clear()
+{
+	decltype(m_entries) entries;
+	{
+		MutexAutoLock lock(m_mutex);
+		entries.swap(m_entries);
+	}
+
+	// Background builds must not outlive what they are built from
+	for (auto &it : entries) {
+		if (it.second.wait_for(std::chrono::seconds(0)) !=
+				std::future_status::deferred)
+			it.second.wait();
+	}
+}
+
+size_t SerializedCache::size()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_entries.size();
+}
@@ -0,0 +1,60 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+	Data that is expensive to build and the same for many clients, like
+	the compressed definitions sent to every joining client.
+
+	Each entry is built once, either by the first caller of get() or in
+	a background thread started by prepare(), and then shared until the
+	cache is cleared. Thread-safe.
+*/
+class SerializedCache
+{
+public:
+	typedef std::function<std::string()> Builder;
+
+	~SerializedCache() { clear(); }
+
+	// Returns the data for key, built by build if it is not cached.
+	// Getting the result waits for a build running in the background.
+	std::shared_future<std::string> get(const std::string &key,
+			const Builder &build);
+
+	// Starts building the data for key in a background thread
+	void prepare(const std::string &key, const Builder &build);
+
+	// Drops all entries, e.g. because what they were built from changed.
+	// Waits for builds running in the background.
+	void clear();
+
+	size_t size();
+
+private:
+	std::mutex m_mutex;
+	std::unordered_map<std::string, std::shared_future<std::string>> m_entries;
+};
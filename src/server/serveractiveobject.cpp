@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventorymanager.h"
 #include "constants.h" // BS
 #include "log.h"
+#include "serverenvironment.h"
 
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 	ActiveObject(0),
@@ -31,6 +32,14 @@ ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 {
 }
 
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	bool changed = pos != m_base_position;
+	m_base_position = pos;
+	if (changed && m_env && m_id != 0)
+		m_env->updateActiveObjectPosition(m_id, pos);
+}
+
 float ServerActiveObject::getMinimumSavedMovement()
 {
 	return 2.0*BS;
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "nodedef.h"
 #include "nodemetadata.h"
+#include "noise.h"
 #include "gamedef.h"
 #include "map.h"
 #include "porting.h"
@@ -36,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
+#include "util/thread.h"
 #include "threading/mutex_auto_lock.h"
 #include "filesys.h"
 #include "gameparams.h"
@@ -262,6 +264,19 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	content_t c;
 	auto it = getLBMsIntroducedAfter(stamp);
 	for (; it != m_lbm_lookup.end(); ++it) {
+		// Skip the node loop if none of the block's content types has LBMs
+		if (block->contents_cached) {
+			bool has_lbms = false;
+			for (content_t c : block->contents) {
+				if (it->second.lookup(c)) {
+					has_lbms = true;
+					break;
+				}
+			}
+			if (!has_lbms)
+				continue;
+		}
+
 		// Cache previous version to speedup lookup which has a very high performance
 		// penalty on each call
 		content_t previous_c = CONTENT_IGNORE;
@@ -418,12 +433,19 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 {
 	m_step_time_counter = mb->addCounter(
 		"minetest_env_step_time", "Time spent in environment step (in microseconds)");
+	m_step_time_histogram = mb->addHistogram(
+		"minetest_env_step_seconds", "Duration of environment steps",
+		MetricsBackend::getDurationBuckets());
 
 	m_active_block_gauge = mb->addGauge(
 		"minetest_env_active_blocks", "Number of active blocks");
 
 	m_active_object_gauge = mb->addGauge(
 		"minetest_env_active_objects", "Number of active objects");
+
+	u16 abm_threads = g_settings->getU16("abm_threads");
+	if (abm_threads > 0)
+		m_abm_workers = std::make_unique<WorkerThreadPool>("ABMWorker", abm_threads);
 }
 
 void ServerEnvironment::init()
@@ -876,29 +898,28 @@ class ABMHandler
 		wider += wider_unknown_count * wider / wider_known_count;
 		return active_object_count;
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	// Checks the content type cache of a block to see whether there are any
+	// ABMs to be run at all for this block
+	bool needsScan(MapBlock *block, int &blocks_cached)
 	{
 		if (m_aabms.empty())
-			return;
+			return false;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (block->contents_cached) {
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
+		if (!block->contents_cached)
+			return true;
+
+		blocks_cached++;
+		for (content_t c : block->contents) {
+			if (c < m_aabms.size() && m_aabms[c])
+				return true;
 		}
+		return false;
+	}
+
+	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		if (!needsScan(block, blocks_cached))
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -914,15 +935,6 @@ class ABMHandler
 		{
 			MapNode n = block->getNodeNoCheck(p0);
 			content_t c = n.getContent();
-			// Cache content types as we go
-			if (!block->contents_cached && !block->do_not_cache_contents) {
-				block->contents.insert(c);
-				if (block->contents.size() > 64) {
-					// Too many different nodes... don't try to cache
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-				}
-			}
 
 			if (c >= m_aabms.size() || !m_aabms[c])
 				continue;
@@ -984,7 +996,151 @@ class ABMHandler
 					break;
 			}
 		}
-		block->contents_cached = !block->do_not_cache_contents;
+	}
+
+	/*
+		Parallel mode: the node scan, chance rolls and neighbor checks are
+		done on worker threads, then the triggers are run on the calling
+		thread with runScanned().
+	*/
+	struct Candidate
+	{
+		v3s16 p0; // relative to block
+		content_t c;
+		const ActiveABM *aabm;
+	};
+
+	struct BlockScan
+	{
+		MapBlock *block;
+		// 3x3x3 blocks around (and including) `block`, NULL if not loaded
+		MapBlock *neighbors[27];
+		u32 seed;
+		std::vector<Candidate> candidates;
+	};
+
+	void scanParallel(const std::vector<MapBlock *> &blocks, WorkerThreadPool &pool,
+		std::vector<BlockScan> &scans, int &blocks_scanned, int &blocks_cached)
+	{
+		ServerMap *map = &m_env->getServerMap();
+
+		// The map must not be accessed from the workers, so collect
+		// everything they will need beforehand
+		scans.reserve(blocks.size());
+		for (MapBlock *block : blocks) {
+			if (!needsScan(block, blocks_cached))
+				continue;
+			blocks_scanned++;
+
+			scans.emplace_back();
+			BlockScan &scan = scans.back();
+			scan.block = block;
+			scan.seed = myrand();
+			const v3s16 bp = block->getPos();
+			for (s16 z = 0; z < 3; z++)
+			for (s16 y = 0; y < 3; y++)
+			for (s16 x = 0; x < 3; x++) {
+				scan.neighbors[z * 9 + y * 3 + x] =
+					map->getBlockNoCreateNoEx(bp + v3s16(x - 1, y - 1, z - 1));
+			}
+		}
+
+		pool.parallelFor(scans.size(), [&] (size_t i) {
+			scanBlock(scans[i]);
+		});
+	}
+
+	void scanBlock(BlockScan &scan)
+	{
+		MapBlock *block = scan.block;
+		PcgRandom pr(scan.seed);
+		const s16 y_offset = block->getPosRelative().Y;
+
+		auto get_content = [&] (v3s16 p1) -> content_t {
+			if (block->isValidPosition(p1))
+				return block->getNodeNoCheck(p1).getContent();
+			v3s16 np(p1.X < 0 ? 0 : p1.X >= MAP_BLOCKSIZE ? 2 : 1,
+				p1.Y < 0 ? 0 : p1.Y >= MAP_BLOCKSIZE ? 2 : 1,
+				p1.Z < 0 ? 0 : p1.Z >= MAP_BLOCKSIZE ? 2 : 1);
+			MapBlock *neighbor = scan.neighbors[np.Z * 9 + np.Y * 3 + np.X];
+			if (!neighbor)
+				return CONTENT_IGNORE;
+			return neighbor->getNodeNoCheck(p1 - (np - 1) * MAP_BLOCKSIZE).getContent();
+		};
+
+		auto has_required_neighbor = [&] (v3s16 p0, const ActiveABM &aabm) -> bool {
+			v3s16 p1;
+			for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+			for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+			for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+			{
+				if (p1 != p0 && CONTAINS(aabm.required_neighbors, get_content(p1)))
+					return true;
+			}
+			return false;
+		};
+
+		v3s16 p0;
+		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
+		{
+			content_t c = block->getNodeNoCheck(p0).getContent();
+
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+
+			s16 y = p0.Y + y_offset;
+			for (const ActiveABM &aabm : *m_aabms[c]) {
+				if ((y < aabm.min_y) || (y > aabm.max_y))
+					continue;
+
+				if (pr.next() % aabm.chance != 0)
+					continue;
+
+				if (aabm.check_required_neighbors &&
+						!has_required_neighbor(p0, aabm))
+					continue;
+
+				scan.candidates.push_back({p0, c, &aabm});
+			}
+		}
+	}
+
+	void runScanned(const BlockScan &scan, int &abms_run)
+	{
+		MapBlock *block = scan.block;
+		if (scan.candidates.empty() || block->isOrphan())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		u32 active_object_count_wider;
+		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+		m_env->m_added_objects = 0;
+
+		for (const Candidate &candidate : scan.candidates) {
+			// An earlier trigger may have changed the node
+			MapNode n = block->getNodeNoCheck(candidate.p0);
+			if (n.getContent() != candidate.c)
+				continue;
+
+			v3s16 p = candidate.p0 + block->getPosRelative();
+			abms_run++;
+			// Call all the trigger variations
+			candidate.aabm->abm->trigger(m_env, p, n);
+			candidate.aabm->abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
+
+			if (block->isOrphan())
+				return;
+
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
 	}
 };
 
@@ -1492,26 +1648,59 @@ void ServerEnvironment::step(float dtime)
 		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
+		if (m_abm_workers) {
+			std::vector<MapBlock *> blocks;
+			blocks.reserve(output.size());
+			for (const v3s16 &p : output) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block)
+					continue;
 
-			i++;
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+				blocks.push_back(block);
+			}
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+			std::vector<ABMHandler::BlockScan> scans;
+			abmhandler.scanParallel(blocks, *m_abm_workers, scans,
+				blocks_scanned, blocks_cached);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			for (const ABMHandler::BlockScan &scan : scans) {
+				i++;
 
-			u32 time_ms = timer.getTimerTime();
+				abmhandler.runScanned(scan, abms_run);
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
+				u32 time_ms = timer.getTimerTime();
+
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << scans.size() << " scanned active blocks)" << std::endl;
+					break;
+				}
+			}
+		} else {
+			for (const v3s16 &p : output) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block)
+					continue;
+
+				i++;
+
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+
+				/* Handle ActiveBlockModifiers */
+				abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+
+				u32 time_ms = timer.getTimerTime();
+
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << output.size() << " active blocks)" << std::endl;
+					break;
+				}
 			}
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
@@ -1610,6 +1799,7 @@ void ServerEnvironment::step(float dtime)
 
 	const auto end_time = porting::getTimeUs();
 	m_step_time_counter->increment(end_time - start_time);
+	m_step_time_histogram->observe((end_time - start_time) / 1000000.0);
 }
 
 ServerEnvironment::BlockStatus ServerEnvironment::getBlockStatus(v3s16 blockpos)
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
+#include <memory>
 #include <set>
 #include <random>
 
@@ -41,6 +42,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerThreadPool;
 enum AccessDeniedCode : u8;
 typedef u16 session_t;
 
@@ -358,6 +360,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
 	}
 
+	// Called by active objects when their base position changes
+	void updateActiveObjectPosition(u16 id, const v3f &pos)
+	{
+		m_ao_manager.updateObjectPosition(id, pos);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -492,6 +500,8 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Scans active blocks for ABMs to run, NULL if that is done serially
+	std::unique_ptr<WorkerThreadPool> m_abm_workers;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
@@ -515,6 +525,7 @@ class ServerEnvironment final : public Environment
 
 	// Environment metrics
 	MetricCounterPtr m_step_time_counter;
+	MetricHistogramPtr m_step_time_histogram;
 	MetricGaugePtr m_active_block_gauge;
 	MetricGaugePtr m_active_object_gauge;
 
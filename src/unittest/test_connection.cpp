@@ -26,6 +26,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "network/connection.h"
 #include "network/networkpacket.h"
 #include "network/socket.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/metricsbackend.h"
+#include <map>
 
 class TestConnection : public TestBase {
 public:
@@ -41,7 +44,11 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testPacketBuffer();
+	void testCongestionControl();
+	void testSelectiveAck();
 	void testConnectSendReceive();
+	void testLossyTransfer();
 };
 
 static TestConnection g_test_instance;
@@ -50,7 +57,11 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testPacketBuffer);
+	TEST(testCongestionControl);
+	TEST(testSelectiveAck);
 	TEST(testConnectSendReceive);
+	TEST(testLossyTransfer);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -80,6 +91,58 @@ struct Handler : public con::PeerHandler
 	const char *name;
 };
 
+// Remembers the metrics it creates, by name and labels
+class RecordingMetricsBackend : public MetricsBackend
+{
+public:
+	MetricCounterPtr addCounter(const std::string &name,
+			const std::string &help_str, const Labels &labels = {}) override
+	{
+		MetricCounterPtr counter = MetricsBackend::addCounter(name, help_str, labels);
+		MutexAutoLock lock(m_mutex);
+		m_counters[getKey(name, labels)] = counter;
+		return counter;
+	}
+
+	MetricHistogramPtr addHistogram(const std::string &name,
+			const std::string &help_str, const std::vector<double> &buckets,
+			const Labels &labels = {}) override
+	{
+		MetricHistogramPtr histogram =
+				MetricsBackend::addHistogram(name, help_str, buckets, labels);
+		MutexAutoLock lock(m_mutex);
+		m_histograms[getKey(name, labels)] = histogram;
+		return histogram;
+	}
+
+	MetricCounterPtr getCounter(const std::string &name, const Labels &labels)
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_counters.find(getKey(name, labels));
+		return it != m_counters.end() ? it->second : nullptr;
+	}
+
+	MetricHistogramPtr getHistogram(const std::string &name, const Labels &labels)
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_histograms.find(getKey(name, labels));
+		return it != m_histograms.end() ? it->second : nullptr;
+	}
+
+private:
+	static std::string getKey(const std::string &name, const Labels &labels)
+	{
+		std::string key = name;
+		for (const auto &label : labels)
+			key.append(" ").append(label.first).append("=").append(label.second);
+		return key;
+	}
+
+	std::mutex m_mutex;
+	std::map<std::string, MetricCounterPtr> m_counters;
+	std::map<std::string, MetricHistogramPtr> m_histograms;
+};
+
 void TestConnection::testNetworkPacketSerialize()
 {
 	const static u8 expected[] = {
@@ -119,7 +182,7 @@ void TestConnection::testHelpers()
 	u32 proto_id = 0x12345678;
 	session_t peer_id = 123;
 	u8 channel = 2;
-	SharedBuffer<u8> data1(1);
+	PacketBuffer data1(1);
 	data1[0] = 100;
 	Address a(127,0,0,1, 10);
 	const u16 seqnum = 34352;
@@ -142,7 +205,7 @@ void TestConnection::testHelpers()
 
 	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	PacketBuffer p2 = con::makeReliablePacket(data1, seqnum);
 
 	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
 			<<data1.getSize()<<std::endl;
@@ -156,6 +219,169 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testPacketBuffer()
+{
+	PacketBuffer data(2);
+	data[0] = 1;
+	data[1] = 2;
+	const u8 *payload = *data;
+
+	{
+		// The first header goes in front of the data without a copy
+		PacketBuffer first = data;
+		writeU8(first.prepend(1), 10);
+		UASSERTEQ(u32, first.getSize(), 3);
+		UASSERT(*first + 1 == payload);
+
+		// That space is taken now, so the next header needs a copy
+		PacketBuffer second = data;
+		writeU8(second.prepend(1), 20);
+		UASSERT(*second + 1 != payload);
+		UASSERT(second[0] == 20 && second[1] == 1 && second[2] == 2);
+		UASSERT(first[0] == 10);
+
+		// Shared data is copied before it is written to
+		PacketBuffer third = data;
+		third.makeUnique();
+		UASSERT(*third != payload);
+		third[0] = 30;
+		UASSERT(data[0] == 1 && first[1] == 1);
+	}
+
+	// Nobody else uses the space in front of the data any more
+	data.makeUnique();
+	UASSERT(*data == payload);
+	PacketBuffer fourth = data;
+	writeU8(fourth.prepend(1), 40);
+	UASSERT(*fourth + 1 == payload);
+
+	// Writing to a packet after sending it must not change what is sent
+	NetworkPacket pkt(123, 0);
+	pkt << (u8)1;
+	PacketBuffer forged = pkt.forgePacket();
+	Buffer<u8> old_forged = pkt.oldForgePacket();
+	pkt << (u8)2;
+	UASSERTEQ(u32, forged.getSize(), 3);
+	UASSERTEQ(u32, old_forged.getSize(), 3);
+	UASSERT(!memcmp(*forged, *old_forged, 3));
+	UASSERTEQ(u32, pkt.getSize(), 2);
+}
+
+void TestConnection::testCongestionControl()
+{
+	const float rtt = 0.1f;
+	con::CongestionControl cc(10.0f, 4.0f, 1000.0f);
+
+	// Slow start grows by one packet per acknowledged packet
+	UASSERT(cc.inSlowStart());
+	cc.onAck(10, 1000, rtt);
+	UASSERTEQ(float, cc.getWindow(), 20.0f);
+
+	// A loss shrinks the window and ends slow start
+	cc.onLoss(2000, rtt);
+	UASSERTEQ(float, cc.getWindow(), 20.0f * con::CongestionControl::BETA);
+	UASSERT(!cc.inSlowStart());
+
+	// More losses in the same round trip are the same congestion event
+	const float after_loss = cc.getWindow();
+	cc.onLoss(2050, rtt);
+	UASSERTEQ(float, cc.getWindow(), after_loss);
+	cc.onLoss(2200, rtt);
+	UASSERT(cc.getWindow() < after_loss);
+
+	// Never below the minimum
+	for (u64 t = 3000; t < 10000; t += 200)
+		cc.onLoss(t, rtt);
+	UASSERTEQ(float, cc.getWindow(), 4.0f);
+
+	// Grows back along the cubic curve: quickly at first, slowly near the
+	// size at the loss, then faster again
+	con::CongestionControl cubic(100.0f, 4.0f, 1000.0f);
+	cubic.onLoss(1000, rtt);
+	UASSERTEQ(float, cubic.getWindow(), 70.0f);
+	float last = cubic.getWindow();
+	for (u64 now = 1100; now <= 9000; now += 100) {
+		cubic.onAck((u32)cubic.getWindow(), now, rtt);
+		UASSERT(cubic.getWindow() >= last);
+		last = cubic.getWindow();
+		if (now == 3000)
+			UASSERT(last > 85.0f && last < 100.0f);
+		if (now == 5000)
+			UASSERT(last > 95.0f && last < 105.0f);
+	}
+	UASSERT(last > 115.0f);
+
+	// Pacing: one window per round trip, after a short first burst
+	con::CongestionControl paced(100.0f, 4.0f, 1000.0f);
+	u32 sent = 0;
+	for (u64 t = 1; t <= 1000; t++) {
+		while (paced.pace(t, rtt))
+			sent++;
+	}
+	// 100 packets per 0.1 s
+	UASSERT(sent >= 950 && sent <= 1050);
+	// Unknown round trip time does not limit anything
+	UASSERT(paced.pace(1000, -1.0f));
+}
+
+void TestConnection::testSelectiveAck()
+{
+	con::SeqnumRanges ranges = {{65534, 1}, {5, 5}};
+	PacketBuffer sack = con::makeSelectiveAck(65530, ranges);
+
+	const u8 expected[] = {
+		con::PACKET_TYPE_CONTROL, CONTROLTYPE_SACK,
+		0xff, 0xfa, // next_expected
+		2,
+		0xff, 0xfe, 0x00, 0x01,
+		0x00, 0x05, 0x00, 0x05,
+	};
+	UASSERTEQ(u32, sack.getSize(), sizeof(expected));
+	UASSERT(!memcmp(*sack, expected, sizeof(expected)));
+
+	// Receiver: buffered out of order packets become ranges
+	Address a(127, 0, 0, 1, 10);
+	auto make = [&] (u16 seqnum) {
+		return con::makePacket(a, con::makeReliablePacket(PacketBuffer(1), seqnum),
+			0x12345678, 2, 0);
+	};
+
+	con::ReliablePacketBuffer incoming;
+	const u16 next_expected = 65533;
+	for (u16 seqnum : {65535, 0, 1, 3, 4, 8}) {
+		con::BufferedPacketPtr p = make(seqnum);
+		incoming.insert(p, next_expected);
+	}
+	ranges = incoming.getSeqnumRanges(SACK_MAX_RANGES);
+	UASSERTEQ(size_t, ranges.size(), 3);
+	UASSERT(ranges[0].first == 65535 && ranges[0].second == 1);
+	UASSERT(ranges[1].first == 3 && ranges[1].second == 4);
+	UASSERT(ranges[2].first == 8 && ranges[2].second == 8);
+	UASSERTEQ(size_t, incoming.getSeqnumRanges(2).size(), 2);
+
+	// Sender: everything before next_expected and in the ranges is acked
+	con::ReliablePacketBuffer sent;
+	for (u16 seqnum = 65530; seqnum != 10; seqnum++) {
+		con::BufferedPacketPtr p = make(seqnum);
+		sent.insert(p, 65529);
+	}
+	auto acked = sent.popAcked(next_expected, ranges);
+	UASSERTEQ(size_t, acked.size(), 3 + 3 + 2 + 1);
+	UASSERTEQ(u32, sent.size(), 7);
+	u16 first = 0;
+	UASSERT(sent.getFirstSeqnum(first) && first == 65533);
+
+	// The holes 65533, 65534, 2 are far enough behind 8 to be lost
+	UASSERTEQ(u32, sent.markLost(ranges.back().second), 3);
+	UASSERTEQ(u32, sent.markLost(ranges.back().second), 0);
+	auto resend = sent.getTimedOuts(1000.0f, 100);
+	UASSERTEQ(size_t, resend.size(), 3);
+	UASSERT(resend.front()->getSeqnum() == 65533);
+	UASSERT(resend.back()->getSeqnum() == 2);
+	// Resent packets are left to the timeout
+	UASSERTEQ(u32, sent.markLost(ranges.back().second), 0);
+}
+
 
 void TestConnection::testConnectSendReceive()
 {
@@ -376,3 +602,96 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+void TestConnection::testLossyTransfer()
+{
+	/*
+		Reliable data must arrive complete and in order when datagrams
+		are lost in both directions
+	*/
+
+	u32 proto_id = 0xad26846a;
+
+	Handler hand_server("server");
+	Handler hand_client("client");
+
+	Address address(0, 0, 0, 0, 30002);
+	Address bind_addr(0, 0, 0, 0, 30002);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		bind_addr.Resolve(bind_str.c_str());
+
+		if (!bind_addr.isIPv6()) {
+			address = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+
+	Address server_address(127, 0, 0, 1, 30002);
+	if (address != Address(0, 0, 0, 0, 30002)) {
+		server_address = bind_addr;
+	}
+
+	auto metrics = std::make_shared<RecordingMetricsBackend>();
+	con::Connection server(proto_id, 512, 30.0, false, &hand_server);
+	server.setMetricsBackend(metrics);
+	server.Serve(address);
+	con::Connection client(proto_id, 512, 30.0, false, &hand_client);
+
+	sleep_ms(50);
+	client.Connect(server_address);
+
+	u64 timems0 = porting::getTimeMs();
+	while (!client.Connected() || hand_server.count == 0) {
+		UASSERT(porting::getTimeMs() - timems0 < 5000);
+		NetworkPacket pkt;
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+
+	server.SimulatePacketLoss(0.1f);
+	client.SimulatePacketLoss(0.1f);
+
+	// Small packets with a big one from time to time, which is split
+	const u32 count = 300;
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x42, 0);
+		pkt << i;
+		pkt.putRawString(std::string(i % 20 == 0 ? 5000 : 100, (char)i));
+		server.Send(hand_server.last_id, 0, &pkt, true);
+	}
+
+	u32 received = 0;
+	timems0 = porting::getTimeMs();
+	while (received < count && porting::getTimeMs() - timems0 < 30000) {
+		NetworkPacket pkt;
+		if (!client.TryReceive(&pkt)) {
+			sleep_ms(10);
+			continue;
+		}
+
+		UASSERTEQ(u16, pkt.getCommand(), 0x42);
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, received);
+		const u32 size = i % 20 == 0 ? 5000 : 100;
+		UASSERTEQ(u32, pkt.getSize(), 4 + size);
+		for (u32 j = 0; j < size; j++)
+			UASSERT(pkt.getU8Ptr(4)[j] == (u8)i);
+		received++;
+	}
+	UASSERTEQ(u32, received, count);
+
+	// The losses show up in the metrics of the peer
+	const std::string peer = std::to_string(hand_server.last_id);
+	MetricCounterPtr resends = metrics->getCounter(
+			"minetest_core_con_peer_resends", {{"peer", peer}});
+	UASSERT(resends && resends->get() > 0);
+	MetricCounterPtr bytes_sent = metrics->getCounter(
+			"minetest_core_con_peer_bytes", {{"peer", peer}, {"type", "sent"}});
+	UASSERT(bytes_sent && bytes_sent->get() > count * 100);
+	MetricHistogramPtr rtt = metrics->getHistogram(
+			"minetest_core_con_peer_rtt_seconds", {{"peer", peer}});
+	UASSERT(rtt && rtt->getCount() > 0);
+}
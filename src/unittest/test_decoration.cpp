@@ -0,0 +1,142 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "dummymap.h"
+#include "gamedef.h"
+#include "mapgen/mapgen.h"
+#include "mapgen/mg_decoration.h"
+
+class TestDecoration : public TestBase
+{
+public:
+	TestDecoration() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestDecoration"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSkipUnusedDecorations(IGameDef *gamedef);
+	void testSeedsOfSkipped(IGameDef *gamedef);
+};
+
+static TestDecoration g_test_instance;
+
+void TestDecoration::runTests(IGameDef *gamedef)
+{
+	TEST(testSkipUnusedDecorations, gamedef);
+	TEST(testSeedsOfSkipped, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const v3s16 nmin(0, 0, 0);
+static const v3s16 nmax(15, 15, 15);
+
+static DecoSimple *create_deco(const std::string &name, biome_t biome,
+	content_t c_deco, float fill_ratio)
+{
+	DecoSimple *deco = new DecoSimple();
+	deco->name = name;
+	deco->sidelen = 16;
+	deco->fill_ratio = fill_ratio;
+	deco->y_min = -100;
+	deco->y_max = 100;
+	deco->nspawnby = -1;
+	deco->c_place_on = {t_CONTENT_STONE};
+	deco->c_decos = {c_deco};
+	deco->deco_height = 1;
+	deco->deco_height_max = 0;
+	deco->deco_param2 = 0;
+	deco->deco_param2_max = 0;
+	deco->biomes.insert(biome);
+	return deco;
+}
+
+// Places the decorations on stone up to y = 4 in biome 1, returns the
+// nodes at y = 5
+static std::vector<content_t> place(IGameDef *gamedef, DecorationManager *decomgr)
+{
+	DummyMap map(gamedef, v3s16(0, 0, 0), v3s16(0, 1, 0));
+	MMVManip vm(&map);
+	vm.initialEmerge(v3s16(0, 0, 0), v3s16(0, 1, 0), false);
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 y = 0; y < 32; y++)
+	for (s16 x = nmin.X; x <= nmax.X; x++) {
+		content_t c = y <= 4 ? t_CONTENT_STONE : CONTENT_AIR;
+		vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(c));
+	}
+
+	std::vector<s16> heightmap(16 * 16, 4);
+	std::vector<biome_t> biomemap(16 * 16, 1);
+
+	Mapgen mg;
+	mg.vm = &vm;
+	mg.ndef = gamedef->getNodeDefManager();
+	mg.heightmap = heightmap.data();
+	mg.biomemap = biomemap.data();
+	decomgr->placeAllDecos(&mg, 1234, nmin, nmax);
+
+	std::vector<content_t> result;
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 x = nmin.X; x <= nmax.X; x++)
+		result.push_back(vm.getNodeNoEx(v3s16(x, 5, z)).getContent());
+	return result;
+}
+
+void TestDecoration::testSkipUnusedDecorations(IGameDef *gamedef)
+{
+	DecorationManager decomgr(gamedef);
+	// Biome is not in the chunk
+	decomgr.add(create_deco("brick", 2, t_CONTENT_BRICK, 10.0f));
+	// Height range is not in the chunk
+	DecoSimple *high = create_deco("torch", 1, t_CONTENT_TORCH, 10.0f);
+	high->y_min = 50;
+	decomgr.add(high);
+	decomgr.add(create_deco("grass", 1, t_CONTENT_GRASS, 10.0f));
+
+	for (content_t c : place(gamedef, &decomgr))
+		UASSERTEQ(content_t, c, t_CONTENT_GRASS);
+
+	// Changes to the decorations are picked up
+	decomgr.clear();
+	decomgr.add(create_deco("brick", 1, t_CONTENT_BRICK, 10.0f));
+	for (content_t c : place(gamedef, &decomgr))
+		UASSERTEQ(content_t, c, t_CONTENT_BRICK);
+}
+
+void TestDecoration::testSeedsOfSkipped(IGameDef *gamedef)
+{
+	// Grass is placed at random positions, which must not change when the
+	// decoration before it is skipped instead of placing nothing
+	DecorationManager skipped(gamedef);
+	skipped.add(create_deco("brick", 2, t_CONTENT_BRICK, 1.0f));
+	skipped.add(create_deco("grass", 1, t_CONTENT_GRASS, 0.1f));
+
+	DecorationManager evaluated(gamedef);
+	DecoSimple *nothing = create_deco("brick", 1, t_CONTENT_BRICK, 1.0f);
+	nothing->c_place_on.clear();
+	evaluated.add(nothing);
+	evaluated.add(create_deco("grass", 1, t_CONTENT_GRASS, 0.1f));
+
+	std::vector<content_t> expected = place(gamedef, &evaluated);
+	UASSERT(std::count(expected.begin(), expected.end(), t_CONTENT_GRASS) > 0);
+	UASSERT(place(gamedef, &skipped) == expected);
+}
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <unordered_set>
 #include <unordered_map>
@@ -36,6 +37,8 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testContentsCache(IGameDef *gamedef);
+	void testContentsVersion(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +49,8 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testContentsCache, gamedef);
+	TEST(testContentsVersion, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +174,58 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testContentsCache(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+
+	// A new block is filled with ignore
+	UASSERT(block.contents_cached);
+	UASSERTEQ(size_t, block.contents.size(), 1);
+	UASSERTEQ(content_t, block.contents[0], CONTENT_IGNORE);
+
+	block.setNode(v3s16(1, 2, 3), MapNode(CONTENT_AIR));
+	block.setNodeNoCheck(v3s16(4, 5, 6), MapNode(100));
+	UASSERT(block.contents_cached);
+	std::vector<content_t> expected = {100, CONTENT_AIR, CONTENT_IGNORE};
+	std::sort(expected.begin(), expected.end());
+	UASSERT(block.contents == expected);
+
+	// Too many different content types disable the cache
+	for (u16 i = 0; i < MapBlock::max_cached_contents; i++)
+		block.setNodeNoCheck(v3s16(i % MAP_BLOCKSIZE, i / MAP_BLOCKSIZE, 0),
+			MapNode(200 + i));
+	UASSERT(!block.contents_cached);
+
+	// Rebuilding drops content types that are gone
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.updateContentsCache();
+	UASSERT(block.contents_cached);
+	UASSERTEQ(size_t, block.contents.size(), 1);
+	UASSERTEQ(content_t, block.contents[0], CONTENT_AIR);
+}
+
+void TestMap::testContentsVersion(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	MapBlock other(nullptr, v3s16(0, 0, 0), gamedef);
+
+	const u64 version = block.getContentsVersion();
+	UASSERT(version != 0);
+	UASSERT(block.getContentsVersion() == version);
+	UASSERT(other.getContentsVersion() != version);
+
+	// Changes that clients never see keep the version
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_CHANGED);
+	block.setTimestamp(1234);
+	UASSERT(block.getContentsVersion() == version);
+
+	block.setNode(v3s16(1, 2, 3), MapNode(CONTENT_AIR));
+	const u64 version2 = block.getContentsVersion();
+	UASSERT(version2 != version);
+	UASSERT(version2 != other.getContentsVersion());
+
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
+	UASSERT(block.getContentsVersion() != version2);
+}
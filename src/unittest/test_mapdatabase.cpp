@@ -0,0 +1,236 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "cmake_config.h"
+
+#include "test.h"
+
+#include <cstdlib>
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#if USE_POSTGRESQL
+#include "database/database-postgresql.h"
+#endif
+#include "filesys.h"
+#include "map_save_thread.h"
+#include "serialization.h"
+#include "util/metricsbackend.h"
+#include <sstream>
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+	void runTestsForCurrentDB();
+
+	void testSingle();
+	void testBatchSave();
+	void testBatchLoad();
+	void testBatchOverwrite();
+	void testSaveThread();
+
+private:
+	MapDatabase *map_db;
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	const std::string test_dir = getTestTempDirectory();
+
+	rawstream << "-------- Dummy database" << std::endl;
+
+	map_db = new Database_Dummy();
+	runTestsForCurrentDB();
+	TEST(testSaveThread);
+	delete map_db;
+
+	rawstream << "-------- SQLite3 database" << std::endl;
+
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+	map_db = new MapDatabaseSQLite3(test_dir);
+	runTestsForCurrentDB();
+	delete map_db;
+
+#if USE_POSTGRESQL
+	const char *env_postgresql_connect_string = getenv("MINETEST_POSTGRESQL_CONNECT_STRING");
+	if (env_postgresql_connect_string) {
+		rawstream << "-------- PostgreSQL database" << std::endl;
+
+		map_db = new MapDatabasePostgreSQL(env_postgresql_connect_string);
+		runTestsForCurrentDB();
+		delete map_db;
+	}
+#endif // USE_POSTGRESQL
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::string blockData(v3s16 pos, char tag)
+{
+	// Arbitrary binary data, including zero bytes
+	std::string data(20, tag);
+	data[1] = '\0';
+	data[2] = (char)pos.X;
+	data[3] = (char)pos.Y;
+	data[4] = (char)pos.Z;
+	return data;
+}
+
+static const v3s16 test_positions[] = {
+	v3s16(0, 0, 0),
+	v3s16(1, -2, 3),
+	v3s16(-2047, 2047, -5),
+	v3s16(7, 7, -7),
+};
+
+void TestMapDatabase::runTestsForCurrentDB()
+{
+	for (v3s16 pos : test_positions)
+		map_db->deleteBlock(pos);
+
+	TEST(testSingle);
+	TEST(testBatchSave);
+	TEST(testBatchLoad);
+	TEST(testBatchOverwrite);
+
+	for (v3s16 pos : test_positions)
+		map_db->deleteBlock(pos);
+}
+
+void TestMapDatabase::testSingle()
+{
+	const v3s16 pos = test_positions[0];
+	std::string data;
+
+	map_db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+
+	map_db->beginSave();
+	UASSERT(map_db->saveBlock(pos, blockData(pos, 'a')));
+	map_db->endSave();
+
+	map_db->loadBlock(pos, &data);
+	UASSERT(data == blockData(pos, 'a'));
+
+	UASSERT(map_db->deleteBlock(pos));
+	map_db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testBatchSave()
+{
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	for (v3s16 pos : test_positions)
+		blocks.emplace_back(pos, blockData(pos, 'b'));
+	// Leave one position out so loading it must fail
+	blocks.pop_back();
+
+	map_db->beginSave();
+	UASSERT(map_db->saveBlocks(blocks));
+	map_db->endSave();
+
+	for (const auto &it : blocks) {
+		std::string data;
+		map_db->loadBlock(it.first, &data);
+		UASSERT(data == it.second);
+	}
+}
+
+void TestMapDatabase::testBatchLoad()
+{
+	std::vector<v3s16> positions(std::begin(test_positions),
+		std::end(test_positions));
+	std::vector<std::string> blocks;
+
+	map_db->loadBlocks(positions, &blocks);
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+	for (size_t i = 0; i + 1 < positions.size(); i++)
+		UASSERT(blocks[i] == blockData(positions[i], 'b'));
+	UASSERT(blocks.back().empty());
+
+	map_db->loadBlocks({}, &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMapDatabase::testBatchOverwrite()
+{
+	const v3s16 pos = test_positions[1];
+	std::vector<std::pair<v3s16, std::string>> blocks = {
+		{pos, blockData(pos, 'c')},
+		{test_positions[2], blockData(test_positions[2], 'c')},
+		{pos, blockData(pos, 'd')},
+	};
+
+	map_db->beginSave();
+	UASSERT(map_db->saveBlocks(blocks));
+	map_db->endSave();
+
+	// The last data given for a position wins
+	std::vector<std::string> loaded;
+	map_db->loadBlocks({test_positions[2], pos}, &loaded);
+	UASSERTEQ(size_t, loaded.size(), 2);
+	UASSERT(loaded[0] == blockData(test_positions[2], 'c'));
+	UASSERT(loaded[1] == blockData(pos, 'd'));
+}
+
+void TestMapDatabase::testSaveThread()
+{
+	std::mutex db_mutex;
+	MetricsBackend mb;
+	const u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	const v3s16 pos = test_positions[3];
+	std::string raw;
+
+	{
+		// A queue of one makes push() wait for the thread
+		MapSaveThread thread(map_db, db_mutex, -1, 1, &mb);
+		thread.start();
+
+		for (char tag = 'a'; tag <= 'f'; tag++) {
+			raw = blockData(pos, tag);
+			std::string copy = raw;
+			thread.push(pos, version, std::move(copy));
+		}
+		thread.waitFor(pos);
+		UASSERT(!thread.isPending(pos));
+
+		// Queued blocks are written when the thread is destroyed
+		thread.push(test_positions[0], version, blockData(test_positions[0], 'g'));
+	}
+
+	auto load_raw = [this] (v3s16 p) -> std::string {
+		std::string data;
+		map_db->loadBlock(p, &data);
+		UASSERT(data.size() > 1);
+		UASSERTEQ(int, (u8)data[0], version);
+		std::istringstream is(data.substr(1), std::ios_base::binary);
+		std::ostringstream os(std::ios_base::binary);
+		decompress(is, os, version);
+		return os.str();
+	};
+
+	// Writes happen in queue order
+	UASSERT(load_raw(pos) == raw);
+	UASSERT(load_raw(test_positions[0]) == blockData(test_positions[0], 'g'));
+}
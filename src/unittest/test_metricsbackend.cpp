@@ -0,0 +1,115 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "util/metricsbackend.h"
+#include <thread>
+#include <vector>
+
+class TestMetricsBackend : public TestBase
+{
+public:
+	TestMetricsBackend() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMetricsBackend"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testHistogram();
+	void testConcurrentUpdates();
+	void testScopeTimer();
+};
+
+static TestMetricsBackend g_test_instance;
+
+void TestMetricsBackend::runTests(IGameDef *gamedef)
+{
+	TEST(testHistogram);
+	TEST(testConcurrentUpdates);
+	TEST(testScopeTimer);
+}
+
+void TestMetricsBackend::testHistogram()
+{
+	MetricsBackend backend;
+	MetricHistogramPtr histogram = backend.addHistogram("test", "Test",
+			{1.0, 2.0, 5.0});
+
+	UASSERTEQ(u64, histogram->getCount(), 0);
+
+	histogram->observe(0.5);
+	histogram->observe(1.0);
+	histogram->observe(1.5);
+	histogram->observe(4.0);
+	histogram->observe(100.0);
+
+	UASSERTEQ(u64, histogram->getCount(), 5);
+	UASSERTEQ(double, histogram->getSum(), 107.0);
+	// Cumulative, upper bounds are inclusive
+	UASSERTEQ(u64, histogram->getBucketCount(0), 2);
+	UASSERTEQ(u64, histogram->getBucketCount(1), 3);
+	UASSERTEQ(u64, histogram->getBucketCount(2), 4);
+	UASSERTEQ(u64, histogram->getBucketCount(3), 5);
+}
+
+void TestMetricsBackend::testConcurrentUpdates()
+{
+	MetricsBackend backend;
+	MetricsBackend::Labels labels;
+	labels["thread"] = "all";
+	MetricCounterPtr counter = backend.addCounter("test_counter", "Test", labels);
+	MetricGaugePtr gauge = backend.addGauge("test_gauge", "Test", labels);
+	MetricHistogramPtr histogram = backend.addHistogram("test_histogram", "Test",
+			{10.0}, labels);
+
+	const u32 threads = 4, updates = 10000;
+	std::vector<std::thread> workers;
+	for (u32 i = 0; i < threads; i++) {
+		workers.emplace_back([&] {
+			for (u32 j = 0; j < updates; j++) {
+				counter->increment();
+				gauge->increment(2.0);
+				gauge->decrement();
+				histogram->observe(j % 20);
+			}
+		});
+	}
+	for (std::thread &worker : workers)
+		worker.join();
+
+	// No updates are lost
+	UASSERTEQ(double, counter->get(), threads * updates);
+	UASSERTEQ(double, gauge->get(), threads * updates);
+	UASSERTEQ(u64, histogram->getCount(), threads * updates);
+	UASSERTEQ(u64, histogram->getBucketCount(0), threads * updates * 11 / 20);
+	UASSERTEQ(double, histogram->getSum(), threads * (updates / 20) * 190.0);
+}
+
+void TestMetricsBackend::testScopeTimer()
+{
+	MetricsBackend backend;
+	MetricHistogramPtr histogram = backend.addHistogram("test", "Test",
+			MetricsBackend::getDurationBuckets());
+
+	{
+		MetricScopeTimer timer(histogram);
+	}
+	UASSERTEQ(u64, histogram->getCount(), 1);
+	UASSERT(histogram->getSum() >= 0.0 && histogram->getSum() < 1.0);
+}
@@ -0,0 +1,95 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/node_change_batch.h"
+#include "util/serialize.h"
+
+class TestNodeChangeBatch : public TestBase
+{
+public:
+	TestNodeChangeBatch() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodeChangeBatch"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGrouping();
+	void testSerialize();
+};
+
+static TestNodeChangeBatch g_test_instance;
+
+void TestNodeChangeBatch::runTests(IGameDef *gamedef)
+{
+	TEST(testGrouping);
+	TEST(testSerialize);
+}
+
+void TestNodeChangeBatch::testGrouping()
+{
+	NodeChangeBatch batch;
+	UASSERT(batch.empty());
+
+	batch.add(v3s16(1, 2, 3), MapNode(100), false, {v3s16(0, 0, 0)});
+	batch.add(v3s16(4, 5, 6), MapNode(101), true, {v3s16(0, 0, 0), v3s16(0, -1, 0)});
+	batch.add(v3s16(-1, 2, 3), MapNode(102), true, {v3s16(-1, 0, 0)});
+	// Replaces the first change, the metadata removal of the second stays
+	batch.add(v3s16(4, 5, 6), MapNode(103), false, {v3s16(0, 0, 0)});
+
+	const auto &blocks = batch.getBlocks();
+	UASSERTEQ(size_t, blocks.size(), 2);
+
+	const NodeChangeBatch::Block &block = blocks.at(v3s16(0, 0, 0));
+	UASSERTEQ(size_t, block.changes.size(), 2);
+	UASSERT(block.changes[0].p == v3s16(1, 2, 3));
+	UASSERT(!block.changes[0].remove_metadata);
+	UASSERT(block.changes[1].p == v3s16(4, 5, 6));
+	UASSERTEQ(content_t, block.changes[1].n.getContent(), 103);
+	UASSERT(block.changes[1].remove_metadata);
+	UASSERTEQ(size_t, block.modified_blocks.size(), 2);
+	UASSERT(block.modified_blocks.count(v3s16(0, -1, 0)));
+
+	const NodeChangeBatch::Block &other = blocks.at(v3s16(-1, 0, 0));
+	UASSERTEQ(size_t, other.changes.size(), 1);
+	UASSERTEQ(size_t, other.modified_blocks.size(), 1);
+
+	batch.clear();
+	UASSERT(batch.empty());
+}
+
+void TestNodeChangeBatch::testSerialize()
+{
+	NodeChangeBatch batch;
+	batch.add(v3s16(1, -2, 3), MapNode(0x1234, 5, 6), false, {});
+	batch.add(v3s16(2, -2, 3), MapNode(7), true, {});
+
+	std::string data;
+	NodeChangeBatch::serialize(batch.getBlocks().begin()->second, data);
+	UASSERTEQ(size_t, data.size(), 2 * NodeChangeBatch::SERIALIZED_CHANGE_SIZE);
+
+	const u8 *p = (const u8 *)data.data();
+	UASSERT(readV3S16(&p[0]) == v3s16(1, -2, 3));
+	UASSERTEQ(u16, readU16(&p[6]), 0x1234);
+	UASSERTEQ(int, p[8], 5);
+	UASSERTEQ(int, p[9], 6);
+	// keep_metadata
+	UASSERTEQ(int, p[10], 1);
+	UASSERTEQ(int, p[NodeChangeBatch::SERIALIZED_CHANGE_SIZE + 10], 0);
+}
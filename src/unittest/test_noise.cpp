@@ -20,8 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
+#include <map>
 #include "exceptions.h"
 #include "noise.h"
+#include "mapgen/noisecache.h"
 
 class TestNoise : public TestBase {
 public:
@@ -41,6 +44,8 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimdIdentical();
+	void testNoiseCache();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -61,6 +66,8 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimdIdentical);
+	TEST(testNoiseCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,6 +182,128 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimdIdentical()
+{
+	const NoiseSimdLevel supported = noise_simd_supported();
+	const NoiseParams params[] = {
+		NoiseParams(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0),
+		NoiseParams(0, 1, v3f(37, 11, 23), 42, 3, 0.5, 2.3,
+			NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE),
+		NoiseParams(-3, 7, v3f(5, 5, 5), 7, 2, 0.7, 2.0, 0),
+	};
+	// Odd sizes to cover the scalar tails of the SIMD kernels
+	const u32 sx = 19, sy = 13, sz = 11;
+	float persistence[sx * sy * sz];
+	for (u32 i = 0; i != sx * sy * sz; i++)
+		persistence[i] = 0.3f + (i % 7) * 0.1f;
+
+	for (const NoiseParams &np : params)
+	for (bool use_persistence : {false, true}) {
+		float *pmap = use_persistence ? persistence : nullptr;
+
+		noise_simd_set(NOISE_SIMD_NONE);
+		Noise expected_2d(&np, 1337, sx, sy);
+		Noise expected_3d(&np, 1337, sx, sy, sz);
+		expected_2d.perlinMap2D(-123.4f, 567.8f, pmap);
+		expected_3d.perlinMap3D(-123.4f, -9.1f, 567.8f, pmap);
+
+		for (int level = NOISE_SIMD_SSE2; level <= supported; level++) {
+			noise_simd_set((NoiseSimdLevel)level);
+			UASSERTEQ(int, noise_simd_get(), level);
+
+			Noise actual_2d(&np, 1337, sx, sy);
+			Noise actual_3d(&np, 1337, sx, sy, sz);
+			actual_2d.perlinMap2D(-123.4f, 567.8f, pmap);
+			actual_3d.perlinMap3D(-123.4f, -9.1f, 567.8f, pmap);
+
+			UASSERT(!memcmp(actual_2d.result, expected_2d.result,
+				sizeof(float) * sx * sy));
+			UASSERT(!memcmp(actual_3d.result, expected_3d.result,
+				sizeof(float) * sx * sy * sz));
+		}
+	}
+
+	noise_simd_set(supported);
+}
+
+// Keeps the counters it creates by name
+class CounterMetricsBackend : public MetricsBackend
+{
+public:
+	MetricCounterPtr addCounter(const std::string &name,
+			const std::string &help_str, const Labels &labels = {}) override
+	{
+		MetricCounterPtr counter = MetricsBackend::addCounter(name, help_str, labels);
+		counters[name] = counter;
+		return counter;
+	}
+
+	std::map<std::string, MetricCounterPtr> counters;
+};
+
+void TestNoise::testNoiseCache()
+{
+	CounterMetricsBackend mb;
+	NoiseCache cache(2, &mb);
+	MetricCounterPtr hits = mb.counters.at("minetest_mapgen_noise_cache_hits");
+	MetricCounterPtr misses = mb.counters.at("minetest_mapgen_noise_cache_misses");
+
+	NoiseParams np(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0);
+	NoiseParams np_persist(0.6, 0.1, v3f(30, 30, 30), 3, 2, 0.5, 2.0);
+	const u32 size = 16;
+
+	Noise expected(&np, 1337, size, size);
+	Noise actual(&np, 1337, size, size);
+	Noise persist(&np_persist, 1337, size, size);
+	persist.perlinMap2D(32, -48);
+
+	// Taken from the cache the second time
+	for (int i = 0; i < 2; i++) {
+		expected.perlinMap2D(32, -48);
+		memset(actual.result, 0, sizeof(float) * size * size);
+		NoiseCache::perlinMap2D(&cache, &actual, 32, -48);
+		UASSERT(!memcmp(actual.result, expected.result,
+			sizeof(float) * size * size));
+
+		expected.perlinMap2D(32, -48, persist.result);
+		memset(actual.result, 0, sizeof(float) * size * size);
+		NoiseCache::perlinMap2D(&cache, &actual, 32, -48, &persist);
+		UASSERT(!memcmp(actual.result, expected.result,
+			sizeof(float) * size * size));
+	}
+	UASSERTEQ(size_t, cache.size(), 2);
+	UASSERTEQ(double, hits->get(), 2);
+	UASSERTEQ(double, misses->get(), 2);
+
+	// Using the first map makes the one with persistence map the least
+	// recently used, which is dropped for a new one
+	NoiseCache::perlinMap2D(&cache, &actual, 32, -48);
+	UASSERTEQ(double, hits->get(), 3);
+	NoiseCache::perlinMap2D(&cache, &actual, 48, -48);
+	UASSERTEQ(size_t, cache.size(), 2);
+	UASSERTEQ(double, misses->get(), 3);
+
+	expected.perlinMap2D(32, -48);
+	NoiseCache::perlinMap2D(&cache, &actual, 32, -48);
+	UASSERTEQ(double, hits->get(), 4);
+	UASSERT(!memcmp(actual.result, expected.result,
+		sizeof(float) * size * size));
+
+	expected.perlinMap2D(32, -48, persist.result);
+	NoiseCache::perlinMap2D(&cache, &actual, 32, -48, &persist);
+	UASSERTEQ(double, misses->get(), 4);
+	UASSERT(!memcmp(actual.result, expected.result,
+		sizeof(float) * size * size));
+
+	// Without a cache the map is computed directly
+	expected.perlinMap2D(32, -48);
+	NoiseCache::perlinMap2D(nullptr, &actual, 32, -48);
+	UASSERT(!memcmp(actual.result, expected.result,
+		sizeof(float) * size * size));
+	UASSERTEQ(double, hits->get(), 4);
+	UASSERTEQ(double, misses->get(), 4);
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
@@ -0,0 +1,163 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/object_update_encoder.h"
+#include "server/unit_sao.h"
+#include "util/serialize.h"
+
+class TestObjectUpdateEncoder : public TestBase
+{
+public:
+	TestObjectUpdateEncoder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectUpdateEncoder"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCoalesce();
+	void testKeyframe();
+	void testDelta();
+	void testOutOfRange();
+};
+
+static TestObjectUpdateEncoder g_test_instance;
+
+void TestObjectUpdateEncoder::runTests(IGameDef *gamedef)
+{
+	TEST(testCoalesce);
+	TEST(testKeyframe);
+	TEST(testDelta);
+	TEST(testOutOfRange);
+}
+
+static std::string positionUpdate(v3f position, bool do_interpolate = true)
+{
+	return UnitSAO::generateUpdatePositionCommand(position, v3f(1.5f, 0, -2),
+		v3f(0, -98.1f, 0), v3f(0, 90, 370), do_interpolate, false, 0.2f);
+}
+
+void TestObjectUpdateEncoder::testCoalesce()
+{
+	std::string texture_mod(1, (char)AO_CMD_SET_TEXTURE_MOD);
+	std::string armor(1, (char)AO_CMD_UPDATE_ARMOR_GROUPS);
+
+	std::vector<ActiveObjectMessage> messages;
+	messages.emplace_back(1, false, positionUpdate(v3f(1, 0, 0)));
+	messages.emplace_back(1, true, armor + "a");
+	messages.emplace_back(1, true, texture_mod + "a");
+	messages.emplace_back(1, false, positionUpdate(v3f(2, 0, 0), false));
+	messages.emplace_back(1, false, positionUpdate(v3f(3, 0, 0)));
+	messages.emplace_back(1, true, texture_mod + "b");
+	messages.emplace_back(1, false, positionUpdate(v3f(4, 0, 0)));
+	messages.emplace_back(1, true, armor + "b");
+
+	UASSERTEQ(u32, coalesceObjectMessages(messages), 3);
+	UASSERTEQ(size_t, messages.size(), 5);
+	// Order of the kept messages is unchanged, the teleport stays
+	UASSERT(messages[0].datastring == texture_mod + "a");
+	UASSERT(messages[1].datastring == positionUpdate(v3f(2, 0, 0), false));
+	UASSERT(messages[2].datastring == texture_mod + "b");
+	UASSERT(messages[3].datastring == positionUpdate(v3f(4, 0, 0)));
+	UASSERT(messages[4].datastring == armor + "b");
+
+	UASSERTEQ(u32, coalesceObjectMessages(messages), 0);
+}
+
+void TestObjectUpdateEncoder::testKeyframe()
+{
+	ObjectPositionEncoder encoder;
+	std::string update = positionUpdate(v3f(100, 20, -30));
+	std::string out;
+
+	// The first update is a reliable keyframe
+	UASSERT(encoder.encode(7, update, out));
+	UASSERTEQ(size_t, out.size(), update.size() + 1);
+	UASSERT(out.compare(0, update.size(), update) == 0);
+	UASSERTEQ(int, (u8)out.back(), 0);
+
+	// Moving far away needs a new keyframe
+	update = positionUpdate(v3f(1000, 20, -30));
+	UASSERT(encoder.encode(7, update, out));
+	UASSERTEQ(int, (u8)out.back(), 1);
+
+	// So does a teleport
+	update = positionUpdate(v3f(1001, 20, -30), false);
+	UASSERT(encoder.encode(7, update, out));
+	UASSERTEQ(int, (u8)out.back(), 2);
+
+	// And an object that was removed and added again
+	encoder.forget(7);
+	UASSERT(encoder.encode(7, update, out));
+	UASSERTEQ(int, (u8)out.back(), 0);
+
+	// Other messages are passed on
+	std::string other(1, (char)AO_CMD_SET_TEXTURE_MOD);
+	UASSERT(!encoder.encode(7, other, out));
+	UASSERT(out == other);
+}
+
+void TestObjectUpdateEncoder::testDelta()
+{
+	ObjectPositionEncoder encoder;
+	std::string out;
+	UASSERT(encoder.encode(3, positionUpdate(v3f(100, 20, -30)), out));
+
+	std::string update = positionUpdate(v3f(102.5f, 19.996f, -60));
+	UASSERT(!encoder.encode(3, update, out));
+
+	const u8 *data = (const u8 *)out.data();
+	UASSERTEQ(int, data[0], AO_CMD_UPDATE_POSITION_DELTA);
+	UASSERTEQ(int, data[1], 0);
+	// Position relative to the keyframe
+	UASSERTEQ(s16, readS16(&data[2]), 250);
+	UASSERTEQ(s16, readS16(&data[4]), 0);
+	UASSERTEQ(s16, readS16(&data[6]), -3000);
+	// Velocity
+	UASSERTEQ(s16, readS16(&data[8]), 150);
+	UASSERTEQ(s16, readS16(&data[12]), -200);
+	// Acceleration
+	UASSERTEQ(s16, readS16(&data[16]), -9810);
+	// Rotation, wrapped to 0..360
+	UASSERTEQ(u16, readU16(&data[20]), 0);
+	UASSERTEQ(u16, readU16(&data[22]), 16384);
+	UASSERTEQ(u16, readU16(&data[24]), 1820);
+	// do_interpolate
+	UASSERTEQ(int, data[26], 1);
+	// update_interval
+	UASSERTEQ(int, data[27], 20);
+	UASSERTEQ(size_t, out.size(), 28);
+}
+
+void TestObjectUpdateEncoder::testOutOfRange()
+{
+	ObjectPositionEncoder encoder;
+	std::string out;
+	UASSERT(encoder.encode(3, positionUpdate(v3f(0, 0, 0)), out));
+
+	// Too fast to quantize, sent as it is
+	std::string update = UnitSAO::generateUpdatePositionCommand(v3f(1, 0, 0),
+		v3f(0, 0, 1000), v3f(0, 0, 0), v3f(0, 0, 0), true, false, 0.2f);
+	UASSERT(!encoder.encode(3, update, out));
+	UASSERT(out == update);
+
+	// The keyframe is still valid
+	UASSERT(!encoder.encode(3, positionUpdate(v3f(1, 0, 0)), out));
+	UASSERTEQ(int, (u8)out[0], AO_CMD_UPDATE_POSITION_DELTA);
+}
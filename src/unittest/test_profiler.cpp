@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "profiler.h"
+#include <sstream>
+#include <thread>
 
 class TestProfiler : public TestBase
 {
@@ -30,6 +32,11 @@ class TestProfiler : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testProfilerAverage();
+	void testProfilerIds();
+	void testProfilerThreads();
+	void testProfilerAverageThreads();
+	void testProfilerGraph();
+	void testProfilerPrint();
 };
 
 static TestProfiler g_test_instance;
@@ -37,6 +44,11 @@ static TestProfiler g_test_instance;
 void TestProfiler::runTests(IGameDef *gamedef)
 {
 	TEST(testProfilerAverage);
+	TEST(testProfilerIds);
+	TEST(testProfilerThreads);
+	TEST(testProfilerAverageThreads);
+	TEST(testProfilerGraph);
+	TEST(testProfilerPrint);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,3 +83,131 @@ void TestProfiler::testProfilerAverage()
 
 	UASSERT(p.getValue("Test2") == 123.57f);
 }
+
+void TestProfiler::testProfilerIds()
+{
+	ProfilerId id = Profiler::getId("TestIds");
+	UASSERTEQ(ProfilerId, Profiler::getId("TestIds"), id);
+	UASSERT(Profiler::getId("TestIds2") != id);
+	UASSERT(Profiler::getName(id) == "TestIds");
+	UASSERTEQ(ProfilerId, ScopeProfiler::getId("TestIds"),
+			Profiler::getId("TestIds [ms]"));
+
+	// Ids are the same in every profiler
+	Profiler p1, p2;
+	p1.add(id, 1.f);
+	p2.add("TestIds", 2.f);
+	UASSERT(p1.getValue("TestIds") == 1.f);
+	UASSERT(p2.getValue("TestIds") == 2.f);
+
+	p1.max(Profiler::getId("TestMax"), 3.f);
+	p1.max("TestMax", 1.f);
+	UASSERT(p1.getValue("TestMax") == 3.f);
+
+	p1.remove("TestIds");
+	UASSERT(p1.getValue("TestIds") == 0.f);
+
+	p1.clear();
+	UASSERT(p1.getValue("TestMax") == 0.f);
+	p1.add(id, 4.f);
+	UASSERT(p1.getValue("TestIds") == 4.f);
+}
+
+void TestProfiler::testProfilerThreads()
+{
+	Profiler p;
+	ProfilerId id_add = Profiler::getId("TestThreadsAdd");
+	ProfilerId id_avg = Profiler::getId("TestThreadsAvg");
+	ProfilerId id_max = Profiler::getId("TestThreadsMax");
+
+	// Values are merged while the threads add more
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&, t] {
+			for (int i = 0; i < 10000; i++) {
+				p.add(id_add, 1.f);
+				p.avg(id_avg, t);
+				p.max(id_max, t * 10000 + i);
+			}
+		});
+	}
+	for (int i = 0; i < 100; i++)
+		p.getValue("TestThreadsAdd");
+	for (auto &thread : threads)
+		thread.join();
+
+	UASSERT(p.getValue("TestThreadsAdd") == 40000.f);
+	UASSERTEQ(int, p.getAvgCount("TestThreadsAvg"), 40000);
+	UASSERT(p.getValue("TestThreadsAvg") == 1.5f);
+	UASSERT(p.getValue("TestThreadsMax") == 39999.f);
+}
+
+void TestProfiler::testProfilerAverageThreads()
+{
+	Profiler p;
+	ProfilerId id = Profiler::getId("TestAverageThreads");
+
+	// A merge must never take a value without its count
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&] {
+			for (int i = 0; i < 10000; i++)
+				p.avg(id, 2.f);
+		});
+	}
+	bool skewed = false;
+	while (p.getAvgCount("TestAverageThreads") < 40000) {
+		float value = p.getValue("TestAverageThreads");
+		skewed = skewed || (value != 0.f && value != 2.f);
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	UASSERT(!skewed);
+	UASSERT(p.getValue("TestAverageThreads") == 2.f);
+}
+
+void TestProfiler::testProfilerGraph()
+{
+	Profiler p;
+	p.graphAdd("TestGraph", 1.f);
+	p.graphAdd(Profiler::getId("TestGraph"), 2.f);
+	std::thread([&] { p.graphAdd("TestGraph", 3.f); }).join();
+
+	Profiler::GraphValues values;
+	p.graphGet(values);
+	UASSERTEQ(size_t, values.size(), 1);
+	UASSERT(values["TestGraph"] == 6.f);
+	// Graph values do not show up in the other values
+	UASSERT(p.getValue("TestGraph") == 0.f);
+
+	p.graphGet(values);
+	UASSERT(values.empty());
+}
+
+void TestProfiler::testProfilerPrint()
+{
+	Profiler p;
+	p.add("TestPrintB", 2.f);
+	p.avg("TestPrintA", 1.f);
+	p.avg("TestPrintA", 2.f);
+	{
+		ScopeProfiler sp(&p, "TestPrintC", SPT_AVG);
+	}
+
+	Profiler::GraphValues values;
+	p.getPage(values, 1, 1);
+	UASSERTEQ(size_t, values.size(), 3);
+	UASSERT(values["TestPrintA"] == 1.5f);
+	UASSERT(values.count("TestPrintC [ms]"));
+
+	// Pages are in the order of the names
+	values.clear();
+	p.getPage(values, 1, 3);
+	UASSERTEQ(size_t, values.size(), 1);
+	UASSERT(values.count("TestPrintA"));
+
+	std::ostringstream os;
+	UASSERTEQ(int, p.print(os), 3);
+	UASSERT(os.str().find("TestPrintA") < os.str().find("TestPrintB"));
+}
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "mapgen/mg_schematic.h"
+#include "dummymap.h"
 #include "gamedef.h"
 #include "nodedef.h"
 
@@ -33,6 +34,7 @@ class TestSchematic : public TestBase {
 	void testMtsSerializeDeserialize(const NodeDefManager *ndef);
 	void testLuaTableSerialize(const NodeDefManager *ndef);
 	void testFileSerializeDeserialize(const NodeDefManager *ndef);
+	void testBlitToVManip(IGameDef *gamedef);
 
 	static const content_t test_schem1_data[7 * 6 * 4];
 	static const content_t test_schem2_data[3 * 3 * 3];
@@ -52,6 +54,7 @@ void TestSchematic::runTests(IGameDef *gamedef)
 	TEST(testMtsSerializeDeserialize, ndef);
 	TEST(testLuaTableSerialize, ndef);
 	TEST(testFileSerializeDeserialize, ndef);
+	TEST(testBlitToVManip, gamedef);
 
 	ndef->resetNodeResolveState();
 }
@@ -187,6 +190,68 @@ void TestSchematic::testFileSerializeDeserialize(const NodeDefManager *ndef)
 }
 
 
+void TestSchematic::testBlitToVManip(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, v3s16(0, 0, 0), v3s16(0, 0, 0));
+	MMVManip vm(&map);
+	vm.initialEmerge(v3s16(0, 0, 0), v3s16(0, 0, 0), false);
+
+	// Row z = 0 has a gap, row z = 1 a node that is never placed and
+	// one that replaces other nodes
+	Schematic schem;
+	schem.m_ndef = gamedef->getNodeDefManager();
+	schem.size = v3s16(3, 1, 2);
+	schem.schemdata = new MapNode[6] {
+		MapNode(t_CONTENT_STONE, MTSCHEM_PROB_ALWAYS),
+		MapNode(CONTENT_IGNORE, MTSCHEM_PROB_ALWAYS),
+		MapNode(t_CONTENT_LAVA, MTSCHEM_PROB_ALWAYS),
+		MapNode(t_CONTENT_TORCH, MTSCHEM_PROB_NEVER),
+		MapNode(t_CONTENT_STONE, MTSCHEM_PROB_ALWAYS | MTSCHEM_FORCE_PLACE),
+		MapNode(t_CONTENT_WATER, MTSCHEM_PROB_ALWAYS),
+	};
+	schem.slice_probs = new u8[1] { MTSCHEM_PROB_ALWAYS };
+
+	auto reset = [&] {
+		for (s16 z = 0; z < 4; z++)
+		for (s16 x = 0; x < 4; x++)
+			vm.setNodeNoEmerge(v3s16(x, 1, z), MapNode(CONTENT_AIR));
+		vm.setNodeNoEmerge(v3s16(2, 1, 2), MapNode(t_CONTENT_BRICK));
+		vm.setNodeNoEmerge(v3s16(3, 1, 2), MapNode(t_CONTENT_BRICK));
+	};
+	auto get = [&] (s16 x, s16 z) {
+		return vm.getNodeNoEx(v3s16(x, 1, z)).getContent();
+	};
+
+	reset();
+	schem.blitToVManip(&vm, v3s16(1, 1, 1), ROTATE_0, false);
+	UASSERTEQ(content_t, get(1, 1), t_CONTENT_STONE);
+	UASSERTEQ(content_t, get(2, 1), CONTENT_AIR);
+	UASSERTEQ(content_t, get(3, 1), t_CONTENT_LAVA);
+	UASSERTEQ(content_t, get(1, 2), CONTENT_AIR);
+	UASSERTEQ(content_t, get(2, 2), t_CONTENT_STONE);
+	UASSERTEQ(content_t, get(3, 2), t_CONTENT_BRICK);
+	UASSERTEQ(int, vm.getNodeNoEx(v3s16(1, 1, 1)).param1, 0);
+
+	// Rotated by 180 degrees and cut off by the edge of the voxelmanip
+	reset();
+	schem.blitToVManip(&vm, v3s16(-1, 1, 1), ROTATE_180, true);
+	UASSERTEQ(content_t, get(0, 1), t_CONTENT_STONE);
+	UASSERTEQ(content_t, get(1, 1), CONTENT_AIR);
+	UASSERTEQ(content_t, get(0, 2), CONTENT_AIR);
+	UASSERTEQ(content_t, get(1, 2), t_CONTENT_STONE);
+	UASSERTEQ(content_t, get(2, 2), t_CONTENT_BRICK);
+
+	// Changes to the data are picked up
+	std::vector<std::pair<v3s16, u8>> probs = {{v3s16(0, 0, 0), MTSCHEM_PROB_NEVER}};
+	std::vector<std::pair<s16, u8>> slice_probs;
+	schem.applyProbabilities(v3s16(0, 0, 0), &probs, &slice_probs);
+	reset();
+	schem.blitToVManip(&vm, v3s16(1, 1, 1), ROTATE_0, false);
+	UASSERTEQ(content_t, get(1, 1), CONTENT_AIR);
+	UASSERTEQ(content_t, get(3, 1), t_CONTENT_LAVA);
+}
+
+
 // Should form a cross-shaped-thing...?
 const content_t TestSchematic::test_schem1_data[7 * 6 * 4] = {
 	3, 3, 1, 1, 1, 3, 3, // Y=0, Z=0
@@ -0,0 +1,87 @@
+/*
+Minetest
+Copyright (C) 2023 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/serialized_cache.h"
+#include <atomic>
+
+class TestSerializedCache : public TestBase
+{
+public:
+	TestSerializedCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestSerializedCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGet();
+	void testPrepare();
+};
+
+static TestSerializedCache g_test_instance;
+
+void TestSerializedCache::runTests(IGameDef *gamedef)
+{
+	TEST(testGet);
+	TEST(testPrepare);
+}
+
+void TestSerializedCache::testGet()
+{
+	SerializedCache cache;
+	int builds = 0;
+	auto build = [&] {
+		builds++;
+		return std::string("data") + std::to_string(builds);
+	};
+
+	std::shared_future<std::string> a = cache.get("a", build);
+	UASSERTEQ(int, builds, 0);
+	UASSERT(a.get() == "data1");
+	UASSERT(cache.get("a", build).get() == "data1");
+	UASSERT(cache.get("b", build).get() == "data2");
+	UASSERTEQ(int, builds, 2);
+	UASSERTEQ(size_t, cache.size(), 2);
+
+	// Results that were handed out stay valid
+	cache.clear();
+	UASSERTEQ(size_t, cache.size(), 0);
+	UASSERT(a.get() == "data1");
+	UASSERT(cache.get("a", build).get() == "data3");
+}
+
+void TestSerializedCache::testPrepare()
+{
+	SerializedCache cache;
+	std::atomic<int> builds{0};
+	auto build = [&] {
+		builds++;
+		return std::string(1000, 'x');
+	};
+
+	cache.prepare("a", build);
+	cache.prepare("a", build);
+	UASSERT(cache.get("a", build).get() == std::string(1000, 'x'));
+	UASSERTEQ(int, builds.load(), 1);
+
+	// Clearing waits for the build
+	cache.prepare("b", build);
+	cache.clear();
+	UASSERTEQ(int, builds.load(), 2);
+}
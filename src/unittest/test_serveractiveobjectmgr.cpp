@@ -40,6 +40,7 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testSpatialIndexUpdate();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -51,6 +52,7 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testSpatialIndexUpdate);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -190,3 +192,36 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testSpatialIndexUpdate()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao = new MockServerActiveObject(nullptr, v3f(10, 40, 10));
+	UASSERT(saomgr.registerObject(sao));
+
+	std::vector<ServerActiveObject *> result;
+	aabb3f box(v3f(-50, -50, -50), v3f(50, 50, 50));
+	saomgr.getObjectsInArea(box, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Move the object far away, into another cell
+	sao->setBasePosition(v3f(5000, -3000, 700));
+	saomgr.updateObjectPosition(sao->getId(), sao->getBasePosition());
+
+	result.clear();
+	saomgr.getObjectsInArea(box, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(5000, -3000, 700), 10, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == sao);
+
+	// Removed objects must not be returned anymore
+	saomgr.removeObject(sao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(5000, -3000, 700), 10, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
@@ -37,6 +37,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -46,6 +47,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -147,3 +149,58 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	Address address(0, 0, 0, 0, port);
+	// Use the bind_address if there is one, see testIPv4Socket()
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(bind_str.c_str());
+		if (!bind_addr.isIPv6())
+			address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	UDPSocket socket(false);
+	socket.Bind(address);
+	if (address == Address(0, 0, 0, 0, port))
+		address = Address(127, 0, 0, 1, port);
+
+	// More than fit in one system call
+	const int count = UDPSocket::max_batch_size * 2 + 3;
+	std::vector<std::string> payloads;
+	std::vector<UDPOutgoingDatagram> outgoing;
+	for (int i = 0; i < count; i++)
+		payloads.push_back("datagram " + std::to_string(i));
+	for (const std::string &payload : payloads)
+		outgoing.push_back({address, payload.data(), (int)payload.size()});
+
+	UASSERTEQ(int, socket.SendBatch(outgoing.data(), count), 0);
+
+	sleep_ms(50);
+
+	char buffers[8][64];
+	UDPIncomingDatagram incoming[8];
+	for (int i = 0; i < 8; i++) {
+		incoming[i].data = buffers[i];
+		incoming[i].capacity = sizeof(buffers[i]);
+	}
+
+	int received = 0;
+	for (;;) {
+		int n = socket.ReceiveBatch(incoming, 8);
+		if (n < 0)
+			break;
+		UASSERT(n > 0 && n <= 8);
+		for (int i = 0; i < n; i++) {
+			UASSERT(received < count);
+			// Loopback keeps the order
+			UASSERT(std::string(buffers[i], incoming[i].size) == payloads[received]);
+			UASSERT(incoming[i].sender == address);
+			received++;
+		}
+	}
+	UASSERTEQ(int, received, count);
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <atomic>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/thread.h"
 
 
 class TestThreading : public TestBase {
@@ -32,6 +33,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testParallelFor();
 };
 
 static TestThreading g_test_instance;
@@ -40,6 +42,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testParallelFor);
 }
 
 class SimpleTestThread : public Thread {
@@ -156,3 +159,29 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testParallelFor()
+{
+	WorkerThreadPool pool("TestWorker", 3);
+
+	for (WorkerThreadPool *p : {(WorkerThreadPool *)nullptr, &pool}) {
+		std::vector<u32> results(1000, 0);
+		parallel_for(p, results.size(), [&] (size_t i) {
+			results[i] += i * 2;
+		});
+		for (size_t i = 0; i < results.size(); i++)
+			UASSERTEQ(u32, results[i], i * 2);
+
+		std::atomic<u32> first{0}, second{0};
+		parallel_run(p, {
+			[&] { first += 1; },
+			[&] { second += 2; },
+		});
+		UASSERTEQ(u32, first.load(), 1);
+		UASSERTEQ(u32, second.load(), 2);
+
+		// Nothing to do
+		parallel_for(p, 0, [] (size_t i) { UASSERT(false); });
+	}
+}
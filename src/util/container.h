@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include <set>
 #include <queue>
+#include <unordered_set>
 
 /*
 Queue with unique values with fast checking of value existence
@@ -71,7 +72,7 @@ class UniqueQueue
 	}
 
 private:
-	std::set<Value> m_set;
+	std::unordered_set<Value> m_set;
 	std::queue<Value> m_queue;
 };
 
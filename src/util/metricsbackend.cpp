@@ -18,18 +18,30 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "metricsbackend.h"
-#include "util/thread.h"
+#include <algorithm>
+#include <atomic>
 #if USE_PROMETHEUS
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 #include "log.h"
 #include "settings.h"
+#include "threading/mutex_auto_lock.h"
 #endif
 
 /* Plain implementation */
 
+// Lock-free, these are updated from many threads on hot paths
+static void atomic_add(std::atomic<double> &value, double number)
+{
+	double old = value.load(std::memory_order_relaxed);
+	while (!value.compare_exchange_weak(old, old + number,
+			std::memory_order_relaxed))
+		;
+}
+
 class SimpleMetricCounter : public MetricCounter
 {
 public:
@@ -39,18 +51,15 @@ class SimpleMetricCounter : public MetricCounter
 
 	void increment(double number) override
 	{
-		MutexAutoLock lock(m_mutex);
-		m_counter += number;
+		atomic_add(m_counter, number);
 	}
 	double get() const override
 	{
-		MutexAutoLock lock(m_mutex);
-		return m_counter;
+		return m_counter.load(std::memory_order_relaxed);
 	}
 
 private:
-	mutable std::mutex m_mutex;
-	double m_counter;
+	std::atomic<double> m_counter;
 };
 
 class SimpleMetricGauge : public MetricGauge
@@ -62,69 +71,167 @@ class SimpleMetricGauge : public MetricGauge
 
 	void increment(double number) override
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge += number;
+		atomic_add(m_gauge, number);
 	}
 	void decrement(double number) override
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge -= number;
+		atomic_add(m_gauge, -number);
 	}
 	void set(double number) override
 	{
-		MutexAutoLock lock(m_mutex);
-		m_gauge = number;
+		m_gauge.store(number, std::memory_order_relaxed);
 	}
 	double get() const override
 	{
-		MutexAutoLock lock(m_mutex);
-		return m_gauge;
+		return m_gauge.load(std::memory_order_relaxed);
 	}
 
 private:
-	mutable std::mutex m_mutex;
-	double m_gauge;
+	std::atomic<double> m_gauge;
+};
+
+class SimpleMetricHistogram : public MetricHistogram
+{
+public:
+	SimpleMetricHistogram(const std::vector<double> &buckets) :
+			MetricHistogram(), m_bounds(buckets),
+			m_buckets(new std::atomic<u64>[buckets.size() + 1])
+	{
+		for (size_t i = 0; i <= m_bounds.size(); i++)
+			m_buckets[i].store(0, std::memory_order_relaxed);
+	}
+
+	virtual ~SimpleMetricHistogram() {}
+
+	void observe(double value) override
+	{
+		size_t i = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) -
+				m_bounds.begin();
+		m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		atomic_add(m_sum, value);
+	}
+	u64 getCount() const override
+	{
+		return m_count.load(std::memory_order_relaxed);
+	}
+	double getSum() const override
+	{
+		return m_sum.load(std::memory_order_relaxed);
+	}
+	u64 getBucketCount(size_t i) const override
+	{
+		u64 count = 0;
+		for (size_t j = 0; j <= i && j <= m_bounds.size(); j++)
+			count += m_buckets[j].load(std::memory_order_relaxed);
+		return count;
+	}
+
+private:
+	const std::vector<double> m_bounds;
+	// Values in each bucket, not cumulative
+	std::unique_ptr<std::atomic<u64>[]> m_buckets;
+	std::atomic<u64> m_count{0};
+	std::atomic<double> m_sum{0.0};
 };
 
 MetricCounterPtr MetricsBackend::addCounter(
-		const std::string &name, const std::string &help_str, Labels labels)
+		const std::string &name, const std::string &help_str, const Labels &labels)
 {
 	return std::make_shared<SimpleMetricCounter>();
 }
 
 MetricGaugePtr MetricsBackend::addGauge(
-		const std::string &name, const std::string &help_str, Labels labels)
+		const std::string &name, const std::string &help_str, const Labels &labels)
 {
 	return std::make_shared<SimpleMetricGauge>();
 }
 
+const std::vector<double> &MetricsBackend::getDurationBuckets()
+{
+	static const std::vector<double> buckets = {
+		0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+		0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+	};
+	return buckets;
+}
+
+MetricHistogramPtr MetricsBackend::addHistogram(
+		const std::string &name, const std::string &help_str,
+		const std::vector<double> &buckets, const Labels &labels)
+{
+	return std::make_shared<SimpleMetricHistogram>(buckets);
+}
+
 /* Prometheus backend */
 
 #if USE_PROMETHEUS
 
+/*
+	Family::Add returns the existing series for labels that were added before,
+	so metrics with the same name and labels share it. It is only removed from
+	its family when the last of them goes away.
+*/
+class PrometheusSeriesRefs
+{
+public:
+	template <typename T, typename... Args>
+	T &add(prometheus::Family<T> &family, const std::string &name,
+			const MetricsBackend::Labels &labels, Args &&...args)
+	{
+		MutexAutoLock lock(m_mutex);
+		T &series = family.Add(labels, std::forward<Args>(args)...);
+		m_refs[{name, labels}]++;
+		return series;
+	}
+
+	template <typename T>
+	void remove(prometheus::Family<T> &family, const std::string &name,
+			const MetricsBackend::Labels &labels, T *series)
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_refs.find({name, labels});
+		if (it == m_refs.end() || --it->second > 0)
+			return;
+		m_refs.erase(it);
+		family.Remove(series);
+	}
+
+private:
+	std::mutex m_mutex;
+	std::map<std::pair<std::string, MetricsBackend::Labels>, u32> m_refs;
+};
+
 class PrometheusMetricCounter : public MetricCounter
 {
 public:
 	PrometheusMetricCounter() = delete;
 
 	PrometheusMetricCounter(const std::string &name, const std::string &help_str,
-			MetricsBackend::Labels labels,
-			std::shared_ptr<prometheus::Registry> registry) :
+			const MetricsBackend::Labels &labels,
+			std::shared_ptr<prometheus::Registry> registry,
+			std::shared_ptr<PrometheusSeriesRefs> refs) :
 			MetricCounter(),
+			m_registry(registry), m_refs(refs), m_name(name), m_labels(labels),
 			m_family(prometheus::BuildCounter()
 							.Name(name)
 							.Help(help_str)
 							.Register(*registry)),
-			m_counter(m_family.Add(labels))
+			m_counter(refs->add(m_family, name, labels))
 	{
 	}
 
-	virtual ~PrometheusMetricCounter() {}
+	// Metrics of things that go away, like peers, are removed with them
+	virtual ~PrometheusMetricCounter() { m_refs->remove(m_family, m_name, m_labels, &m_counter); }
 
 	virtual void increment(double number) { m_counter.Increment(number); }
 	virtual double get() const { return m_counter.Value(); }
 
 private:
+	std::shared_ptr<prometheus::Registry> m_registry;
+	std::shared_ptr<PrometheusSeriesRefs> m_refs;
+	const std::string m_name;
+	const MetricsBackend::Labels m_labels;
 	prometheus::Family<prometheus::Counter> &m_family;
 	prometheus::Counter &m_counter;
 };
@@ -135,18 +242,20 @@ class PrometheusMetricGauge : public MetricGauge
 	PrometheusMetricGauge() = delete;
 
 	PrometheusMetricGauge(const std::string &name, const std::string &help_str,
-			MetricsBackend::Labels labels,
-			std::shared_ptr<prometheus::Registry> registry) :
+			const MetricsBackend::Labels &labels,
+			std::shared_ptr<prometheus::Registry> registry,
+			std::shared_ptr<PrometheusSeriesRefs> refs) :
 			MetricGauge(),
+			m_registry(registry), m_refs(refs), m_name(name), m_labels(labels),
 			m_family(prometheus::BuildGauge()
 							.Name(name)
 							.Help(help_str)
 							.Register(*registry)),
-			m_gauge(m_family.Add(labels))
+			m_gauge(refs->add(m_family, name, labels))
 	{
 	}
 
-	virtual ~PrometheusMetricGauge() {}
+	virtual ~PrometheusMetricGauge() { m_refs->remove(m_family, m_name, m_labels, &m_gauge); }
 
 	virtual void increment(double number) { m_gauge.Increment(number); }
 	virtual void decrement(double number) { m_gauge.Decrement(number); }
@@ -154,16 +263,71 @@ class PrometheusMetricGauge : public MetricGauge
 	virtual double get() const { return m_gauge.Value(); }
 
 private:
+	std::shared_ptr<prometheus::Registry> m_registry;
+	std::shared_ptr<PrometheusSeriesRefs> m_refs;
+	const std::string m_name;
+	const MetricsBackend::Labels m_labels;
 	prometheus::Family<prometheus::Gauge> &m_family;
 	prometheus::Gauge &m_gauge;
 };
 
+class PrometheusMetricHistogram : public MetricHistogram
+{
+public:
+	PrometheusMetricHistogram() = delete;
+
+	PrometheusMetricHistogram(const std::string &name, const std::string &help_str,
+			const std::vector<double> &buckets, const MetricsBackend::Labels &labels,
+			std::shared_ptr<prometheus::Registry> registry,
+			std::shared_ptr<PrometheusSeriesRefs> refs) :
+			MetricHistogram(),
+			m_registry(registry), m_refs(refs), m_name(name), m_labels(labels),
+			m_family(prometheus::BuildHistogram()
+							.Name(name)
+							.Help(help_str)
+							.Register(*registry)),
+			m_histogram(refs->add(m_family, name, labels, buckets))
+	{
+	}
+
+	virtual ~PrometheusMetricHistogram() { m_refs->remove(m_family, m_name, m_labels, &m_histogram); }
+
+	virtual void observe(double value) { m_histogram.Observe(value); }
+	virtual u64 getCount() const
+	{
+		return collect().sample_count;
+	}
+	virtual double getSum() const
+	{
+		return collect().sample_sum;
+	}
+	virtual u64 getBucketCount(size_t i) const
+	{
+		const auto &buckets = collect().bucket;
+		return i < buckets.size() ? buckets[i].cumulative_count : 0;
+	}
+
+private:
+	prometheus::ClientMetric::Histogram collect() const
+	{
+		return m_histogram.Collect().histogram;
+	}
+
+	std::shared_ptr<prometheus::Registry> m_registry;
+	std::shared_ptr<PrometheusSeriesRefs> m_refs;
+	const std::string m_name;
+	const MetricsBackend::Labels m_labels;
+	prometheus::Family<prometheus::Histogram> &m_family;
+	prometheus::Histogram &m_histogram;
+};
+
 class PrometheusMetricsBackend : public MetricsBackend
 {
 public:
 	PrometheusMetricsBackend(const std::string &addr) :
 			MetricsBackend(), m_exposer(std::make_unique<prometheus::Exposer>(addr)),
-			m_registry(std::make_shared<prometheus::Registry>())
+			m_registry(std::make_shared<prometheus::Registry>()),
+			m_refs(std::make_shared<PrometheusSeriesRefs>())
 	{
 		m_exposer->RegisterCollectable(m_registry);
 	}
@@ -172,26 +336,39 @@ class PrometheusMetricsBackend : public MetricsBackend
 
 	MetricCounterPtr addCounter(
 			const std::string &name, const std::string &help_str,
-			Labels labels = {}) override;
+			const Labels &labels = {}) override;
 	MetricGaugePtr addGauge(
 			const std::string &name, const std::string &help_str,
-			Labels labels = {}) override;
+			const Labels &labels = {}) override;
+	MetricHistogramPtr addHistogram(
+			const std::string &name, const std::string &help_str,
+			const std::vector<double> &buckets, const Labels &labels = {}) override;
 
 private:
 	std::unique_ptr<prometheus::Exposer> m_exposer;
 	std::shared_ptr<prometheus::Registry> m_registry;
+	// Shared with the metrics, which may outlive the backend
+	std::shared_ptr<PrometheusSeriesRefs> m_refs;
 };
 
 MetricCounterPtr PrometheusMetricsBackend::addCounter(
-		const std::string &name, const std::string &help_str, Labels labels)
+		const std::string &name, const std::string &help_str, const Labels &labels)
 {
-	return std::make_shared<PrometheusMetricCounter>(name, help_str, labels, m_registry);
+	return std::make_shared<PrometheusMetricCounter>(name, help_str, labels, m_registry, m_refs);
 }
 
 MetricGaugePtr PrometheusMetricsBackend::addGauge(
-		const std::string &name, const std::string &help_str, Labels labels)
+		const std::string &name, const std::string &help_str, const Labels &labels)
+{
+	return std::make_shared<PrometheusMetricGauge>(name, help_str, labels, m_registry, m_refs);
+}
+
+MetricHistogramPtr PrometheusMetricsBackend::addHistogram(
+		const std::string &name, const std::string &help_str,
+		const std::vector<double> &buckets, const Labels &labels)
 {
-	return std::make_shared<PrometheusMetricGauge>(name, help_str, labels, m_registry);
+	return std::make_shared<PrometheusMetricHistogram>(name, help_str, buckets,
+			labels, m_registry, m_refs);
 }
 
 MetricsBackend *createPrometheusMetricsBackend()
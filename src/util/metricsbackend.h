@@ -18,10 +18,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #pragma once
+#include <chrono>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 #include "config.h"
+#include "irrlichttypes.h"
 
 class MetricCounter
 {
@@ -50,6 +54,24 @@ class MetricGauge
 
 typedef std::shared_ptr<MetricGauge> MetricGaugePtr;
 
+class MetricHistogram
+{
+public:
+	MetricHistogram() = default;
+	virtual ~MetricHistogram() {}
+
+	virtual void observe(double value) = 0;
+	// Number of observed values
+	virtual u64 getCount() const = 0;
+	// Sum of the observed values
+	virtual double getSum() const = 0;
+	// Number of observed values <= the upper bound of bucket i.
+	// The last bucket has no upper bound.
+	virtual u64 getBucketCount(size_t i) const = 0;
+};
+
+typedef std::shared_ptr<MetricHistogram> MetricHistogramPtr;
+
 class MetricsBackend
 {
 public:
@@ -57,14 +79,48 @@ class MetricsBackend
 
 	virtual ~MetricsBackend() {}
 
-	typedef std::initializer_list<std::pair<const std::string, std::string>> Labels;
+	// Label names and values. Metrics with the same name must have
+	// different labels.
+	typedef std::map<std::string, std::string> Labels;
 
 	virtual MetricCounterPtr addCounter(
 			const std::string &name, const std::string &help_str,
-			Labels labels = {});
+			const Labels &labels = {});
 	virtual MetricGaugePtr addGauge(
 			const std::string &name, const std::string &help_str,
-			Labels labels = {});
+			const Labels &labels = {});
+	// buckets are the ascending upper bounds of the buckets, a bucket
+	// for larger values is added
+	virtual MetricHistogramPtr addHistogram(
+			const std::string &name, const std::string &help_str,
+			const std::vector<double> &buckets, const Labels &labels = {});
+
+	// Upper bounds for histograms of durations in seconds, from 100 µs to 10 s
+	static const std::vector<double> &getDurationBuckets();
+};
+
+/*
+	Observes the time from its construction to its destruction in seconds,
+	like ScopeProfiler
+*/
+class MetricScopeTimer
+{
+public:
+	MetricScopeTimer(const MetricHistogramPtr &histogram) :
+			m_histogram(histogram.get()), m_start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~MetricScopeTimer()
+	{
+		std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - m_start;
+		m_histogram->observe(elapsed.count());
+	}
+
+private:
+	MetricHistogram *m_histogram;
+	const std::chrono::steady_clock::time_point m_start;
 };
 
 #if USE_PROMETHEUS
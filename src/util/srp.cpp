@@ -70,11 +70,12 @@
 	printf("\n");
 }*/
 
-static int g_initialized = 0;
+// Per thread, logins are handled by several threads at the same time
+static thread_local int g_initialized = 0;
 
 #define RAND_BUFF_MAX 128
-static unsigned int g_rand_idx;
-static unsigned char g_rand_buff[RAND_BUFF_MAX];
+static thread_local unsigned int g_rand_idx;
+static thread_local unsigned char g_rand_buff[RAND_BUFF_MAX];
 
 void *(*srp_alloc)(size_t) = &malloc;
 void *(*srp_realloc)(void *, size_t) = &realloc;
@@ -25,6 +25,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "log.h"
 #include "container.h"
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <memory>
 
 template<typename T>
 class MutexedVariable
@@ -226,3 +231,156 @@ class UpdateThread : public Thread
 private:
 	Semaphore m_update_sem;
 };
+
+/*
+	A fixed number of worker threads executing queued jobs.
+	Jobs are run in no particular order and must only touch data that is
+	safe to be accessed from another thread.
+*/
+class WorkerThreadPool
+{
+public:
+	WorkerThreadPool(const std::string &name, unsigned int num_threads)
+	{
+		for (unsigned int i = 0; i < num_threads; i++) {
+			m_workers.emplace_back(new Worker(this, name + std::to_string(i)));
+			m_workers.back()->start();
+		}
+	}
+
+	~WorkerThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_all();
+		for (auto &worker : m_workers)
+			worker->wait();
+	}
+
+	DISABLE_CLASS_COPY(WorkerThreadPool)
+
+	size_t getThreadCount() const { return m_workers.size(); }
+
+	// Queues a job, can be called from any thread
+	void enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+		}
+		m_cv.notify_one();
+	}
+
+	/*
+		Calls job(i) for every i in [0, count) and returns once all calls
+		have finished. The calling thread takes part in the work.
+	*/
+	void parallelFor(size_t count, const std::function<void(size_t)> &job)
+	{
+		if (count == 0)
+			return;
+
+		struct State {
+			std::atomic<size_t> next{0};
+			size_t done = 0;
+			std::mutex mutex;
+			std::condition_variable cv;
+		};
+		auto state = std::make_shared<State>();
+		const std::function<void(size_t)> *job_p = &job;
+
+		// job_p is only dereferenced while indices are left, i.e. before
+		// this function returns
+		auto work = [state, job_p, count] () {
+			size_t finished = 0;
+			for (size_t i = state->next++; i < count; i = state->next++) {
+				(*job_p)(i);
+				finished++;
+			}
+			if (finished == 0)
+				return;
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->done += finished;
+			if (state->done == count)
+				state->cv.notify_all();
+		};
+
+		size_t helpers = std::min(m_workers.size(), count - 1);
+		for (size_t i = 0; i < helpers; i++)
+			enqueue(work);
+		work();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->cv.wait(lock, [&] { return state->done == count; });
+	}
+
+private:
+	class Worker : public Thread
+	{
+	public:
+		Worker(WorkerThreadPool *pool, const std::string &name) :
+			Thread(name), m_pool(pool) {}
+
+	protected:
+		void *run()
+		{
+			BEGIN_DEBUG_EXCEPTION_HANDLER
+
+			std::function<void()> job;
+			while (m_pool->popJob(job))
+				job();
+
+			END_DEBUG_EXCEPTION_HANDLER
+
+			return nullptr;
+		}
+
+	private:
+		WorkerThreadPool *m_pool;
+	};
+
+	// Blocks until a job is available, returns false when shutting down
+	bool popJob(std::function<void()> &job)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+		if (m_jobs.empty())
+			return false;
+		job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		return true;
+	}
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop = false;
+};
+
+/*
+	Calls job(i) for every i in [0, count), spread over pool.
+	Without a pool the calls are made in order on the calling thread.
+*/
+inline void parallel_for(WorkerThreadPool *pool, size_t count,
+	const std::function<void(size_t)> &job)
+{
+	if (pool && count > 1) {
+		pool->parallelFor(count, job);
+		return;
+	}
+	for (size_t i = 0; i < count; i++)
+		job(i);
+}
+
+// Runs independent jobs, at the same time if there is a pool
+inline void parallel_run(WorkerThreadPool *pool,
+	std::initializer_list<std::function<void()>> jobs)
+{
+	const std::function<void()> *first = jobs.begin();
+	parallel_for(pool, jobs.size(), [first] (size_t i) {
+		first[i]();
+	});
+}